@@ -0,0 +1,223 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  ARM load/store multiple benchmark.
+ *
+ *  Creates a small raw ARM program which executes the most common load/store
+ *  multiple instructions of an instruction profile (see src/cpus/
+ *  generate_arm_multi.c), each one about as often, relative to the others,
+ *  as in the profile. The program can then be timed in the emulator:
+ *
+ *	gxemul -s w:profile.raw ...
+ *	../src/cpus/generate_arm_multi -l -p profile.raw > profile.txt
+ *	./arm_multi_bench profile.txt > bench.bin
+ *	time gxemul -q -E testarm 0x10000:bench.bin
+ *
+ *  The checked-in src/cpus/cpu_arm_multi.txt can also be used directly.
+ *  Opcodes with count 0 at the end of a profile were never executed, and
+ *  are not used.
+ *
+ *  Usage:  ./arm_multi_bench profile [n_opcodes [n_iterations]]
+ *
+ *  The default is to use the 64 most common opcodes, and 200000 iterations.
+ *  To compare against the generic load/store multiple implementation,
+ *  rebuild the emulator with "-n 0" instead of "-n 256" in the rule for
+ *  tmp_arm_multi.c in src/cpus/Makefile, and run the same program again.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define	LOAD_ADDR		0x10000
+#define	MAX_WORDS		65536
+#define	MAX_REPEAT		16
+
+
+struct entry {
+	uint32_t	opcode;
+	long long	count;
+};
+
+static uint32_t code[MAX_WORDS];
+static int n_words = 0;
+
+
+static void emit(uint32_t iword)
+{
+	if (n_words >= MAX_WORDS) {
+		fprintf(stderr, "program too large\n");
+		exit(1);
+	}
+
+	code[n_words++] = iword;
+}
+
+
+static uint32_t branch(uint32_t cond, int from, int to)
+{
+	return cond | 0x0a000000 | ((to - (from + 2)) & 0x00ffffff);
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct entry *entries = NULL;
+	int n_entries = 0, max_opcodes = 64, loop, i, j;
+	long long n_iterations = 200000, max_count = 0, n_per_iteration = 0;
+	char line[200];
+	FILE *f;
+
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "usage: %s profile [n_opcodes "
+		    "[n_iterations]]\n", argv[0]);
+		exit(1);
+	}
+
+	if (argc > 2)
+		max_opcodes = atoi(argv[2]);
+	if (argc > 3)
+		n_iterations = atoll(argv[3]);
+
+	f = fopen(argv[1], "r");
+	if (f == NULL) {
+		perror(argv[1]);
+		exit(1);
+	}
+
+	/*
+	 *  Read "count opcode" or "opcode" lines, as written by
+	 *  "generate_arm_multi -l", skipping '#' comments. Lines without a
+	 *  count all get the same weight.
+	 */
+	while (n_entries < max_opcodes && fgets(line, sizeof(line), f)) {
+		char *p = strrchr(line, ' ');
+		long long count = 0;
+		uint32_t opcode;
+
+		if (line[0] == '#')
+			continue;
+
+		if (p == NULL)
+			p = line;
+		else {
+			count = atoll(line);
+			p ++;
+		}
+
+		/*  The rest of a sorted profile was never executed:  */
+		if (max_count > 0 && count == 0)
+			break;
+
+		if (p[0] != '0')
+			continue;
+
+		opcode = strtoul(p, NULL, 16) & 0x0fffffff;
+
+		/*  Loading the pc would leave the benchmark loop:  */
+		if ((opcode & 0x0e000000) != 0x08000000 ||
+		    (opcode & 0x00108000) == 0x00108000 ||
+		    ((opcode >> 16) & 15) == 15)
+			continue;
+
+		entries = realloc(entries, sizeof(struct entry) *
+		    (n_entries + 1));
+		if (entries == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+
+		entries[n_entries].opcode = opcode;
+		entries[n_entries].count = count;
+		if (count > max_count)
+			max_count = count;
+		n_entries ++;
+	}
+
+	fclose(f);
+
+	if (n_entries == 0) {
+		fprintf(stderr, "%s: no usable load/store multiple opcodes\n",
+		    argv[1]);
+		exit(1);
+	}
+
+	/*  Store the iteration count at 0x20000:  */
+	emit(0xe59f0000);			/*  ldr r0,[pc,#0]  */
+	emit(branch(0xe0000000, 1, 3));		/*  b over the word  */
+	emit(n_iterations);
+	emit(0xe3a01802);			/*  mov r1,#0x20000  */
+	emit(0xe5810000);			/*  str r0,[r1]  */
+
+	loop = n_words;
+
+	for (i=0; i<n_entries; i++) {
+		int rn = (entries[i].opcode >> 16) & 15;
+		int n = 1;
+
+		if (max_count > 0)
+			n += (entries[i].count * (MAX_REPEAT-1)) / max_count;
+
+		for (j=0; j<n; j++) {
+			/*  The base register points to the middle of a page:  */
+			emit(0xe3a00803 | (rn << 12));	/*  mov rn,#0x30000  */
+			emit(0xe3800b02 | (rn << 16) | (rn << 12));
+							/*  orr rn,rn,#0x800  */
+			emit(0xe0000000 | entries[i].opcode);
+		}
+
+		n_per_iteration += n;
+	}
+
+	emit(0xe3a01802);			/*  mov r1,#0x20000  */
+	emit(0xe5910000);			/*  ldr r0,[r1]  */
+	emit(0xe2500001);			/*  subs r0,r0,#1  */
+	emit(0xe5810000);			/*  str r0,[r1]  */
+	emit(branch(0x10000000, n_words, loop));	/*  bne loop  */
+
+	/*  Halt the testarm machine:  */
+	emit(0xe3a01201);			/*  mov r1,#0x10000000  */
+	emit(0xe5c10010);			/*  strb r0,[r1,#0x10]  */
+	emit(branch(0xe0000000, n_words, n_words));	/*  b .  */
+
+	for (i=0; i<n_words; i++) {
+		unsigned char b[4];
+		b[0] = code[i]; b[1] = code[i] >> 8;
+		b[2] = code[i] >> 16; b[3] = code[i] >> 24;
+		fwrite(b, 1, 4, stdout);
+	}
+
+	fprintf(stderr, "%i opcodes, %lli load/store multiple instructions per"
+	    " iteration, %lli iterations\n", n_entries, n_per_iteration,
+	    n_iterations);
+	fprintf(stderr, "run with:  gxemul -q -E testarm 0x%x:filename\n",
+	    LOAD_ADDR);
+
+	return 0;
+}
@@ -0,0 +1,284 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Creates a block-compressed disk image, which GXemul can use directly
+ *  as a read-only disk or CD-ROM image. (See src/disk/diskimage_compressed.c
+ *  for a description of the file format.)
+ *
+ *  Usage:  ./compress_diskimage [-c chunk_size] infile outfile
+ *
+ *  The default chunk size is 65536 bytes. Smaller chunks make random access
+ *  cheaper, larger chunks compress slightly better. infile may be "-" to
+ *  read from stdin, e.g.:
+ *
+ *	gunzip -c cd.iso.gz | ./compress_diskimage - cd.iso.gxz
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+
+#define	MAGIC			"GXemuCMP"
+#define	VERSION			1
+#define	HEADER_SIZE		64
+#define	DEFAULT_CHUNK_SIZE	65536
+#define	MAX_CHUNK_SIZE		(4 * 1048576)
+
+#define	HASH_BITS		14
+#define	MIN_MATCH		4
+#define	MAX_OFFSET		65535
+
+/*  The LZ4 block format requires the last literals to be at least this
+    long, and matches to start at least 12 bytes before the end.  */
+#define	LAST_LITERALS		5
+#define	MF_LIMIT		12
+
+
+static void put_le32(unsigned char *p, uint32_t x)
+{
+	for (int i = 0; i < 4; i++, x >>= 8)
+		p[i] = x;
+}
+
+static void put_le64(unsigned char *p, uint64_t x)
+{
+	for (int i = 0; i < 8; i++, x >>= 8)
+		p[i] = x;
+}
+
+
+static unsigned char *put_length(unsigned char *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+
+/*
+ *  lz4_compress():
+ *
+ *  Greedy LZ4 block compressor. dst must be large enough for the worst
+ *  case (src_len + src_len / 255 + 16). Returns the compressed length.
+ */
+static size_t lz4_compress(const unsigned char *src, size_t src_len,
+	unsigned char *dst)
+{
+	static int32_t table[1 << HASH_BITS];
+	const unsigned char *ip = src, *anchor = src;
+	const unsigned char *iend = src + src_len;
+	unsigned char *op = dst;
+
+	for (int i = 0; i < (1 << HASH_BITS); i++)
+		table[i] = -1;
+
+	while (src_len >= MF_LIMIT && ip < iend - MF_LIMIT) {
+		uint32_t seq = ip[0] | (ip[1] << 8) | (ip[2] << 16)
+		    | ((uint32_t)ip[3] << 24);
+		uint32_t h = (seq * 2654435761U) >> (32 - HASH_BITS);
+		int32_t cand = table[h];
+		const unsigned char *match;
+		size_t lit_len, match_len;
+
+		table[h] = ip - src;
+
+		if (cand < 0 || (ip - src) - cand > MAX_OFFSET ||
+		    memcmp(src + cand, ip, MIN_MATCH) != 0) {
+			ip ++;
+			continue;
+		}
+
+		match = src + cand;
+
+		/*  Extend the match (but not into the last literals):  */
+		match_len = MIN_MATCH;
+		while (ip + match_len < iend - LAST_LITERALS &&
+		    match[match_len] == ip[match_len])
+			match_len ++;
+
+		lit_len = ip - anchor;
+
+		unsigned char *token = op++;
+		*token = ((lit_len >= 15 ? 15 : lit_len) << 4) |
+		    (match_len - MIN_MATCH >= 15 ? 15 : match_len - MIN_MATCH);
+
+		if (lit_len >= 15)
+			op = put_length(op, lit_len - 15);
+		memcpy(op, anchor, lit_len);
+		op += lit_len;
+
+		*op++ = (ip - match) & 255;
+		*op++ = (ip - match) >> 8;
+
+		if (match_len - MIN_MATCH >= 15)
+			op = put_length(op, match_len - MIN_MATCH - 15);
+
+		ip += match_len;
+		anchor = ip;
+	}
+
+	/*  Last literals:  */
+	size_t lit_len = iend - anchor;
+	*op++ = (lit_len >= 15 ? 15 : lit_len) << 4;
+	if (lit_len >= 15)
+		op = put_length(op, lit_len - 15);
+	memcpy(op, anchor, lit_len);
+	op += lit_len;
+
+	return op - dst;
+}
+
+
+int main(int argc, char *argv[])
+{
+	FILE *fin, *fout, *ftmp;
+	size_t chunk_size = DEFAULT_CHUNK_SIZE;
+	unsigned char *chunk, *cbuf, hdr[HEADER_SIZE], le[8];
+	uint64_t *index = NULL, n_chunks = 0, size = 0, ofs;
+	int argi = 1;
+
+	if (argc > 2 && strcmp(argv[1], "-c") == 0) {
+		chunk_size = strtoul(argv[2], NULL, 0);
+		argi = 3;
+	}
+
+	if (argc - argi != 2 || chunk_size < 512 ||
+	    chunk_size > MAX_CHUNK_SIZE) {
+		fprintf(stderr, "usage: %s [-c chunk_size] infile outfile\n",
+		    argv[0]);
+		exit(1);
+	}
+
+	fin = strcmp(argv[argi], "-") == 0 ? stdin : fopen(argv[argi], "r");
+	if (fin == NULL) {
+		perror(argv[argi]);
+		exit(1);
+	}
+
+	chunk = malloc(chunk_size);
+	cbuf = malloc(chunk_size + chunk_size / 255 + 16);
+	if (chunk == NULL || cbuf == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	/*
+	 *  The index comes before the chunk data, but its size is not known
+	 *  until all input has been read (stdin may be a pipe), so the chunks
+	 *  are first written to a temporary file.
+	 */
+	ftmp = tmpfile();
+	if (ftmp == NULL) {
+		perror("tmpfile");
+		exit(1);
+	}
+
+	ofs = 0;
+	for (;;) {
+		size_t len = fread(chunk, 1, chunk_size, fin);
+		size_t clen;
+
+		if (len == 0)
+			break;
+
+		clen = lz4_compress(chunk, len, cbuf);
+
+		index = realloc(index, sizeof(uint64_t) * (n_chunks + 2));
+		if (index == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+
+		index[n_chunks++] = ofs;
+
+		/*  Store incompressible chunks as they are:  */
+		if (clen >= len) {
+			clen = len;
+			fwrite(chunk, 1, len, ftmp);
+		} else
+			fwrite(cbuf, 1, clen, ftmp);
+
+		ofs += clen;
+		size += len;
+
+		if (len < chunk_size)
+			break;
+	}
+
+	if (n_chunks == 0) {
+		fprintf(stderr, "%s: empty input\n", argv[argi]);
+		exit(1);
+	}
+
+	index[n_chunks] = ofs;
+
+	fout = fopen(argv[argi + 1], "w");
+	if (fout == NULL) {
+		perror(argv[argi + 1]);
+		exit(1);
+	}
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, MAGIC, 8);
+	put_le32(hdr + 8, VERSION);
+	put_le32(hdr + 12, chunk_size);
+	put_le64(hdr + 16, size);
+	put_le64(hdr + 24, n_chunks);
+	fwrite(hdr, 1, sizeof(hdr), fout);
+
+	uint64_t data_start = HEADER_SIZE + (n_chunks + 1) * 8;
+	for (uint64_t i = 0; i <= n_chunks; i++) {
+		put_le64(le, data_start + index[i]);
+		fwrite(le, 1, 8, fout);
+	}
+
+	rewind(ftmp);
+	for (;;) {
+		size_t len = fread(chunk, 1, chunk_size, ftmp);
+		if (len == 0)
+			break;
+		fwrite(chunk, 1, len, fout);
+	}
+
+	if (fclose(fout) != 0) {
+		perror(argv[argi + 1]);
+		exit(1);
+	}
+
+	printf("%llu bytes in %llu chunks, compressed to %llu bytes (%.1f%%)\n",
+	    (unsigned long long) size, (unsigned long long) n_chunks,
+	    (unsigned long long) (data_start + ofs),
+	    100.0 * (data_start + ofs) / size);
+
+	return 0;
+}
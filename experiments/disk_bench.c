@@ -0,0 +1,212 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Disk image throughput benchmark.
+ *
+ *  Reads a (disk image) file using the same access patterns as an emulated
+ *  disk controller, with each of the host I/O methods that src/disk/
+ *  diskimage.c can use: fseek+fread (stdio), pread, and mmap+memcpy, and
+ *  with pread through a 2 MB block cache (src/disk/diskimage_cache.c, as
+ *  with the k2048; disk image prefix).
+ *
+ *  Usage:  ./disk_bench imagefile [transfer_size [n_transfers]]
+ *
+ *  For each method, n_transfers sequential and n_transfers random transfers
+ *  of transfer_size bytes (default 512) are done, and the throughput is
+ *  printed. Run it twice to get numbers with a warm host page cache.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include "diskimage.h"
+
+
+enum { METHOD_STDIO, METHOD_PREAD, METHOD_MMAP, METHOD_CACHE, N_METHODS };
+static const char *method_names[N_METHODS] =
+    { "stdio", "pread", "mmap", "cache" };
+
+#define	CACHE_SIZE	(2 * 1048576)
+
+static int cache_fd;
+
+
+static size_t cache_fill(struct diskimage *d, off_t offset,
+	unsigned char *buf, size_t len)
+{
+	ssize_t res = pread(cache_fd, buf, len, offset);
+	return res < 0 ? 0 : res;
+}
+
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+static void run(int method, const char *fname, off_t size, size_t xfer,
+	long n, int random_access)
+{
+	unsigned char *buf, *map = NULL;
+	struct diskimage_cache *cache = NULL;
+	struct diskimage d;
+	FILE *f = NULL;
+	int fd = -1;
+	off_t n_blocks = size / xfer;
+	unsigned long sum = 0;
+	double t0, t1;
+	long i;
+
+	buf = malloc(xfer);
+	if (buf == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	switch (method) {
+	case METHOD_STDIO:
+		f = fopen(fname, "r");
+		if (f == NULL) {
+			perror(fname);
+			exit(1);
+		}
+		break;
+	default:
+		fd = open(fname, O_RDONLY);
+		if (fd < 0) {
+			perror(fname);
+			exit(1);
+		}
+		if (method == METHOD_MMAP) {
+			map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+			if (map == MAP_FAILED) {
+				perror("mmap");
+				exit(1);
+			}
+		}
+		if (method == METHOD_CACHE) {
+			memset(&d, 0, sizeof(d));
+			d.total_size = size;
+			cache_fd = fd;
+			cache = diskimage_cache_new(CACHE_SIZE);
+		}
+	}
+
+	srandom(1);
+	t0 = now();
+
+	for (i = 0; i < n; i++) {
+		off_t ofs = random_access ? (off_t) (random() % n_blocks) * xfer
+		    : (off_t) (i % n_blocks) * xfer;
+
+		switch (method) {
+		case METHOD_STDIO:
+			fseeko(f, ofs, SEEK_SET);
+			if (fread(buf, 1, xfer, f) != xfer)
+				fprintf(stderr, "short read\n");
+			break;
+		case METHOD_PREAD:
+			if (pread(fd, buf, xfer, ofs) != (ssize_t) xfer)
+				fprintf(stderr, "short read\n");
+			break;
+		case METHOD_MMAP:
+			memcpy(buf, map + ofs, xfer);
+			break;
+		case METHOD_CACHE:
+			diskimage_cache_read(cache, &d, ofs, buf, xfer,
+			    cache_fill);
+			break;
+		}
+
+		/*  Touch the data, so that nothing can be optimized away.  */
+		sum += buf[i % xfer];
+	}
+
+	t1 = now();
+
+	printf("%-6s %-10s %10.1f MB/s %12.0f transfers/s   (%lu)\n",
+	    method_names[method], random_access ? "random" : "sequential",
+	    (double) xfer * n / (t1 - t0) / 1048576.0, n / (t1 - t0), sum);
+
+	if (cache != NULL)
+		diskimage_cache_free(cache);
+	if (map != NULL)
+		munmap(map, size);
+	if (fd >= 0)
+		close(fd);
+	if (f != NULL)
+		fclose(f);
+	free(buf);
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct stat st;
+	size_t xfer = 512;
+	long n = 200000;
+	int method;
+
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "usage: %s imagefile [transfer_size "
+		    "[n_transfers]]\n", argv[0]);
+		exit(1);
+	}
+
+	if (argc > 2)
+		xfer = strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		n = strtol(argv[3], NULL, 0);
+
+	if (stat(argv[1], &st) != 0) {
+		perror(argv[1]);
+		exit(1);
+	}
+
+	if (xfer == 0 || n < 1 || st.st_size < (off_t) xfer) {
+		fprintf(stderr, "the image must be at least one transfer "
+		    "in size\n");
+		exit(1);
+	}
+
+	for (method = 0; method < N_METHODS; method++) {
+		run(method, argv[1], st.st_size, xfer, n, 0);
+		run(method, argv[1], st.st_size, xfer, n, 1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,370 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Loopback HTTP throughput benchmark for the NAT gateway (src/net/).
+ *
+ *  The program links directly against the emulator's network objects, and
+ *  plays the part of a guest OS: it sends hand-made TCP segments from
+ *  10.0.0.1 to the gateway, and acks everything the gateway sends back.
+ *  A child process acts as an HTTP server on the host's loopback interface,
+ *  and serves a single response of a given size. Usage:
+ *
+ *	net_bench [-n connections] [-u idle_udp_flows] [size_in_MB]
+ *
+ *  The connections are opened one after another, and the total is
+ *  reported. With -u, the guest first sends one UDP packet from each of
+ *  that many source ports, so that the gateway has as many idle outgoing
+ *  UDP sockets during the downloads. The gateway is driven the way an emulated NIC drives it: one
+ *  net_ethernet_rx_avail() call per "rx round", and then all queued
+ *  packets are taken with net_ethernet_rx().
+ *
+ *  Build with "make net_bench" after the emulator itself has been built.
+ *  To compare with another version of the network code, build that tree
+ *  and point NET_SRC at its src directory:
+ *
+ *	make net_bench NET_SRC=/other/tree/src
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "misc.h"
+#include "net.h"
+
+
+/*  Give up on a connection after this many seconds:  */
+#define	TIMEOUT_SECONDS		60
+
+/*  The window advertised by the "guest":  */
+#define	GUEST_WINDOW		65535
+
+#define	TCP_FIN			0x01
+#define	TCP_SYN			0x02
+#define	TCP_PSH			0x08
+#define	TCP_ACK			0x10
+
+static struct nic_data nic;
+static unsigned char gateway_mac[6] = { 0x60,0x50,0x40,0x30,0x20,0x10 };
+static unsigned char guest_mac[6] = { 0x10,0x20,0x30,0x40,0x50,0x60 };
+static int guest_port, server_port;
+static uint32_t guest_seq, guest_ack;
+
+
+/*
+ *  The network code uses the emulator's debug output functions. Only
+ *  fatal() messages are shown here.
+ */
+static int verbosity[64];
+int *debugmsg_current_verbosity = verbosity;
+void debug_indentation(int diff) { }
+void debug(const char *fmt, ...) { }
+void fatal(const char *fmt, ...)
+{
+	va_list argp;
+	va_start(argp, fmt);
+	vfprintf(stderr, fmt, argp);
+	va_end(argp);
+}
+void debugmsg(int subsystem, const char *name, int verbosity_required,
+	const char *fmt, ...) { }
+
+
+/*
+ *  Serves one HTTP response of size bytes per connection, n times. Runs in
+ *  a child process.
+ */
+static void server(int s, int n, size_t size)
+{
+	static char buf[65536];
+
+	memset(buf, 'x', sizeof(buf));
+
+	while (n-- > 0) {
+		const char *hdr = "HTTP/1.0 200 OK\r\n\r\n";
+		size_t left = size;
+		int c = accept(s, NULL, NULL), got = 0;
+
+		if (c < 0) {
+			perror("accept");
+			exit(1);
+		}
+
+		/*  The whole request arrives in one segment:  */
+		while (got < 4 || memcmp(buf + got - 4, "\r\n\r\n", 4) != 0) {
+			ssize_t res = read(c, buf + got, sizeof(buf) - got);
+			if (res <= 0)
+				exit(1);
+			got += res;
+		}
+		memset(buf, 'x', sizeof(buf));
+
+		if (write(c, hdr, strlen(hdr)) != (ssize_t) strlen(hdr))
+			exit(1);
+		while (left > 0) {
+			size_t len = left < sizeof(buf)? left : sizeof(buf);
+			ssize_t res = write(c, buf, len);
+			if (res <= 0)
+				exit(1);
+			left -= res;
+		}
+
+		close(c);
+	}
+
+	exit(0);
+}
+
+
+/*
+ *  Sends one TCP segment from the guest to the server, via the gateway.
+ */
+static void guest_tcp(struct net *net, int flags, const char *data, int len)
+{
+	unsigned char p[1600];
+	int tcp_len = 20 + len, ip_len = 20 + tcp_len;
+
+	memset(p, 0, sizeof(p));
+	memcpy(p, gateway_mac, 6);
+	memcpy(p + 6, guest_mac, 6);
+	p[12] = 0x08; p[13] = 0x00;
+
+	/*  IPv4, 10.0.0.1 -> 127.0.0.1:  */
+	p[14] = 0x45;
+	p[16] = ip_len >> 8; p[17] = ip_len;
+	p[22] = 64; p[23] = 6;
+	p[26] = 10; p[27] = 0; p[28] = 0; p[29] = 1;
+	p[30] = 127; p[31] = 0; p[32] = 0; p[33] = 1;
+	net_ip_checksum(p + 14, 10, 20);
+
+	p[34] = guest_port >> 8; p[35] = guest_port;
+	p[36] = server_port >> 8; p[37] = server_port;
+	p[38] = guest_seq >> 24; p[39] = guest_seq >> 16;
+	p[40] = guest_seq >> 8; p[41] = guest_seq;
+	p[42] = guest_ack >> 24; p[43] = guest_ack >> 16;
+	p[44] = guest_ack >> 8; p[45] = guest_ack;
+	p[46] = 0x50; p[47] = flags;
+	p[48] = GUEST_WINDOW >> 8; p[49] = GUEST_WINDOW & 255;
+	memcpy(p + 54, data, len);
+	net_ip_tcp_checksum(p + 34, 16, tcp_len, p + 26, p + 30, 0);
+
+	net_ethernet_tx(net, &nic, p, 14 + ip_len);
+
+	guest_seq += len + (flags & TCP_SYN? 1 : 0) + (flags & TCP_FIN? 1 : 0);
+}
+
+
+/*
+ *  Sends one UDP packet from the guest, to the discard port on the host.
+ */
+static void guest_udp(struct net *net, int src_port)
+{
+	unsigned char p[60];
+	int udp_len = 8 + 4, ip_len = 20 + udp_len;
+
+	memset(p, 0, sizeof(p));
+	memcpy(p, gateway_mac, 6);
+	memcpy(p + 6, guest_mac, 6);
+	p[12] = 0x08; p[13] = 0x00;
+
+	p[14] = 0x45;
+	p[16] = ip_len >> 8; p[17] = ip_len;
+	p[22] = 64; p[23] = 17;
+	p[26] = 10; p[27] = 0; p[28] = 0; p[29] = 1;
+	p[30] = 127; p[31] = 0; p[32] = 0; p[33] = 1;
+	net_ip_checksum(p + 14, 10, 20);
+
+	/*  No UDP checksum:  */
+	p[34] = src_port >> 8; p[35] = src_port;
+	p[36] = 0; p[37] = 9;
+	p[38] = udp_len >> 8; p[39] = udp_len;
+	memcpy(p + 42, "idle", 4);
+
+	net_ethernet_tx(net, &nic, p, 14 + ip_len);
+}
+
+
+/*
+ *  Downloads one response. Returns the number of bytes received, including
+ *  the HTTP header, and adds to the packet and rx round counters.
+ */
+static size_t download(struct net *net, long *n_packets, long *n_rounds)
+{
+	const char *req = "GET / HTTP/1.0\r\n\r\n";
+	size_t total = 0;
+	int state = 0;
+	time_t start = time(NULL);
+
+	guest_seq = 1000;
+	guest_ack = 0;
+	guest_tcp(net, TCP_SYN, "", 0);
+
+	while (state != 2) {
+		unsigned char *p;
+		int len;
+
+		if (time(NULL) - start > TIMEOUT_SECONDS) {
+			fprintf(stderr, "timeout after %lli bytes\n",
+			    (long long) total);
+			exit(1);
+		}
+
+		(*n_rounds) ++;
+		net_ethernet_rx_avail(net, &nic);
+
+		while (state != 2 && net_ethernet_rx(net, &nic, &p, &len)) {
+			int flags = p[47];
+			int data_ofs = 14 + 20 + (p[46] >> 4) * 4;
+			int data_len = ((p[16] << 8) + p[17]) + 14 - data_ofs;
+			uint32_t seq = (p[38] << 24) + (p[39] << 16) +
+			    (p[40] << 8) + p[41];
+
+			(*n_packets) ++;
+
+			if (p[23] != 6 || ((p[34] << 8) + p[35]) != server_port) {
+				free(p);
+				continue;
+			}
+
+			if (state == 0 && (flags & TCP_SYN)) {
+				guest_ack = seq + 1;
+				guest_tcp(net, TCP_ACK, "", 0);
+				guest_tcp(net, TCP_ACK | TCP_PSH, req, strlen(req));
+				state = 1;
+			} else if (state == 1) {
+				/*  Out of order data is dropped, and re-acked:  */
+				if (seq == guest_ack && data_len > 0) {
+					guest_ack += data_len;
+					total += data_len;
+				}
+				if (flags & TCP_FIN && seq + data_len == guest_ack) {
+					guest_ack ++;
+					guest_tcp(net, TCP_ACK | TCP_FIN, "", 0);
+					state = 2;
+				} else
+					guest_tcp(net, TCP_ACK, "", 0);
+			}
+
+			free(p);
+		}
+	}
+
+	return total;
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in si;
+	socklen_t si_len = sizeof(si);
+	struct timespec t0, t1;
+	struct net *net;
+	size_t size = 20 * 1048576, total = 0, expected;
+	long n_packets = 0, n_rounds = 0;
+	int s, i, n = 1, n_udp = 0, status;
+	pid_t pid;
+	double t;
+
+	while (argc > 2 && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-n") == 0)
+			n = atoi(argv[2]);
+		else if (strcmp(argv[1], "-u") == 0)
+			n_udp = atoi(argv[2]);
+		else
+			break;
+		argc -= 2; argv += 2;
+	}
+	if (argc > 1)
+		size = (size_t) atoi(argv[1]) * 1048576;
+	if (n < 1 || size == 0) {
+		fprintf(stderr, "usage: net_bench [-n connections] "
+		    "[-u idle_udp_flows] [size_in_MB]\n");
+		exit(1);
+	}
+
+	/*  Loopback server, on a port chosen by the kernel:  */
+	s = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&si, 0, sizeof(si));
+	si.sin_family = AF_INET;
+	si.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (s < 0 || bind(s, (struct sockaddr *) &si, sizeof(si)) < 0 ||
+	    listen(s, 1) < 0 ||
+	    getsockname(s, (struct sockaddr *) &si, &si_len) < 0) {
+		perror("server socket");
+		exit(1);
+	}
+	server_port = ntohs(si.sin_port);
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0)
+		server(s, n, size);
+	close(s);
+
+	net = net_init(NULL, NET_INIT_FLAG_GATEWAY, NULL, "10.0.0.0", 8,
+	    NULL, 0, 0, NULL);
+	memcpy(nic.mac_address, guest_mac, 6);
+	net_add_nic(net, &nic);
+
+	for (i=0; i<n_udp; i++)
+		guest_udp(net, 20000 + i);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i=0; i<n; i++) {
+		guest_port = 40000 + i;
+		total += download(net, &n_packets, &n_rounds);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	waitpid(pid, &status, 0);
+
+	expected = n * (size + strlen("HTTP/1.0 200 OK\r\n\r\n"));
+	if (total != expected) {
+		fprintf(stderr, "got %lli bytes, expected %lli\n",
+		    (long long) total, (long long) expected);
+		exit(1);
+	}
+
+	t = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("%i x %lli bytes, %i idle UDP: %.3f s, %.1f MB/s, %li packets, "
+	    "%li rx rounds\n", n, (long long) size, n_udp, t, total / t / 1e6,
+	    n_packets, n_rounds);
+
+	return 0;
+}
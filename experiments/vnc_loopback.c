@@ -0,0 +1,370 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Minimal VNC client, for testing the built-in VNC server (-w) over the
+ *  loopback interface. Start the emulator with a headless framebuffer, e.g.
+ *
+ *	gxemul -E testmips -g /tmp/snap -w 5900 program
+ *
+ *  and then run
+ *
+ *	vnc_loopback [-d] [-r] 5900 [keys]
+ *
+ *  The client does the RFB 3.8 handshake, asks for a full framebuffer update,
+ *  and then types each character of keys, asking for an incremental update
+ *  after each one. Every rectangle is checked against the framebuffer size
+ *  that the client knows about. -d makes the client support the DesktopSize
+ *  pseudo-encoding, and -r the RRE encoding.
+ *
+ *  A server that resizes the framebuffer must either send a DesktopSize
+ *  rectangle (with -d) or close the connection (without -d), never
+ *  rectangles outside of the old framebuffer. The exit code is 0 if the
+ *  server followed the protocol, 1 otherwise.
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+#define	ENCODING_RAW		0
+#define	ENCODING_RRE		2
+#define	ENCODING_DESKTOPSIZE	(-223)
+
+/*  Milliseconds to wait for the server:  */
+#define	TIMEOUT_MS		3000
+
+static int s;
+static int xsize, ysize;
+static int n_raw, n_rre, n_desktopsize;
+
+
+/*
+ *  Reads exactly len bytes. Returns 1 on success, 0 if the server closed the
+ *  connection, and -1 on timeout.
+ */
+int read_exact(unsigned char *buf, size_t len)
+{
+	while (len > 0) {
+		struct pollfd pfd;
+		ssize_t res;
+
+		pfd.fd = s;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, TIMEOUT_MS) <= 0)
+			return -1;
+
+		res = read(s, buf, len);
+		if (res <= 0)
+			return 0;
+
+		buf += res;
+		len -= res;
+	}
+
+	return 1;
+}
+
+
+void need(unsigned char *buf, size_t len)
+{
+	int res = read_exact(buf, len);
+
+	if (res == 0) {
+		printf("server closed the connection\n");
+		exit(1);
+	}
+	if (res < 0) {
+		printf("timeout\n");
+		exit(1);
+	}
+}
+
+
+void send_buf(const unsigned char *buf, size_t len)
+{
+	if (write(s, buf, len) != (ssize_t) len) {
+		perror("write");
+		exit(1);
+	}
+}
+
+
+uint32_t be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) + (p[1] << 16) + (p[2] << 8) + p[3];
+}
+
+
+void handshake(int desktop_size, int rre)
+{
+	unsigned char buf[256], *name;
+	uint32_t name_len;
+	int n_enc = 1;
+
+	need(buf, 12);
+	if (memcmp(buf, "RFB 003.", 8) != 0) {
+		printf("bad server version\n");
+		exit(1);
+	}
+	send_buf((unsigned char *) "RFB 003.008\n", 12);
+
+	need(buf, 1);
+	if (buf[0] == 0) {
+		printf("server refused the connection\n");
+		exit(1);
+	}
+	need(buf + 1, buf[0]);
+	if (memchr(buf + 1, 1, buf[0]) == NULL) {
+		printf("server does not offer security type None\n");
+		exit(1);
+	}
+	buf[0] = 1;
+	send_buf(buf, 1);
+
+	need(buf, 4);
+	if (be32(buf) != 0) {
+		printf("security handshake failed\n");
+		exit(1);
+	}
+
+	buf[0] = 1;		/*  shared  */
+	send_buf(buf, 1);
+
+	need(buf, 24);
+	xsize = (buf[0] << 8) + buf[1];
+	ysize = (buf[2] << 8) + buf[3];
+	if (buf[4] != 32 || !buf[7]) {
+		printf("unexpected native pixel format\n");
+		exit(1);
+	}
+
+	name_len = be32(buf + 20);
+	name = malloc(name_len + 1);
+	need(name, name_len);
+	name[name_len] = '\0';
+	printf("%ix%i \"%s\"\n", xsize, ysize, name);
+	free(name);
+
+	/*  SetEncodings; the native pixel format is kept:  */
+	memset(buf, 0, sizeof(buf));
+	buf[0] = 2;		/*  the first encoding, 0, is RAW  */
+	if (rre) {
+		buf[4 + n_enc*4 + 3] = ENCODING_RRE;
+		n_enc ++;
+	}
+	if (desktop_size) {
+		uint32_t e = (uint32_t) ENCODING_DESKTOPSIZE;
+		buf[4 + n_enc*4 + 0] = e >> 24;
+		buf[4 + n_enc*4 + 1] = e >> 16;
+		buf[4 + n_enc*4 + 2] = e >> 8;
+		buf[4 + n_enc*4 + 3] = e;
+		n_enc ++;
+	}
+	buf[3] = n_enc;
+	send_buf(buf, 4 + n_enc * 4);
+}
+
+
+void request_update(int incremental)
+{
+	unsigned char buf[10];
+
+	buf[0] = 3;
+	buf[1] = incremental;
+	buf[2] = buf[3] = buf[4] = buf[5] = 0;
+	buf[6] = xsize >> 8; buf[7] = xsize;
+	buf[8] = ysize >> 8; buf[9] = ysize;
+	send_buf(buf, 10);
+}
+
+
+/*
+ *  Reads one FramebufferUpdate, and checks that all of its rectangles are
+ *  inside the framebuffer. Returns 1 if an update was read, 0 if the server
+ *  closed the connection, and -1 if no update arrived in time.
+ */
+int read_update(int desktop_size)
+{
+	unsigned char hdr[12], *data;
+	int res, i, n_rects;
+
+	res = read_exact(hdr, 4);
+	if (res <= 0)
+		return res;
+
+	if (hdr[0] != 0) {
+		printf("unexpected message type %i\n", hdr[0]);
+		exit(1);
+	}
+
+	n_rects = (hdr[2] << 8) + hdr[3];
+	for (i=0; i<n_rects; i++) {
+		int x, y, w, h;
+		int32_t enc;
+		size_t len;
+
+		need(hdr, 12);
+		x = (hdr[0] << 8) + hdr[1];
+		y = (hdr[2] << 8) + hdr[3];
+		w = (hdr[4] << 8) + hdr[5];
+		h = (hdr[6] << 8) + hdr[7];
+		enc = (int32_t) be32(hdr + 8);
+
+		if (enc == ENCODING_DESKTOPSIZE) {
+			if (!desktop_size) {
+				printf("DesktopSize was not negotiated\n");
+				exit(1);
+			}
+			xsize = w;
+			ysize = h;
+			n_desktopsize ++;
+			printf("new size %ix%i\n", xsize, ysize);
+			continue;
+		}
+
+		if (x + w > xsize || y + h > ysize) {
+			printf("rectangle %ix%i at %i,%i is outside of the "
+			    "%ix%i framebuffer\n", w, h, x, y, xsize, ysize);
+			exit(1);
+		}
+
+		if (enc == ENCODING_RAW) {
+			len = (size_t) w * h * 4;
+			n_raw ++;
+		} else if (enc == ENCODING_RRE) {
+			need(hdr, 8);
+			len = (size_t) be32(hdr) * 12;
+			n_rre ++;
+		} else {
+			printf("unexpected encoding %i\n", (int) enc);
+			exit(1);
+		}
+
+		data = malloc(len + 1);
+		need(data, len);
+		free(data);
+	}
+
+	return 1;
+}
+
+
+void send_key(int ch)
+{
+	unsigned char buf[8];
+	int down;
+
+	for (down=1; down>=0; down--) {
+		buf[0] = 4;
+		buf[1] = down;
+		buf[2] = buf[3] = 0;
+		buf[4] = buf[5] = buf[6] = 0;
+		buf[7] = ch;
+		send_buf(buf, 8);
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in si;
+	int desktop_size = 0, rre = 0, res;
+	const char *keys = "";
+
+	while (argc > 1 && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-d") == 0)
+			desktop_size = 1;
+		else if (strcmp(argv[1], "-r") == 0)
+			rre = 1;
+		else
+			break;
+		argc --; argv ++;
+	}
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s [-d] [-r] port [keys]\n", argv[0]);
+		exit(1);
+	}
+	if (argc > 2)
+		keys = argv[2];
+
+	if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		exit(1);
+	}
+
+	memset(&si, 0, sizeof(si));
+	si.sin_family = AF_INET;
+	si.sin_port = htons(atoi(argv[1]));
+	si.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(s, (struct sockaddr *)&si, sizeof(si)) < 0) {
+		perror("connect");
+		exit(1);
+	}
+
+	handshake(desktop_size, rre);
+
+	request_update(0);
+	if (read_update(desktop_size) <= 0) {
+		printf("no initial update\n");
+		exit(1);
+	}
+
+	for (; *keys; keys++) {
+		int old_xsize = xsize, old_ysize = ysize;
+
+		send_key(*keys);
+		request_update(1);
+		res = read_update(desktop_size);
+
+		if (res == 0) {
+			/*  E.g. after a resize, or the emulator exited:  */
+			printf("server closed the connection after '%c'\n",
+			    *keys);
+			close(s);
+			return 0;
+		}
+		if (res < 0)
+			printf("no update after '%c'\n", *keys);
+		else if (xsize != old_xsize || ysize != old_ysize)
+			printf("update after '%c' includes the new size\n",
+			    *keys);
+	}
+
+	printf("%i raw, %i rre, %i desktopsize rectangles\n",
+	    n_raw, n_rre, n_desktopsize);
+	close(s);
+	return 0;
+}
@@ -50,6 +50,14 @@
  *
  *  xterms are opened up "on demand", when output is sent to them.
  *
+ *  As an alternative to xterms, each console handle can be bound to a
+ *  listening Unix-domain socket or loopback TCP port (the -U command line
+ *  option). An external program, for example an expect script, may then
+ *  connect to the socket to drive that console. The socket I/O is
+ *  non-blocking; new connections are accepted when input is polled and on
+ *  each console_flush(). Output produced while no client is connected is
+ *  buffered, and discarded when the buffer fills up.
+ *
  *  The MAIN console handle (fixed as handle nr 0) is the one used by the
  *  default terminal window. A machine which registers a serial controller,
  *  which should be used as the main way of communicating with guest operating
@@ -61,6 +69,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -68,8 +77,12 @@
 #include <termios.h>
 #include <unistd.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <time.h>
 
 #include "console.h"
@@ -95,6 +108,7 @@ static struct settings *console_settings = NULL;
 static int console_stdout_pending;
 
 #define	CONSOLE_FIFO_LEN	4096
+#define	CONSOLE_OUTBUF_LEN	4096
 
 static struct timeval console_mouse_lastupdate;
 static int console_mouse_dx;		/*  relative since last call  */
@@ -105,6 +119,9 @@ static int console_mouse_buttons;	/*  left=4, middle=2, right=1  */
 
 static int allow_slaves = 0;
 
+/*  Socket consoles (-U):  "unix:PATHPREFIX" or "tcp:BASEPORT"  */
+static char *console_socket_spec = NULL;
+
 struct console_handle {
 	int		in_use;
 	int		in_use_for_input;
@@ -119,9 +136,23 @@ struct console_handle {
 	int		w_descriptor;
 	int		r_descriptor;
 
+	int		using_socket;
+	int		listen_descriptor;
+	char		*socket_path;
+
 	unsigned char	fifo[CONSOLE_FIFO_LEN];
 	int		fifo_head;
 	int		fifo_tail;
+
+	/*
+	 *  Output is collected here, and written to w_descriptor in bulk
+	 *  on newline, when the buffer is full, or on console_flush().
+	 *  If input was read from the handle since the last flush, output
+	 *  is written through immediately, so that echo is not delayed.
+	 */
+	unsigned char	outbuf[CONSOLE_OUTBUF_LEN];
+	int		outbuf_len;
+	int		interactive;
 };
 
 #define	NOT_USING_XTERM				0
@@ -132,6 +163,8 @@ struct console_handle {
 static struct console_handle *console_handles = NULL;
 static int n_console_handles = 0;
 
+static void console_sockets_close(void);
+
 
 /*
  *  console_deinit_main():
@@ -140,7 +173,9 @@ static int n_console_handles = 0;
  */
 void console_deinit_main(void)
 {
+	console_flush();
 	fflush(stdout);
+	console_sockets_close();
 
 	if (!console_initialized)
 		return;
@@ -273,6 +308,163 @@ static void start_xterm(int handle)
 }
 
 
+/*
+ *  console_socket_listen():
+ *
+ *  Creates a non-blocking listening socket for a console handle, according
+ *  to console_socket_spec. Unix-domain sockets are named PATHPREFIX.N, and
+ *  TCP sockets listen on 127.0.0.1, port BASEPORT+N, where N is the
+ *  console handle number.
+ */
+static void console_socket_listen(int handle)
+{
+	struct console_handle *chp = &console_handles[handle];
+	char addrstr[300];
+	int d, res;
+
+	if (strncmp(console_socket_spec, "unix:", 5) == 0) {
+		struct sockaddr_un sun;
+		size_t len = strlen(console_socket_spec + 5) + 20;
+
+		CHECK_ALLOCATION(chp->socket_path = (char *) malloc(len));
+		snprintf(chp->socket_path, len, "%s.%i",
+		    console_socket_spec + 5, handle);
+
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		if (strlen(chp->socket_path) >= sizeof(sun.sun_path)) {
+			fprintf(stderr, "console socket path too long: %s\n",
+			    chp->socket_path);
+			exit(1);
+		}
+		strlcpy(sun.sun_path, chp->socket_path, sizeof(sun.sun_path));
+
+		d = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (d < 0) {
+			perror("console_socket_listen(): socket");
+			exit(1);
+		}
+
+		unlink(chp->socket_path);
+		res = bind(d, (struct sockaddr *) &sun, sizeof(sun));
+		snprintf(addrstr, sizeof(addrstr), "%s", chp->socket_path);
+	} else {
+		struct sockaddr_in sin;
+		long port = strtol(console_socket_spec + 4, NULL, 10);
+		int one = 1;
+
+		/*  BASEPORT is 1..65535 (see console_allow_sockets()), but
+		    BASEPORT+N may still run past the end of the port range:  */
+		if (port > 65535 - handle) {
+			fprintf(stderr, "console_socket_listen(): port %li+%i"
+			    " is out of range\n", port, handle);
+			exit(1);
+		}
+		port += handle;
+
+		d = socket(AF_INET, SOCK_STREAM, 0);
+		if (d < 0) {
+			perror("console_socket_listen(): socket");
+			exit(1);
+		}
+
+		setsockopt(d, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(port);
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		res = bind(d, (struct sockaddr *) &sin, sizeof(sin));
+		snprintf(addrstr, sizeof(addrstr), "127.0.0.1:%li", port);
+	}
+
+	if (res < 0 || listen(d, 1) < 0) {
+		fprintf(stderr, "console_socket_listen(): could not listen"
+		    " on %s: %s\n", addrstr, strerror(errno));
+		exit(1);
+	}
+
+	res = fcntl(d, F_GETFL);
+	fcntl(d, F_SETFL, res | O_NONBLOCK);
+
+	chp->using_socket = 1;
+	chp->listen_descriptor = d;
+	chp->w_descriptor = chp->r_descriptor = -1;
+
+	fatal("[ console handle %i (%s%s%s): listening on %s ]\n", handle,
+	    chp->machine_name, chp->machine_name[0]? " " : "", chp->name,
+	    addrstr);
+}
+
+
+/*
+ *  console_socket_disconnect():
+ *
+ *  Closes the connection to a socket console's client (if any). The
+ *  handle keeps listening for new connections.
+ */
+static void console_socket_disconnect(int handle)
+{
+	struct console_handle *chp = &console_handles[handle];
+
+	if (chp->r_descriptor >= 0)
+		close(chp->r_descriptor);
+
+	chp->w_descriptor = chp->r_descriptor = -1;
+}
+
+
+/*
+ *  console_socket_poll():
+ *
+ *  Accepts a pending connection on a socket console's listening socket,
+ *  if no client is currently connected.
+ */
+static void console_socket_poll(int handle)
+{
+	struct console_handle *chp = &console_handles[handle];
+	int d, res;
+
+	if (chp->r_descriptor >= 0 || chp->listen_descriptor < 0)
+		return;
+
+	d = accept(chp->listen_descriptor, NULL, NULL);
+	if (d < 0)
+		return;
+
+	res = fcntl(d, F_GETFL);
+	fcntl(d, F_SETFL, res | O_NONBLOCK);
+
+	chp->w_descriptor = chp->r_descriptor = d;
+}
+
+
+/*
+ *  console_sockets_close():
+ *
+ *  Closes all socket consoles, and removes Unix-domain socket files.
+ */
+static void console_sockets_close(void)
+{
+	for (int i = 0; i < n_console_handles; i++) {
+		struct console_handle *chp = &console_handles[i];
+
+		if (!chp->using_socket)
+			continue;
+
+		console_socket_disconnect(i);
+		if (chp->listen_descriptor >= 0)
+			close(chp->listen_descriptor);
+		chp->listen_descriptor = -1;
+		if (chp->socket_path != NULL) {
+			unlink(chp->socket_path);
+			free(chp->socket_path);
+			chp->socket_path = NULL;
+		}
+	}
+}
+
+
 /*
  *  d_avail():
  *
@@ -330,6 +522,12 @@ static int console_stdin_avail(int handle)
 	if (!allow_slaves)
 		return d_avail(STDIN_FILENO);
 
+	if (console_handles[handle].using_socket) {
+		console_socket_poll(handle);
+		if (console_handles[handle].r_descriptor < 0)
+			return 0;
+	}
+
 	if (console_handles[handle].using_xterm ==
 	    USING_XTERM_BUT_NOT_YET_OPEN)
 		return 0;
@@ -374,6 +572,13 @@ int console_charavail(int handle)
 
 		len = read(d, ch, sizeof(ch));
 
+		if (len <= 0 && console_handles[handle].using_socket) {
+			/*  The client went away, or the read would block:  */
+			if (len == 0 || (errno != EAGAIN && errno != EINTR))
+				console_socket_disconnect(handle);
+			break;
+		}
+
 		for (i=0; i<len; i++) {
 			/*  printf("[ %i: %i ]\n", i, ch[i]);  */
 
@@ -447,23 +652,83 @@ int console_readchar(int handle)
 	console_handles[handle].fifo_tail ++;
 	console_handles[handle].fifo_tail %= CONSOLE_FIFO_LEN;
 
+	/*  Guest is reading input; any echo should be shown right away:  */
+	console_handles[handle].interactive = 1;
+
 	return ch;
 }
 
 
+/*
+ *  console_outbuf_flush():
+ *
+ *  Writes a handle's buffered output to its write descriptor, using as few
+ *  write() calls as possible.
+ */
+static void console_outbuf_flush(int handle)
+{
+	struct console_handle *chp = &console_handles[handle];
+	int ofs = 0;
+
+	if (chp->using_socket && chp->w_descriptor < 0) {
+		/*  No client connected. Keep the output until the buffer
+		    is full, then discard it.  */
+		if (chp->outbuf_len >= CONSOLE_OUTBUF_LEN)
+			chp->outbuf_len = 0;
+		return;
+	}
+
+	while (ofs < chp->outbuf_len) {
+		ssize_t res = write(chp->w_descriptor, chp->outbuf + ofs,
+		    chp->outbuf_len - ofs);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			if (chp->using_socket) {
+				if (errno == EAGAIN)
+					break;
+				console_socket_disconnect(handle);
+				break;
+			}
+			perror("error writing to console handle");
+			break;
+		}
+		ofs += res;
+	}
+
+	if (chp->using_socket && ofs < chp->outbuf_len &&
+	    chp->w_descriptor >= 0) {
+		/*  The client is not keeping up. Keep what is left, unless
+		    the buffer is full, in which case output is dropped.  */
+		if (ofs == 0 && chp->outbuf_len >= CONSOLE_OUTBUF_LEN)
+			ofs = chp->outbuf_len;
+		memmove(chp->outbuf, chp->outbuf + ofs, chp->outbuf_len - ofs);
+		chp->outbuf_len -= ofs;
+		return;
+	}
+
+	chp->outbuf_len = 0;
+}
+
+
 /*
  *  console_putchar():
  *
  *  Prints a char to stdout, and sets the console_stdout_pending flag.
+ *  When slaves are used, the char is instead appended to the handle's
+ *  output buffer, which is written to the slave on newline, when full,
+ *  or (at the latest) on the next console_flush().
  */
 void console_putchar(int handle, int ch)
 {
-	char buf[1];
+	struct console_handle *chp;
 
 	if (!console_handles[handle].in_use_for_input &&
 	    !console_handles[handle].outputonly)
 		console_change_inputability(handle, 1);
 
+	chp = &console_handles[handle];
+
 	if (!allow_slaves) {
 		/*  stdout:  */
 		putchar(ch);
@@ -474,22 +739,31 @@ void console_putchar(int handle, int ch)
 		else
 			console_stdout_pending = 1;
 
+		if (chp->interactive && console_stdout_pending) {
+			fflush(stdout);
+			console_stdout_pending = 0;
+		}
+
 		return;
 	}
 
-	if (!console_handles[handle].in_use) {
+	if (!chp->in_use) {
 		printf("[ console_putchar(): handle %i not in"
 		    " use! ]\n", handle);
 		return;
-		}
+	}
 
-	if (console_handles[handle].using_xterm ==
-	    USING_XTERM_BUT_NOT_YET_OPEN)
+	if (chp->using_xterm == USING_XTERM_BUT_NOT_YET_OPEN)
 		start_xterm(handle);
 
-	buf[0] = ch;
-	if (write(console_handles[handle].w_descriptor, buf, 1) != 1)
-		perror("error writing to console handle");
+	if (chp->using_socket)
+		console_socket_poll(handle);
+
+	chp->outbuf[chp->outbuf_len ++] = ch;
+
+	if (ch == '\n' || chp->interactive ||
+	    chp->outbuf_len >= CONSOLE_OUTBUF_LEN)
+		console_outbuf_flush(handle);
 }
 
 
@@ -497,6 +771,7 @@ void console_putchar(int handle, int ch)
  *  console_flush():
  *
  *  Flushes stdout, if necessary, and resets console_stdout_pending to zero.
+ *  Buffered output for slave handles is also written out.
  */
 void console_flush(void)
 {
@@ -504,6 +779,14 @@ void console_flush(void)
 		fflush(stdout);
 
 	console_stdout_pending = 0;
+
+	for (int i = 0; i < n_console_handles; i++) {
+		if (console_handles[i].using_socket)
+			console_socket_poll(i);
+		if (console_handles[i].outbuf_len > 0)
+			console_outbuf_flush(i);
+		console_handles[i].interactive = 0;
+	}
 }
 
 
@@ -688,6 +971,7 @@ static struct console_handle *console_new_handle(const char *name, int *handlep)
 	memset(chp, 0, sizeof(struct console_handle));
 
 	chp->in_use = 1;
+	chp->listen_descriptor = -1;
 	chp->machine_name = strdup("");
 	CHECK_ALLOCATION(chp->name = strdup(name));
 
@@ -748,7 +1032,9 @@ int console_start_slave(struct machine *machine, const char *consolename,
 
 	CHECK_ALLOCATION(chp->name = strdup(consolename));
 
-	if (allow_slaves)
+	if (console_socket_spec != NULL)
+		console_socket_listen(handle);
+	else if (allow_slaves)
 		chp->using_xterm = USING_XTERM_BUT_NOT_YET_OPEN;
 
 	return handle;
@@ -899,6 +1185,8 @@ void console_debug_dump(struct machine *machine)
 
 	debug("console slaves (xterms): %s\n", allow_slaves?
 	    "yes" : "no");
+	if (console_socket_spec != NULL)
+		debug("console sockets: %s\n", console_socket_spec);
 
 	debug("console handles:\n");
 	debug_indentation(iadd);
@@ -909,6 +1197,8 @@ void console_debug_dump(struct machine *machine)
 		debug("%i: \"%s\"", i, console_handles[i].name);
 		if (console_handles[i].using_xterm)
 			debug(" [xterm]");
+		if (console_handles[i].using_socket)
+			debug(" [socket]");
 		if (console_handles[i].inputonly)
 			debug(" [inputonly]");
 		if (console_handles[i].outputonly)
@@ -939,12 +1229,50 @@ void console_allow_slaves(int allow)
 
 	if (allow_slaves) {
 		for (int i = 0; i < n_console_handles; i++)
-			if (i != MAIN_CONSOLE)
+			if (i != MAIN_CONSOLE && !console_handles[i].using_socket)
 				console_handles[i].using_xterm = USING_XTERM_BUT_NOT_YET_OPEN;
 	}
 }
 
 
+/*
+ *  console_allow_sockets():
+ *
+ *  Binds each emulated serial console to a listening socket, instead of
+ *  opening up slave xterms. spec is either "unix:PATHPREFIX" or
+ *  "tcp:BASEPORT". Returns 1 on success, 0 if spec is malformed.
+ */
+int console_allow_sockets(const char *spec)
+{
+	if (strncmp(spec, "unix:", 5) == 0) {
+		if (spec[5] == '\0')
+			return 0;
+	} else if (strncmp(spec, "tcp:", 4) == 0) {
+		char *end;
+		long port = strtol(spec + 4, &end, 10);
+		if (*end != '\0' || port < 1 || port > 65535)
+			return 0;
+	} else
+		return 0;
+
+	CHECK_ALLOCATION(console_socket_spec = strdup(spec));
+	allow_slaves = 1;
+
+	/*  Clients going away must not kill the emulator:  */
+	signal(SIGPIPE, SIG_IGN);
+
+	for (int i = 0; i < n_console_handles; i++)
+		if (i != MAIN_CONSOLE && console_handles[i].in_use &&
+		    !console_handles[i].inputonly &&
+		    !console_handles[i].using_socket) {
+			console_handles[i].using_xterm = NOT_USING_XTERM;
+			console_socket_listen(i);
+		}
+
+	return 1;
+}
+
+
 /*
  *  console_are_slaves_allowed():
  *
@@ -1043,6 +1371,7 @@ void console_init(void)
  */
 void console_deinit(void)
 {
+	console_sockets_close();
 	settings_remove(console_settings, "allow_slaves");
 	settings_remove(global_settings, "console");
 }
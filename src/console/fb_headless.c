@@ -0,0 +1,614 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *
+ *  Headless framebuffer windows.
+ *
+ *  When GXemul is started with -g (or is built without X11), framebuffer
+ *  windows are not shown on screen. Instead, dev_fb converts the emulated
+ *  framebuffer into an in-memory 32 bits per pixel buffer (laid out like a
+ *  little-endian 24-bit XImage, i.e. the bytes b, g, r, 0 for each pixel).
+ *  Snapshots of that buffer may be written to PNG or PPM files, and the
+ *  buffer may be served over VNC (see fb_vnc.c).
+ *
+ *  Snapshots are written periodically (every HEADLESS_SNAPSHOT_INTERVAL
+ *  framebuffer ticks), but only when the contents, including the cursor,
+ *  have actually changed since the last snapshot. A final snapshot is
+ *  written when the emulator exits. The file names are
+ *  <prefix><fb number>-<snapshot number>.png, or .ppm if the prefix given
+ *  to -g ends with ".ppm".
+ *
+ *  The PNG writer is self-contained: the image data is compressed with a
+ *  simple greedy LZ77 matcher, and encoded as a single deflate block using
+ *  the fixed Huffman codes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+#include "misc.h"
+#include "x11.h"
+
+
+#define	HEADLESS_SNAPSHOT_INTERVAL	64
+
+#define	DEFLATE_WINDOW			32768
+#define	DEFLATE_MIN_MATCH		3
+#define	DEFLATE_MAX_MATCH		258
+#define	DEFLATE_HASH_BITS		15
+
+
+/*  All headless windows, for the final snapshots at exit:  */
+static struct fb_window **headless_windows = NULL;
+static int n_headless_windows = 0;
+
+static void fb_headless_finish(void);
+
+
+/*
+ *  fb_headless_init():
+ *
+ *  Sets up a framebuffer window as a headless window.
+ */
+void fb_headless_init(struct fb_window *fbwin, struct machine *m)
+{
+	fbwin->headless = true;
+
+	if (m->x11_md.snapshot_prefix != NULL)
+		CHECK_ALLOCATION(fbwin->snapshot_prefix =
+		    strdup(m->x11_md.snapshot_prefix));
+
+	if (n_headless_windows == 0)
+		atexit(fb_headless_finish);
+
+	CHECK_ALLOCATION(headless_windows = (struct fb_window **) realloc(
+	    headless_windows, sizeof(struct fb_window *) *
+	    (n_headless_windows + 1)));
+	headless_windows[n_headless_windows ++] = fbwin;
+
+	fb_headless_resize(fbwin, fbwin->x11_fb_winxsize,
+	    fbwin->x11_fb_winysize);
+
+	if (m->x11_md.vnc_port > 0)
+		fb_vnc_init(fbwin, m);
+
+	debugmsg(SUBSYS_X11, "fb_init", VERBOSITY_INFO,
+	    "headless framebuffer window %i, %ix%i", fbwin->fb_number,
+	    fbwin->x11_fb_winxsize, fbwin->x11_fb_winysize);
+}
+
+
+/*
+ *  fb_headless_resize():
+ *
+ *  (Re)allocates the pixel buffer of a headless window. The new contents
+ *  are black.
+ */
+void fb_headless_resize(struct fb_window *fbwin, int xsize, int ysize)
+{
+	size_t len;
+
+	if (xsize < 1)
+		xsize = 1;
+	if (ysize < 1)
+		ysize = 1;
+
+	fbwin->x11_fb_winxsize = xsize;
+	fbwin->x11_fb_winysize = ysize;
+	fbwin->ximage_bytes_per_line = xsize * 4;
+
+	len = (size_t) fbwin->ximage_bytes_per_line * ysize;
+
+	free(fbwin->ximage_data);
+	CHECK_ALLOCATION(fbwin->ximage_data = (unsigned char *) malloc(len));
+	memset(fbwin->ximage_data, 0, len);
+
+	fbwin->headless_changed = true;
+
+	if (fbwin->vnc != NULL)
+		fb_vnc_resize(fbwin);
+}
+
+
+/*
+ *  fb_headless_update():
+ *
+ *  Called when a rectangle of a headless window's buffer has been updated.
+ */
+void fb_headless_update(struct fb_window *fbwin, int x, int y, int w, int h)
+{
+	fbwin->headless_changed = true;
+
+	if (fbwin->vnc != NULL)
+		fb_vnc_update(fbwin, x, y, w, h);
+}
+
+
+/*
+ *  fb_headless_hash():
+ *
+ *  Returns a hash of the visible contents of a headless window, including
+ *  the cursor state, so that identical frames need not be written again.
+ */
+static uint64_t fb_headless_hash(struct fb_window *fbwin)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int x, y;
+
+	for (y=0; y<fbwin->x11_fb_winysize; y++) {
+		uint32_t *p = (uint32_t *) (fbwin->ximage_data +
+		    (size_t) y * fbwin->ximage_bytes_per_line);
+
+		for (x=0; x<fbwin->x11_fb_winxsize; x++) {
+			h = (h ^ p[x]) * 0x100000001b3ULL;
+			h ^= h >> 29;
+		}
+	}
+
+	h = (h ^ fbwin->x11_fb_winxsize) * 0x100000001b3ULL;
+	h = (h ^ fbwin->x11_fb_winysize) * 0x100000001b3ULL;
+
+	if (fbwin->cursor_on) {
+		h = (h ^ (fbwin->cursor_x + 1)) * 0x100000001b3ULL;
+		h = (h ^ (fbwin->cursor_y + 1)) * 0x100000001b3ULL;
+		h = (h ^ fbwin->cursor_xsize) * 0x100000001b3ULL;
+		h = (h ^ fbwin->cursor_ysize) * 0x100000001b3ULL;
+		for (y=0; y<fbwin->cursor_ysize && y<CURSOR_MAXY; y++)
+			for (x=0; x<fbwin->cursor_xsize && x<CURSOR_MAXX; x++)
+				h = (h ^ (fbwin->cursor_pixels[y][x] & 255))
+				    * 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+
+/*
+ *  fb_headless_get_row():
+ *
+ *  Fills rgb with row y of a headless window as 8-bit r, g, b triplets,
+ *  with the cursor (if it is on) drawn on top.
+ */
+void fb_headless_get_row(struct fb_window *fbwin, int y, unsigned char *rgb)
+{
+	unsigned char *p = fbwin->ximage_data +
+	    (size_t) y * fbwin->ximage_bytes_per_line;
+	int x, q = fbwin->scaledown, cy;
+
+	for (x=0; x<fbwin->x11_fb_winxsize; x++) {
+		rgb[x*3 + 0] = p[x*4 + 2];
+		rgb[x*3 + 1] = p[x*4 + 1];
+		rgb[x*3 + 2] = p[x*4 + 0];
+	}
+
+	if (!fbwin->cursor_on)
+		return;
+
+	cy = y * q - fbwin->cursor_y;
+	if (cy < 0 || cy >= fbwin->cursor_ysize || cy >= CURSOR_MAXY)
+		return;
+
+	for (x=0; x<fbwin->x11_fb_winxsize; x++) {
+		int cx = x * q - fbwin->cursor_x, c;
+
+		if (cx < 0 || cx >= fbwin->cursor_xsize || cx >= CURSOR_MAXX)
+			continue;
+
+		c = fbwin->cursor_pixels[cy][cx];
+		switch (c) {
+
+		case CURSOR_COLOR_TRANSPARENT:
+			break;
+
+		case CURSOR_COLOR_INVERT:
+			c = (rgb[x*3] == 255 && rgb[x*3+1] == 255 &&
+			    rgb[x*3+2] == 255)? 0 : 255;
+			rgb[x*3] = rgb[x*3+1] = rgb[x*3+2] = c;
+			break;
+
+		default:	/*  Normal grayscale:  */
+			c *= 255 / (N_GRAYCOLORS - 1);
+			rgb[x*3] = rgb[x*3+1] = rgb[x*3+2] = c;
+		}
+	}
+}
+
+
+/*
+ *  PNG output:
+ */
+
+static uint32_t crc_table[256];
+
+static uint32_t png_crc(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	size_t i;
+
+	if (crc_table[1] == 0) {
+		for (i=0; i<256; i++) {
+			uint32_t c = i;
+			int k;
+			for (k=0; k<8; k++)
+				c = (c & 1)? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+			crc_table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	for (i=0; i<len; i++)
+		crc = crc_table[(crc ^ buf[i]) & 255] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+
+static void put_be32(unsigned char *p, uint32_t x)
+{
+	p[0] = x >> 24; p[1] = x >> 16; p[2] = x >> 8; p[3] = x;
+}
+
+
+static void png_chunk(FILE *f, const char *type, const unsigned char *data,
+	size_t len)
+{
+	unsigned char buf[8];
+	uint32_t crc;
+
+	put_be32(buf, len);
+	memcpy(buf + 4, type, 4);
+	fwrite(buf, 1, 8, f);
+	if (len > 0)
+		fwrite(data, 1, len, f);
+
+	crc = png_crc(0, buf + 4, 4);
+	crc = png_crc(crc, data, len);
+	put_be32(buf, crc);
+	fwrite(buf, 1, 4, f);
+}
+
+
+struct bitwriter {
+	unsigned char	*p;
+	uint32_t	bits;
+	int		n;
+};
+
+static void put_bits(struct bitwriter *bw, uint32_t value, int n)
+{
+	bw->bits |= value << bw->n;
+	bw->n += n;
+	while (bw->n >= 8) {
+		*bw->p++ = bw->bits;
+		bw->bits >>= 8;
+		bw->n -= 8;
+	}
+}
+
+/*  Huffman codes are sent most significant bit first:  */
+static void put_code(struct bitwriter *bw, uint32_t code, int n)
+{
+	uint32_t r = 0;
+	int i;
+
+	for (i=0; i<n; i++)
+		r |= ((code >> i) & 1) << (n - 1 - i);
+
+	put_bits(bw, r, n);
+}
+
+static void put_litlen(struct bitwriter *bw, int sym)
+{
+	if (sym < 144)
+		put_code(bw, 0x30 + sym, 8);
+	else if (sym < 256)
+		put_code(bw, 0x190 + sym - 144, 9);
+	else if (sym < 280)
+		put_code(bw, sym - 256, 7);
+	else
+		put_code(bw, 0xc0 + sym - 280, 8);
+}
+
+static void put_match(struct bitwriter *bw, int len, int dist)
+{
+	static const int len_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13,
+	    15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131,
+	    163, 195, 227, 258 };
+	static const int len_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+	    1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const int dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25,
+	    33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049,
+	    3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	int i;
+
+	for (i=28; len_base[i] > len; i--)
+		;
+	put_litlen(bw, 257 + i);
+	put_bits(bw, len - len_base[i], len_extra[i]);
+
+	for (i=29; dist_base[i] > dist; i--)
+		;
+	put_code(bw, i, 5);
+	put_bits(bw, dist - dist_base[i], i < 4? 0 : i/2 - 1);
+}
+
+
+/*
+ *  deflate_fixed():
+ *
+ *  Compresses src into dst as a zlib stream, consisting of a single deflate
+ *  block with the fixed Huffman codes. Besides the most recent position with
+ *  the same first three bytes, the previous pixel and the pixel above are
+ *  tried as matches, which suits screen contents well. dst must have room
+ *  for len * 9 / 8 + 64 bytes. Returns the compressed length.
+ */
+static size_t deflate_fixed(const unsigned char *src, size_t len,
+	unsigned char *dst, size_t rowlen)
+{
+	struct bitwriter bw;
+	int32_t *head;
+	uint32_t a = 1, b = 0;
+	size_t i, pos = 0;
+
+	CHECK_ALLOCATION(head = (int32_t *) malloc(sizeof(int32_t) <<
+	    DEFLATE_HASH_BITS));
+	for (i=0; i<(1 << DEFLATE_HASH_BITS); i++)
+		head[i] = -1;
+
+	dst[0] = 0x78; dst[1] = 0x01;
+	bw.p = dst + 2; bw.bits = 0; bw.n = 0;
+
+	put_bits(&bw, 1, 1);		/*  BFINAL  */
+	put_bits(&bw, 1, 2);		/*  BTYPE = fixed Huffman  */
+
+	while (pos < len) {
+		size_t cand[3], best_len = 0, best_dist = 0, maxlen;
+		int j;
+
+		maxlen = len - pos;
+		if (maxlen > DEFLATE_MAX_MATCH)
+			maxlen = DEFLATE_MAX_MATCH;
+
+		cand[0] = cand[1] = cand[2] = pos;
+		if (maxlen >= DEFLATE_MIN_MATCH) {
+			uint32_t h = ((src[pos] << 16) | (src[pos+1] << 8) |
+			    src[pos+2]) * 2654435761U >> (32 - DEFLATE_HASH_BITS);
+			if (head[h] >= 0)
+				cand[0] = head[h];
+			head[h] = pos;
+		}
+		if (pos >= 3)
+			cand[1] = pos - 3;
+		if (pos >= rowlen && rowlen <= DEFLATE_WINDOW)
+			cand[2] = pos - rowlen;
+
+		for (j=0; j<3; j++) {
+			size_t n = 0;
+
+			if (cand[j] == pos || pos - cand[j] > DEFLATE_WINDOW)
+				continue;
+			while (n < maxlen && src[cand[j] + n] == src[pos + n])
+				n ++;
+			if (n > best_len) {
+				best_len = n;
+				best_dist = pos - cand[j];
+			}
+		}
+
+		if (best_len >= DEFLATE_MIN_MATCH) {
+			put_match(&bw, best_len, best_dist);
+			pos += best_len;
+		} else {
+			put_litlen(&bw, src[pos]);
+			pos ++;
+		}
+	}
+
+	put_litlen(&bw, 256);		/*  End of block  */
+	if (bw.n > 0)
+		put_bits(&bw, 0, 8 - bw.n);
+
+	for (i=0; i<len; i++) {
+		a = (a + src[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	put_be32(bw.p, (b << 16) | a);
+	bw.p += 4;
+
+	free(head);
+	return bw.p - dst;
+}
+
+
+static void fb_headless_write_png(struct fb_window *fbwin, FILE *f)
+{
+	static const unsigned char signature[8] = {
+	    0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	int xsize = fbwin->x11_fb_winxsize, ysize = fbwin->x11_fb_winysize;
+	size_t rowlen = (size_t) xsize * 3 + 1;
+	size_t rawlen = rowlen * ysize, clen;
+	unsigned char ihdr[13], *raw, *compressed;
+	int y;
+
+	CHECK_ALLOCATION(raw = (unsigned char *) malloc(rawlen));
+	CHECK_ALLOCATION(compressed = (unsigned char *)
+	    malloc(rawlen * 9 / 8 + 64));
+
+	for (y=0; y<ysize; y++) {
+		raw[y * rowlen] = 0;	/*  filter type None  */
+		fb_headless_get_row(fbwin, y, raw + y * rowlen + 1);
+	}
+
+	clen = deflate_fixed(raw, rawlen, compressed, rowlen);
+
+	put_be32(ihdr, xsize);
+	put_be32(ihdr + 4, ysize);
+	ihdr[8] = 8;		/*  bit depth  */
+	ihdr[9] = 2;		/*  color type RGB  */
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+	fwrite(signature, 1, sizeof(signature), f);
+	png_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+	png_chunk(f, "IDAT", compressed, clen);
+	png_chunk(f, "IEND", NULL, 0);
+
+	free(compressed);
+	free(raw);
+}
+
+
+static void fb_headless_write_ppm(struct fb_window *fbwin, FILE *f)
+{
+	unsigned char *rgb;
+	int y;
+
+	CHECK_ALLOCATION(rgb = (unsigned char *)
+	    malloc(fbwin->x11_fb_winxsize * 3));
+
+	fprintf(f, "P6\n%i %i\n255\n", fbwin->x11_fb_winxsize,
+	    fbwin->x11_fb_winysize);
+
+	for (y=0; y<fbwin->x11_fb_winysize; y++) {
+		fb_headless_get_row(fbwin, y, rgb);
+		fwrite(rgb, 3, fbwin->x11_fb_winxsize, f);
+	}
+
+	free(rgb);
+}
+
+
+static bool has_ppm_suffix(const char *s)
+{
+	size_t len = strlen(s);
+	return len >= 4 && strcmp(s + len - 4, ".ppm") == 0;
+}
+
+
+/*
+ *  fb_headless_snapshot():
+ *
+ *  Writes the contents of a headless window to a file, as PPM if the file
+ *  name ends with ".ppm", otherwise as PNG. Returns true on success.
+ */
+bool fb_headless_snapshot(struct fb_window *fbwin, const char *fname)
+{
+	FILE *f = fopen(fname, "w");
+
+	if (f == NULL) {
+		perror(fname);
+		return false;
+	}
+
+	if (has_ppm_suffix(fname))
+		fb_headless_write_ppm(fbwin, f);
+	else
+		fb_headless_write_png(fbwin, f);
+
+	if (fclose(f) != 0) {
+		perror(fname);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ *  fb_headless_auto_snapshot():
+ *
+ *  Writes the next numbered snapshot of a window, if its contents differ from
+ *  the previous snapshot.
+ */
+static void fb_headless_auto_snapshot(struct fb_window *fbwin)
+{
+	uint64_t hash;
+	size_t fname_len;
+	char *fname;
+	bool ppm;
+	int prefix_len;
+
+	fbwin->headless_changed = false;
+
+	hash = fb_headless_hash(fbwin);
+	if (fbwin->n_snapshots > 0 && hash == fbwin->snapshot_hash)
+		return;
+
+	fbwin->snapshot_hash = hash;
+
+	ppm = has_ppm_suffix(fbwin->snapshot_prefix);
+	prefix_len = strlen(fbwin->snapshot_prefix) - (ppm? 4 : 0);
+	fname_len = prefix_len + 40;
+	CHECK_ALLOCATION(fname = (char *) malloc(fname_len));
+	snprintf(fname, fname_len, "%.*s%i-%05i.%s", prefix_len,
+	    fbwin->snapshot_prefix, fbwin->fb_number, fbwin->n_snapshots,
+	    ppm? "ppm" : "png");
+
+	if (fb_headless_snapshot(fbwin, fname))
+		debugmsg(SUBSYS_X11, "headless", VERBOSITY_DEBUG,
+		    "wrote %s", fname);
+
+	fbwin->n_snapshots ++;
+	free(fname);
+}
+
+
+/*
+ *  fb_headless_flush():
+ *
+ *  Called once per framebuffer tick. Writes a snapshot, if one is due, and
+ *  lets the VNC server (if any) send an update.
+ */
+void fb_headless_flush(struct fb_window *fbwin)
+{
+	if (fbwin->vnc != NULL)
+		fb_vnc_flush(fbwin);
+
+	if (fbwin->snapshot_prefix == NULL || !fbwin->headless_changed)
+		return;
+
+	if (++ fbwin->headless_flushes < HEADLESS_SNAPSHOT_INTERVAL)
+		return;
+
+	fbwin->headless_flushes = 0;
+	fb_headless_auto_snapshot(fbwin);
+}
+
+
+/*
+ *  fb_headless_finish():
+ *
+ *  Writes final snapshots of all headless windows, when the emulator exits.
+ */
+static void fb_headless_finish(void)
+{
+	int i;
+
+	for (i=0; i<n_headless_windows; i++)
+		if (headless_windows[i]->snapshot_prefix != NULL)
+			fb_headless_auto_snapshot(headless_windows[i]);
+}
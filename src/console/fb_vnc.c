@@ -0,0 +1,884 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *
+ *  VNC (RFB protocol) server for headless framebuffer windows.
+ *
+ *  With -w BASEPORT, each headless framebuffer window listens on 127.0.0.1,
+ *  port BASEPORT+n, where n counts the windows in the order they were
+ *  created. One client at a time may be connected to each window; further
+ *  connections are accepted when the current client disconnects. Security
+ *  type None is used, so the ports are only bound to the loopback interface.
+ *
+ *  The window is divided into VNC_TILE_SIZE x VNC_TILE_SIZE pixel tiles.
+ *  Updates of the window's buffer mark tiles as dirty, and when the client
+ *  asks for an update, runs of dirty tiles are sent as rectangles, each
+ *  one using RRE encoding (a background color plus one subrectangle per
+ *  horizontal run of other colors) if that is smaller than raw pixels.
+ *
+ *  Key events are translated into the same characters and escape sequences
+ *  as X11 key presses, and pointer events into relative mouse movements and
+ *  button presses, via console_makeavail() and console_mouse_*().
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "console.h"
+#include "machine.h"
+#include "misc.h"
+#include "x11.h"
+
+
+#define	VNC_TILE_SHIFT		4
+#define	VNC_TILE_SIZE		(1 << VNC_TILE_SHIFT)
+#define	VNC_INBUF_SIZE		8192
+
+#define	VNC_STATE_VERSION	0
+#define	VNC_STATE_SECURITY	1
+#define	VNC_STATE_CLIENTINIT	2
+#define	VNC_STATE_NORMAL	3
+
+#define	VNC_ENCODING_RAW	0
+#define	VNC_ENCODING_RRE	2
+#define	VNC_ENCODING_DESKTOPSIZE (-223)
+
+
+struct fb_vnc {
+	struct machine	*machine;
+	int		port;
+	int		listen_descriptor;
+	int		descriptor;		/*  -1 if no client  */
+
+	int		state;
+	int		minor_version;
+
+	unsigned char	inbuf[VNC_INBUF_SIZE];
+	size_t		inbuf_len;
+	uint32_t	skip_bytes;		/*  of ClientCutText  */
+
+	unsigned char	*outbuf;
+	size_t		outbuf_len, outbuf_sent, outbuf_alloc;
+
+	/*  The client's pixel format (always true color):  */
+	int		bytes_per_pixel;
+	bool		big_endian;
+	int		red_max, green_max, blue_max;
+	int		red_shift, green_shift, blue_shift;
+
+	bool		rre_ok;
+	bool		desktop_size_ok;
+
+	bool		update_requested;
+	bool		size_changed;
+
+	/*  Dirty tiles, and scratch buffers for one row of tiles:  */
+	int		tiles_x, tiles_y;
+	unsigned char	*dirty;
+	unsigned char	*rgb;
+	uint32_t	*pixels;
+
+	/*  Input state:  */
+	int		last_x, last_y;		/*  -1 before the first event  */
+	int		last_buttons;
+	bool		ctrl;
+};
+
+static int n_vnc_windows = 0;
+
+
+/*
+ *  Key symbols that do not map to a single character are sent as the same
+ *  escape sequences as the corresponding X11 key presses in x11.c.
+ */
+static const struct vnc_key {
+	uint32_t	keysym;
+	const char	*seq;
+} vnc_keys[] = {
+	{ 0xff08, "\010" },		/*  BackSpace  */
+	{ 0xff09, "\t" },		/*  Tab  */
+	{ 0xff0d, "\r" },		/*  Return  */
+	{ 0xff8d, "\r" },		/*  KP_Enter  */
+	{ 0xff1b, "\033" },		/*  Escape  */
+	{ 0xffff, "\177" },		/*  Delete  */
+	{ 0xffbe, "\033[OP" },		/*  F1  */
+	{ 0xffbf, "\033[OQ" },		/*  F2  */
+	{ 0xffc0, "\033[OR" },		/*  F3  */
+	{ 0xffc1, "\033[OS" },		/*  F4  */
+	{ 0xffc2, "\033[15" },		/*  F5  */
+	{ 0xffc3, "\033[17" },		/*  F6  */
+	{ 0xffc4, "\033[18" },		/*  F7  */
+	{ 0xffc5, "\033[19" },		/*  F8  */
+	{ 0xffc6, "\033[28" },		/*  F9  */
+	{ 0xffc7, "\033[29" },		/*  F10  */
+	{ 0xffc8, "\033[23" },		/*  F11  */
+	{ 0xffc9, "\033[24" },		/*  F12  */
+	{ 0xff52, "\033[A" },		/*  Up  */
+	{ 0xff97, "\033[A" },		/*  KP_Up  */
+	{ 0xff54, "\033[B" },		/*  Down  */
+	{ 0xff99, "\033[B" },		/*  KP_Down  */
+	{ 0xff53, "\033[C" },		/*  Right  */
+	{ 0xff98, "\033[C" },		/*  KP_Right  */
+	{ 0xff51, "\033[D" },		/*  Left  */
+	{ 0xff96, "\033[D" },		/*  KP_Left  */
+	{ 0xff50, "\033[H" },		/*  Home  */
+	{ 0xff95, "\033[H" },		/*  KP_Home  */
+	{ 0xff57, "\033[F" },		/*  End  */
+	{ 0xff9c, "\033[F" },		/*  KP_End  */
+	{ 0xff55, "\033[5~" },		/*  Prior  */
+	{ 0xff9a, "\033[5~" },		/*  KP_Prior  */
+	{ 0xff56, "\033[6~" },		/*  Next  */
+	{ 0xff9b, "\033[6~" },		/*  KP_Next  */
+	{ 0, NULL }
+};
+
+
+static uint16_t get_be16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+
+/*
+ *  vnc_reserve():
+ *
+ *  Returns a pointer to len bytes at the end of the output buffer.
+ */
+static unsigned char *vnc_reserve(struct fb_vnc *v, size_t len)
+{
+	unsigned char *p;
+
+	if (v->outbuf_len + len > v->outbuf_alloc) {
+		v->outbuf_alloc = (v->outbuf_len + len) * 2;
+		CHECK_ALLOCATION(v->outbuf = (unsigned char *)
+		    realloc(v->outbuf, v->outbuf_alloc));
+	}
+
+	p = v->outbuf + v->outbuf_len;
+	v->outbuf_len += len;
+	return p;
+}
+
+static void vnc_put8(struct fb_vnc *v, int x)
+{
+	*vnc_reserve(v, 1) = x;
+}
+
+static void vnc_put16(struct fb_vnc *v, int x)
+{
+	unsigned char *p = vnc_reserve(v, 2);
+	p[0] = x >> 8; p[1] = x;
+}
+
+static void vnc_put32(struct fb_vnc *v, uint32_t x)
+{
+	unsigned char *p = vnc_reserve(v, 4);
+	p[0] = x >> 24; p[1] = x >> 16; p[2] = x >> 8; p[3] = x;
+}
+
+static void vnc_store_pixel(struct fb_vnc *v, unsigned char *p,
+	uint32_t pixel)
+{
+	int i, n = v->bytes_per_pixel;
+
+	for (i=0; i<n; i++)
+		p[v->big_endian? n-1-i : i] = pixel >> (i*8);
+}
+
+static void vnc_put_pixel(struct fb_vnc *v, uint32_t pixel)
+{
+	vnc_store_pixel(v, vnc_reserve(v, v->bytes_per_pixel), pixel);
+}
+
+
+/*
+ *  vnc_disconnect():
+ *
+ *  Closes the connection to the client (if any). The window keeps listening
+ *  for new connections.
+ */
+static void vnc_disconnect(struct fb_vnc *v)
+{
+	if (v->descriptor >= 0) {
+		close(v->descriptor);
+		debugmsg(SUBSYS_X11, "vnc", VERBOSITY_INFO,
+		    "client on port %i disconnected", v->port);
+	}
+
+	v->descriptor = -1;
+	v->outbuf_len = v->outbuf_sent = 0;
+}
+
+
+/*
+ *  vnc_write_pending():
+ *
+ *  Writes as much of the output buffer to the client as can be written
+ *  without blocking.
+ */
+static void vnc_write_pending(struct fb_vnc *v)
+{
+	while (v->descriptor >= 0 && v->outbuf_sent < v->outbuf_len) {
+		ssize_t res = write(v->descriptor, v->outbuf + v->outbuf_sent,
+		    v->outbuf_len - v->outbuf_sent);
+
+		if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+		    errno == EINTR))
+			return;
+
+		if (res <= 0) {
+			vnc_disconnect(v);
+			return;
+		}
+
+		v->outbuf_sent += res;
+	}
+
+	v->outbuf_len = v->outbuf_sent = 0;
+}
+
+
+static void vnc_mark_dirty(struct fb_vnc *v, int x, int y, int w, int h)
+{
+	int tx1, ty1, tx2, ty2, tx, ty;
+
+	if (x < 0) { w += x; x = 0; }
+	if (y < 0) { h += y; y = 0; }
+	if (w <= 0 || h <= 0)
+		return;
+
+	tx1 = x >> VNC_TILE_SHIFT;
+	ty1 = y >> VNC_TILE_SHIFT;
+	tx2 = (x + w - 1) >> VNC_TILE_SHIFT;
+	ty2 = (y + h - 1) >> VNC_TILE_SHIFT;
+
+	if (tx2 >= v->tiles_x)
+		tx2 = v->tiles_x - 1;
+	if (ty2 >= v->tiles_y)
+		ty2 = v->tiles_y - 1;
+
+	for (ty=ty1; ty<=ty2; ty++)
+		for (tx=tx1; tx<=tx2; tx++)
+			v->dirty[ty * v->tiles_x + tx] = 1;
+}
+
+
+/*
+ *  fb_vnc_resize():
+ *
+ *  Called when a headless window with a VNC server has changed size.
+ */
+void fb_vnc_resize(struct fb_window *fbwin)
+{
+	struct fb_vnc *v = fbwin->vnc;
+	int xsize = fbwin->x11_fb_winxsize, ysize = fbwin->x11_fb_winysize;
+
+	v->tiles_x = (xsize + VNC_TILE_SIZE - 1) >> VNC_TILE_SHIFT;
+	v->tiles_y = (ysize + VNC_TILE_SIZE - 1) >> VNC_TILE_SHIFT;
+
+	free(v->dirty);
+	free(v->rgb);
+	free(v->pixels);
+	CHECK_ALLOCATION(v->dirty = (unsigned char *)
+	    malloc(v->tiles_x * v->tiles_y));
+	CHECK_ALLOCATION(v->rgb = (unsigned char *)
+	    malloc((size_t) xsize * 3 * VNC_TILE_SIZE));
+	CHECK_ALLOCATION(v->pixels = (uint32_t *)
+	    malloc(sizeof(uint32_t) * xsize * VNC_TILE_SIZE));
+
+	memset(v->dirty, 1, v->tiles_x * v->tiles_y);
+	v->size_changed = true;
+}
+
+
+/*
+ *  fb_vnc_update():
+ *
+ *  Called when a rectangle of a headless window's buffer has been updated.
+ */
+void fb_vnc_update(struct fb_window *fbwin, int x, int y, int w, int h)
+{
+	vnc_mark_dirty(fbwin->vnc, x, y, w, h);
+}
+
+
+/*
+ *  vnc_send_rect():
+ *
+ *  Adds a rectangle to a FramebufferUpdate message. v->rgb holds the rows
+ *  of the current row of tiles, starting at row y0.
+ */
+static void vnc_send_rect(struct fb_window *fbwin, int x, int y, int w,
+	int h, int y0)
+{
+	struct fb_vnc *v = fbwin->vnc;
+	int bpp = v->bytes_per_pixel, i, j;
+	uint32_t *pix = v->pixels, bg, n_subrects = 0;
+
+	for (j=0; j<h; j++) {
+		unsigned char *rgb = v->rgb +
+		    ((size_t) (y - y0 + j) * fbwin->x11_fb_winxsize + x) * 3;
+
+		for (i=0; i<w; i++, rgb += 3)
+			*pix++ =
+			    ((rgb[0] * v->red_max + 127) / 255 << v->red_shift) |
+			    ((rgb[1] * v->green_max + 127) / 255 << v->green_shift) |
+			    ((rgb[2] * v->blue_max + 127) / 255 << v->blue_shift);
+	}
+
+	pix = v->pixels;
+	bg = pix[0];
+
+	if (v->rre_ok) {
+		for (j=0; j<h; j++)
+			for (i=0; i<w; i++)
+				if (pix[j*w+i] != bg &&
+				    (i == 0 || pix[j*w+i] != pix[j*w+i-1]))
+					n_subrects ++;
+	}
+
+	vnc_put16(v, x);
+	vnc_put16(v, y);
+	vnc_put16(v, w);
+	vnc_put16(v, h);
+
+	if (!v->rre_ok || 4 + bpp + (size_t) n_subrects * (bpp + 8) >=
+	    (size_t) w * h * bpp) {
+		unsigned char *p;
+
+		vnc_put32(v, VNC_ENCODING_RAW);
+		p = vnc_reserve(v, (size_t) w * h * bpp);
+		for (i=0; i<w*h; i++, p += bpp)
+			vnc_store_pixel(v, p, pix[i]);
+		return;
+	}
+
+	vnc_put32(v, VNC_ENCODING_RRE);
+	vnc_put32(v, n_subrects);
+	vnc_put_pixel(v, bg);
+
+	for (j=0; j<h; j++) {
+		for (i=0; i<w; ) {
+			uint32_t c = pix[j*w+i];
+			int len = 1;
+
+			while (i + len < w && pix[j*w+i+len] == c)
+				len ++;
+
+			if (c != bg) {
+				vnc_put_pixel(v, c);
+				vnc_put16(v, i);
+				vnc_put16(v, j);
+				vnc_put16(v, len);
+				vnc_put16(v, 1);
+			}
+
+			i += len;
+		}
+	}
+}
+
+
+/*
+ *  vnc_send_update():
+ *
+ *  Sends a FramebufferUpdate message with all dirty tiles, if the client has
+ *  asked for one and there is anything to send.
+ */
+static void vnc_send_update(struct fb_window *fbwin)
+{
+	struct fb_vnc *v = fbwin->vnc;
+	int xsize = fbwin->x11_fb_winxsize, ysize = fbwin->x11_fb_winysize;
+	int tx, ty, n_rects = 0;
+	size_t header;
+
+	if (v->descriptor < 0 || v->state != VNC_STATE_NORMAL)
+		return;
+
+	/*
+	 *  A client without the DesktopSize pseudo-encoding still has the
+	 *  framebuffer size from ServerInit, and cannot be told about the new
+	 *  one. Let it reconnect instead of sending it rectangles outside of
+	 *  its framebuffer.
+	 */
+	if (v->size_changed && !v->desktop_size_ok) {
+		debugmsg(SUBSYS_X11, "vnc", VERBOSITY_WARNING,
+		    "framebuffer resized to %ix%i; the client on port %i does "
+		    "not support DesktopSize", xsize, ysize, v->port);
+		vnc_disconnect(v);
+		return;
+	}
+
+	if (!v->update_requested || v->outbuf_len > 0)
+		return;
+
+	if (!v->size_changed && memchr(v->dirty, 1, v->tiles_x * v->tiles_y)
+	    == NULL)
+		return;
+
+	v->update_requested = false;
+
+	header = v->outbuf_len;
+	vnc_put8(v, 0);		/*  FramebufferUpdate  */
+	vnc_put8(v, 0);
+	vnc_put16(v, 0);	/*  number of rectangles, filled in below  */
+
+	if (v->size_changed && v->desktop_size_ok) {
+		vnc_put16(v, 0);
+		vnc_put16(v, 0);
+		vnc_put16(v, xsize);
+		vnc_put16(v, ysize);
+		vnc_put32(v, VNC_ENCODING_DESKTOPSIZE);
+		n_rects ++;
+	}
+	v->size_changed = false;
+
+	for (ty=0; ty<v->tiles_y; ty++) {
+		unsigned char *dirty = v->dirty + ty * v->tiles_x;
+		int y0 = ty << VNC_TILE_SHIFT, h = VNC_TILE_SIZE, y;
+
+		if (memchr(dirty, 1, v->tiles_x) == NULL)
+			continue;
+
+		if (y0 + h > ysize)
+			h = ysize - y0;
+
+		for (y=0; y<h; y++)
+			fb_headless_get_row(fbwin, y0 + y,
+			    v->rgb + (size_t) y * xsize * 3);
+
+		for (tx=0; tx<v->tiles_x; ) {
+			int n = 0, x, w;
+
+			while (tx + n < v->tiles_x && dirty[tx + n])
+				n ++;
+
+			if (n == 0) {
+				tx ++;
+				continue;
+			}
+
+			x = tx << VNC_TILE_SHIFT;
+			w = n << VNC_TILE_SHIFT;
+			if (x + w > xsize)
+				w = xsize - x;
+
+			vnc_send_rect(fbwin, x, y0, w, h, y0);
+			n_rects ++;
+
+			memset(dirty + tx, 0, n);
+			tx += n;
+		}
+	}
+
+	v->outbuf[header + 2] = n_rects >> 8;
+	v->outbuf[header + 3] = n_rects;
+
+	vnc_write_pending(v);
+}
+
+
+static void vnc_key(struct fb_vnc *v, bool down, uint32_t keysym)
+{
+	int handle = v->machine->main_console_handle;
+	const struct vnc_key *k;
+
+	if (keysym == 0xffe3 || keysym == 0xffe4) {	/*  Control_L/R  */
+		v->ctrl = down;
+		return;
+	}
+
+	if (!down)
+		return;
+
+	if (keysym >= 0x20 && keysym <= 0xff) {
+		if (v->ctrl && keysym >= 0x40 && keysym <= 0x7f)
+			keysym &= 0x1f;
+		console_makeavail(handle, keysym);
+		return;
+	}
+
+	for (k = vnc_keys; k->seq != NULL; k++)
+		if (k->keysym == keysym) {
+			const char *s;
+			for (s = k->seq; *s; s++)
+				console_makeavail(handle, *s);
+			return;
+		}
+}
+
+
+static void vnc_pointer(struct fb_window *fbwin, int buttons, int x, int y)
+{
+	struct fb_vnc *v = fbwin->vnc;
+	int i;
+
+	if (v->last_x >= 0 && (x != v->last_x || y != v->last_y))
+		console_mouse_coordinate_update(
+		    (x - v->last_x) * fbwin->scaledown,
+		    (y - v->last_y) * fbwin->scaledown, fbwin->fb_number);
+
+	v->last_x = x;
+	v->last_y = y;
+
+	/*  RFB button bits 0, 1, 2 = left, middle, right:  */
+	for (i=0; i<3; i++)
+		if ((buttons ^ v->last_buttons) & (1 << i))
+			console_mouse_button(i + 1, (buttons >> i) & 1);
+
+	v->last_buttons = buttons;
+}
+
+
+static void vnc_set_pixel_format(struct fb_vnc *v, const unsigned char *pf)
+{
+	int bpp = pf[0];
+
+	if ((bpp != 8 && bpp != 16 && bpp != 32) || !pf[3]) {
+		fatal("[ vnc: unsupported pixel format (%i bits per pixel%s)"
+		    " requested by the client ]\n", bpp,
+		    pf[3]? "" : ", color map");
+		vnc_disconnect(v);
+		return;
+	}
+
+	v->bytes_per_pixel = bpp / 8;
+	v->big_endian = pf[2] != 0;
+	v->red_max = get_be16(pf + 4);
+	v->green_max = get_be16(pf + 6);
+	v->blue_max = get_be16(pf + 8);
+	v->red_shift = pf[10];
+	v->green_shift = pf[11];
+	v->blue_shift = pf[12];
+}
+
+
+/*
+ *  vnc_handle_message():
+ *
+ *  Handles the message (or handshake step) at the start of the input buffer.
+ *  Returns the number of bytes used, or 0 if the message is not complete
+ *  yet.
+ */
+static size_t vnc_handle_message(struct fb_window *fbwin)
+{
+	struct fb_vnc *v = fbwin->vnc;
+	unsigned char *p = v->inbuf;
+	size_t len = v->inbuf_len, n;
+	int i;
+
+	switch (v->state) {
+
+	case VNC_STATE_VERSION:
+		if (len < 12)
+			return 0;
+		if (memcmp(p, "RFB 003.", 8) != 0) {
+			vnc_disconnect(v);
+			return 0;
+		}
+		v->minor_version = atoi((char *) p + 8);
+		if (v->minor_version >= 7) {
+			vnc_put8(v, 1);		/*  one security type:  */
+			vnc_put8(v, 1);		/*  None  */
+			v->state = VNC_STATE_SECURITY;
+		} else {
+			vnc_put32(v, 1);	/*  None  */
+			v->state = VNC_STATE_CLIENTINIT;
+		}
+		return 12;
+
+	case VNC_STATE_SECURITY:
+		if (len < 1)
+			return 0;
+		if (p[0] != 1) {
+			vnc_disconnect(v);
+			return 0;
+		}
+		if (v->minor_version >= 8)
+			vnc_put32(v, 0);	/*  SecurityResult OK  */
+		v->state = VNC_STATE_CLIENTINIT;
+		return 1;
+
+	case VNC_STATE_CLIENTINIT:
+		if (len < 1)
+			return 0;
+
+		/*  ServerInit, with the native pixel format:  */
+		vnc_put16(v, fbwin->x11_fb_winxsize);
+		vnc_put16(v, fbwin->x11_fb_winysize);
+		vnc_put8(v, 32);	/*  bits per pixel  */
+		vnc_put8(v, 24);	/*  depth  */
+		vnc_put8(v, 0);		/*  big endian  */
+		vnc_put8(v, 1);		/*  true color  */
+		vnc_put16(v, 255);
+		vnc_put16(v, 255);
+		vnc_put16(v, 255);
+		vnc_put8(v, 16);
+		vnc_put8(v, 8);
+		vnc_put8(v, 0);
+		vnc_put8(v, 0);
+		vnc_put8(v, 0);
+		vnc_put8(v, 0);
+		vnc_put32(v, strlen(fbwin->name));
+		memcpy(vnc_reserve(v, strlen(fbwin->name)), fbwin->name,
+		    strlen(fbwin->name));
+
+		v->bytes_per_pixel = 4;
+		v->big_endian = false;
+		v->red_max = v->green_max = v->blue_max = 255;
+		v->red_shift = 16; v->green_shift = 8; v->blue_shift = 0;
+		v->rre_ok = v->desktop_size_ok = false;
+		v->update_requested = v->size_changed = false;
+		v->last_x = v->last_y = -1;
+		v->last_buttons = 0;
+		v->ctrl = false;
+		memset(v->dirty, 1, v->tiles_x * v->tiles_y);
+
+		v->state = VNC_STATE_NORMAL;
+		return 1;
+	}
+
+	if (len < 1)
+		return 0;
+
+	switch (p[0]) {
+
+	case 0:	/*  SetPixelFormat  */
+		if (len < 20)
+			return 0;
+		vnc_set_pixel_format(v, p + 4);
+		return 20;
+
+	case 2:	/*  SetEncodings  */
+		if (len < 4)
+			return 0;
+		n = 4 + 4 * get_be16(p + 2);
+		if (n > VNC_INBUF_SIZE) {
+			vnc_disconnect(v);
+			return 0;
+		}
+		if (len < n)
+			return 0;
+		v->rre_ok = v->desktop_size_ok = false;
+		for (i=0; i<get_be16(p + 2); i++) {
+			int32_t enc = get_be32(p + 4 + i*4);
+			if (enc == VNC_ENCODING_RRE)
+				v->rre_ok = true;
+			if (enc == VNC_ENCODING_DESKTOPSIZE)
+				v->desktop_size_ok = true;
+		}
+		return n;
+
+	case 3:	/*  FramebufferUpdateRequest  */
+		if (len < 10)
+			return 0;
+		if (!p[1])
+			vnc_mark_dirty(v, get_be16(p + 2), get_be16(p + 4),
+			    get_be16(p + 6), get_be16(p + 8));
+		v->update_requested = true;
+		return 10;
+
+	case 4:	/*  KeyEvent  */
+		if (len < 8)
+			return 0;
+		vnc_key(v, p[1] != 0, get_be32(p + 4));
+		return 8;
+
+	case 5:	/*  PointerEvent  */
+		if (len < 6)
+			return 0;
+		vnc_pointer(fbwin, p[1], get_be16(p + 2), get_be16(p + 4));
+		return 6;
+
+	case 6:	/*  ClientCutText  */
+		if (len < 8)
+			return 0;
+		v->skip_bytes = get_be32(p + 4);
+		return 8;
+	}
+
+	fatal("[ vnc: unknown message type %i from the client ]\n", p[0]);
+	vnc_disconnect(v);
+	return 0;
+}
+
+
+/*
+ *  fb_vnc_poll():
+ *
+ *  Accepts a new client (if none is connected), handles input from the
+ *  client, and sends an update if one is due.
+ */
+void fb_vnc_poll(struct fb_window *fbwin)
+{
+	struct fb_vnc *v = fbwin->vnc;
+	ssize_t res;
+	size_t used;
+
+	if (v->descriptor < 0) {
+		int d = accept(v->listen_descriptor, NULL, NULL), one = 1;
+		if (d < 0)
+			return;
+
+		res = fcntl(d, F_GETFL);
+		fcntl(d, F_SETFL, res | O_NONBLOCK);
+		setsockopt(d, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		v->descriptor = d;
+		v->state = VNC_STATE_VERSION;
+		v->inbuf_len = 0;
+		v->skip_bytes = 0;
+		v->outbuf_len = v->outbuf_sent = 0;
+
+		debugmsg(SUBSYS_X11, "vnc", VERBOSITY_INFO,
+		    "client connected on port %i", v->port);
+
+		memcpy(vnc_reserve(v, 12), "RFB 003.008\n", 12);
+	}
+
+	vnc_write_pending(v);
+
+	while (v->descriptor >= 0) {
+		res = read(v->descriptor, v->inbuf + v->inbuf_len,
+		    VNC_INBUF_SIZE - v->inbuf_len);
+		if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+		    errno == EINTR))
+			break;
+		if (res <= 0) {
+			vnc_disconnect(v);
+			return;
+		}
+
+		v->inbuf_len += res;
+
+		for (;;) {
+			if (v->skip_bytes > 0) {
+				used = v->skip_bytes < v->inbuf_len?
+				    v->skip_bytes : v->inbuf_len;
+				v->skip_bytes -= used;
+			} else
+				used = vnc_handle_message(fbwin);
+
+			if (used == 0 || v->descriptor < 0)
+				break;
+
+			memmove(v->inbuf, v->inbuf + used,
+			    v->inbuf_len - used);
+			v->inbuf_len -= used;
+		}
+	}
+
+	vnc_write_pending(v);
+	vnc_send_update(fbwin);
+}
+
+
+/*
+ *  fb_vnc_flush():
+ *
+ *  Called once per framebuffer tick, to send updates to the client as soon
+ *  as the window has changed.
+ */
+void fb_vnc_flush(struct fb_window *fbwin)
+{
+	struct fb_vnc *v = fbwin->vnc;
+
+	if (v->descriptor < 0)
+		return;
+
+	vnc_write_pending(v);
+	vnc_send_update(fbwin);
+}
+
+
+/*
+ *  fb_vnc_init():
+ *
+ *  Starts a VNC server for a headless window, listening on 127.0.0.1.
+ */
+void fb_vnc_init(struct fb_window *fbwin, struct machine *m)
+{
+	struct sockaddr_in sin;
+	struct fb_vnc *v;
+	int d, res, one = 1;
+
+	CHECK_ALLOCATION(v = (struct fb_vnc *) malloc(sizeof(struct fb_vnc)));
+	memset(v, 0, sizeof(struct fb_vnc));
+
+	v->machine = m;
+	v->port = m->x11_md.vnc_port + n_vnc_windows ++;
+	v->descriptor = -1;
+
+	d = socket(AF_INET, SOCK_STREAM, 0);
+	if (d < 0) {
+		perror("fb_vnc_init(): socket");
+		exit(1);
+	}
+
+	setsockopt(d, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(v->port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(d, (struct sockaddr *) &sin, sizeof(sin)) < 0 ||
+	    listen(d, 1) < 0) {
+		fprintf(stderr, "fb_vnc_init(): could not listen on "
+		    "127.0.0.1:%i: %s\n", v->port, strerror(errno));
+		exit(1);
+	}
+
+	res = fcntl(d, F_GETFL);
+	fcntl(d, F_SETFL, res | O_NONBLOCK);
+
+	v->listen_descriptor = d;
+	fbwin->vnc = v;
+	fb_vnc_resize(fbwin);
+
+	/*  Clients going away must not kill the emulator:  */
+	signal(SIGPIPE, SIG_IGN);
+
+	debugmsg(SUBSYS_X11, "vnc", VERBOSITY_INFO,
+	    "framebuffer window %i (%s): VNC server listening on "
+	    "127.0.0.1:%i", fbwin->fb_number, fbwin->name, v->port);
+}
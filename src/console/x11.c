@@ -40,21 +40,7 @@
 #include "x11.h"
 
 
-#ifndef	WITH_X11
-
-
-/*  Dummy functions:  */
-void x11_redraw_cursor(struct machine *m, int i) { }
-void x11_redraw(struct machine *m, int x) { }
-void x11_putpixel_fb(struct machine *m, int fb, int x, int y, int color) { }
-void x11_init(struct machine *machine) { }
-struct fb_window *x11_fb_init(int xsize, int ysize, char *name,
-	int scaledown, struct machine *machine)
-    { return NULL; }
-void x11_check_event(struct emul *emul) { }
-
-
-#else	/*  WITH_X11  */
+#ifdef WITH_X11
 
 
 #include <X11/Xlib.h>
@@ -210,11 +196,15 @@ static void ungrab()
 	setMousePointerCoordinates(fbwin, mouseXbeforeGrab, mouseYbeforeGrab);
 }
 
+#endif	/*  WITH_X11  */
+
 
 /*
  *  x11_redraw_cursor():
  *
- *  Redraw a framebuffer's X11 cursor.
+ *  Redraw a framebuffer's X11 cursor. (Headless windows get the cursor drawn
+ *  into their snapshots, so only the old and new cursor areas are marked as
+ *  changed.)
  *
  *  NOTE: It is up to the caller to call XFlush.
  */
@@ -222,15 +212,35 @@ void x11_redraw_cursor(struct machine *m, int i)
 {
 	struct fb_window *fbwin = m->x11_md.fb_windows[i];
 
+	if (fbwin->headless) {
+		if (fbwin->OLD_cursor_on)
+			fb_headless_update(fbwin,
+			    fbwin->OLD_cursor_x/fbwin->scaledown,
+			    fbwin->OLD_cursor_y/fbwin->scaledown,
+			    fbwin->OLD_cursor_xsize/fbwin->scaledown + 1,
+			    fbwin->OLD_cursor_ysize/fbwin->scaledown + 1);
+		if (fbwin->cursor_on)
+			fb_headless_update(fbwin,
+			    fbwin->cursor_x/fbwin->scaledown,
+			    fbwin->cursor_y/fbwin->scaledown,
+			    fbwin->cursor_xsize/fbwin->scaledown + 1,
+			    fbwin->cursor_ysize/fbwin->scaledown + 1);
+
+		fbwin->OLD_cursor_on = fbwin->cursor_on;
+		fbwin->OLD_cursor_x = fbwin->cursor_x;
+		fbwin->OLD_cursor_y = fbwin->cursor_y;
+		fbwin->OLD_cursor_xsize = fbwin->cursor_xsize;
+		fbwin->OLD_cursor_ysize = fbwin->cursor_ysize;
+		return;
+	}
+
+#ifdef WITH_X11
 	if (fbwin->x11_display == NULL)
 		return;
 
 	/*  Remove old cursor, if any:  */
 	if (fbwin->OLD_cursor_on) {
-		XPutImage(fbwin->x11_display, fbwin->x11_fb_window,
-		    fbwin->x11_fb_gc, fbwin->fb_ximage,
-		    fbwin->OLD_cursor_x/fbwin->scaledown,
-		    fbwin->OLD_cursor_y/fbwin->scaledown,
+		x11_fb_put_rect(fbwin,
 		    fbwin->OLD_cursor_x/fbwin->scaledown,
 		    fbwin->OLD_cursor_y/fbwin->scaledown,
 		    fbwin->OLD_cursor_xsize/fbwin->scaledown + 1,
@@ -304,6 +314,7 @@ void x11_redraw_cursor(struct machine *m, int i)
 	fbwin->OLD_cursor_y = fbwin->cursor_y;
 	fbwin->OLD_cursor_xsize = fbwin->cursor_xsize;
 	fbwin->OLD_cursor_ysize = fbwin->cursor_ysize;
+#endif
 }
 
 
@@ -315,12 +326,15 @@ void x11_redraw_cursor(struct machine *m, int i)
 void x11_redraw(struct machine *m, int i)
 {
 	if (i < 0 || i >= m->x11_md.n_fb_windows ||
-	    m->x11_md.fb_windows[i]->x11_fb_winxsize <= 0)
+	    m->x11_md.fb_windows[i]->x11_fb_winxsize <= 0 ||
+	    m->x11_md.fb_windows[i]->headless)
 		return;
 
+#ifdef WITH_X11
 	x11_putimage_fb(m, i);
 	x11_redraw_cursor(m, i);
 	XFlush(m->x11_md.fb_windows[i]->x11_display);
+#endif
 }
 
 
@@ -337,9 +351,10 @@ void x11_putpixel_fb(struct machine *m, int i, int x, int y, int color)
 
 	fbwin = m->x11_md.fb_windows[i];
 
-	if (fbwin->x11_fb_winxsize <= 0)
+	if (fbwin->x11_fb_winxsize <= 0 || fbwin->headless)
 		return;
 
+#ifdef WITH_X11
 	if (color)
 		XSetForeground(fbwin->x11_display,
 		    fbwin->x11_fb_gc, fbwin->fg_color);
@@ -351,9 +366,11 @@ void x11_putpixel_fb(struct machine *m, int i, int x, int y, int color)
 	    fbwin->x11_fb_window, fbwin->x11_fb_gc, x, y);
 
 	XFlush(fbwin->x11_display);
+#endif
 }
 
 
+#ifdef WITH_X11
 /*
  *  x11_putimage_fb():
  *
@@ -371,15 +388,105 @@ void x11_putimage_fb(struct machine *m, int i)
 	if (fbwin->x11_fb_winxsize <= 0)
 		return;
 
-	XPutImage(fbwin->x11_display,
-	    fbwin->x11_fb_window,
-	    fbwin->x11_fb_gc, fbwin->fb_ximage, 0,0, 0,0,
-	    fbwin->x11_fb_winxsize,
+	x11_fb_put_rect(fbwin, 0, 0, fbwin->x11_fb_winxsize,
 	    fbwin->x11_fb_winysize);
 	XFlush(fbwin->x11_display);
 }
 
 
+#endif
+
+
+/*
+ *  x11_fb_put_rect():
+ *
+ *  Output part of a framebuffer window's XImage to the window. (With MIT-SHM,
+ *  the X server reads the pixels directly from the shared XImage.) For a
+ *  headless window, the rectangle is just marked as changed.
+ *
+ *  NOTE: It is up to the caller to call x11_fb_flush.
+ */
+void x11_fb_put_rect(struct fb_window *fbwin, int x, int y, int w, int h)
+{
+	if (x < 0) {
+		w += x;
+		x = 0;
+	}
+	if (y < 0) {
+		h += y;
+		y = 0;
+	}
+	if (x + w > fbwin->x11_fb_winxsize)
+		w = fbwin->x11_fb_winxsize - x;
+	if (y + h > fbwin->x11_fb_winysize)
+		h = fbwin->x11_fb_winysize - y;
+
+	if (w <= 0 || h <= 0)
+		return;
+
+	if (fbwin->headless) {
+		fb_headless_update(fbwin, x, y, w, h);
+		return;
+	}
+
+#ifdef WITH_X11
+#ifdef WITH_XSHM
+	if (fbwin->use_shm) {
+		XShmPutImage(fbwin->x11_display, fbwin->x11_fb_window,
+		    fbwin->x11_fb_gc, fbwin->fb_ximage, x, y, x, y, w, h,
+		    False);
+		fbwin->shm_put_pending = true;
+		return;
+	}
+#endif
+
+	XPutImage(fbwin->x11_display, fbwin->x11_fb_window,
+	    fbwin->x11_fb_gc, fbwin->fb_ximage, x, y, x, y, w, h);
+#endif
+}
+
+
+/*
+ *  x11_fb_flush():
+ *
+ *  Called by framebuffer devices after each round of updates. Flushes X11
+ *  output, or lets a headless window write a snapshot.
+ */
+void x11_fb_flush(struct fb_window *fbwin)
+{
+	if (fbwin->headless) {
+		fb_headless_flush(fbwin);
+		return;
+	}
+
+#ifdef WITH_X11
+	XFlush(fbwin->x11_display);
+#endif
+}
+
+
+/*
+ *  x11_fb_wait():
+ *
+ *  Called by framebuffer devices before converting pixels into the XImage.
+ *  With MIT-SHM, XShmPutImage returns before the X server has read the
+ *  shared segment, so wait for the server to catch up before overwriting
+ *  pixels that are still queued for output.
+ */
+void x11_fb_wait(struct fb_window *fbwin)
+{
+#ifdef WITH_X11
+#ifdef WITH_XSHM
+	if (fbwin->headless || !fbwin->shm_put_pending)
+		return;
+
+	XSync(fbwin->x11_display, False);
+	fbwin->shm_put_pending = false;
+#endif
+#endif
+}
+
+
 /*
  *  x11_init():
  *
@@ -403,6 +510,140 @@ void x11_init(struct machine *m)
 }
 
 
+#ifdef WITH_X11
+
+#ifdef WITH_XSHM
+static bool shm_attach_failed;
+
+static int x11_shm_error_handler(Display *display, XErrorEvent *event)
+{
+	shm_attach_failed = true;
+	return 0;
+}
+
+
+/*
+ *  x11_fb_create_shm_image():
+ *
+ *  Try to create a framebuffer window's XImage in memory which is shared
+ *  with the X server. This fails if the server doesn't support MIT-SHM, or
+ *  if it is running on another host.
+ */
+static bool x11_fb_create_shm_image(struct fb_window *win, int xsize,
+	int ysize)
+{
+	XErrorHandler old_handler;
+	XImage *img;
+
+	if (!XShmQueryExtension(win->x11_display))
+		return false;
+
+	img = XShmCreateImage(win->x11_display,
+	    DefaultVisual(win->x11_display, win->x11_screen),
+	    win->x11_screen_depth, ZPixmap, NULL, &win->shminfo,
+	    xsize, ysize);
+	if (img == NULL)
+		return false;
+
+	win->shminfo.shmid = shmget(IPC_PRIVATE,
+	    (size_t) img->bytes_per_line * ysize, IPC_CREAT | 0600);
+	if (win->shminfo.shmid < 0) {
+		XDestroyImage(img);
+		return false;
+	}
+
+	win->shminfo.shmaddr = img->data =
+	    (char *) shmat(win->shminfo.shmid, NULL, 0);
+	win->shminfo.readOnly = False;
+
+	shm_attach_failed = win->shminfo.shmaddr == (char *) -1;
+	if (!shm_attach_failed) {
+		old_handler = XSetErrorHandler(x11_shm_error_handler);
+		XShmAttach(win->x11_display, &win->shminfo);
+		XSync(win->x11_display, False);
+		XSetErrorHandler(old_handler);
+	}
+
+	/*  The segment goes away when both we and the server detach:  */
+	shmctl(win->shminfo.shmid, IPC_RMID, NULL);
+
+	if (shm_attach_failed) {
+		if (win->shminfo.shmaddr != (char *) -1)
+			shmdt(win->shminfo.shmaddr);
+		XDestroyImage(img);
+		return false;
+	}
+
+	win->fb_ximage = img;
+	win->use_shm = true;
+	return true;
+}
+#endif
+
+
+/*
+ *  x11_fb_create_image():
+ *
+ *  Create a (black) XImage for a framebuffer window.
+ */
+static void x11_fb_create_image(struct fb_window *win, int xsize, int ysize)
+{
+	int alloc_depth = win->x11_screen_depth;
+	unsigned char *data;
+
+#ifdef WITH_XSHM
+	if (x11_fb_create_shm_image(win, xsize, ysize))
+		debugmsg(SUBSYS_X11, "fb_init", VERBOSITY_DEBUG,
+		    "using a MIT-SHM shared memory XImage");
+	else
+#endif
+	{
+		if (alloc_depth == 24)
+			alloc_depth = 32;
+		if (alloc_depth == 15)
+			alloc_depth = 16;
+
+		/*  Note: The data is freed by XDestroyImage.  */
+		CHECK_ALLOCATION(data = (unsigned char *) malloc(
+		    xsize * ysize * alloc_depth / 8));
+
+		win->fb_ximage = XCreateImage(win->x11_display,
+		    CopyFromParent, win->x11_screen_depth, ZPixmap, 0,
+		    (char *) data, xsize, ysize, 8, xsize * alloc_depth / 8);
+		CHECK_ALLOCATION(win->fb_ximage);
+	}
+
+	win->ximage_data = (unsigned char *) win->fb_ximage->data;
+	win->ximage_bytes_per_line = win->fb_ximage->bytes_per_line;
+
+	/*  TODO: clear for non-truecolor modes  */
+	memset(win->ximage_data, 0, (size_t) win->ximage_bytes_per_line * ysize);
+}
+
+
+static void x11_fb_destroy_image(struct fb_window *win)
+{
+	if (win->fb_ximage == NULL)
+		return;
+
+#ifdef WITH_XSHM
+	if (win->use_shm) {
+		XShmDetach(win->x11_display, &win->shminfo);
+		XSync(win->x11_display, False);
+		shmdt(win->shminfo.shmaddr);
+		win->use_shm = false;
+		win->shm_put_pending = false;
+	}
+#endif
+
+	XDestroyImage(win->fb_ximage);
+	win->fb_ximage = NULL;
+	win->ximage_data = NULL;
+}
+
+#endif	/*  WITH_X11  */
+
+
 /*
  *  x11_fb_resize():
  *
@@ -412,40 +653,26 @@ void x11_init(struct machine *m)
  */
 void x11_fb_resize(struct fb_window *win, int new_xsize, int new_ysize)
 {
-	int alloc_depth;
-
 	if (win == NULL) {
 		debugmsg(SUBSYS_X11, "resize", VERBOSITY_ERROR, "win == NULL");
 		return;
 	}
 
+	if (win->headless) {
+		fb_headless_resize(win, new_xsize, new_ysize);
+		return;
+	}
+
+#ifdef WITH_X11
 	win->x11_fb_winxsize = new_xsize;
 	win->x11_fb_winysize = new_ysize;
 
-	alloc_depth = win->x11_screen_depth;
-	if (alloc_depth == 24)
-		alloc_depth = 32;
-	if (alloc_depth == 15)
-		alloc_depth = 16;
-
-	/*  Note: ximage_data seems to be freed by XDestroyImage below.  */
-	/*  if (win->ximage_data != NULL)
-		free(win->ximage_data);  */
-	CHECK_ALLOCATION(win->ximage_data = (unsigned char *) malloc(
-	    new_xsize * new_ysize * alloc_depth / 8));
-
-	/*  TODO: clear for non-truecolor modes  */
-	memset(win->ximage_data, 0, new_xsize * new_ysize * alloc_depth / 8);
-
-	if (win->fb_ximage != NULL)
-		XDestroyImage(win->fb_ximage);
-	win->fb_ximage = XCreateImage(win->x11_display, CopyFromParent,
-	    win->x11_screen_depth, ZPixmap, 0, (char *)win->ximage_data,
-	    new_xsize, new_ysize, 8, new_xsize * alloc_depth / 8);
-	CHECK_ALLOCATION(win->fb_ximage);
+	x11_fb_destroy_image(win);
+	x11_fb_create_image(win, new_xsize, new_ysize);
 
 	XResizeWindow(win->x11_display, win->x11_fb_window,
 	    new_xsize, new_ysize);
+#endif
 }
 
 
@@ -456,8 +683,13 @@ void x11_fb_resize(struct fb_window *win, int new_xsize, int new_ysize)
  */
 void x11_set_standard_properties(struct fb_window *fb_window)
 {
+#ifdef WITH_X11
 	size_t title_maxlen = strlen(fb_window->name) + 100;
 	char *title;
+
+	if (fb_window->headless)
+		return;
+
 	CHECK_ALLOCATION(title = malloc(title_maxlen));
 
 	snprintf(title, title_maxlen, "%s%s", fb_window->name,
@@ -468,41 +700,25 @@ void x11_set_standard_properties(struct fb_window *fb_window)
 	    None, NULL, 0, NULL);
 
 	free(title);
+#endif
 }
 
 
+#ifdef WITH_X11
 /*
- *  x11_fb_init():
+ *  x11_fb_open_window():
  *
- *  Initialize a framebuffer window.
+ *  Open an X11 window (and create its XImage) for a framebuffer window.
  */
-struct fb_window *x11_fb_init(int xsize, int ysize, char *name,
-	int scaledown, struct machine *m)
+static void x11_fb_open_window(struct fb_window *fbwin, struct machine *m)
 {
 	Display *x11_display;
-	int x, y, fb_number = 0;
-	size_t alloclen, alloc_depth;
+	int xsize = fbwin->x11_fb_winxsize, ysize = fbwin->x11_fb_winysize;
+	int x, y, i;
 	XColor tmpcolor;
-	struct fb_window *fbwin;
-	int i;
 	char fg[80], bg[80];
 	char *display_name;
 
-	fb_number = m->x11_md.n_fb_windows;
-
-	CHECK_ALLOCATION(m->x11_md.fb_windows = 
-	    (struct fb_window **) realloc(m->x11_md.fb_windows,
-	    sizeof(struct fb_window *) * (m->x11_md.n_fb_windows + 1)));
-	CHECK_ALLOCATION(fbwin = m->x11_md.fb_windows[fb_number] =
-	    (struct fb_window *) malloc(sizeof(struct fb_window)));
-
-	m->x11_md.n_fb_windows ++;
-
-	memset(fbwin, 0, sizeof(struct fb_window));
-
-	fbwin->x11_fb_winxsize = xsize;
-	fbwin->x11_fb_winysize = ysize;
-
 	/*  Which display name?  */
 	display_name = NULL;
 	if (m->x11_md.n_display_names > 0) {
@@ -515,13 +731,13 @@ struct fb_window *x11_fb_init(int xsize, int ysize, char *name,
 	if (display_name != NULL)
 		debugmsg(SUBSYS_X11, "fb_init", VERBOSITY_INFO,
 		    "framebuffer window %i, %ix%i, DISPLAY"
-		    "=%s", fb_number, xsize, ysize, display_name);
+		    "=%s", fbwin->fb_number, xsize, ysize, display_name);
 
 	x11_display = XOpenDisplay(display_name);
 
 	if (x11_display == NULL) {
 		debugmsg(SUBSYS_X11, "fb_init", VERBOSITY_ERROR,
-		    "couldn't open display '%s'", name);
+		    "couldn't open display '%s'", fbwin->name);
 		if (display_name != NULL)
 			debugmsg(SUBSYS_X11, "fb_init", VERBOSITY_ERROR, "display_name = '%s'", display_name);
 
@@ -583,13 +799,6 @@ struct fb_window *x11_fb_init(int xsize, int ysize, char *name,
 
         XFlush(x11_display);
 
-	alloc_depth = fbwin->x11_screen_depth;
-
-	if (alloc_depth == 24)
-		alloc_depth = 32;
-	if (alloc_depth == 15)
-		alloc_depth = 16;
-
 	fbwin->x11_fb_window = XCreateWindow(
 	    x11_display, DefaultRootWindow(x11_display),
 	    0, 0, fbwin->x11_fb_winxsize,
@@ -598,8 +807,6 @@ struct fb_window *x11_fb_init(int xsize, int ysize, char *name,
 
 	fbwin->x11_display = x11_display;
 
-	fbwin->name = strdup(name);
-
 	x11_set_standard_properties(fbwin);
 
 	XSelectInput(x11_display,
@@ -617,22 +824,10 @@ struct fb_window *x11_fb_init(int xsize, int ysize, char *name,
 	XFillRectangle(x11_display, fbwin->x11_fb_window, fbwin->x11_fb_gc, 0,0,
 	    fbwin->x11_fb_winxsize, fbwin->x11_fb_winysize);
 
-	fbwin->scaledown   = scaledown;
-
-	fbwin->fb_number = fb_number;
-
-	alloclen = xsize * ysize * alloc_depth / 8;
-	CHECK_ALLOCATION(fbwin->ximage_data = (unsigned char *) malloc(alloclen));
-
-	fbwin->fb_ximage = XCreateImage(fbwin->x11_display, CopyFromParent,
-	    fbwin->x11_screen_depth, ZPixmap, 0, (char *)fbwin->ximage_data,
-	    xsize, ysize, 8, xsize * alloc_depth / 8);
-	CHECK_ALLOCATION(fbwin->fb_ximage);
+	x11_fb_create_image(fbwin, xsize, ysize);
 
 	/*  Fill the ximage with black pixels:  */
-	if (fbwin->x11_screen_depth > 8)
-		memset(fbwin->ximage_data, 0, alloclen);
-	else {
+	if (fbwin->x11_screen_depth <= 8) {
 		debugmsg(SUBSYS_X11, "fb_init", VERBOSITY_DEBUG,
 		    "clearing the XImage\n");
 		for (y=0; y<ysize; y++)
@@ -641,20 +836,60 @@ struct fb_window *x11_fb_init(int xsize, int ysize, char *name,
 				    fbwin->x11_graycolor[0].pixel);
 	}
 
-	x11_putimage_fb(m, fb_number);
+	x11_putimage_fb(m, fbwin->fb_number);
+}
+#endif
 
-	/*  Fill the 64x64 "hardware" cursor with white pixels:  */
-	xsize = ysize = 64;
 
-	/*  Fill the cursor ximage with white pixels:  */
-	for (y=0; y<ysize; y++)
-		for (x=0; x<xsize; x++)
+/*
+ *  x11_fb_init():
+ *
+ *  Initialize a framebuffer window. Without X11 (or with -g), the window is
+ *  headless.
+ */
+struct fb_window *x11_fb_init(int xsize, int ysize, char *name,
+	int scaledown, struct machine *m)
+{
+	struct fb_window *fbwin;
+	int x, y, fb_number;
+
+	fb_number = m->x11_md.n_fb_windows;
+
+	CHECK_ALLOCATION(m->x11_md.fb_windows = 
+	    (struct fb_window **) realloc(m->x11_md.fb_windows,
+	    sizeof(struct fb_window *) * (m->x11_md.n_fb_windows + 1)));
+	CHECK_ALLOCATION(fbwin = m->x11_md.fb_windows[fb_number] =
+	    (struct fb_window *) malloc(sizeof(struct fb_window)));
+
+	m->x11_md.n_fb_windows ++;
+
+	memset(fbwin, 0, sizeof(struct fb_window));
+
+	fbwin->x11_fb_winxsize = xsize;
+	fbwin->x11_fb_winysize = ysize;
+	fbwin->scaledown = scaledown;
+	fbwin->fb_number = fb_number;
+
+	CHECK_ALLOCATION(fbwin->name = strdup(name));
+
+#ifdef WITH_X11
+	if (!m->x11_md.headless)
+		x11_fb_open_window(fbwin, m);
+	else
+#endif
+		fb_headless_init(fbwin, m);
+
+	/*  Fill the 64x64 "hardware" cursor with white pixels:  */
+	for (y=0; y<CURSOR_MAXY; y++)
+		for (x=0; x<CURSOR_MAXX; x++)
 			fbwin->cursor_pixels[y][x] = N_GRAYCOLORS-1;
 
 	return fbwin;
 }
 
 
+#ifdef WITH_X11
+
 /*
  *  x11_check_events_machine():
  *
@@ -673,6 +908,9 @@ static void x11_check_events_machine(struct emul *emul, struct machine *m)
 		XEvent event;
 		bool need_redraw = false;
 
+		if (fbwin->headless)
+			continue;
+
 		while (XPending(fbwin->x11_display)) {
 			XNextEvent(fbwin->x11_display, &event);
 
@@ -979,17 +1217,27 @@ static void x11_check_events_machine(struct emul *emul, struct machine *m)
 }
 
 
+#endif	/*  WITH_X11  */
+
+
 /*
  *  x11_check_event():
  *
- *  Check for X11 events.
+ *  Check for X11 events, and for input from VNC clients.
  */
 void x11_check_event(struct emul *emul)
 {
-	int i;
+	int i, fb_nr;
 
-	for (i=0; i<emul->n_machines; i++)
-		x11_check_events_machine(emul, emul->machines[i]);
-}
+	for (i=0; i<emul->n_machines; i++) {
+		struct machine *m = emul->machines[i];
 
-#endif	/*  WITH_X11  */
+		for (fb_nr=0; fb_nr<m->x11_md.n_fb_windows; fb_nr++)
+			if (m->x11_md.fb_windows[fb_nr]->vnc != NULL)
+				fb_vnc_poll(m->x11_md.fb_windows[fb_nr]);
+
+#ifdef WITH_X11
+		x11_check_events_machine(emul, m);
+#endif
+	}
+}
@@ -36,10 +36,15 @@
 #include "debugger.h"
 #include "breakpoints.h"
 #include "machine.h"
+#include "memory.h"
 #include "misc.h"
 #include "symbol.h"
 
 
+extern bool about_to_enter_single_step;
+extern bool single_step_breakpoint;
+
+
 static bool breakpoint_init(struct address_breakpoint *bp, const char *string, uint64_t addr)
 {
 	memset(bp, 0, sizeof(struct address_breakpoint));
@@ -60,6 +65,27 @@ static bool breakpoint_init(struct address_breakpoint *bp, const char *string, u
 }
 
 
+/*
+ *  breakpoints_rehash():
+ *
+ *  Rebuilds the breakpoint address hash table. Must be called whenever
+ *  breakpoints are added, removed, or change address.
+ */
+static void breakpoints_rehash(struct machine *m)
+{
+	memset(m->breakpoints.addr_bp_hash, 0,
+	    sizeof(m->breakpoints.addr_bp_hash));
+
+	for (size_t i = 0; i < m->breakpoints.n_addr_bp; i++) {
+		struct address_breakpoint *bp = &m->breakpoints.addr_bp[i];
+		size_t h = BREAKPOINTS_HASH(bp->addr);
+
+		bp->next_in_hash = m->breakpoints.addr_bp_hash[h];
+		m->breakpoints.addr_bp_hash[h] = i + 1;
+	}
+}
+
+
 /*
  *  breakpoints_show():
  */
@@ -153,6 +179,8 @@ void breakpoints_parse_all(struct machine *m)
 		    "%zi: 0x%" PRIx64 " (%s)", i, dp,
 		    string_flag ? m->breakpoints.addr_bp[i].string : "unknown");
 	}
+
+	breakpoints_rehash(m);
 }
 
 
@@ -178,6 +206,7 @@ bool breakpoints_add_without_lookup(struct machine *machine, const char *str)
 	}
 
 	machine->breakpoints.n_addr_bp = n;
+	breakpoints_rehash(machine);
 
 	return true;
 }
@@ -197,6 +226,11 @@ bool breakpoints_add(struct machine *m, const char *string)
 		return false;
 	}
 
+	if (m->cpus[0]->cpu_family->arch == ARCH_MIPS) {
+		if ((tmp >> 32) == 0 && ((tmp >> 31) & 1))
+			tmp |= 0xffffffff00000000ULL;
+	}
+
 	CHECK_ALLOCATION(m->breakpoints.addr_bp = (struct address_breakpoint *) realloc(
 	    m->breakpoints.addr_bp, sizeof(struct address_breakpoint) *
 	   (m->breakpoints.n_addr_bp + 1)));
@@ -209,6 +243,7 @@ bool breakpoints_add(struct machine *m, const char *string)
 	}
 
 	m->breakpoints.n_addr_bp ++;
+	breakpoints_rehash(m);
 
 	/*  Clear translations:  */
 	for (int j = 0; j < m->ncpus; j++)
@@ -236,6 +271,7 @@ void breakpoints_delete(struct machine *m, size_t i)
 		m->breakpoints.addr_bp[j] = m->breakpoints.addr_bp[j+1];
 
 	m->breakpoints.n_addr_bp --;
+	breakpoints_rehash(m);
 
 	/*  Clear translations:  */
 	for (int j = 0; j < m->ncpus; j++)
@@ -244,4 +280,238 @@ void breakpoints_delete(struct machine *m, size_t i)
 }
 
 
+/*
+ *  breakpoints_delete_temporary():
+ *
+ *  Deletes all temporary breakpoints, i.e. those added by the debugger's
+ *  "goto" command.
+ */
+void breakpoints_delete_temporary(struct machine *m)
+{
+	size_t i = m->breakpoints.n_addr_bp;
+
+	while (i-- > 0)
+		if (m->breakpoints.addr_bp[i].temporary)
+			breakpoints_delete(m, i);
+}
+
+
+/*
+ *  watchpoints_invalidate_all():
+ *
+ *  Throws away all virtual to host page mappings, so that pages which are
+ *  (or are no longer) watched get re-mapped according to the current set
+ *  of watchpoints.
+ */
+static void watchpoints_invalidate_all(struct machine *m)
+{
+	for (int j = 0; j < m->ncpus; j++)
+		if (m->cpus[j]->invalidate_translation_caches != NULL)
+			m->cpus[j]->invalidate_translation_caches(m->cpus[j],
+			    0, INVALIDATE_ALL);
+}
+
+
+/*
+ *  watchpoints_show():
+ */
+void watchpoints_show(struct machine *m, size_t i)
+{
+	struct data_watchpoint *wp = &m->breakpoints.watchpoints[i];
+
+	printf("  wp %zi: 0x", i);
+	if (m->cpus[0]->is_32bit)
+		printf("%08" PRIx32, (uint32_t) wp->addr);
+	else
+		printf("%016" PRIx64, (uint64_t) wp->addr);
+
+	printf(" len %" PRIi64, (int64_t) wp->len);
+
+	if (wp->string != NULL)
+		printf(" (%s%s%s)", color_symbol_ptr(), wp->string, color_normal_ptr());
+
+	printf("\t%s%s", wp->flags & WATCHPOINT_READ ? "r" : "",
+	    wp->flags & WATCHPOINT_WRITE ? "w" : "");
+
+	if (wp->total_hit_count > 0)
+		printf("\thits: %lli", (long long)wp->total_hit_count);
+
+	printf("\n");
+}
+
+
+/*
+ *  watchpoints_show_all():
+ */
+void watchpoints_show_all(struct machine *m)
+{
+	for (size_t i = 0; i < m->breakpoints.n_watchpoints; i++)
+		watchpoints_show(m, i);
+}
+
+
+/*
+ *  watchpoints_add():
+ *
+ *  Adds a data watchpoint covering len bytes starting at the address given
+ *  by string. flags is WATCHPOINT_READ, WATCHPOINT_WRITE, or both.
+ */
+bool watchpoints_add(struct machine *m, const char *string, uint64_t len,
+	int flags)
+{
+	uint64_t tmp;
+	int res = debugger_parse_expression(m, string, 0, &tmp);
+	if (!res) {
+		printf("Couldn't parse '%s'\n", string);
+		return false;
+	}
+
+	if (len == 0 || (flags & (WATCHPOINT_READ | WATCHPOINT_WRITE)) == 0) {
+		printf("Invalid watchpoint length or access type.\n");
+		return false;
+	}
+
+	if (m->cpus[0]->cpu_family->arch == ARCH_MIPS) {
+		if ((tmp >> 32) == 0 && ((tmp >> 31) & 1))
+			tmp |= 0xffffffff00000000ULL;
+	}
+
+	CHECK_ALLOCATION(m->breakpoints.watchpoints = (struct data_watchpoint *)
+	    realloc(m->breakpoints.watchpoints, sizeof(struct data_watchpoint) *
+	    (m->breakpoints.n_watchpoints + 1)));
+
+	struct data_watchpoint *wp =
+	    &m->breakpoints.watchpoints[m->breakpoints.n_watchpoints];
+
+	memset(wp, 0, sizeof(struct data_watchpoint));
+	CHECK_ALLOCATION(wp->string = strdup(string));
+	wp->addr = tmp;
+	wp->len = len;
+	wp->flags = flags;
+
+	m->breakpoints.n_watchpoints ++;
+
+	watchpoints_invalidate_all(m);
+
+	return true;
+}
+
+
+/*
+ *  watchpoints_delete():
+ */
+void watchpoints_delete(struct machine *m, size_t i)
+{
+	if (i >= m->breakpoints.n_watchpoints) {
+		printf("Invalid watchpoint nr %i. Use 'watchpoint "
+		    "show' to see the current watchpoints.\n", (int)i);
+		return;
+	}
+
+	free(m->breakpoints.watchpoints[i].string);
+
+	for (size_t j = i; j < m->breakpoints.n_watchpoints - 1; j++)
+		m->breakpoints.watchpoints[j] = m->breakpoints.watchpoints[j+1];
+
+	m->breakpoints.n_watchpoints --;
+
+	watchpoints_invalidate_all(m);
+}
+
+
+/*
+ *  watchpoints_overlap():
+ *
+ *  Returns true if [addr, addr+len) overlaps the watched range of wp. For
+ *  32-bit emulation, only the low 32 bits of the addresses are compared.
+ */
+static bool watchpoints_overlap(struct data_watchpoint *wp, uint64_t addr,
+	uint64_t len, bool is_32bit)
+{
+	uint64_t wa = wp->addr;
+
+	if (is_32bit) {
+		wa = (uint32_t) wa;
+		addr = (uint32_t) addr;
+	}
+
+	return addr < wa + wp->len && wa < addr + len;
+}
+
+
+/*
+ *  watchpoints_page_flags():
+ *
+ *  Returns the union of the WATCHPOINT_* flags of all watchpoints which
+ *  overlap the given virtual page. Called when mapping a page into the
+ *  dyntrans host_load/host_store arrays; watched pages are left unmapped
+ *  so that accesses to them take the slow memory_rw() path.
+ */
+int watchpoints_page_flags(struct machine *m, uint64_t vaddr_page,
+	uint64_t pagesize, bool is_32bit)
+{
+	int flags = 0;
+
+	for (size_t i = 0; i < m->breakpoints.n_watchpoints; i++)
+		if (watchpoints_overlap(&m->breakpoints.watchpoints[i],
+		    vaddr_page, pagesize, is_32bit))
+			flags |= m->breakpoints.watchpoints[i].flags;
+
+	return flags;
+}
+
+
+/*
+ *  watchpoints_check():
+ *
+ *  Called from memory_rw() for data accesses, when watchpoints exist. If
+ *  the access hits a watchpoint, a message is printed and the emulator
+ *  breaks into the debugger.
+ *
+ *  The instruction which hit the watchpoint is abandoned after the access
+ *  (see BREAK_DYNTRANS_CHECK), and is executed again on continue. As for
+ *  execution breakpoints, single_step_breakpoint is set so that the
+ *  repeated access does not hit the watchpoint again. It is cleared once
+ *  that one instruction has executed, so the following instructions are
+ *  checked as usual.
+ */
+void watchpoints_check(struct cpu *cpu, uint64_t vaddr, size_t len,
+	int writeflag)
+{
+	struct machine *m = cpu->machine;
+	int type = writeflag == MEM_WRITE ? WATCHPOINT_WRITE : WATCHPOINT_READ;
+
+	if (single_step_breakpoint)
+		return;
 
+	for (size_t i = 0; i < m->breakpoints.n_watchpoints; i++) {
+		struct data_watchpoint *wp = &m->breakpoints.watchpoints[i];
+
+		if (!(wp->flags & type) ||
+		    !watchpoints_overlap(wp, vaddr, len, cpu->is_32bit))
+			continue;
+
+		wp->total_hit_count ++;
+
+		color_normal();
+		printf("WATCHPOINT: %s%s%s (%lli hit%s): %s of %i byte%s at 0x",
+		    color_symbol_ptr(), wp->string, color_normal_ptr(),
+		    (long long) wp->total_hit_count,
+		    wp->total_hit_count == 1 ? "" : "s",
+		    type == WATCHPOINT_WRITE ? "write" : "read",
+		    (int) len, len == 1 ? "" : "s");
+		if (cpu->is_32bit)
+			printf("%08" PRIx32", pc = 0x%08" PRIx32 "\n",
+			    (uint32_t) vaddr, (uint32_t) cpu->pc);
+		else
+			printf("%016" PRIx64", pc = 0x%016" PRIx64 "\n",
+			    (uint64_t) vaddr, (uint64_t) cpu->pc);
+
+		/*  Stop any "step n", and enter the debugger:  */
+		debugger_reset();
+		single_step_breakpoint = true;
+		about_to_enter_single_step = true;
+		cpu_break_out_of_dyntrans_loop(cpu);
+		return;
+	}
+}
@@ -43,6 +43,7 @@
 #include "console.h"
 #include "debugger.h"
 #include "device.h"
+#include "devices.h"
 #include "diskimage.h"
 #include "machine.h"
 #include "memory.h"
@@ -628,6 +629,9 @@ bool emul_machine_setup(struct machine *m, int n_load, char **load_names,
 	/*  Parse and add breakpoints:  */
 	breakpoints_parse_all(m);
 
+	/*  Look up accelerated guest routines:  */
+	guest_routines_parse_all(m);
+
 	symbol_recalc_sizes(&m->symbol_context);
 
 	/*  Special hack for ARC/SGI emulation:  */
@@ -973,6 +977,10 @@ void emul_run(struct emul *emul)
 	/*  Stop any running timers:  */
 	timer_stop();
 
+	/*  Let the final framebuffer snapshots (-g) include the last writes:  */
+	for (int j = 0; j < emul->n_machines; j++)
+		dev_fb_update_windows(emul->machines[j], NULL);
+
 	for (int j = 0; j <emul->n_machines; j++) {
 		if (emul_show_nr_of_instructions)
 			cpu_show_cycles(emul->machines[j], tv_diff_ms);
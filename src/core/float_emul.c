@@ -26,18 +26,37 @@
  *
  *
  *  Floating point emulation routines.
+ *
+ *  Guest floating point registers hold IEEE 754 single and double precision
+ *  values, which are converted to and from host doubles by reinterpreting
+ *  their bits. (This assumes that the host's float and double types are
+ *  IEEE 754 single and double precision, which is the case on all hosts
+ *  that GXemul runs on.) NaNs are always returned as the host's quiet NaN;
+ *  signalling NaNs are treated as quiet NaNs.
+ *
+ *  Strict mode (the -F command line option) additionally models the guest's
+ *  rounding mode and exception flags: the CPU code wraps each guest floating
+ *  point instruction in ieee_strict_begin() and ieee_strict_end(), which run
+ *  the host's own IEEE arithmetic in the guest's rounding mode and collect
+ *  the exception flags it raised. Single precision operations are carried
+ *  out in double precision and then rounded to single precision, which for
+ *  add, sub, mul, div and sqrt gives the correctly rounded result, since a
+ *  double has more than twice the precision of a single. Strict mode is
+ *  slower, because the host's floating point environment is changed for
+ *  every guest floating point instruction.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fenv.h>
 #include <math.h>
 
 #include "float_emul.h"
 #include "misc.h"
 
 
-/*  #define IEEE_DEBUG  */
+bool ieee_strict = false;
 
 
 /*
@@ -49,150 +68,42 @@
 void ieee_interpret_float_value(uint64_t x, struct ieee_float_value *fvp,
 	int fmt)
 {
-	memset(fvp, 0, sizeof(struct ieee_float_value));
-
-	int n_frac = 0, n_exp = 0;
-	int i, nan, sign = 0, exponent;
-	double fraction;
-
-	/*  n_frac and n_exp:  */
-	switch (fmt) {
-	case IEEE_FMT_S:	n_frac = 23; n_exp = 8; break;
-	case IEEE_FMT_W:	n_frac = 31; n_exp = 0; break;
-	case IEEE_FMT_D:	n_frac = 52; n_exp = 11; break;
-	case IEEE_FMT_L:	n_frac = 63; n_exp = 0; break;
-	default:fatal("ieee_interpret_float_value(): "
-		    "unimplemented format %i\n", fmt);
-	}
-
-	/*  Get the Exponent:  */
-	exponent = 0;
-	switch (fmt) {
-	case IEEE_FMT_W:
-		x &= 0xffffffffULL;
-	case IEEE_FMT_L:
-		break;
-	case IEEE_FMT_S:
-		x &= 0xffffffffULL;
-		// fall through
-	case IEEE_FMT_D:
-		exponent = (x >> n_frac) & ((1 << n_exp) - 1);
-		exponent -= (1 << (n_exp-1)) - 1;
-		break;
-	default:fatal("ieee_interpret_float_value(): unimplemented "
-		    "format %i\n", fmt);
-	}
+	uint32_t x32;
+	float f;
 
-	/*  Is this a Not-A-Number?  */
-	nan = 0;
 	switch (fmt) {
 	case IEEE_FMT_S:
-		sign = (x >> 31) & 1;
-		if ((x & ~0x80000000ULL) == 0x7f800000ULL) {
-			fvp->f = INFINITY;
-			goto zero_or_no_reasonable_result;
+		x32 = x;
+		fvp->nan = (x32 & 0x7f800000) == 0x7f800000 &&
+		    (x32 & 0x007fffff) != 0;
+		if (fvp->nan)
+			fvp->f = NAN;
+		else {
+			memcpy(&f, &x32, sizeof(f));
+			fvp->f = f;
 		}
-		if ((x & 0x7f800000ULL) == 0x7f800000ULL)
-			nan = 1;
 		break;
 	case IEEE_FMT_D:
-		sign = (x >> 63) & 1;
-		if ((x & ~0x8000000000000000ULL) == 0x7ff0000000000000ULL) {
-			fvp->f = INFINITY;
-			goto zero_or_no_reasonable_result;
-		}
-		if ((x & 0x7ff0000000000000ULL) == 0x7ff0000000000000ULL)
-			nan = 1;
+		fvp->nan = (x & 0x7ff0000000000000ULL) == 0x7ff0000000000000ULL
+		    && (x & 0x000fffffffffffffULL) != 0;
+		if (fvp->nan)
+			fvp->f = NAN;
+		else
+			memcpy(&fvp->f, &x, sizeof(fvp->f));
 		break;
-	}
-
-	if (nan) {
-		fvp->f = NAN;
-		goto no_reasonable_result;
-	}
-
-	/*  Calculate the fraction:  */
-	fraction = 0.0;
-
-	switch (fmt) {
-
 	case IEEE_FMT_W:
-		{
-			int32_t r_int = x;
-			fraction = r_int;
-		}
+		fvp->f = (int32_t) x;
+		fvp->nan = 0;
 		break;
-
 	case IEEE_FMT_L:
-		{
-			int64_t r_int = x;
-			fraction = r_int;
-		}
-		break;
-
-	case IEEE_FMT_S:
-	case IEEE_FMT_D:
-		if (x == 0 ||
-		    (fmt == IEEE_FMT_D && x == 0x8000000000000000ULL) ||
-		    (fmt == IEEE_FMT_S && x == 0x80000000ULL)) {
-			fvp->f = 0.0;
-			goto zero_or_no_reasonable_result;
-		}
-
-		fraction = 0.0;
-		for (i=0; i<n_frac; i++) {
-			int bit = (x >> i) & 1;
-			fraction /= 2.0;
-			if (bit)
-				fraction += 1.0;
-		}
-
-		/*  Add implicit bit 0:  */
-		fraction = (fraction / 2.0) + 1.0;
+		fvp->f = (int64_t) x;
+		fvp->nan = 0;
 		break;
-
 	default:fatal("ieee_interpret_float_value(): "
 		    "unimplemented format %i\n", fmt);
+		fvp->f = 0.0;
+		fvp->nan = 0;
 	}
-
-	/*  form the value:  */
-	fvp->f = fraction;
-
-#ifdef IEEE_DEBUG
-	fatal("{ ieee: x=%016"PRIx64" => sign=%i exponent=%i frac=%f ",
-	    (uint64_t) x, sign, exponent, fraction);
-#endif
-
-	/*  TODO: this is awful for exponents of large magnitude.  */
-	if (exponent > 0) {
-		/*
-		 *  NOTE / TODO:
-		 *
-		 *  This is an ulgy workaround on Alpha, where it seems that
-		 *  multiplying by 2, 1024 times causes a floating point
-		 *  exception. (Triggered by running for example NetBSD/pmax
-		 *  2.0 emulated on an Alpha host.)
-		 */
-		if (exponent == 1024)
-			fvp->f = INFINITY;
-		else
-			while (exponent-- > 0)
-				fvp->f *= 2.0;
-	} else if (exponent < 0) {
-		while (exponent++ < 0)
-			fvp->f /= 2.0;
-	}
-
-zero_or_no_reasonable_result:
-	if (sign)
-		fvp->f = -fvp->f;
-
-no_reasonable_result:
-	fvp->nan = nan;
-
-#ifdef IEEE_DEBUG
-	fatal("nan=%i (f=%f) }\n", nan, fvp->f);
-#endif
 }
 
 
@@ -203,105 +114,43 @@ no_reasonable_result:
  */
 uint64_t ieee_store_float_value(double nf, int fmt)
 {
-	int n_frac = 0, n_exp = 0, signofs = 0, i, exponent;
-	uint64_t r = 0, r2;
-	int64_t r3;
-
-	/*  n_frac and n_exp:  */
-	switch (fmt) {
-	case IEEE_FMT_S:	n_frac = 23; n_exp = 8; signofs = 31; break;
-	case IEEE_FMT_W:	n_frac = 31; n_exp = 0; signofs = 31; break;
-	case IEEE_FMT_D:	n_frac = 52; n_exp = 11; signofs = 63; break;
-	case IEEE_FMT_L:	n_frac = 63; n_exp = 0; signofs = 63; break;
-	default:fatal("ieee_store_float_value(): unimplemented format"
-		    " %i\n", fmt);
-	}
+	uint64_t r = 0;
+	uint32_t r32;
+	float f;
 
 	switch (fmt) {
 	case IEEE_FMT_W:
+		/*  Out of range values are invalid, also in the 64-bit
+		    conversion below:  */
+		if (ieee_strict && !(nf > -2147483649.0 && nf < 2147483648.0)) {
+			ieee_strict_raise(IEEE_EXC_INVALID);
+			return 0x7fffffffULL;
+		}
+		// fall through
 	case IEEE_FMT_L:
 		/*
 		 *  This causes an implicit conversion of double to integer.
-		 *  If nf < 0.0, then r2 will begin with a sequence of binary
+		 *  If nf < 0.0, then r will begin with a sequence of binary
 		 *  1's, which is ok.
 		 */
-		r3 = (int64_t) nf;
-		r2 = r3;
-		r |= r2;
+		r = (int64_t) nf;
 		break;
 	case IEEE_FMT_S:
-	case IEEE_FMT_D:
-		/*  sign bit:  */
-		if (signbit(nf)) {
-			r |= ((uint64_t)1 << signofs);
-		}
-
-		// printf("fpclassify(nf) = %i\n", fpclassify(nf));
-		switch (fpclassify(nf)) {
-		case FP_INFINITE:
-			if (fmt == IEEE_FMT_D)
-				r |= 0x7ff0000000000000ULL;
-			else
-				r |= 0x7f800000ULL;
-			break;
-		case FP_NAN:
-			if (fmt == IEEE_FMT_D)
-				r |= 0x7fffffffffffffffULL;
-			else
-				r |= 0x7fffffffULL;
+		if (isnan(nf)) {
+			r = signbit(nf)? 0xffffffffULL : 0x7fffffffULL;
 			break;
-		case FP_NORMAL:
-			if (signbit(nf))
-				nf = -nf;
-
-			/*
-			 *  How to convert back from double to exponent + fraction:
-			 *  The fraction should be 1.xxx, that is
-			 *  1.0 <= fraction < 2.0
-			 *
-			 *  This method is very slow but should work:
-			 *  (TODO: Fix the performance problem!)
-			 */
-			exponent = 0;
-			while (nf < 1.0 && exponent > -1023) {
-				nf *= 2.0;
-				exponent --;
-			}
-			while (nf >= 2.0 && exponent < 1023) {
-				nf /= 2.0;
-				exponent ++;
-			}
-
-			/*  Here:   1.0 <= nf < 2.0  */
-			nf -= 1.0;	/*  remove implicit first bit  */
-			for (i=n_frac-1; i>=0; i--) {
-				nf *= 2.0;
-				if (nf >= 1.0) {
-					r |= ((uint64_t)1 << i);
-					nf -= 1.0;
-				}
-			}
-
-			/*  Insert the exponent into the resulting word:  */
-			/*  (First bias, then make sure it's within range)  */
-			exponent += (((uint64_t)1 << (n_exp-1)) - 1);
-			if (exponent < 0)
-				exponent = 0;
-			if (exponent >= ((int64_t)1 << n_exp))
-				exponent = ((int64_t)1 << n_exp) - 1;
-			r |= (uint64_t)exponent << n_frac;
-
-			/*  Special case for 0.0:  */
-			if (exponent == 0)
-				r = 0;
-			break;
-		case FP_SUBNORMAL:
-			// TODO
-			break;
-		case FP_ZERO:
-			// r already has zeros in the lowest bits. Done.
+		}
+		f = nf;
+		memcpy(&r32, &f, sizeof(r32));
+		r = r32;
+		break;
+	case IEEE_FMT_D:
+		if (isnan(nf)) {
+			r = signbit(nf)? 0xffffffffffffffffULL :
+			    0x7fffffffffffffffULL;
 			break;
 		}
+		memcpy(&r, &nf, sizeof(r));
 		break;
 	default:/*  TODO  */
 		fatal("ieee_store_float_value(): unimplemented format %i\n",
@@ -314,3 +163,67 @@ uint64_t ieee_store_float_value(double nf, int fmt)
 	return r;
 }
 
+
+/*
+ *  ieee_strict_begin():
+ *
+ *  Prepares the host's floating point environment for a guest floating point
+ *  operation in strict mode: sets the rounding mode (one of IEEE_ROUND_*),
+ *  and clears the exception flags.
+ */
+void ieee_strict_begin(int rounding_mode)
+{
+	static const int fe_round[4] = {
+		FE_TONEAREST, FE_TOWARDZERO, FE_UPWARD, FE_DOWNWARD };
+
+	fesetround(fe_round[rounding_mode & 3]);
+	feclearexcept(FE_ALL_EXCEPT);
+}
+
+
+/*
+ *  ieee_strict_raise():
+ *
+ *  Raises exceptions (IEEE_EXC_* flags) which the host's arithmetic does not
+ *  raise by itself, e.g. for signalling comparisons.
+ */
+void ieee_strict_raise(int exceptions)
+{
+	if (exceptions & IEEE_EXC_INVALID)
+		feraiseexcept(FE_INVALID);
+	if (exceptions & IEEE_EXC_DIVBYZERO)
+		feraiseexcept(FE_DIVBYZERO);
+	if (exceptions & IEEE_EXC_OVERFLOW)
+		feraiseexcept(FE_OVERFLOW);
+	if (exceptions & IEEE_EXC_UNDERFLOW)
+		feraiseexcept(FE_UNDERFLOW);
+	if (exceptions & IEEE_EXC_INEXACT)
+		feraiseexcept(FE_INEXACT);
+}
+
+
+/*
+ *  ieee_strict_end():
+ *
+ *  Returns the exceptions (IEEE_EXC_* flags) raised since the call to
+ *  ieee_strict_begin(), and restores the host's default rounding mode.
+ */
+int ieee_strict_end(void)
+{
+	int raised = fetestexcept(FE_ALL_EXCEPT), exceptions = 0;
+
+	fesetround(FE_TONEAREST);
+
+	if (raised & FE_INVALID)
+		exceptions |= IEEE_EXC_INVALID;
+	if (raised & FE_DIVBYZERO)
+		exceptions |= IEEE_EXC_DIVBYZERO;
+	if (raised & FE_OVERFLOW)
+		exceptions |= IEEE_EXC_OVERFLOW;
+	if (raised & FE_UNDERFLOW)
+		exceptions |= IEEE_EXC_UNDERFLOW;
+	if (raised & FE_INEXACT)
+		exceptions |= IEEE_EXC_INEXACT;
+
+	return exceptions;
+}
@@ -0,0 +1,266 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *
+ *  Accelerated guest routines.
+ *
+ *  Guest kernels spend a lot of time in a few bulk memory routines (memcpy,
+ *  bzero, etc). When such a routine is found in the guest's symbol table,
+ *  the dynamic translator can replace the routine's entry instruction with
+ *  a call to a host-native implementation, which works directly on the
+ *  host pages that the guest pages are mapped to. If any page involved is
+ *  not mapped (or not writable) for direct access, the guest's own code is
+ *  run instead.
+ *
+ *  This is opt-in (-b on the command line), since it assumes that the
+ *  symbols really are the standard C routines, called with the normal
+ *  calling convention of the architecture. The arguments, return value, and
+ *  return address are taken from the architecture's registers as described
+ *  in the DYNTRANS_GUEST_ROUTINES section of cpu_dyntrans.c.
+ *
+ *  A routine is given as symbol=kind, where kind is one of memcpy, memmove,
+ *  bcopy, memset, bzero, or strlen. If the symbol has the same name as its
+ *  kind, then "=kind" may be left out. "all" adds all of the standard names.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "guest_routines.h"
+#include "machine.h"
+#include "misc.h"
+#include "symbol.h"
+
+
+static const char *guest_routine_kind_names[N_GUEST_ROUTINE_KINDS] =
+    GUEST_ROUTINE_KIND_NAMES;
+
+
+static void guest_routines_rehash(struct machine *m)
+{
+	struct guest_routines *gr = &m->guest_routines;
+
+	memset(gr->hash, 0, sizeof(gr->hash));
+
+	for (size_t i = 0; i < gr->n_routines; i++) {
+		struct guest_routine *r = &gr->routines[i];
+		size_t h = GUEST_ROUTINES_HASH(r->addr);
+
+		if (!r->resolved)
+			continue;
+
+		r->next_in_hash = gr->hash[h];
+		gr->hash[h] = i + 1;
+	}
+}
+
+
+/*
+ *  guest_routines_lookup():
+ *
+ *  Returns the accelerated routine at addr, or NULL. For 32-bit emulation
+ *  modes, only the low 32 bits of the address are compared.
+ */
+struct guest_routine *guest_routines_lookup(struct machine *m, uint64_t addr,
+	bool is_32bit)
+{
+	size_t i = m->guest_routines.hash[GUEST_ROUTINES_HASH(addr)];
+
+	while (i != 0) {
+		struct guest_routine *r = &m->guest_routines.routines[i - 1];
+
+		if (r->addr == addr ||
+		    (is_32bit && (uint32_t) r->addr == (uint32_t) addr))
+			return r;
+
+		i = r->next_in_hash;
+	}
+
+	return NULL;
+}
+
+
+static void guest_routines_add(struct machine *m, const char *symbol,
+	int kind, bool optional)
+{
+	struct guest_routines *gr = &m->guest_routines;
+	struct guest_routine *r;
+
+	/*  Adding the same symbol twice replaces the first one:  */
+	for (size_t i = 0; i < gr->n_routines; i++)
+		if (strcmp(gr->routines[i].symbol, symbol) == 0) {
+			gr->routines[i].kind = kind;
+			gr->routines[i].optional &= optional;
+			return;
+		}
+
+	CHECK_ALLOCATION(gr->routines = (struct guest_routine *) realloc(
+	    gr->routines, sizeof(struct guest_routine) * (gr->n_routines + 1)));
+
+	r = &gr->routines[gr->n_routines ++];
+	memset(r, 0, sizeof(struct guest_routine));
+
+	CHECK_ALLOCATION(r->symbol = strdup(symbol));
+	r->kind = kind;
+	r->optional = optional;
+}
+
+
+/*
+ *  guest_routines_add_without_lookup():
+ *
+ *  Adds a comma-separated list of routines (symbol=kind, kind, or "all") to
+ *  a machine. The symbols are looked up later, by guest_routines_parse_all().
+ *  Returns false if the list could not be parsed.
+ */
+bool guest_routines_add_without_lookup(struct machine *m, const char *spec)
+{
+	char *s, *tmp, *word;
+
+	CHECK_ALLOCATION(tmp = strdup(spec));
+
+	for (word = strtok_r(tmp, ",", &s); word != NULL;
+	    word = strtok_r(NULL, ",", &s)) {
+		char *kind_name = strchr(word, '=');
+		int kind;
+
+		if (strcmp(word, "all") == 0) {
+			for (kind = 0; kind < N_GUEST_ROUTINE_KINDS; kind++)
+				guest_routines_add(m,
+				    guest_routine_kind_names[kind], kind, true);
+			continue;
+		}
+
+		if (kind_name != NULL)
+			*kind_name++ = '\0';
+		else
+			kind_name = word;
+
+		for (kind = 0; kind < N_GUEST_ROUTINE_KINDS; kind++)
+			if (strcmp(kind_name, guest_routine_kind_names[kind]) == 0)
+				break;
+
+		if (kind == N_GUEST_ROUTINE_KINDS || word[0] == '\0') {
+			fprintf(stderr, "Unknown guest routine '%s'. Use "
+			    "symbol=kind, where kind is one of", kind_name);
+			for (kind = 0; kind < N_GUEST_ROUTINE_KINDS; kind++)
+				fprintf(stderr, "%s %s", kind > 0? "," : "",
+				    guest_routine_kind_names[kind]);
+			fprintf(stderr, ".\n");
+			free(tmp);
+			return false;
+		}
+
+		guest_routines_add(m, word, kind, false);
+	}
+
+	free(tmp);
+	return true;
+}
+
+
+/*
+ *  guest_routines_parse_all():
+ *
+ *  Looks up the addresses of all guest routines, once all binaries (and
+ *  their symbols) have been loaded.
+ */
+void guest_routines_parse_all(struct machine *m)
+{
+	struct guest_routines *gr = &m->guest_routines;
+	int arch;
+
+	if (gr->n_routines == 0)
+		return;
+
+	arch = m->cpus[0]->cpu_family->arch;
+	if (arch != ARCH_ARM && arch != ARCH_M88K && arch != ARCH_MIPS) {
+		debugmsg(SUBSYS_STARTUP, "routines", VERBOSITY_WARNING,
+		    "accelerated guest routines are not supported for this"
+		    " architecture");
+		gr->n_routines = 0;
+		return;
+	}
+
+	for (size_t i = 0; i < gr->n_routines; i++) {
+		struct guest_routine *r = &gr->routines[i];
+		uint64_t addr;
+
+		r->resolved = get_symbol_addr(&m->symbol_context, r->symbol,
+		    &addr);
+		if (!r->resolved) {
+			debugmsg(SUBSYS_STARTUP, "routines", r->optional?
+			    VERBOSITY_DEBUG : VERBOSITY_WARNING,
+			    "symbol '%s' not found", r->symbol);
+			continue;
+		}
+
+		if (arch == ARCH_MIPS && (addr >> 32) == 0 && ((addr >> 31) & 1))
+			addr |= 0xffffffff00000000ULL;
+
+		r->addr = addr;
+
+		debugmsg(SUBSYS_STARTUP, "routines", VERBOSITY_INFO,
+		    "%s: 0x%" PRIx64 " (%s)", r->symbol, addr,
+		    guest_routine_kind_names[r->kind]);
+	}
+
+	guest_routines_rehash(m);
+}
+
+
+/*
+ *  guest_routines_show_all():
+ *
+ *  Prints the accelerated routines, with statistics.
+ */
+void guest_routines_show_all(struct machine *m)
+{
+	struct guest_routines *gr = &m->guest_routines;
+
+	for (size_t i = 0; i < gr->n_routines; i++) {
+		struct guest_routine *r = &gr->routines[i];
+
+		printf("  %s%s%s (%s): ", color_symbol_ptr(), r->symbol,
+		    color_normal_ptr(), guest_routine_kind_names[r->kind]);
+
+		if (!r->resolved) {
+			printf("not found\n");
+			continue;
+		}
+
+		if (m->cpus[0]->is_32bit)
+			printf("0x%08" PRIx32, (uint32_t) r->addr);
+		else
+			printf("0x%016" PRIx64, (uint64_t) r->addr);
+
+		printf(", %" PRIu64" calls (%" PRIu64" bytes), %" PRIu64
+		    " fallbacks\n", r->n_calls, r->n_bytes, r->n_fallbacks);
+	}
+}
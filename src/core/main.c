@@ -42,6 +42,7 @@
 #include "device.h"
 #include "diskimage.h"
 #include "emul.h"
+#include "float_emul.h"
 #include "machine.h"
 #include "misc.h"
 #include "settings.h"
@@ -143,6 +144,9 @@ static void usage(bool longusage)
 	printf("  -e st     try to emulate machine subtype st.\n");
 
 	printf("\nOther options:\n");
+	printf("  -b list   accelerate guest routines, e.g. memcpy,bzero or"
+	    " my_copy=memcpy\n            (kinds: memcpy, memmove, bcopy,"
+	    " memset, bzero, strlen; or all)\n");
 	printf("  -C x      try to emulate a specific CPU. (Use -H to get a "
 	    "list of types.)\n");
 	printf("  -d fname  add fname as a disk image. You can add \"xxx:\""
@@ -151,11 +155,18 @@ static void usage(bool longusage)
 	printf("                b      specifies that this is the boot"
 	    " device\n");
 	printf("                c      CD-ROM\n");
+	printf("                CNAME; use the copy-on-write image NAME (created"
+	    " as a clone\n                       of fname, if it does not"
+	    " exist)\n");
 	printf("                d      DISK\n");
 	printf("                f      FLOPPY\n");
 	printf("                gH;S;  set geometry to H heads and S"
 	    " sectors-per-track\n");
 	printf("                i      IDE\n");
+	printf("                kSIZE; set the block cache size to SIZE KB"
+	    " (default %i, 0 = off)\n", DISKIMAGE_DEFAULT_CACHE_SIZE / 1024);
+	printf("                m      mmap the image file (implies r,"
+	    " unless R is used)\n");
 	printf("                oOFS;  set base offset to OFS (for ISO9660"
 	    " filesystems)\n");
 	printf("                r      read-only (don't allow changes to the file)\n");
@@ -166,6 +177,9 @@ static void usage(bool longusage)
 	printf("                t      tape\n");
 	printf("                V      add an overlay (also requires explicit ID)\n");
 	printf("                0-7    use a specific ID\n");
+	printf("  -g spec   use headless framebuffers, and write snapshots of them to\n"
+	       "            spec<fb>-<n>.png (or .ppm, if spec ends with .ppm)\n"
+	       "            when their contents change; spec \"none\" disables snapshots\n");
 	printf("  -I hz     set the main cpu frequency to hz (not used by "
 	    "all combinations\n            of machines and guest OSes)\n");
 	printf("  -i        display each instruction as it is executed\n");
@@ -203,12 +217,16 @@ static void usage(bool longusage)
 	printf("                p    physical equivalent of program counter\n");
 	printf("                i    internal ic->f representation of "
 	    "the program counter\n");
+	printf("                w    the instruction word at the program "
+	    "counter\n");
 	printf("            and optionally:\n");
 	printf("                d    disable statistics gathering at "
 	    "startup\n");
 	printf("                o    overwrite instead of append\n");
 	printf("  -T        break on non-existant memory accesses\n");
 	printf("  -t        show function trace tree\n");
+	printf("  -w port   use headless framebuffers (see -g), and serve them over VNC on\n"
+	       "            127.0.0.1, port port+n for framebuffer window n\n");
 #ifdef WITH_X11
 	printf("  -X        use X11\n");
 	printf("  -Y n      scale down framebuffer windows by n x n times\n");
@@ -225,6 +243,9 @@ static void usage(bool longusage)
 	printf("  -c cmd    add cmd as a command to run before starting "
 	    "the simulation\n");
 	printf("  -D        skip the srandom call at startup\n");
+	printf("  -F        strict IEEE floating point: model the guest's "
+	    "rounding modes and\n            exception flags exactly "
+	    "(slower; MIPS only, so far)\n");
 	printf("  -G        enable colorized output (same as if the CLICOLOR"
 	    " env. var is set)\n");
 	printf("  -H        display a list of possible CPU and "
@@ -236,6 +257,10 @@ static void usage(bool longusage)
 	printf("  -N        display status info (nr of instrs/second etc), at"
 	    " regular intervals\n");
 	printf("  -q        quiet mode (don't print startup messages)\n");
+	printf("  -U spec   bind emulated serial ports to listening sockets instead of\n"
+	       "            xterms; spec is unix:PATHPREFIX (sockets are named\n"
+	       "            PATHPREFIX.n) or tcp:PORT (127.0.0.1, port PORT+n), where n\n"
+	       "            is the console handle number\n");
 	printf("  -V        start up in the interactive debugger, paused; this also sets -K\n");
 	printf("  -v        increase debug message verbosity\n");
 #ifdef WITH_X11
@@ -281,7 +306,7 @@ int get_cmd_args(int argc, char *argv[], struct emul *emul,
 	struct machine *m = emul_add_machine(emul, NULL);
 
 	const char *opts =
-	    "AC:c:Dd:E:e:GHhI:iJj:k:KL:M:Nn:Oo:p:QqRrSs:TtVvW:"
+	    "Ab:C:c:Dd:E:e:Fg:GHhI:iJj:k:KL:M:Nn:Oo:p:QqRrSs:TtU:VvW:w:"
 #ifdef WITH_X11
 	    "XxY:"
 #endif
@@ -292,6 +317,14 @@ int get_cmd_args(int argc, char *argv[], struct emul *emul,
 		case 'A':
 			enable_colorized_output = false;
 			break;
+		case 'b':
+			// Like breakpoints, the symbols are looked up once all
+			// binaries have been loaded.
+			if (!guest_routines_add_without_lookup(m, optarg))
+				exit(1);
+
+			machine_specific_options_used = true;
+			break;
 		case 'C':
 			CHECK_ALLOCATION(m->cpu_name = strdup(optarg));
 			machine_specific_options_used = true;
@@ -334,6 +367,17 @@ int get_cmd_args(int argc, char *argv[], struct emul *emul,
 			subtype = optarg;
 			machine_specific_options_used = true;
 			break;
+		case 'F':
+			ieee_strict = true;
+			break;
+		case 'g':
+			m->x11_md.in_use = 1;
+			m->x11_md.headless = true;
+			if (strcmp(optarg, "none") != 0)
+				CHECK_ALLOCATION(m->x11_md.snapshot_prefix =
+				    strdup(optarg));
+			machine_specific_options_used = true;
+			break;
 		case 'G':
 			enable_colorized_output = true;
 			break;
@@ -432,6 +476,13 @@ int get_cmd_args(int argc, char *argv[], struct emul *emul,
 			m->show_trace_tree = 1;
 			machine_specific_options_used = true;
 			break;
+		case 'U':
+			if (!console_allow_sockets(optarg)) {
+				fprintf(stderr, "Invalid -U argument; use "
+				    "unix:PATHPREFIX or tcp:PORT.\n");
+				exit(1);
+			}
+			break;
 		case 'V':
 			single_step = true;
 			debugger_enter_at_end_of_run = true;
@@ -442,6 +493,17 @@ int get_cmd_args(int argc, char *argv[], struct emul *emul,
 		case 'W':
 			internal_w(optarg);
 			exit(0);
+		case 'w':
+			m->x11_md.vnc_port = atoi(optarg);
+			if (m->x11_md.vnc_port < 1 ||
+			    m->x11_md.vnc_port > 65535) {
+				fprintf(stderr, "Invalid -w port number.\n");
+				exit(1);
+			}
+			m->x11_md.in_use = 1;
+			m->x11_md.headless = true;
+			machine_specific_options_used = true;
+			break;
 		case 'X':
 			m->x11_md.in_use = 1;
 			machine_specific_options_used = true;
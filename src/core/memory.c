@@ -256,53 +256,122 @@ char *memory_conv_to_string(struct cpu *cpu, struct memory *mem, uint64_t addr,
 }
 
 
+/*  Size in bytes of the dirty page bitmap of a device of len bytes:  */
+static size_t dirty_bitmap_size(uint64_t len)
+{
+	uint64_t n_pages = (len + DYNTRANS_DIRTY_PAGE_SIZE - 1)
+	    >> DYNTRANS_DIRTY_PAGE_SHIFT;
+
+	return (n_pages + 63) / 64 * sizeof(uint64_t);
+}
+
+
 /*
- *  memory_device_dyntrans_access():
+ *  memory_device_dyntrans_mark_dirty():
  *
- *  Get the lowest and highest dyntrans access since last time.
+ *  Marks the pages covering offset .. offset+len-1 of a device as dirty.
+ *  Called when a dyntrans translation which allows writes is set up for a
+ *  page of the device, since writes through such a translation are not seen
+ *  by the device.
  */
-void memory_device_dyntrans_access(struct cpu *cpu, struct memory *mem,
-	void *extra, uint64_t *low, uint64_t *high)
+void memory_device_dyntrans_mark_dirty(struct memory_device *dev,
+	uint64_t offset, uint64_t len)
 {
-	size_t s;
-	int i, need_inval = 0;
+	uint64_t page, last_page;
+
+	if (dev->dyntrans_dirty == NULL || len == 0 || offset >= dev->length)
+		return;
+
+	if (offset + len > dev->length)
+		len = dev->length - offset;
+
+	page = offset >> DYNTRANS_DIRTY_PAGE_SHIFT;
+	last_page = (offset + len - 1) >> DYNTRANS_DIRTY_PAGE_SHIFT;
+
+	for (; page <= last_page; page++) {
+		uint64_t bit = (uint64_t) 1 << (page & 63);
+
+		if (!(dev->dyntrans_dirty[page >> 6] & bit)) {
+			dev->dyntrans_dirty[page >> 6] |= bit;
+			dev->n_dyntrans_dirty ++;
+		}
+	}
+}
+
+
+/*
+ *  memory_device_dyntrans_dirty():
+ *
+ *  Returns the parts of a device's memory which may have been written to via
+ *  dyntrans since the last call, as up to max_ranges ranges of consecutive
+ *  dirty pages, in increasing order. (If there are more ranges than that,
+ *  the last range covers the rest.) The return value is the number of
+ *  ranges; 0 if nothing has been written to.
+ *
+ *  The dirty pages are marked as clean, and are write-protected in the
+ *  cpu's translation caches, so that the next write to each of them goes
+ *  through memory_rw() and marks the page dirty again.
+ */
+int memory_device_dyntrans_dirty(struct cpu *cpu, struct memory *mem,
+	void *extra, struct memory_dirty_range *ranges, int max_ranges)
+{
+	struct memory_device *dev = NULL;
+	uint64_t n_pages, page;
+	int i, n = 0;
 
 	/*  TODO: This is O(n), so it might be good to rewrite it some day.
 	    For now, it will be enough, as long as this function is not
 	    called too often.  */
 
-	for (i=0; i<mem->n_mmapped_devices; i++) {
+	for (i=0; i<mem->n_mmapped_devices; i++)
 		if (mem->devices[i].extra == extra &&
 		    mem->devices[i].flags & DM_DYNTRANS_WRITE_OK &&
 		    mem->devices[i].dyntrans_data != NULL) {
-			if (mem->devices[i].dyntrans_write_low != (uint64_t) -1)
-				need_inval = 1;
-			if (low != NULL)
-				*low = mem->devices[i].dyntrans_write_low;
-			mem->devices[i].dyntrans_write_low = (uint64_t) -1;
-
-			if (high != NULL)
-				*high = mem->devices[i].dyntrans_write_high;
-			mem->devices[i].dyntrans_write_high = 0;
-
-			if (!need_inval)
-				return;
-
-			/*  Invalidate any pages of this device that might
-			    be in the dyntrans load/store cache, by marking
-			    the pages read-only.  */
-			if (cpu->invalidate_translation_caches != NULL) {
-				for (s = *low; s <= *high;
-				    s += cpu->machine->arch_pagesize)
-					cpu->invalidate_translation_caches
-					    (cpu, mem->devices[i].baseaddr + s,
-					    JUST_MARK_AS_NON_WRITABLE
-					    | INVALIDATE_PADDR);
-			}
+			dev = &mem->devices[i];
+			break;
+		}
 
-			return;
+	if (dev == NULL || dev->n_dyntrans_dirty == 0 || max_ranges < 1)
+		return 0;
+
+	n_pages = (dev->length + DYNTRANS_DIRTY_PAGE_SIZE - 1)
+	    >> DYNTRANS_DIRTY_PAGE_SHIFT;
+
+	for (page = 0; page < n_pages; page++) {
+		uint64_t low = page << DYNTRANS_DIRTY_PAGE_SHIFT;
+		uint64_t word = dev->dyntrans_dirty[page >> 6];
+
+		/*  Skip 64 clean pages at a time:  */
+		if (word == 0) {
+			page |= 63;
+			continue;
 		}
+
+		if (!(word & ((uint64_t) 1 << (page & 63))))
+			continue;
+
+		dev->dyntrans_dirty[page >> 6] &= ~((uint64_t) 1 << (page & 63));
+
+		if (n > 0 && (ranges[n-1].high + 1 == low || n == max_ranges))
+			ranges[n-1].high = low + DYNTRANS_DIRTY_PAGE_SIZE - 1;
+		else {
+			ranges[n].low = low;
+			ranges[n].high = low + DYNTRANS_DIRTY_PAGE_SIZE - 1;
+			n ++;
+		}
+
+		if (cpu->invalidate_translation_caches != NULL)
+			cpu->invalidate_translation_caches(cpu,
+			    dev->baseaddr + low, JUST_MARK_AS_NON_WRITABLE
+			    | INVALIDATE_PADDR);
 	}
+
+	dev->n_dyntrans_dirty = 0;
+
+	if (n > 0 && ranges[n-1].high >= dev->length)
+		ranges[n-1].high = dev->length - 1;
+
+	return n;
 }
 
 
@@ -325,8 +394,12 @@ void memory_device_update_data(struct memory *mem, void *extra,
 			continue;
 
 		mem->devices[i].dyntrans_data = data;
-		mem->devices[i].dyntrans_write_low = (uint64_t)-1;
-		mem->devices[i].dyntrans_write_high = 0;
+
+		if (mem->devices[i].dyntrans_dirty != NULL) {
+			memset(mem->devices[i].dyntrans_dirty, 0,
+			    dirty_bitmap_size(mem->devices[i].length));
+			mem->devices[i].n_dyntrans_dirty = 0;
+		}
 	}
 }
 
@@ -439,8 +512,14 @@ void memory_device_register(struct memory *mem, const char *device_name,
 		abort();
 	}
 
-	mem->devices[newi].dyntrans_write_low = (uint64_t)-1;
-	mem->devices[newi].dyntrans_write_high = 0;
+	mem->devices[newi].dyntrans_dirty = NULL;
+	mem->devices[newi].n_dyntrans_dirty = 0;
+	if (flags & DM_DYNTRANS_WRITE_OK && !(flags & DM_EMULATED_RAM)) {
+		CHECK_ALLOCATION(mem->devices[newi].dyntrans_dirty =
+		    (uint64_t *) malloc(dirty_bitmap_size(len)));
+		memset(mem->devices[newi].dyntrans_dirty, 0,
+		    dirty_bitmap_size(len));
+	}
 	mem->devices[newi].f = f;
 	mem->devices[newi].extra = extra;
 
@@ -467,6 +546,8 @@ void memory_device_remove(struct memory *mem, int i)
 		exit(1);
 	}
 
+	free(mem->devices[i].dyntrans_dirty);
+
 	mem->n_mmapped_devices --;
 
 	if (i == mem->n_mmapped_devices)
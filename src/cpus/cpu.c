@@ -353,6 +353,11 @@ void cpu_create_or_reset_tc(struct cpu *cpu)
 	 */
 	if (cpu->invalidate_code_translation != NULL)
 		cpu->invalidate_code_translation(cpu, 0, INVALIDATE_ALL);
+
+	/*  Detected idle loops point into the translation cache, too.
+	    (Their statistics are kept until the slot is reused.)  */
+	for (int i = 0; i < N_IDLE_LOOPS; i++)
+		cpu->idle_loops[i].ic = NULL;
 }
 
 
@@ -365,6 +370,46 @@ void cpu_break_out_of_dyntrans_loop(struct cpu *cpu)
 }
 
 
+/*
+ *  cpu_show_idle_loops():
+ *
+ *  Prints the idle loops that have been detected automatically, and how
+ *  often the CPU has idled in each of them.
+ */
+void cpu_show_idle_loops(struct cpu *cpu)
+{
+	int n = 0;
+
+	for (int i = 0; i < N_IDLE_LOOPS; i++) {
+		struct idle_loop *l = &cpu->idle_loops[i];
+		uint64_t offset;
+		const char *symbol;
+
+		if (l->n_instrs == 0)
+			continue;
+
+		printf("cpu%i: ", cpu->cpu_id);
+		if (cpu->is_32bit)
+			printf("0x%08" PRIx32, (uint32_t) l->pc);
+		else
+			printf("0x%016" PRIx64, (uint64_t) l->pc);
+
+		symbol = get_symbol_name(&cpu->machine->symbol_context,
+		    l->pc, &offset);
+		if (symbol != NULL)
+			printf(" <%s+0x%" PRIx64">", symbol, offset);
+
+		printf(": %i instr%s, %" PRIu64" iterations, idled %" PRIu64
+		    " times\n", l->n_instrs, l->n_instrs == 1 ? "" : "s",
+		    l->n_iterations, l->n_idle);
+		n ++;
+	}
+
+	if (n == 0)
+		printf("cpu%i: no idle loops detected\n", cpu->cpu_id);
+}
+
+
 /*
  *  cpu_dumpinfo():
  *
@@ -65,6 +65,9 @@
  *  this to give a new cpu_arm_multi.txt:
  *
  *  uniq -c bdt_statistics.txt|sort -nr|head -256|cut -f 2 > cpu_arm_multi.txt
+ *
+ *  Without recompiling, the same can be done with "gxemul -s w:filename",
+ *  followed by "make arm_multi_profile PROFILE=filename" in src/cpus.
  */
 static void update_bdt_statistics(uint32_t iw)
 {
@@ -1517,7 +1520,18 @@ void arm_pop(struct cpu* cpu, uint32_t* np, int p_bit, int u_bit, int s_bit, int
 
 	/*  NOTE: Special case: Loading the PC  */
 	if (iw & 0x8000) {
-		cpu->pc = cpu->cd.arm.r[ARM_PC] & 0xfffffffc;
+		/*  Bit 0 selects Thumb mode, except when returning from
+		    an exception, where the mode comes from the SPSR:  */
+		if (!return_flag) {
+			if (cpu->cd.arm.r[ARM_PC] & 1)
+				cpu->cd.arm.cpsr |= ARM_FLAG_T;
+			else
+				cpu->cd.arm.cpsr &= ~ARM_FLAG_T;
+		}
+		if (cpu->cd.arm.cpsr & ARM_FLAG_T)
+			cpu->pc = cpu->cd.arm.r[ARM_PC] | 1;
+		else
+			cpu->pc = cpu->cd.arm.r[ARM_PC] & 0xfffffffc;
 		if (cpu->machine->show_trace_tree)
 			cpu_functioncall_trace_return(cpu);
 		/*  TODO: There is no need to update the
@@ -2976,6 +2990,141 @@ static void arm_switch_add1(struct arm_instr_call *ic, int rd,
 }
 
 
+/*
+ *  Idle loop detection (see DYNTRANS_IDLE_LOOP in cpu_dyntrans.c):
+ *
+ *  The loop must end with a b_samepage, or with a cmp/tst/teq which has
+ *  been combined with the b_samepage following it (by COMBINE(beq_etc)).
+ *  Only ARM mode code is considered, not Thumb code.
+ */
+static void (*arm_idle_loop_cmp_b[])(struct cpu *, struct arm_instr_call *) = {
+	arm_instr_cmps0_beq_samepage, arm_instr_cmps_beq_samepage,
+	arm_instr_cmps0_bne_samepage, arm_instr_cmps_bne_samepage,
+	arm_instr_cmps_bcc_samepage, arm_instr_cmps_bhi_samepage,
+	arm_instr_cmps_bgt_samepage, arm_instr_cmps_ble_samepage,
+	arm_instr_teqs_beq_samepage, arm_instr_teqs_bne_samepage,
+	arm_instr_tsts_lo_beq_samepage, arm_instr_tsts_lo_bne_samepage,
+	arm_instr_cmps_reg_bcc_samepage, arm_instr_cmps_reg_bhi_samepage,
+	NULL };
+
+struct arm_instr_call *COMBINE(idle_loop_branch)(struct cpu *cpu,
+	struct arm_instr_call *ic, int n_back,
+	struct arm_instr_call **target, bool *delayed)
+{
+	int i;
+
+	if (cpu->cd.arm.cpsr & ARM_FLAG_T)
+		return NULL;
+
+	for (i = 0; i < 15; i++)
+		if (ic->f == arm_cond_instr_b_samepage[i])
+			break;
+	if (i == 15)
+		return NULL;
+
+	*target = (struct arm_instr_call *) ic->arg[0];
+
+	if (n_back >= 1)
+		for (i = 0; arm_idle_loop_cmp_b[i] != NULL; i++)
+			if (ic[-1].f == arm_idle_loop_cmp_b[i])
+				return &ic[-1];
+
+	return ic;
+}
+
+
+bool COMBINE(idle_loop_instr)(struct cpu *cpu, struct arm_instr_call *ic,
+	struct idle_loop_regs *regs)
+{
+	size_t flags = (size_t) &cpu->cd.arm.flags;
+	int i, cond, op;
+
+	if (ic->f == instr(nop))
+		return true;
+	if (ic->f == instr(invalid))
+		return false;
+
+	/*  Branches:  */
+	for (i = 0; i < 15; i++)
+		if (ic->f == arm_cond_instr_b_samepage[i]) {
+			if (i != 14)
+				regs->reads[regs->n_reads++] = flags;
+			return true;
+		}
+
+	/*  Compare and branch:  */
+	for (i = 0; arm_idle_loop_cmp_b[i] != NULL; i++)
+		if (ic->f == arm_idle_loop_cmp_b[i]) {
+			regs->reads[regs->n_reads++] = ic->arg[0];
+			if (ic->f == instr(cmps_reg_bcc_samepage) ||
+			    ic->f == instr(cmps_reg_bhi_samepage))
+				regs->reads[regs->n_reads++] = ic->arg[1];
+			regs->writes[regs->n_writes++] = flags;
+			return true;
+		}
+
+	/*
+	 *  Loads with an immediate offset, without writeback:
+	 *  arg[0] = rn, arg[2] = rd.
+	 */
+	for (i = 0x110; i < 0x200; i++)
+		if (!(i & 0x20) && (i & 0x10) && (i & 15) != 15 &&
+		    ic->f == arm_load_store_instr[i]) {
+			regs->reads[regs->n_reads++] = ic->arg[0];
+			regs->writes[regs->n_writes++] = ic->arg[2];
+			if ((i & 15) != 14) {
+				regs->reads[regs->n_reads++] = flags;
+				regs->reads[regs->n_reads++] = ic->arg[2];
+			}
+			return true;
+		}
+
+	/*
+	 *  Data processing instructions with an immediate, or a register
+	 *  without shift (regshort), and without pc:
+	 *  arg[0] = rn, arg[1] = rm (regshort), arg[2] = rd.
+	 */
+	for (i = 0; i < 512; i++) {
+		bool regshort = ic->f == arm_dpi_instr_regshort[i];
+
+		if (!regshort && ic->f != arm_dpi_instr[i])
+			continue;
+
+		cond = i & 15; op = (i >> 4) & 15;
+		if (op != 0xd && op != 0xf)
+			regs->reads[regs->n_reads++] = ic->arg[0];
+		if (regshort)
+			regs->reads[regs->n_reads++] = ic->arg[1];
+		if (cond != 14 || (op >= 5 && op <= 7))
+			regs->reads[regs->n_reads++] = flags;
+		if (op < 8 || op > 0xb) {
+			regs->writes[regs->n_writes++] = ic->arg[2];
+			if (cond != 14)
+				regs->reads[regs->n_reads++] = ic->arg[2];
+		}
+		if (i & 256)
+			regs->writes[regs->n_writes++] = flags;
+		return true;
+	}
+
+	return false;
+}
+
+bool COMBINE(idle_loop_interrupts_enabled)(struct cpu *cpu)
+{
+	return !(cpu->cd.arm.cpsr & ARM_FLAG_I);
+}
+
+#define DYNTRANS_IDLE_LOOP
+#include "cpu_dyntrans.c"
+#undef  DYNTRANS_IDLE_LOOP
+
+/*  Accelerated guest routines (see DYNTRANS_GUEST_ROUTINES in cpu_dyntrans.c):  */
+#define DYNTRANS_GUEST_ROUTINES
+#include "cpu_dyntrans.c"
+#undef  DYNTRANS_GUEST_ROUTINES
+
+
 /*****************************************************************************/
 
 
@@ -3838,3 +3987,10 @@ okay:
 #undef	DYNTRANS_TO_BE_TRANSLATED_TAIL
 }
 
+
+
+/*****************************************************************************/
+
+
+#include "cpu_arm_instr_thumb.c"
+
@@ -59,15 +59,6 @@
  */
 
 
-#ifndef NOTHING
-#define NOTHING
-// Used to break out of dyntrans. TODO: Duplicate of arm_instr_nothing
-// code in tmp_arm_head.cc.
-void abortdyntrans(struct cpu* cpu, struct arm_instr_call* ic) { cpu->cd.arm.next_ic --; }
-static struct arm_instr_call abortdyntrans_call = { abortdyntrans, {0,0,0} };
-#endif	// NOTHING
-
-
 /*
  *  arg[0] = pointer to rn
  *  arg[1] = int32_t immediate value   OR  ptr to a reg_func() function
@@ -216,21 +207,20 @@ void A__NAME(struct cpu *cpu, struct arm_instr_call *ic)
 		}
 		cpu->cd.arm.flags = cpu->cd.arm.cpsr >> 28;
 		arm_load_register_bank(cpu);
-#else
-		if ((old_pc & ~mask_within_page) ==
+#endif
+		if (cpu->pc & 1) {
+			/*  Switch to Thumb:  */
+			cpu->cd.arm.cpsr |= ARM_FLAG_T;
+		}
+#ifndef A__S
+		if (!(cpu->pc & 1) && (old_pc & ~mask_within_page) ==
 		    ((uint32_t)cpu->pc & ~mask_within_page)) {
 			cpu->cd.arm.next_ic = cpu->cd.arm.cur_ic_page +
 			    ((cpu->pc & mask_within_page) >>
 			    ARM_INSTR_ALIGNMENT_SHIFT);
 		} else
 #endif
-			quick_pc_to_pointers(cpu);
-
-		if (cpu->pc & 1) {
-			// Switch to THUMB and break out of the dyntrans loop.
-			cpu->cd.arm.cpsr |= ARM_FLAG_T;
-			cpu->cd.arm.next_ic = &abortdyntrans_call;
-		}
+			quick_pc_to_pointers_arm(cpu);
 		return;
 	} else
 		reg(ic->arg[2]) = c64;
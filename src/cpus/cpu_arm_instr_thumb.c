@@ -0,0 +1,1393 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Thumb instructions. Included from cpu_arm_instr.c.
+ *
+ *  Thumb code is translated into translation pages of its own, one for each
+ *  2 KB half of a physical page, with one arm_instr_call per 16-bit halfword
+ *  (see cpu_arm.h for how they are linked to the ARM translation page).
+ *  While in Thumb mode, cpu->pc always has bit 0 set.
+ *
+ *  The original Thumb instruction set (ARMv4T and ARMv5T) is implemented,
+ *  plus a few of the 16-bit ARMv6 additions. 32-bit Thumb-2 encodings are
+ *  not.
+ */
+
+
+#define THUMB_SYNCH_PC		{					\
+		int low_pc_ = ((size_t)ic - (size_t)cpu->cd.arm.cur_ic_page) \
+		    / sizeof(struct arm_instr_call);			\
+		cpu->pc = (cpu->pc & ~(ARM_THUMB_PAGESIZE - 1)) +	\
+		    (low_pc_ << ARM_THUMB_INSTR_ALIGNMENT_SHIFT) + 1;	\
+	}
+
+/*  The start of the current half page, which all offsets are relative to:  */
+#define	THUMB_BASE		((uint32_t)cpu->pc & ~(ARM_THUMB_PAGESIZE - 1))
+
+#define	THUMB_LSL		0
+#define	THUMB_LSR		1
+#define	THUMB_ASR		2
+#define	THUMB_ROR		3
+
+
+/*
+ *  Helpers for the flag bits. Thumb data processing instructions (except
+ *  for hi register operations) always update the flags.
+ */
+static inline void thumb_flags_nz(struct cpu *cpu, uint32_t x)
+{
+	cpu->cd.arm.flags &= ARM_F_C | ARM_F_V;
+	if (x == 0)
+		cpu->cd.arm.flags |= ARM_F_Z;
+	if (x & 0x80000000)
+		cpu->cd.arm.flags |= ARM_F_N;
+}
+
+static inline uint32_t thumb_add_with_carry(struct cpu *cpu, uint32_t a,
+	uint32_t b, int carry)
+{
+	uint64_t c64 = (uint64_t)a + b + carry;
+	uint32_t c = c64;
+
+	cpu->cd.arm.flags = (c64 >> 32)? ARM_F_C : 0;
+	if ((~(a ^ b) & (a ^ c)) & 0x80000000)
+		cpu->cd.arm.flags |= ARM_F_V;
+	if (c == 0)
+		cpu->cd.arm.flags |= ARM_F_Z;
+	if (c & 0x80000000)
+		cpu->cd.arm.flags |= ARM_F_N;
+
+	return c;
+}
+
+#define	THUMB_CARRY		((cpu->cd.arm.flags & ARM_F_C)? 1 : 0)
+
+
+/*
+ *  thumb_shift():
+ *
+ *  Shifts x by n bits (n may be any value, as for shifts by register), and
+ *  updates the C flag. A zero shift leaves both x and C unchanged.
+ */
+static inline uint32_t thumb_shift(struct cpu *cpu, int type, uint32_t x,
+	uint32_t n)
+{
+	int c;
+
+	if (n == 0)
+		return x;
+
+	switch (type) {
+	case THUMB_LSL:
+		if (n < 32) {
+			c = (x >> (32 - n)) & 1;
+			x <<= n;
+		} else {
+			c = n == 32? x & 1 : 0;
+			x = 0;
+		}
+		break;
+	case THUMB_LSR:
+		if (n < 32) {
+			c = (x >> (n - 1)) & 1;
+			x >>= n;
+		} else {
+			c = n == 32? x >> 31 : 0;
+			x = 0;
+		}
+		break;
+	case THUMB_ASR:
+		if (n < 32) {
+			c = (x >> (n - 1)) & 1;
+			x = (int32_t)x >> n;
+		} else {
+			c = x >> 31;
+			x = c? 0xffffffff : 0;
+		}
+		break;
+	default:n &= 31;
+		if (n != 0)
+			x = (x >> n) | (x << (32 - n));
+		c = x >> 31;
+	}
+
+	if (c)
+		cpu->cd.arm.flags |= ARM_F_C;
+	else
+		cpu->cd.arm.flags &= ~ARM_F_C;
+
+	return x;
+}
+
+
+/*
+ *  thumb_load(), thumb_store():
+ *
+ *  Load or store len (1, 2, or 4) bytes. Pages that are in the host_load or
+ *  host_store arrays are accessed directly, anything else via memory_rw().
+ *  Returns false if the instruction should not complete, either because
+ *  there was an exception, or because the emulator needs to break out of
+ *  the dyntrans loop (the instruction is then executed again later).
+ */
+static inline bool thumb_load(struct cpu *cpu, struct arm_instr_call *ic,
+	uint32_t addr, int len, uint32_t *valuep)
+{
+	unsigned char data[4], *p = cpu->cd.arm.host_load[addr >> 12];
+
+	addr &= ~(len - 1);
+
+	if (p != NULL) {
+		p += addr & 0xfff;
+	} else {
+		THUMB_SYNCH_PC;
+		if (!cpu->memory_rw(cpu, cpu->mem, addr, data, len,
+		    MEM_READ, CACHE_DATA))
+			return false;
+		if (!cpu->running || about_to_enter_single_step) {
+			N_BREAK_OUT_UNCOUNTED(cpu);
+			cpu->cd.arm.next_ic = &nothing_call;
+			return false;
+		}
+		p = data;
+	}
+
+	switch (len) {
+	case 1:	*valuep = p[0];
+		break;
+	case 2:	if (cpu->byte_order == EMUL_LITTLE_ENDIAN)
+			*valuep = p[0] + (p[1] << 8);
+		else
+			*valuep = p[1] + (p[0] << 8);
+		break;
+	default:if (cpu->byte_order == EMUL_LITTLE_ENDIAN)
+			*valuep = p[0] + (p[1] << 8) + (p[2] << 16) +
+			    ((uint32_t)p[3] << 24);
+		else
+			*valuep = p[3] + (p[2] << 8) + (p[1] << 16) +
+			    ((uint32_t)p[0] << 24);
+	}
+
+	return true;
+}
+
+static inline void thumb_store(struct cpu *cpu, struct arm_instr_call *ic,
+	uint32_t addr, int len, uint32_t value)
+{
+	unsigned char data[4], *p = cpu->cd.arm.host_store[addr >> 12];
+
+	addr &= ~(len - 1);
+
+	if (p != NULL)
+		p += addr & 0xfff;
+	else
+		p = data;
+
+	switch (len) {
+	case 1:	p[0] = value;
+		break;
+	case 2:	if (cpu->byte_order == EMUL_LITTLE_ENDIAN) {
+			p[0] = value; p[1] = value >> 8;
+		} else {
+			p[1] = value; p[0] = value >> 8;
+		}
+		break;
+	default:if (cpu->byte_order == EMUL_LITTLE_ENDIAN) {
+			p[0] = value; p[1] = value >> 8;
+			p[2] = value >> 16; p[3] = value >> 24;
+		} else {
+			p[3] = value; p[2] = value >> 8;
+			p[1] = value >> 16; p[0] = value >> 24;
+		}
+	}
+
+	if (p != data)
+		return;
+
+	THUMB_SYNCH_PC;
+	if (!cpu->memory_rw(cpu, cpu->mem, addr, data, len,
+	    MEM_WRITE, CACHE_DATA))
+		return;
+	if (!cpu->running || about_to_enter_single_step) {
+		/*  The store has been done; continue after it.  */
+		cpu->pc += sizeof(uint16_t);
+		cpu->n_translated_instrs |= N_BREAK_OUT_OF_DYNTRANS_LOOP;
+		cpu->cd.arm.next_ic = &nothing_call;
+	}
+}
+
+
+/*
+ *  thumb_branch_exchange():
+ *
+ *  Branch to target, switching to ARM mode if bit 0 is clear.
+ */
+static void thumb_branch_exchange(struct cpu *cpu, uint32_t target)
+{
+	if (target & 1) {
+		cpu->pc = target;
+	} else {
+		cpu->cd.arm.cpsr &= ~ARM_FLAG_T;
+		cpu->pc = target & ~3;
+	}
+
+	quick_pc_to_pointers_arm(cpu);
+}
+
+
+/*****************************************************************************/
+
+
+/*
+ *  Shifts, moves, and add/subtract:
+ *
+ *  arg[0] = pointer to rd
+ *  arg[1] = pointer to rs (or rn)
+ *  arg[2] = shift amount, immediate value, or pointer to rm
+ */
+X(thumb_movs)
+{
+	uint32_t x = reg(ic->arg[1]);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+X(thumb_lsl_imm)
+{
+	uint32_t x = thumb_shift(cpu, THUMB_LSL, reg(ic->arg[1]), ic->arg[2]);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+X(thumb_lsr_imm)
+{
+	uint32_t x = thumb_shift(cpu, THUMB_LSR, reg(ic->arg[1]), ic->arg[2]);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+X(thumb_asr_imm)
+{
+	uint32_t x = thumb_shift(cpu, THUMB_ASR, reg(ic->arg[1]), ic->arg[2]);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+X(thumb_adds)
+{
+	reg(ic->arg[0]) = thumb_add_with_carry(cpu, reg(ic->arg[1]),
+	    reg(ic->arg[2]), 0);
+}
+X(thumb_subs)
+{
+	reg(ic->arg[0]) = thumb_add_with_carry(cpu, reg(ic->arg[1]),
+	    ~reg(ic->arg[2]), 1);
+}
+X(thumb_adds_imm)
+{
+	reg(ic->arg[0]) = thumb_add_with_carry(cpu, reg(ic->arg[1]),
+	    ic->arg[2], 0);
+}
+X(thumb_subs_imm)
+{
+	reg(ic->arg[0]) = thumb_add_with_carry(cpu, reg(ic->arg[1]),
+	    ~(uint32_t)ic->arg[2], 1);
+}
+X(thumb_movs_imm)
+{
+	reg(ic->arg[0]) = ic->arg[2];
+	thumb_flags_nz(cpu, ic->arg[2]);
+}
+X(thumb_cmp_imm)
+{
+	thumb_add_with_carry(cpu, reg(ic->arg[0]), ~(uint32_t)ic->arg[2], 1);
+}
+
+
+/*
+ *  mov_imm:  Set a register, without updating the flags. (Used for
+ *            pc-relative loads from the same page.)
+ *
+ *  arg[0] = pointer to rd
+ *  arg[2] = value
+ */
+X(thumb_mov_imm)
+{
+	reg(ic->arg[0]) = ic->arg[2];
+}
+
+
+/*
+ *  add_imm_noflags:  add rd,sp,#imm  and  add/sub sp,#imm
+ *
+ *  arg[0] = pointer to rd
+ *  arg[1] = pointer to sp
+ *  arg[2] = immediate value (negative for sub)
+ */
+X(thumb_add_imm_noflags)
+{
+	reg(ic->arg[0]) = reg(ic->arg[1]) + (uint32_t)ic->arg[2];
+}
+
+
+/*
+ *  ALU operations:
+ *
+ *  arg[0] = pointer to rd
+ *  arg[1] = pointer to rs
+ */
+X(thumb_ands)
+{
+	uint32_t x = reg(ic->arg[0]) & reg(ic->arg[1]);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+X(thumb_eors)
+{
+	uint32_t x = reg(ic->arg[0]) ^ reg(ic->arg[1]);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+X(thumb_lsls)
+{
+	uint32_t x = thumb_shift(cpu, THUMB_LSL, reg(ic->arg[0]),
+	    reg(ic->arg[1]) & 0xff);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+X(thumb_lsrs)
+{
+	uint32_t x = thumb_shift(cpu, THUMB_LSR, reg(ic->arg[0]),
+	    reg(ic->arg[1]) & 0xff);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+X(thumb_asrs)
+{
+	uint32_t x = thumb_shift(cpu, THUMB_ASR, reg(ic->arg[0]),
+	    reg(ic->arg[1]) & 0xff);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+X(thumb_adcs)
+{
+	reg(ic->arg[0]) = thumb_add_with_carry(cpu, reg(ic->arg[0]),
+	    reg(ic->arg[1]), THUMB_CARRY);
+}
+X(thumb_sbcs)
+{
+	reg(ic->arg[0]) = thumb_add_with_carry(cpu, reg(ic->arg[0]),
+	    ~reg(ic->arg[1]), THUMB_CARRY);
+}
+X(thumb_rors)
+{
+	uint32_t x = thumb_shift(cpu, THUMB_ROR, reg(ic->arg[0]),
+	    reg(ic->arg[1]) & 0xff);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+X(thumb_tst)
+{
+	thumb_flags_nz(cpu, reg(ic->arg[0]) & reg(ic->arg[1]));
+}
+X(thumb_negs)
+{
+	reg(ic->arg[0]) = thumb_add_with_carry(cpu, 0, ~reg(ic->arg[1]), 1);
+}
+X(thumb_cmp)
+{
+	thumb_add_with_carry(cpu, reg(ic->arg[0]), ~reg(ic->arg[1]), 1);
+}
+X(thumb_cmn)
+{
+	thumb_add_with_carry(cpu, reg(ic->arg[0]), reg(ic->arg[1]), 0);
+}
+X(thumb_orrs)
+{
+	uint32_t x = reg(ic->arg[0]) | reg(ic->arg[1]);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+X(thumb_muls)
+{
+	uint32_t x = reg(ic->arg[0]) * reg(ic->arg[1]);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+X(thumb_bics)
+{
+	uint32_t x = reg(ic->arg[0]) & ~reg(ic->arg[1]);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+X(thumb_mvns)
+{
+	uint32_t x = ~reg(ic->arg[1]);
+	reg(ic->arg[0]) = x;
+	thumb_flags_nz(cpu, x);
+}
+
+static void (*thumb_alu_instr[16])(struct cpu *, struct arm_instr_call *) = {
+	instr(thumb_ands), instr(thumb_eors), instr(thumb_lsls),
+	instr(thumb_lsrs), instr(thumb_asrs), instr(thumb_adcs),
+	instr(thumb_sbcs), instr(thumb_rors), instr(thumb_tst),
+	instr(thumb_negs), instr(thumb_cmp), instr(thumb_cmn),
+	instr(thumb_orrs), instr(thumb_muls), instr(thumb_bics),
+	instr(thumb_mvns) };
+
+
+/*
+ *  Sign/zero extension and byte reversal (ARMv6):
+ *
+ *  arg[0] = pointer to rd
+ *  arg[1] = pointer to rm
+ */
+X(thumb_sxth) { reg(ic->arg[0]) = (int32_t)(int16_t)reg(ic->arg[1]); }
+X(thumb_sxtb) { reg(ic->arg[0]) = (int32_t)(int8_t)reg(ic->arg[1]); }
+X(thumb_uxth) { reg(ic->arg[0]) = (uint16_t)reg(ic->arg[1]); }
+X(thumb_uxtb) { reg(ic->arg[0]) = (uint8_t)reg(ic->arg[1]); }
+X(thumb_rev)
+{
+	uint32_t x = reg(ic->arg[1]);
+	reg(ic->arg[0]) = (x >> 24) | ((x >> 8) & 0xff00) |
+	    ((x << 8) & 0xff0000) | (x << 24);
+}
+X(thumb_rev16)
+{
+	uint32_t x = reg(ic->arg[1]);
+	reg(ic->arg[0]) = ((x >> 8) & 0x00ff00ff) | ((x << 8) & 0xff00ff00);
+}
+X(thumb_revsh)
+{
+	uint32_t x = reg(ic->arg[1]);
+	reg(ic->arg[0]) = (int32_t)(int16_t)(((x >> 8) & 0xff) | (x << 8));
+}
+
+
+/*
+ *  Hi register operations, which do not update the flags:
+ *
+ *  arg[0] = pointer to rd
+ *  arg[1] = pointer to rm, or an offset from the start of the half page
+ */
+X(thumb_add)
+{
+	reg(ic->arg[0]) += reg(ic->arg[1]);
+}
+X(thumb_mov)
+{
+	reg(ic->arg[0]) = reg(ic->arg[1]);
+}
+X(thumb_add_pcrel)
+{
+	reg(ic->arg[0]) += THUMB_BASE + ic->arg[1];
+}
+X(thumb_mov_pcrel)
+{
+	reg(ic->arg[0]) = THUMB_BASE + ic->arg[1];
+}
+
+
+/*
+ *  add_to_pc:  add pc,rm
+ *  mov_pc:     mov pc,rm  (mov_pc_trace: mov pc,lr with trace enabled)
+ *
+ *  arg[0] = pointer to rm
+ *  arg[1] = offset of the instruction + 4, from the start of the half page
+ */
+X(thumb_add_to_pc)
+{
+	cpu->pc = (THUMB_BASE + ic->arg[1] + reg(ic->arg[0])) | 1;
+	quick_pc_to_pointers_arm(cpu);
+}
+X(thumb_mov_pc)
+{
+	cpu->pc = reg(ic->arg[0]) | 1;
+	quick_pc_to_pointers_arm(cpu);
+}
+X(thumb_mov_pc_trace)
+{
+	cpu->pc = reg(ic->arg[0]) | 1;
+	cpu_functioncall_trace_return(cpu);
+	quick_pc_to_pointers_arm(cpu);
+}
+
+
+/*
+ *  bx:        Branch, switching to ARM mode if bit 0 of rm is clear.
+ *  bx_trace:  bx lr, with trace enabled.
+ *  bx_pc:     bx pc, i.e. switch to ARM mode.
+ *  blx:       Branch and link, switching to ARM mode if bit 0 of rm is clear.
+ *
+ *  arg[0] = pointer to rm  (bx_pc: offset of the ARM code from the start
+ *           of the half page)
+ *  arg[1] = offset of the next instruction, from the start of the half page
+ */
+X(thumb_bx)
+{
+	thumb_branch_exchange(cpu, reg(ic->arg[0]));
+}
+X(thumb_bx_trace)
+{
+	uint32_t target = cpu->cd.arm.r[ARM_LR];
+	cpu_functioncall_trace_return(cpu);
+	thumb_branch_exchange(cpu, target);
+}
+X(thumb_bx_pc)
+{
+	cpu->pc = THUMB_BASE + ic->arg[0];
+	cpu->cd.arm.cpsr &= ~ARM_FLAG_T;
+	quick_pc_to_pointers_arm(cpu);
+}
+X(thumb_blx)
+{
+	uint32_t target = reg(ic->arg[0]);
+	cpu->cd.arm.r[ARM_LR] = (THUMB_BASE + ic->arg[1]) | 1;
+	if (cpu->machine->show_trace_tree)
+		cpu_functioncall_trace(cpu, target & ~1);
+	thumb_branch_exchange(cpu, target);
+}
+
+
+/*
+ *  Loads and stores:
+ *
+ *  arg[0] = pointer to rd
+ *  arg[1] = pointer to rn (the base register)
+ *  arg[2] = pointer to rm, or an immediate offset
+ */
+#define	THUMB_LOAD(n, len, cast, ofs)					\
+	X(n) {								\
+		uint32_t v;						\
+		if (thumb_load(cpu, ic, reg(ic->arg[1]) + (ofs), len, &v))\
+			reg(ic->arg[0]) = cast v;			\
+	}
+#define	THUMB_STORE(n, len, ofs)					\
+	X(n) {								\
+		thumb_store(cpu, ic, reg(ic->arg[1]) + (ofs), len,	\
+		    reg(ic->arg[0]));					\
+	}
+
+THUMB_LOAD(thumb_ldr_reg, 4, , reg(ic->arg[2]))
+THUMB_LOAD(thumb_ldrh_reg, 2, , reg(ic->arg[2]))
+THUMB_LOAD(thumb_ldrb_reg, 1, , reg(ic->arg[2]))
+THUMB_LOAD(thumb_ldrsh_reg, 2, (int32_t)(int16_t), reg(ic->arg[2]))
+THUMB_LOAD(thumb_ldrsb_reg, 1, (int32_t)(int8_t), reg(ic->arg[2]))
+THUMB_LOAD(thumb_ldr_imm, 4, , ic->arg[2])
+THUMB_LOAD(thumb_ldrh_imm, 2, , ic->arg[2])
+THUMB_LOAD(thumb_ldrb_imm, 1, , ic->arg[2])
+THUMB_STORE(thumb_str_reg, 4, reg(ic->arg[2]))
+THUMB_STORE(thumb_strh_reg, 2, reg(ic->arg[2]))
+THUMB_STORE(thumb_strb_reg, 1, reg(ic->arg[2]))
+THUMB_STORE(thumb_str_imm, 4, ic->arg[2])
+THUMB_STORE(thumb_strh_imm, 2, ic->arg[2])
+THUMB_STORE(thumb_strb_imm, 1, ic->arg[2])
+
+
+/*
+ *  ldr_pcrel:  Load from a pc-relative address on another page.
+ *
+ *  arg[0] = pointer to rd
+ *  arg[1] = offset of the word, from the start of the half page
+ */
+X(thumb_ldr_pcrel)
+{
+	uint32_t v;
+	if (thumb_load(cpu, ic, THUMB_BASE + ic->arg[1], 4, &v))
+		reg(ic->arg[0]) = v;
+}
+
+
+/*
+ *  push, pop, stmia, ldmia:
+ *
+ *  arg[0] = register list (push, pop), or pointer to rn (stmia, ldmia)
+ *  arg[1] = register list (stmia, ldmia)
+ *  arg[2] = whether to write back rn (ldmia)
+ */
+X(thumb_push)
+{
+	THUMB_SYNCH_PC;
+	arm_push(cpu, &cpu->cd.arm.r[ARM_SP], 1, 0, 0, 1, ic->arg[0]);
+}
+X(thumb_pop)
+{
+	THUMB_SYNCH_PC;
+	arm_pop(cpu, &cpu->cd.arm.r[ARM_SP], 0, 1, 0, 1, ic->arg[0]);
+}
+X(thumb_stmia)
+{
+	THUMB_SYNCH_PC;
+	arm_push(cpu, (uint32_t *) ic->arg[0], 0, 1, 0, 1, ic->arg[1]);
+}
+X(thumb_ldmia)
+{
+	THUMB_SYNCH_PC;
+	arm_pop(cpu, (uint32_t *) ic->arg[0], 0, 1, 0, ic->arg[2], ic->arg[1]);
+}
+
+
+/*
+ *  b:  Branch (to a different half page)
+ *
+ *  arg[0] = target address + 1, relative to the start of the half page
+ */
+X(thumb_b)
+{
+	cpu->pc = THUMB_BASE + (uint32_t)ic->arg[0];
+
+	/*  Find the new physical page and update the translation pointers:  */
+	quick_pc_to_pointers_arm(cpu);
+}
+Y(thumb_b)
+
+
+/*
+ *  bl_prefix:  The first half of a bl or blx instruction pair.
+ *
+ *  arg[0] = offset of the instruction + 4 + the high part of the branch
+ *           offset, relative to the start of the half page
+ */
+X(thumb_bl_prefix)
+{
+	cpu->cd.arm.r[ARM_LR] = THUMB_BASE + (uint32_t)ic->arg[0];
+}
+
+
+/*
+ *  bl_suffix, blx_suffix:  The second half of a bl or blx instruction pair.
+ *
+ *  arg[0] = the low part of the branch offset
+ *  arg[1] = offset of the next instruction, from the start of the half page
+ */
+X(thumb_bl_suffix)
+{
+	uint32_t target = cpu->cd.arm.r[ARM_LR] + ic->arg[0];
+	cpu->cd.arm.r[ARM_LR] = (THUMB_BASE + ic->arg[1]) | 1;
+	cpu->pc = target | 1;
+	if (cpu->machine->show_trace_tree)
+		cpu_functioncall_trace(cpu, target & ~1);
+	quick_pc_to_pointers_arm(cpu);
+}
+X(thumb_blx_suffix)
+{
+	uint32_t target = (cpu->cd.arm.r[ARM_LR] + ic->arg[0]) & ~3;
+	cpu->cd.arm.r[ARM_LR] = (THUMB_BASE + ic->arg[1]) | 1;
+	cpu->cd.arm.cpsr &= ~ARM_FLAG_T;
+	cpu->pc = target;
+	if (cpu->machine->show_trace_tree)
+		cpu_functioncall_trace(cpu, target);
+	quick_pc_to_pointers_arm(cpu);
+}
+
+
+/*
+ *  bl, bl_samepage, blx:  A bl or blx instruction pair, combined into one.
+ *
+ *  arg[0] = target address, relative to the start of the half page
+ *  arg[1] = offset of the instruction after the pair, from the start of
+ *           the half page
+ *  arg[2] = pointer to the target arm_instr_call (bl_samepage)
+ */
+X(thumb_bl)
+{
+	uint32_t base = THUMB_BASE;
+	cpu->cd.arm.r[ARM_LR] = (base + ic->arg[1]) | 1;
+	cpu->pc = (base + (uint32_t)ic->arg[0]) | 1;
+	cpu->n_translated_instrs ++;
+	if (cpu->machine->show_trace_tree)
+		cpu_functioncall_trace(cpu, cpu->pc & ~1);
+	quick_pc_to_pointers_arm(cpu);
+}
+X(thumb_bl_samepage)
+{
+	cpu->cd.arm.r[ARM_LR] = (THUMB_BASE + ic->arg[1]) | 1;
+	cpu->n_translated_instrs ++;
+	cpu->cd.arm.next_ic = (struct arm_instr_call *) ic->arg[2];
+}
+X(thumb_blx_imm)
+{
+	uint32_t base = THUMB_BASE;
+	cpu->cd.arm.r[ARM_LR] = (base + ic->arg[1]) | 1;
+	cpu->pc = (base + (uint32_t)ic->arg[0]) & ~3;
+	cpu->cd.arm.cpsr &= ~ARM_FLAG_T;
+	cpu->n_translated_instrs ++;
+	if (cpu->machine->show_trace_tree)
+		cpu_functioncall_trace(cpu, cpu->pc);
+	quick_pc_to_pointers_arm(cpu);
+}
+
+
+/*
+ *  swi, und, bkpt:  Exceptions.
+ */
+X(thumb_swi)
+{
+	THUMB_SYNCH_PC;
+	arm_exception(cpu, ARM_EXCEPTION_SWI);
+}
+X(thumb_und)
+{
+	THUMB_SYNCH_PC;
+	arm_exception(cpu, ARM_EXCEPTION_UND);
+}
+X(thumb_bkpt)
+{
+	THUMB_SYNCH_PC;
+	arm_exception(cpu, ARM_EXCEPTION_PREF_ABT);
+}
+
+
+/*
+ *  cps:  Change the A, I, and F bits of the cpsr (ARMv6).
+ *
+ *  arg[0] = the bits to change
+ *  arg[1] = 1 to set the bits (disable), 0 to clear them (enable)
+ */
+X(thumb_cps)
+{
+	if ((cpu->cd.arm.cpsr & ARM_FLAG_MODE) == ARM_MODE_USR32)
+		return;
+
+	if (ic->arg[1])
+		cpu->cd.arm.cpsr |= ic->arg[0];
+	else
+		cpu->cd.arm.cpsr &= ~ic->arg[0];
+}
+
+
+X(thumb_end_of_page)
+{
+	/*  Update the PC:  (offset 0, but on the next half page)  */
+	cpu->pc = THUMB_BASE + ARM_THUMB_PAGESIZE + 1;
+
+	/*  Find the new physical page and update the translation pointers:  */
+	quick_pc_to_pointers_arm(cpu);
+
+	/*  end_of_page doesn't count as an executed instruction:  */
+	cpu->n_translated_instrs --;
+}
+
+
+/*****************************************************************************/
+
+
+/*
+ *  Compare (or subtract), followed by a conditional branch within the same
+ *  half page. ic[1] is the branch, one of the b_samepage instructions.
+ */
+X(thumb_cmp_imm_b_samepage)
+{
+	thumb_add_with_carry(cpu, reg(ic->arg[0]), ~(uint32_t)ic->arg[2], 1);
+	cpu->n_translated_instrs ++;
+	ic[1].f(cpu, &ic[1]);
+}
+X(thumb_cmp_imm_beq_samepage)
+{
+	thumb_add_with_carry(cpu, reg(ic->arg[0]), ~(uint32_t)ic->arg[2], 1);
+	cpu->n_translated_instrs ++;
+	cpu->cd.arm.next_ic = (struct arm_instr_call *)
+	    ic[1].arg[cpu->cd.arm.flags & ARM_F_Z? 0 : 1];
+}
+X(thumb_cmp_imm_bne_samepage)
+{
+	thumb_add_with_carry(cpu, reg(ic->arg[0]), ~(uint32_t)ic->arg[2], 1);
+	cpu->n_translated_instrs ++;
+	cpu->cd.arm.next_ic = (struct arm_instr_call *)
+	    ic[1].arg[cpu->cd.arm.flags & ARM_F_Z? 1 : 0];
+}
+X(thumb_cmp_b_samepage)
+{
+	thumb_add_with_carry(cpu, reg(ic->arg[0]), ~reg(ic->arg[1]), 1);
+	cpu->n_translated_instrs ++;
+	ic[1].f(cpu, &ic[1]);
+}
+X(thumb_tst_b_samepage)
+{
+	thumb_flags_nz(cpu, reg(ic->arg[0]) & reg(ic->arg[1]));
+	cpu->n_translated_instrs ++;
+	ic[1].f(cpu, &ic[1]);
+}
+X(thumb_subs_imm_b_samepage)
+{
+	reg(ic->arg[0]) = thumb_add_with_carry(cpu, reg(ic->arg[1]),
+	    ~(uint32_t)ic->arg[2], 1);
+	cpu->n_translated_instrs ++;
+	ic[1].f(cpu, &ic[1]);
+}
+
+
+/*
+ *  Combine: thumb_cmp_b():
+ *
+ *  A conditional branch within the same half page, preceded by an
+ *  instruction which sets the flags.
+ */
+void COMBINE(thumb_cmp_b)(struct cpu *cpu,
+	struct arm_instr_call *ic, int low_addr)
+{
+	int n_back = (low_addr & (ARM_THUMB_PAGESIZE - 1))
+	    >> ARM_THUMB_INSTR_ALIGNMENT_SHIFT;
+	if (n_back < 1)
+		return;
+
+	if (ic[-1].f == instr(thumb_cmp_imm)) {
+		if (ic[0].f == instr(b_samepage__eq))
+			ic[-1].f = instr(thumb_cmp_imm_beq_samepage);
+		else if (ic[0].f == instr(b_samepage__ne))
+			ic[-1].f = instr(thumb_cmp_imm_bne_samepage);
+		else
+			ic[-1].f = instr(thumb_cmp_imm_b_samepage);
+	} else if (ic[-1].f == instr(thumb_cmp))
+		ic[-1].f = instr(thumb_cmp_b_samepage);
+	else if (ic[-1].f == instr(thumb_tst))
+		ic[-1].f = instr(thumb_tst_b_samepage);
+	else if (ic[-1].f == instr(thumb_subs_imm))
+		ic[-1].f = instr(thumb_subs_imm_b_samepage);
+}
+
+
+/*
+ *  Combine: thumb_bl():
+ *
+ *  A bl or blx suffix, preceded by its prefix. The pair is replaced by a
+ *  single instruction at the prefix.
+ */
+void COMBINE(thumb_bl)(struct cpu *cpu,
+	struct arm_instr_call *ic, int low_addr)
+{
+	int n_back = (low_addr & (ARM_THUMB_PAGESIZE - 1))
+	    >> ARM_THUMB_INSTR_ALIGNMENT_SHIFT;
+	uint32_t target;
+
+	if (n_back < 1 || ic[-1].f != instr(thumb_bl_prefix))
+		return;
+
+	target = (uint32_t)ic[-1].arg[0] + (uint32_t)ic[0].arg[0];
+	ic[-1].arg[0] = target;
+	ic[-1].arg[1] = ic[0].arg[1];
+
+	if (ic[0].f == instr(thumb_blx_suffix)) {
+		ic[-1].f = instr(thumb_blx_imm);
+	} else if (target < ARM_THUMB_PAGESIZE &&
+	    !cpu->machine->show_trace_tree) {
+		ic[-1].arg[2] = (size_t) (cpu->cd.arm.cur_ic_page +
+		    (target >> ARM_THUMB_INSTR_ALIGNMENT_SHIFT));
+		ic[-1].f = instr(thumb_bl_samepage);
+	} else
+		ic[-1].f = instr(thumb_bl);
+}
+
+
+/*****************************************************************************/
+
+
+/*
+ *  arm_thumb_pc_to_pointers():
+ *
+ *  Like arm_pc_to_pointers(), but for Thumb mode: Finds (or creates) the
+ *  Thumb translation page for the half page that cpu->pc is in, and sets
+ *  the current translation page pointers to it.
+ */
+void arm_thumb_pc_to_pointers(struct cpu *cpu)
+{
+	struct arm_tc_physpage *ppp, *tpp;
+	int half;
+
+	ppp = cpu->cd.arm.phys_page[cpu->pc >> 12];
+	if (ppp == NULL) {
+		arm_pc_to_pointers_generic(cpu);
+
+		/*  Exceptions (e.g. a prefetch abort) switch to ARM mode:  */
+		if (!(cpu->cd.arm.cpsr & ARM_FLAG_T))
+			return;
+
+		ppp = (struct arm_tc_physpage *) cpu->cd.arm.cur_ic_page;
+	}
+
+	half = (cpu->pc & ARM_THUMB_PAGESIZE)? 1 : 0;
+	tpp = (struct arm_tc_physpage *) ppp->ics[ARM_THUMB_PAGE_LINK].arg[half];
+
+	if (tpp == NULL) {
+		if (cpu->translation_cache_cur_ofs >= dyntrans_cache_size) {
+			debugmsg(SUBSYS_CPU, "dyntrans", VERBOSITY_INFO,
+			    "resetting the translation cache");
+
+			cpu_create_or_reset_tc(cpu);
+			arm_thumb_pc_to_pointers(cpu);
+			return;
+		}
+
+		tpp = (struct arm_tc_physpage *)(cpu->translation_cache
+		    + cpu->translation_cache_cur_ofs);
+
+		memcpy(tpp, cpu->cd.arm.thumb_physpage_template,
+		    sizeof(struct arm_tc_physpage));
+		tpp->physaddr = ppp->physaddr + half * ARM_THUMB_PAGESIZE;
+		tpp->ics[ARM_THUMB_PAGE_LINK].arg[0] = (size_t) ppp;
+		ppp->ics[ARM_THUMB_PAGE_LINK].arg[half] = (size_t) tpp;
+
+		cpu->translation_cache_cur_ofs += sizeof(struct arm_tc_physpage);
+		cpu->translation_cache_cur_ofs --;
+		cpu->translation_cache_cur_ofs |= 63;
+		cpu->translation_cache_cur_ofs ++;
+	}
+
+	/*  Make sure that writes to the page are noticed:  */
+	if (ppp->translations_bitmap == 0)
+		cpu->invalidate_translation_caches(cpu, ppp->physaddr,
+		    JUST_MARK_AS_NON_WRITABLE | INVALIDATE_PADDR);
+
+	cpu->pc |= 1;
+	cpu->cd.arm.cur_ic_page = &tpp->ics[0];
+	cpu->cd.arm.next_ic = cpu->cd.arm.cur_ic_page +
+	    ARM_THUMB_PC_TO_IC_ENTRY(cpu->pc);
+}
+
+
+/*****************************************************************************/
+
+
+/*
+ *  arm_instr_thumb_to_be_translated():
+ *
+ *  Translate a Thumb instruction into an arm_instr_call. Works like
+ *  arm_instr_to_be_translated(), but with 16-bit instruction words.
+ */
+#undef	TO_BE_TRANSLATED
+#define	TO_BE_TRANSLATED	( instr(thumb_to_be_translated) )
+
+X(thumb_to_be_translated)
+{
+	uint32_t addr, low_pc, iword, imm, target;
+	unsigned char *page;
+	unsigned char ib[2];
+	int main_opcode, condition_code, rd, rs, rm, rd8;
+
+	/*  Figure out the address of the instruction:  */
+	low_pc = ((size_t)ic - (size_t)cpu->cd.arm.cur_ic_page)
+	    / sizeof(struct arm_instr_call);
+	addr = (cpu->pc & ~(ARM_THUMB_PAGESIZE - 1)) +
+	    (low_pc << ARM_THUMB_INSTR_ALIGNMENT_SHIFT);
+	cpu->pc = addr | 1;
+
+	/*  Read the instruction word from memory:  */
+	page = cpu->cd.arm.host_load[addr >> 12];
+
+	if (page != NULL) {
+		memcpy(ib, page + (addr & 0xfff), sizeof(ib));
+	} else {
+		if (!cpu->memory_rw(cpu, cpu->mem, addr, &ib[0],
+		    sizeof(ib), MEM_READ, CACHE_INSTRUCTION)) {
+			/*
+			 *  A failed MMU translation has already caused a
+			 *  prefetch abort, which leaves Thumb mode. Other
+			 *  failures, such as a failed device read, cause one
+			 *  here, unless the emulator was stopped.
+			 */
+			if (!cpu->running) {
+				cpu->cd.arm.next_ic = &nothing_call;
+				return;
+			}
+			if (cpu->cd.arm.cpsr & ARM_FLAG_T)
+				arm_exception(cpu, ARM_EXCEPTION_PREF_ABT);
+			return;
+		}
+	}
+
+	if (cpu->byte_order == EMUL_LITTLE_ENDIAN)
+		iword = ib[0] + (ib[1]<<8);
+	else
+		iword = ib[1] + (ib[0]<<8);
+
+
+#define DYNTRANS_TO_BE_TRANSLATED_HEAD
+#include "cpu_dyntrans.c"
+#undef  DYNTRANS_TO_BE_TRANSLATED_HEAD
+
+
+	main_opcode = iword >> 12;
+	condition_code = (iword >> 8) & 15;
+	rd  = iword & 7;
+	rs  = (iword >> 3) & 7;
+	rm  = (iword >> 6) & 7;
+	rd8 = (iword >> 8) & 7;
+
+	/*
+	 *  Translate the instruction:
+	 */
+
+	switch (main_opcode) {
+
+	case 0x0:
+	case 0x1:
+		ic->arg[0] = (size_t)(&cpu->cd.arm.r[rd]);
+		ic->arg[1] = (size_t)(&cpu->cd.arm.r[rs]);
+		imm = (iword >> 6) & 31;
+		switch ((iword >> 11) & 3) {
+		case 0:	/*  lsls rd,rs,#imm  */
+			ic->f = imm == 0? instr(thumb_movs) :
+			    instr(thumb_lsl_imm);
+			ic->arg[2] = imm;
+			break;
+		case 1:	/*  lsrs rd,rs,#imm  (0 means 32)  */
+			ic->f = instr(thumb_lsr_imm);
+			ic->arg[2] = imm == 0? 32 : imm;
+			break;
+		case 2:	/*  asrs rd,rs,#imm  (0 means 32)  */
+			ic->f = instr(thumb_asr_imm);
+			ic->arg[2] = imm == 0? 32 : imm;
+			break;
+		case 3:	/*  adds/subs rd,rs,rm  or  adds/subs rd,rs,#imm  */
+			if (iword & 0x0400) {
+				ic->f = iword & 0x0200? instr(thumb_subs_imm) :
+				    instr(thumb_adds_imm);
+				ic->arg[2] = rm;
+			} else {
+				ic->f = iword & 0x0200? instr(thumb_subs) :
+				    instr(thumb_adds);
+				ic->arg[2] = (size_t)(&cpu->cd.arm.r[rm]);
+			}
+			break;
+		}
+		break;
+
+	case 0x2:
+	case 0x3:
+		/*  movs/cmp/adds/subs rd,#imm  */
+		ic->arg[0] = ic->arg[1] = (size_t)(&cpu->cd.arm.r[rd8]);
+		ic->arg[2] = iword & 0xff;
+		switch ((iword >> 11) & 3) {
+		case 0:	ic->f = instr(thumb_movs_imm); break;
+		case 1:	ic->f = instr(thumb_cmp_imm); break;
+		case 2:	ic->f = instr(thumb_adds_imm); break;
+		case 3:	ic->f = instr(thumb_subs_imm); break;
+		}
+		break;
+
+	case 0x4:
+		if (iword & 0x0800) {
+			/*  ldr rd,[pc,#imm]  */
+			ic->arg[0] = (size_t)(&cpu->cd.arm.r[rd8]);
+			target = (addr & ~3) + 4 + (iword & 0xff) * 4;
+
+			/*  Within the same page? Then load it now:  */
+			if (page != NULL && (target & ~0xfff) == (addr & ~0xfff)) {
+				unsigned char *p = page + (target & 0xfff);
+				ic->f = instr(thumb_mov_imm);
+				if (cpu->byte_order == EMUL_LITTLE_ENDIAN)
+					ic->arg[2] = p[0] + (p[1] << 8) +
+					    (p[2] << 16) + ((uint32_t)p[3] << 24);
+				else
+					ic->arg[2] = p[3] + (p[2] << 8) +
+					    (p[1] << 16) + ((uint32_t)p[0] << 24);
+			} else {
+				ic->f = instr(thumb_ldr_pcrel);
+				ic->arg[1] = target -
+				    (addr & ~(ARM_THUMB_PAGESIZE - 1));
+			}
+			break;
+		}
+
+		if (!(iword & 0x0400)) {
+			/*  ALU operations:  */
+			ic->f = thumb_alu_instr[(iword >> 6) & 15];
+			ic->arg[0] = (size_t)(&cpu->cd.arm.r[rd]);
+			ic->arg[1] = (size_t)(&cpu->cd.arm.r[rs]);
+			break;
+		}
+
+		/*  Hi register operations, and bx/blx:  */
+		rd = (iword & 7) | ((iword >> 4) & 8);
+		rm = (iword >> 3) & 15;
+		ic->arg[0] = (size_t)(&cpu->cd.arm.r[rd]);
+		ic->arg[1] = (size_t)(&cpu->cd.arm.r[rm]);
+
+		switch ((iword >> 8) & 3) {
+		case 0:	/*  add rd,rm  */
+			if (rd == ARM_PC) {
+				if (rm == ARM_PC)
+					goto bad;
+				ic->f = instr(thumb_add_to_pc);
+				ic->arg[0] = (size_t)(&cpu->cd.arm.r[rm]);
+				ic->arg[1] = (addr & (ARM_THUMB_PAGESIZE-1)) + 4;
+			} else if (rm == ARM_PC) {
+				ic->f = instr(thumb_add_pcrel);
+				ic->arg[1] = (addr & (ARM_THUMB_PAGESIZE-1)) + 4;
+			} else
+				ic->f = instr(thumb_add);
+			break;
+		case 1:	/*  cmp rd,rm  */
+			if (rd == ARM_PC || rm == ARM_PC)
+				goto bad;
+			ic->f = instr(thumb_cmp);
+			break;
+		case 2:	/*  mov rd,rm  */
+			if (rd == ARM_PC) {
+				if (rm == ARM_PC)
+					goto bad;
+				ic->f = instr(thumb_mov_pc);
+				if (rm == ARM_LR && cpu->machine->show_trace_tree)
+					ic->f = instr(thumb_mov_pc_trace);
+				ic->arg[0] = (size_t)(&cpu->cd.arm.r[rm]);
+			} else if (rm == ARM_PC) {
+				ic->f = instr(thumb_mov_pcrel);
+				ic->arg[1] = (addr & (ARM_THUMB_PAGESIZE-1)) + 4;
+			} else if (rd == rm)
+				ic->f = instr(nop);
+			else
+				ic->f = instr(thumb_mov);
+			break;
+		case 3:	/*  bx rm  or  blx rm  */
+			ic->arg[0] = (size_t)(&cpu->cd.arm.r[rm]);
+			ic->arg[1] = (addr & (ARM_THUMB_PAGESIZE-1)) + 2;
+			if (iword & 0x0080) {
+				if (rm == ARM_PC)
+					goto bad;
+				ic->f = instr(thumb_blx);
+			} else if (rm == ARM_PC) {
+				ic->f = instr(thumb_bx_pc);
+				ic->arg[0] = ((addr & (ARM_THUMB_PAGESIZE-1))
+				    & ~3) + 4;
+			} else if (rm == ARM_LR &&
+			    cpu->machine->show_trace_tree)
+				ic->f = instr(thumb_bx_trace);
+			else
+				ic->f = instr(thumb_bx);
+			break;
+		}
+		break;
+
+	case 0x5:
+		/*  Load/store with register offset:  */
+		ic->arg[0] = (size_t)(&cpu->cd.arm.r[rd]);
+		ic->arg[1] = (size_t)(&cpu->cd.arm.r[rs]);
+		ic->arg[2] = (size_t)(&cpu->cd.arm.r[rm]);
+		switch ((iword >> 9) & 7) {
+		case 0:	ic->f = instr(thumb_str_reg); break;
+		case 1:	ic->f = instr(thumb_strh_reg); break;
+		case 2:	ic->f = instr(thumb_strb_reg); break;
+		case 3:	ic->f = instr(thumb_ldrsb_reg); break;
+		case 4:	ic->f = instr(thumb_ldr_reg); break;
+		case 5:	ic->f = instr(thumb_ldrh_reg); break;
+		case 6:	ic->f = instr(thumb_ldrb_reg); break;
+		case 7:	ic->f = instr(thumb_ldrsh_reg); break;
+		}
+		break;
+
+	case 0x6:
+	case 0x7:
+	case 0x8:
+		/*  Load/store word, byte, or halfword with immediate offset:  */
+		ic->arg[0] = (size_t)(&cpu->cd.arm.r[rd]);
+		ic->arg[1] = (size_t)(&cpu->cd.arm.r[rs]);
+		imm = (iword >> 6) & 31;
+		if (main_opcode == 0x6) {
+			ic->f = iword & 0x0800? instr(thumb_ldr_imm) :
+			    instr(thumb_str_imm);
+			ic->arg[2] = imm * sizeof(uint32_t);
+		} else if (main_opcode == 0x7) {
+			ic->f = iword & 0x0800? instr(thumb_ldrb_imm) :
+			    instr(thumb_strb_imm);
+			ic->arg[2] = imm;
+		} else {
+			ic->f = iword & 0x0800? instr(thumb_ldrh_imm) :
+			    instr(thumb_strh_imm);
+			ic->arg[2] = imm * sizeof(uint16_t);
+		}
+		break;
+
+	case 0x9:
+		/*  ldr/str rd,[sp,#imm]  */
+		ic->f = iword & 0x0800? instr(thumb_ldr_imm) :
+		    instr(thumb_str_imm);
+		ic->arg[0] = (size_t)(&cpu->cd.arm.r[rd8]);
+		ic->arg[1] = (size_t)(&cpu->cd.arm.r[ARM_SP]);
+		ic->arg[2] = (iword & 0xff) * sizeof(uint32_t);
+		break;
+
+	case 0xa:
+		/*  add rd,pc,#imm  or  add rd,sp,#imm  */
+		ic->arg[0] = (size_t)(&cpu->cd.arm.r[rd8]);
+		if (iword & 0x0800) {
+			ic->f = instr(thumb_add_imm_noflags);
+			ic->arg[1] = (size_t)(&cpu->cd.arm.r[ARM_SP]);
+			ic->arg[2] = (iword & 0xff) * sizeof(uint32_t);
+		} else {
+			ic->f = instr(thumb_mov_pcrel);
+			ic->arg[1] = (((addr & (ARM_THUMB_PAGESIZE-1)) + 4)
+			    & ~3) + (iword & 0xff) * sizeof(uint32_t);
+		}
+		break;
+
+	case 0xb:
+		/*  Miscellaneous:  */
+		if ((iword & 0xff00) == 0xb000) {
+			/*  add/sub sp,#imm  */
+			ic->f = instr(thumb_add_imm_noflags);
+			ic->arg[0] = ic->arg[1] =
+			    (size_t)(&cpu->cd.arm.r[ARM_SP]);
+			imm = (iword & 0x7f) * sizeof(uint32_t);
+			ic->arg[2] = iword & 0x80? (uint32_t) -imm : imm;
+		} else if ((iword & 0xf600) == 0xb400) {
+			/*  push {list,lr}  or  pop {list,pc}  */
+			if (iword & 0x0800) {
+				ic->f = instr(thumb_pop);
+				ic->arg[0] = (iword & 0xff) |
+				    (iword & 0x100? 0x8000 : 0);
+			} else {
+				ic->f = instr(thumb_push);
+				ic->arg[0] = (iword & 0xff) |
+				    (iword & 0x100? 0x4000 : 0);
+			}
+			if (ic->arg[0] == 0)
+				goto bad;
+		} else if ((iword & 0xff00) == 0xb200) {
+			/*  sxth, sxtb, uxth, uxtb  */
+			void (*f[4])(struct cpu *, struct arm_instr_call *) = {
+			    instr(thumb_sxth), instr(thumb_sxtb),
+			    instr(thumb_uxth), instr(thumb_uxtb) };
+			ic->f = f[(iword >> 6) & 3];
+			ic->arg[0] = (size_t)(&cpu->cd.arm.r[rd]);
+			ic->arg[1] = (size_t)(&cpu->cd.arm.r[rs]);
+		} else if ((iword & 0xff00) == 0xba00 &&
+		    ((iword >> 6) & 3) != 2) {
+			/*  rev, rev16, revsh  */
+			ic->f = ((iword >> 6) & 3) == 0? instr(thumb_rev) :
+			    ((iword >> 6) & 3) == 1? instr(thumb_rev16) :
+			    instr(thumb_revsh);
+			ic->arg[0] = (size_t)(&cpu->cd.arm.r[rd]);
+			ic->arg[1] = (size_t)(&cpu->cd.arm.r[rs]);
+		} else if ((iword & 0xffe8) == 0xb660) {
+			/*  cpsie/cpsid  */
+			ic->f = instr(thumb_cps);
+			ic->arg[0] = (iword & 4? ARM_FLAG_A : 0) |
+			    (iword & 2? ARM_FLAG_I : 0) |
+			    (iword & 1? ARM_FLAG_F : 0);
+			ic->arg[1] = iword & 0x10? 1 : 0;
+		} else if ((iword & 0xff00) == 0xbe00) {
+			ic->f = instr(thumb_bkpt);
+		} else if ((iword & 0xff8f) == 0xbf00 &&
+		    (iword & 0x70) <= 0x40) {
+			/*  nop, yield, wfe, wfi, sev: treat as nop.  */
+			ic->f = instr(nop);
+		} else
+			goto bad;
+		break;
+
+	case 0xc:
+		/*  stmia/ldmia rn!,{list}  */
+		if ((iword & 0xff) == 0)
+			goto bad;
+		ic->arg[0] = (size_t)(&cpu->cd.arm.r[rd8]);
+		ic->arg[1] = iword & 0xff;
+		if (iword & 0x0800) {
+			ic->f = instr(thumb_ldmia);
+			/*  No writeback if rn is loaded:  */
+			ic->arg[2] = (iword & (1 << rd8))? 0 : 1;
+		} else
+			ic->f = instr(thumb_stmia);
+		break;
+
+	case 0xd:
+		if (condition_code == 0xe) {
+			ic->f = instr(thumb_und);
+			break;
+		}
+		if (condition_code == 0xf) {
+			ic->f = instr(thumb_swi);
+			break;
+		}
+
+		/*  Conditional branch:  */
+		target = addr + 4 + ((int32_t)(int8_t)(iword & 0xff) << 1);
+		goto branch;
+
+	case 0xe:
+		if (iword & 0x0800) {
+			/*  Second half of blx (ARMv5):  */
+			if (iword & 1)
+				goto bad;
+			ic->f = instr(thumb_blx_suffix);
+			ic->arg[0] = (iword & 0x7ff) << 1;
+			ic->arg[1] = (addr & (ARM_THUMB_PAGESIZE-1)) + 2;
+			cpu->cd.arm.combination_check = COMBINE(thumb_bl);
+			break;
+		}
+
+		/*  Unconditional branch:  */
+		condition_code = 0xe;
+		target = addr + 4 + ((int32_t)((iword & 0x7ff) << 21) >> 20);
+
+branch:
+		if ((target & ~(ARM_THUMB_PAGESIZE - 1)) ==
+		    (addr & ~(ARM_THUMB_PAGESIZE - 1))) {
+			/*  Within the same half page:  */
+			ic->f = arm_cond_instr_b_samepage[condition_code];
+			ic->arg[0] = (size_t) (cpu->cd.arm.cur_ic_page +
+			    ((target & (ARM_THUMB_PAGESIZE - 1)) >>
+			    ARM_THUMB_INSTR_ALIGNMENT_SHIFT));
+			ic->arg[1] = (size_t) (ic + 1);
+			if (condition_code != 0xe)
+				cpu->cd.arm.combination_check =
+				    COMBINE(thumb_cmp_b);
+		} else {
+			ic->f = cond_instr(thumb_b);
+			ic->arg[0] = (int32_t)(target + 1 -
+			    (addr & ~(ARM_THUMB_PAGESIZE - 1)));
+		}
+		break;
+
+	case 0xf:
+		if (iword & 0x0800) {
+			/*  Second half of bl:  */
+			ic->f = instr(thumb_bl_suffix);
+			ic->arg[0] = (iword & 0x7ff) << 1;
+			ic->arg[1] = (addr & (ARM_THUMB_PAGESIZE-1)) + 2;
+			cpu->cd.arm.combination_check = COMBINE(thumb_bl);
+		} else {
+			/*  First half of bl or blx:  */
+			ic->f = instr(thumb_bl_prefix);
+			ic->arg[0] = (int32_t)((addr & (ARM_THUMB_PAGESIZE-1))
+			    + 4 + ((int32_t)((iword & 0x7ff) << 21) >> 9));
+		}
+		break;
+
+	default:goto bad;
+	}
+
+	/*
+	 *  Writes to the page are detected through the ARM translation page,
+	 *  so mark it as containing a translation here:
+	 */
+	((struct arm_tc_physpage *) cpu->cd.arm.cur_ic_page[
+	    ARM_THUMB_PAGE_LINK].arg[0])->translations_bitmap |=
+	    1 << ((addr & 0xfff) >> 7);
+
+#define	DYNTRANS_TO_BE_TRANSLATED_TAIL
+#include "cpu_dyntrans.c"
+#undef	DYNTRANS_TO_BE_TRANSLATED_TAIL
+}
+
+#undef	TO_BE_TRANSLATED
+#define	TO_BE_TRANSLATED	( instr(to_be_translated) )
+
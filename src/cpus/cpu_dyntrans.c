@@ -47,6 +47,12 @@ static void gather_statistics(struct cpu *cpu)
 	uint64_t a;
 	int low_pc = ((size_t)cpu->cd.DYNTRANS_ARCH.next_ic - (size_t)
 	    cpu->cd.DYNTRANS_ARCH.cur_ic_page) / sizeof(struct DYNTRANS_IC);
+	int shift = DYNTRANS_INSTR_ALIGNMENT_SHIFT;
+
+#ifdef DYNTRANS_ARM
+	if (cpu->cd.arm.cpsr & ARM_FLAG_T)
+		shift = ARM_THUMB_INSTR_ALIGNMENT_SHIFT;
+#endif
 
 	if (cpu->machine->statistics.file == NULL) {
 		fatal("statistics gathering with no filename set is"
@@ -74,9 +80,8 @@ static void gather_statistics(struct cpu *cpu)
 			cpu->cd.DYNTRANS_ARCH.cur_physpage = (struct DYNTRANS_TC_PHYSPAGE *)
 			    cpu->cd.DYNTRANS_ARCH.cur_ic_page;
 			a = cpu->cd.DYNTRANS_ARCH.cur_physpage->physaddr;
-			a &= ~((DYNTRANS_IC_ENTRIES_PER_PAGE-1) <<
-			    DYNTRANS_INSTR_ALIGNMENT_SHIFT);
-			a += low_pc << DYNTRANS_INSTR_ALIGNMENT_SHIFT;
+			a &= ~((DYNTRANS_IC_ENTRIES_PER_PAGE-1) << shift);
+			a += low_pc << shift;
 			if (cpu->is_32bit)
 				snprintf(buf + strlen(buf), sizeof(buf),
 				    "0x%08" PRIx32, (uint32_t)a);
@@ -87,9 +92,8 @@ static void gather_statistics(struct cpu *cpu)
 		case 'v':
 			/*  Virtual program counter address:  */
 			a = cpu->pc;
-			a &= ~((DYNTRANS_IC_ENTRIES_PER_PAGE-1) <<
-			    DYNTRANS_INSTR_ALIGNMENT_SHIFT);
-			a += low_pc << DYNTRANS_INSTR_ALIGNMENT_SHIFT;
+			a &= ~((DYNTRANS_IC_ENTRIES_PER_PAGE-1) << shift);
+			a += low_pc << shift;
 			if (cpu->is_32bit)
 				snprintf(buf + strlen(buf), sizeof(buf),
 				    "0x%08" PRIx32, (uint32_t)a);
@@ -97,6 +101,34 @@ static void gather_statistics(struct cpu *cpu)
 				snprintf(buf + strlen(buf), sizeof(buf),
 				    "0x%016" PRIx64, (uint64_t)a);
 			break;
+		case 'w':
+			/*  The instruction word itself:  */
+			a = cpu->pc;
+			a &= ~((DYNTRANS_IC_ENTRIES_PER_PAGE-1) << shift);
+			a += low_pc << shift;
+			{
+				unsigned char ib[4];
+				uint32_t iword = 0;
+				int j, len = 1 << shift;
+
+				if (len > (int) sizeof(ib))
+					len = sizeof(ib);
+
+				if (!cpu->memory_rw(cpu, cpu->mem, a, ib, len,
+				    MEM_READ, CACHE_INSTRUCTION | NO_EXCEPTIONS)) {
+					strlcat(buf, "?", sizeof(buf));
+					break;
+				}
+
+				for (j=0; j<len; j++)
+					iword |= (uint32_t) ib[cpu->byte_order
+					    == EMUL_BIG_ENDIAN? j : len-1-j] <<
+					    (8 * (len-1-j));
+
+				snprintf(buf + strlen(buf), sizeof(buf) -
+				    strlen(buf), "0x%0*" PRIx32, len * 2, iword);
+			}
+			break;
 		}
 		i++;
 	}
@@ -251,17 +283,6 @@ int DYNTRANS_RUN_INSTR_DEF(struct cpu *cpu)
 #endif
 	}
 
-#ifdef DYNTRANS_ARM
-	if (cpu->cd.arm.cpsr & ARM_FLAG_T) {
-		// fatal("THUMB execution not implemented.\n");
-		// cpu->running = false;
-		// return 0;
-		
-		arm_cpu_interpret_thumb_SLOW(cpu);
-		return 1;
-	}
-#endif
-
 	cached_pc = cpu->pc;
 
 	cpu->n_translated_instrs = 0;
@@ -269,7 +290,46 @@ int DYNTRANS_RUN_INSTR_DEF(struct cpu *cpu)
 	cpu->cd.DYNTRANS_ARCH.cur_physpage = (struct DYNTRANS_TC_PHYSPAGE *)
 	    cpu->cd.DYNTRANS_ARCH.cur_ic_page;
 
-	if (single_step || cpu->machine->instruction_trace
+	if (single_step && cpu->step_budget > 1 &&
+	    !cpu->machine->instruction_trace && !cpu->machine->register_dump) {
+		/*
+		 *  Multiple single-steps ("step n"), without disassembly:
+		 *
+		 *  The budget is charged with the number of emulated
+		 *  instructions, as counted in n_translated_instrs, so that
+		 *  pseudo-instructions (such as end_of_page) are not counted
+		 *  as steps. The last step is left for the normal single-step
+		 *  code below, so that it gets disassembled. Stop early if
+		 *  something wants to break out of the dyntrans loop (e.g. a
+		 *  breakpoint, which also clears step_budget).
+		 */
+		int64_t n = cpu->step_budget - 1;
+		if (n > N_SAFE_DYNTRANS_LIMIT)
+			n = N_SAFE_DYNTRANS_LIMIT;
+
+		while (cpu->n_translated_instrs < n) {
+			struct DYNTRANS_IC *ic;
+			int64_t before = cpu->n_translated_instrs;
+
+			if (cpu->machine->statistics.enabled)
+				S;
+
+			I;
+
+			cpu->n_translated_instrs ++;
+
+			if (cpu->step_budget > 0) {
+				cpu->step_budget -= (cpu->n_translated_instrs &
+				    ~N_BREAK_OUT_OF_DYNTRANS_LOOP) - before;
+				if (cpu->step_budget < 0)
+					cpu->step_budget = 0;
+			}
+
+			if (cpu->n_translated_instrs &
+			    N_BREAK_OUT_OF_DYNTRANS_LOOP || !cpu->running)
+				break;
+		}
+	} else if (single_step || cpu->machine->instruction_trace
 	    || cpu->machine->register_dump) {
 		/*
 		 *  Single-step:
@@ -284,8 +344,15 @@ int DYNTRANS_RUN_INSTR_DEF(struct cpu *cpu)
 			    any instruction for any ISA:  */
 			unsigned char instr[1 <<
 			    DYNTRANS_INSTR_ALIGNMENT_SHIFT];
+			size_t instr_len = sizeof(instr);
+#ifdef DYNTRANS_ARM
+			if (cpu->cd.arm.cpsr & ARM_FLAG_T) {
+				cached_pc &= ~1;
+				instr_len = sizeof(uint16_t);
+			}
+#endif
 			if (!cpu->memory_rw(cpu, cpu->mem, cached_pc, &instr[0],
-			    sizeof(instr), MEM_READ, CACHE_INSTRUCTION)) {
+			    instr_len, MEM_READ, CACHE_INSTRUCTION)) {
 				fatal("XXX_run_instr(): could not read "
 				    "the instruction\n");
 			} else {
@@ -325,6 +392,15 @@ int DYNTRANS_RUN_INSTR_DEF(struct cpu *cpu)
 		I;
 
 		cpu->n_translated_instrs ++;
+
+		/*  n_translated_instrs started at 0, so this charges the
+		    emulated instructions, as in the "step n" loop above:  */
+		if (cpu->step_budget > 0) {
+			cpu->step_budget -= cpu->n_translated_instrs &
+			    ~N_BREAK_OUT_OF_DYNTRANS_LOOP;
+			if (cpu->step_budget < 0)
+				cpu->step_budget = 0;
+		}
 	} else if (cpu->machine->statistics.enabled) {
 		/*  Gather statistics while executing multiple instructions:  */
 		for (;;) {
@@ -390,6 +466,16 @@ int DYNTRANS_RUN_INSTR_DEF(struct cpu *cpu)
 	/*  Synchronize the program counter:  */
 	low_pc = ((size_t)cpu->cd.DYNTRANS_ARCH.next_ic - (size_t)
 	    cpu->cd.DYNTRANS_ARCH.cur_ic_page) / sizeof(struct DYNTRANS_IC);
+#ifdef DYNTRANS_ARM
+	if (cpu->cd.arm.cpsr & ARM_FLAG_T) {
+		/*  Thumb pages have one entry per halfword:  */
+		if (low_pc >= 0 && low_pc <= ARM_IC_ENTRIES_PER_PAGE) {
+			cpu->pc &= ~(ARM_THUMB_PAGESIZE - 1);
+			cpu->pc += (low_pc << ARM_THUMB_INSTR_ALIGNMENT_SHIFT)
+			    + 1;
+		}
+	} else
+#endif
 	if (low_pc >= 0 && low_pc < DYNTRANS_IC_ENTRIES_PER_PAGE) {
 		cpu->pc &= ~((DYNTRANS_IC_ENTRIES_PER_PAGE-1) <<
 		    DYNTRANS_INSTR_ALIGNMENT_SHIFT);
@@ -857,6 +943,13 @@ void DYNTRANS_PC_TO_POINTERS_FUNC(struct cpu *cpu)
 	    cached_pc = cpu->pc;
 	struct DYNTRANS_TC_PHYSPAGE *ppp;
 
+#ifdef DYNTRANS_ARM
+	if (cpu->cd.arm.cpsr & ARM_FLAG_T) {
+		arm_thumb_pc_to_pointers(cpu);
+		return;
+	}
+#endif
+
 #ifdef MODE32
 	int index;
 	index = DYNTRANS_ADDR_TO_PAGENR(cached_pc);
@@ -903,6 +996,10 @@ have_it:
 /*  forward declaration of to_be_translated and end_of_page:  */
 static void instr(to_be_translated)(struct cpu *, struct DYNTRANS_IC *);
 static void instr(end_of_page)(struct cpu *,struct DYNTRANS_IC *);
+#ifdef DYNTRANS_ARM
+static void instr(thumb_to_be_translated)(struct cpu *, struct DYNTRANS_IC *);
+static void instr(thumb_end_of_page)(struct cpu *,struct DYNTRANS_IC *);
+#endif
 #ifdef DYNTRANS_DUALMODE_32
 static void instr32(to_be_translated)(struct cpu *, struct DYNTRANS_IC *);
 static void instr32(end_of_page)(struct cpu *,struct DYNTRANS_IC *);
@@ -965,6 +1062,22 @@ void DYNTRANS_INIT_TABLES(struct cpu *cpu)
 	    instr(end_of_page2);
 #endif
 
+#ifdef DYNTRANS_ARM
+	/*  No Thumb translation pages yet:  */
+	memset(&ppp->ics[ARM_THUMB_PAGE_LINK], 0, sizeof(struct DYNTRANS_IC));
+
+	/*  Default Thumb translation page:  */
+	CHECK_ALLOCATION(cpu->cd.arm.thumb_physpage_template =
+	    (struct DYNTRANS_TC_PHYSPAGE *) malloc(sizeof(struct DYNTRANS_TC_PHYSPAGE)));
+	memcpy(cpu->cd.arm.thumb_physpage_template, ppp,
+	    sizeof(struct DYNTRANS_TC_PHYSPAGE));
+	for (i=0; i<DYNTRANS_IC_ENTRIES_PER_PAGE; i++)
+		cpu->cd.arm.thumb_physpage_template->ics[i].f =
+		    instr(thumb_to_be_translated);
+	cpu->cd.arm.thumb_physpage_template->ics[
+	    DYNTRANS_IC_ENTRIES_PER_PAGE].f = instr(thumb_end_of_page);
+#endif
+
 	cpu->cd.DYNTRANS_ARCH.physpage_template = ppp;
 
 
@@ -1436,6 +1549,20 @@ void DYNTRANS_INVALIDATE_TC_CODE(struct cpu *cpu, uint64_t addr, int flags)
 				physpage_ranges->next_ofs = 0;
 				physpage_ranges->n_entries_used = 0;
 			}
+
+#ifdef DYNTRANS_ARM
+			/*  ... and the same for the Thumb translations:  */
+			for (i=0; i<2; i++) {
+				struct DYNTRANS_TC_PHYSPAGE *tpp =
+				    (struct DYNTRANS_TC_PHYSPAGE *)
+				    ppp->ics[ARM_THUMB_PAGE_LINK].arg[i];
+				if (tpp != NULL)
+					memcpy(tpp->ics, cpu->cd.arm.
+					    thumb_physpage_template->ics,
+					    sizeof(struct DYNTRANS_IC) *
+					    DYNTRANS_IC_ENTRIES_PER_PAGE);
+			}
+#endif
 		}
 #endif
 	}
@@ -1490,6 +1617,7 @@ void DYNTRANS_UPDATE_TRANSLATION_TABLE(struct cpu *cpu, uint64_t vaddr_page,
 	unsigned char *host_page, int writeflag, uint64_t paddr_page)
 {
 	int found, r, useraccess = 0;
+	unsigned char *load_page = host_page;
 
 #ifdef MODE32
 	uint32_t index;
@@ -1534,6 +1662,31 @@ void DYNTRANS_UPDATE_TRANSLATION_TABLE(struct cpu *cpu, uint64_t vaddr_page,
 		return;
 #endif
 
+	/*
+	 *  Pages with data watchpoints are not mapped in the watched
+	 *  direction(s), so that those accesses go through the slow
+	 *  memory_rw() path, where they are checked. E.g. loads from a page
+	 *  with only a write watchpoint still run at full speed.
+	 */
+	if (cpu->machine->breakpoints.n_watchpoints > 0) {
+		int wflags = watchpoints_page_flags(cpu->machine, vaddr_page,
+		    DYNTRANS_PAGESIZE,
+#ifdef MODE32
+		    true
+#else
+		    cpu->is_32bit
+#endif
+		    );
+
+		if ((wflags & (WATCHPOINT_READ | WATCHPOINT_WRITE)) ==
+		    (WATCHPOINT_READ | WATCHPOINT_WRITE))
+			return;
+		if (wflags & WATCHPOINT_READ)
+			load_page = NULL;
+		if (wflags & WATCHPOINT_WRITE)
+			writeflag = 0;
+	}
+
 	/*  Scan the current TLB entries:  */
 
 #ifdef MODE32
@@ -1587,7 +1740,7 @@ void DYNTRANS_UPDATE_TRANSLATION_TABLE(struct cpu *cpu, uint64_t vaddr_page,
 		/*  Add the new translation to the table:  */
 #ifdef MODE32
 		index = DYNTRANS_ADDR_TO_PAGENR(vaddr_page);
-		cpu->cd.DYNTRANS_ARCH.host_load[index] = host_page;
+		cpu->cd.DYNTRANS_ARCH.host_load[index] = load_page;
 		cpu->cd.DYNTRANS_ARCH.host_store[index] =
 		    writeflag? host_page : NULL;
 		cpu->cd.DYNTRANS_ARCH.phys_addr[index] = paddr_page;
@@ -1647,7 +1800,7 @@ void DYNTRANS_UPDATE_TRANSLATION_TABLE(struct cpu *cpu, uint64_t vaddr_page,
 			exit(1);
 		}
 
-		l3->host_load[x3] = host_page;
+		l3->host_load[x3] = load_page;
 		l3->host_store[x3] = writeflag? host_page : NULL;
 		l3->phys_addr[x3] = paddr_page;
 		l3->phys_page[x3] = NULL;
@@ -1707,7 +1860,7 @@ void DYNTRANS_UPDATE_TRANSLATION_TABLE(struct cpu *cpu, uint64_t vaddr_page,
 				cpu->cd.DYNTRANS_ARCH.host_store[index] = NULL;
 		} else {
 			/*  Change the entire physical/host mapping:  */
-			cpu->cd.DYNTRANS_ARCH.host_load[index] = host_page;
+			cpu->cd.DYNTRANS_ARCH.host_load[index] = load_page;
 			cpu->cd.DYNTRANS_ARCH.host_store[index] =
 			    writeflag? host_page : NULL;
 			cpu->cd.DYNTRANS_ARCH.phys_addr[index] = paddr_page;
@@ -1726,7 +1879,7 @@ void DYNTRANS_UPDATE_TRANSLATION_TABLE(struct cpu *cpu, uint64_t vaddr_page,
 				l3->host_store[x3] = NULL;
 		} else {
 			/*  Change the entire physical/host mapping:  */
-			l3->host_load[x3] = host_page;
+			l3->host_load[x3] = load_page;
 			l3->host_store[x3] = writeflag? host_page : NULL;
 			l3->phys_addr[x3] = paddr_page;
 		}
@@ -1770,16 +1923,516 @@ cpu->cd.DYNTRANS_ARCH.vph_tlb_entry[r].valid);
 /*****************************************************************************/
 
 
+#ifdef DYNTRANS_IDLE_LOOP
+/*
+ *  Automatic idle loop detection:
+ *
+ *  Guest operating systems often idle by spinning in a short loop, waiting
+ *  for a variable in memory or a device register to change. When the last
+ *  instruction of such a loop has been translated, COMBINE(idle_loop) checks
+ *  that no instruction in the loop has side effects (stores, calls, etc.),
+ *  and that no register value is carried over from one iteration to the
+ *  next, which rules out delay loops and pointer chasing. If the loop
+ *  passes, its branch is replaced by instr(idle_loop), which lets the host
+ *  idle once the loop has spun IDLE_LOOP_MIN_ITERATIONS times in a row.
+ *
+ *  The architecture provides two functions:
+ *
+ *  COMBINE(idle_loop_branch)(cpu, ic, n_back, &target, &delayed) returns
+ *	the branch (back to target, within the same page) which ends at
+ *	the newly translated ic, or NULL. If ic is the delay slot of the
+ *	branch, *delayed is set to true.
+ *
+ *  COMBINE(idle_loop_instr)(cpu, ic, &regs) returns false if ic may have
+ *	side effects. Otherwise, it fills in the registers that ic reads
+ *	and writes.
+ *
+ *  COMBINE(idle_loop_interrupts_enabled)(cpu) returns true if the CPU
+ *	currently accepts interrupts. With interrupts disabled, nothing
+ *	but another CPU or a device register can end the loop, so the
+ *	host does not idle.
+ */
+
+#define	IDLE_LOOP_HASH(ic)	((((size_t)(ic)) / sizeof(struct DYNTRANS_IC)) \
+				    % N_IDLE_LOOPS)
+
+
+/*
+ *  idle_loop:  The branch of an automatically detected idle loop.
+ *
+ *  Executes the original branch instruction. If the branch went back to the
+ *  start of the loop, then the loop's iteration count is increased, and once
+ *  it reaches IDLE_LOOP_MIN_ITERATIONS, the dyntrans loop is left with
+ *  wants_to_idle set, unless interrupts are disabled. (next_ic still points
+ *  to the start of the loop.)
+ */
+X(idle_loop)
+{
+	struct idle_loop *l = &cpu->idle_loops[IDLE_LOOP_HASH(ic)];
+
+	if (l->ic != (void *) ic) {
+		/*  The slot has been reused. Translate the branch again.  */
+		ic->f = instr(to_be_translated);
+		ic->f(cpu, ic);
+		return;
+	}
+
+	((void (*)(struct cpu *, struct DYNTRANS_IC *)) l->f)(cpu, ic);
+
+	if (cpu->cd.DYNTRANS_ARCH.next_ic != l->target_ic ||
+	    !cpu->machine->idle_loop_detection) {
+		l->iterations = 0;
+		return;
+	}
+
+	l->n_iterations ++;
+	if (++ l->iterations < IDLE_LOOP_MIN_ITERATIONS)
+		return;
+
+	l->iterations = 0;
+
+	if (!COMBINE(idle_loop_interrupts_enabled)(cpu))
+		return;
+
+	l->n_idle ++;
+
+	cpu->wants_to_idle = true;
+	cpu_break_out_of_dyntrans_loop(cpu);
+}
+
+
+/*
+ *  COMBINE(idle_loop):
+ *
+ *  Called from DYNTRANS_TO_BE_TRANSLATED_TAIL for every translated
+ *  instruction (after the architecture's own combination check).
+ */
+void COMBINE(idle_loop)(struct cpu *cpu, struct DYNTRANS_IC *ic,
+	uint64_t addr)
+{
+	int n_back = (addr >> DYNTRANS_INSTR_ALIGNMENT_SHIFT)
+	    & (DYNTRANS_IC_ENTRIES_PER_PAGE - 1);
+	struct idle_loop_regs regs[IDLE_LOOP_MAX_INSTRS];
+	struct DYNTRANS_IC *branch, *target = NULL;
+	struct idle_loop *l;
+	bool delayed = false;
+	uint64_t pc;
+	int i, j, k, n;
+
+	branch = COMBINE(idle_loop_branch)(cpu, ic, n_back, &target, &delayed);
+	if (branch == NULL || target == NULL || target > branch ||
+	    branch - target > n_back)
+		return;
+
+	/*  Instructions following a non-delayed branch are skipped by it.  */
+	n = (delayed? ic : branch) - target + 1;
+	if (ic - target + 1 > IDLE_LOOP_MAX_INSTRS)
+		return;
+
+	for (i = 0; i < n; i++) {
+		memset(&regs[i], 0, sizeof(regs[i]));
+		if (!COMBINE(idle_loop_instr)(cpu, target + i, &regs[i]))
+			return;
+	}
+
+	/*
+	 *  A register which is written somewhere in the loop must not be read
+	 *  before it has been written in the same iteration. Otherwise, each
+	 *  iteration depends on the one before (e.g. a counter).
+	 */
+	for (i = 0; i < n; i++)
+		for (j = 0; j < regs[i].n_reads; j++) {
+			size_t r = regs[i].reads[j];
+			bool written_before = false, written = false;
+
+			for (k = 0; k < n; k++) {
+				int w;
+				for (w = 0; w < regs[k].n_writes; w++)
+					if (regs[k].writes[w] == r) {
+						written = true;
+						if (k < i)
+							written_before = true;
+					}
+			}
+
+			if (written && !written_before)
+				return;
+		}
+
+	l = &cpu->idle_loops[IDLE_LOOP_HASH(branch)];
+	if (l->ic != NULL && l->ic != (void *) branch &&
+	    ((struct DYNTRANS_IC *) l->ic)->f == instr(idle_loop))
+		return;
+
+	pc = addr - ((uint64_t)(ic - target) << DYNTRANS_INSTR_ALIGNMENT_SHIFT);
+	if (l->pc != pc || l->n_instrs != ic - target + 1) {
+		memset(l, 0, sizeof(struct idle_loop));
+		l->pc = pc;
+		l->n_instrs = ic - target + 1;
+
+		debugmsg_cpu(cpu, SUBSYS_CPU, "idle", VERBOSITY_DEBUG,
+		    "idle loop at 0x%" PRIx64", %i instructions", pc,
+		    l->n_instrs);
+	}
+
+	l->ic = branch;
+	l->target_ic = target;
+	l->f = (void (*)(struct cpu *, void *)) branch->f;
+	l->iterations = 0;
+
+	branch->f = instr(idle_loop);
+}
+
+/*  Tells DYNTRANS_TO_BE_TRANSLATED_TAIL to call COMBINE(idle_loop):  */
+#define	DYNTRANS_IDLE_LOOP_DETECTION
+
+#endif	/*  DYNTRANS_IDLE_LOOP  */
+
+
+/*****************************************************************************/
+
+
+#ifdef DYNTRANS_GUEST_ROUTINES
+/*
+ *  Accelerated guest routines (see src/core/guest_routines.c):
+ *
+ *  When the entry instruction of one of the machine's guest_routines is
+ *  translated, COMBINE(guest_routine) replaces it with instr(guest_routine),
+ *  which carries out the whole routine on the host and returns directly to
+ *  the caller. If any page involved is not directly accessible via the
+ *  host_load/host_store tables, the original entry instruction is run
+ *  instead, i.e. the guest's own code takes care of it.
+ *
+ *  The calling convention: Arguments are taken from GUEST_ROUTINE_ARG(n),
+ *  the return value is placed in GUEST_ROUTINE_RETVAL, and execution
+ *  continues at GUEST_ROUTINE_RETADDR.
+ *
+ *  The routines are looked up by virtual address, and are meant to be kernel
+ *  routines. On M88K, userspace has an address space of its own, so there
+ *  GUEST_ROUTINE_USERSPACE keeps user code from being matched.
+ */
+#ifdef DYNTRANS_ARM
+#define	GUEST_ROUTINE_ARG(n)	cpu->cd.arm.r[n]
+#define	GUEST_ROUTINE_RETVAL	cpu->cd.arm.r[0]
+#define	GUEST_ROUTINE_RETADDR	cpu->cd.arm.r[ARM_LR]
+#define	GUEST_ROUTINE_USERSPACE	false
+#endif
+#ifdef DYNTRANS_M88K
+#define	GUEST_ROUTINE_ARG(n)	cpu->cd.m88k.r[2 + (n)]
+#define	GUEST_ROUTINE_RETVAL	cpu->cd.m88k.r[2]
+#define	GUEST_ROUTINE_RETADDR	cpu->cd.m88k.r[M88K_RETURN_REG]
+#define	GUEST_ROUTINE_USERSPACE	\
+	(!(cpu->cd.m88k.cr[M88K_CR_PSR] & M88K_PSR_MODE))
+#endif
+#ifdef DYNTRANS_MIPS
+#define	GUEST_ROUTINE_ARG(n)	cpu->cd.mips.gpr[MIPS_GPR_A0 + (n)]
+#define	GUEST_ROUTINE_RETVAL	cpu->cd.mips.gpr[MIPS_GPR_V0]
+#define	GUEST_ROUTINE_RETADDR	cpu->cd.mips.gpr[MIPS_GPR_RA]
+#define	GUEST_ROUTINE_USERSPACE	false
+#endif
+
+#ifdef MODE32
+#define	GUEST_ROUTINE_32BIT	true
+#else
+#define	GUEST_ROUTINE_32BIT	false
+#endif
+
+#define	GUEST_ROUTINE_PAGEMASK	(DYNTRANS_PAGESIZE - 1)
+
+
+/*
+ *  COMBINE(guest_routine_page):
+ *
+ *  Returns the host page that a guest page is mapped to for direct reads
+ *  (or writes), or NULL.
+ */
+static unsigned char *COMBINE(guest_routine_page)(struct cpu *cpu,
+	MODE_uint_t addr, bool writeflag)
+{
+#ifdef MODE32
+	uint32_t index = DYNTRANS_ADDR_TO_PAGENR(addr);
+
+	return writeflag? cpu->cd.DYNTRANS_ARCH.host_store[index] :
+	    cpu->cd.DYNTRANS_ARCH.host_load[index];
+#else
+	const uint32_t mask1 = (1 << DYNTRANS_L1N) - 1;
+	const uint32_t mask2 = (1 << DYNTRANS_L2N) - 1;
+	const uint32_t mask3 = (1 << DYNTRANS_L3N) - 1;
+	uint32_t x1 = (addr >> (64-DYNTRANS_L1N)) & mask1;
+	uint32_t x2 = (addr >> (64-DYNTRANS_L1N-DYNTRANS_L2N)) & mask2;
+	uint32_t x3 = (addr >> (64-DYNTRANS_L1N-DYNTRANS_L2N-DYNTRANS_L3N))
+	    & mask3;
+	struct DYNTRANS_L3_64_TABLE *l3 =
+	    cpu->cd.DYNTRANS_ARCH.l1_64[x1]->l3[x2];
+
+	return writeflag? l3->host_store[x3] : l3->host_load[x3];
+#endif
+}
+
+
+/*
+ *  COMBINE(guest_routine_mapped):
+ *
+ *  Returns true if all of [addr, addr + len) can be accessed directly.
+ */
+static bool COMBINE(guest_routine_mapped)(struct cpu *cpu, MODE_uint_t addr,
+	uint64_t len, bool writeflag)
+{
+	MODE_uint_t end = addr + len, page;
+
+	if (len > GUEST_ROUTINE_MAX_LEN || end < addr)
+		return false;
+
+	for (page = addr & ~(MODE_uint_t) GUEST_ROUTINE_PAGEMASK; page < end;
+	    page += DYNTRANS_PAGESIZE)
+		if (COMBINE(guest_routine_page)(cpu, page, writeflag) == NULL)
+			return false;
+
+	return true;
+}
+
+
+/*
+ *  COMBINE(guest_routine_copy):
+ *
+ *  Copies len bytes from src to dst, one page-sized chunk at a time. The
+ *  areas may overlap; if dst is above src, then the copy is done from the
+ *  end, like memmove().
+ */
+static void COMBINE(guest_routine_copy)(struct cpu *cpu, MODE_uint_t dst,
+	MODE_uint_t src, uint64_t len)
+{
+	bool backwards = dst > src && dst - src < len;
+
+	while (len > 0) {
+		MODE_uint_t d = dst, s = src;
+		size_t n;
+
+		if (backwards) {
+			d += len - 1;
+			s += len - 1;
+			n = len;
+			if ((d & GUEST_ROUTINE_PAGEMASK) + 1 < n)
+				n = (d & GUEST_ROUTINE_PAGEMASK) + 1;
+			if ((s & GUEST_ROUTINE_PAGEMASK) + 1 < n)
+				n = (s & GUEST_ROUTINE_PAGEMASK) + 1;
+			d -= n - 1;
+			s -= n - 1;
+		} else {
+			n = len;
+			if (DYNTRANS_PAGESIZE - (d & GUEST_ROUTINE_PAGEMASK) < n)
+				n = DYNTRANS_PAGESIZE - (d & GUEST_ROUTINE_PAGEMASK);
+			if (DYNTRANS_PAGESIZE - (s & GUEST_ROUTINE_PAGEMASK) < n)
+				n = DYNTRANS_PAGESIZE - (s & GUEST_ROUTINE_PAGEMASK);
+			dst += n;
+			src += n;
+		}
+
+		memmove(COMBINE(guest_routine_page)(cpu, d, true) +
+		    (d & GUEST_ROUTINE_PAGEMASK),
+		    COMBINE(guest_routine_page)(cpu, s, false) +
+		    (s & GUEST_ROUTINE_PAGEMASK), n);
+
+		len -= n;
+	}
+}
+
+
+/*
+ *  COMBINE(guest_routine_call):
+ *
+ *  Carries out a guest routine call on the host. Returns false (without
+ *  having changed anything) if the guest's own code has to be used.
+ */
+static bool COMBINE(guest_routine_call)(struct cpu *cpu,
+	struct guest_routine *r)
+{
+	MODE_uint_t a0 = GUEST_ROUTINE_ARG(0), a1 = GUEST_ROUTINE_ARG(1);
+	MODE_uint_t a2 = GUEST_ROUTINE_ARG(2);
+	unsigned char *page;
+	uint64_t len = 0;
+
+#ifdef DYNTRANS_DELAYSLOT
+	if (cpu->delay_slot != NOT_DELAYED)
+		return false;
+#endif
+#ifdef DYNTRANS_ARM
+	/*  Returning to Thumb code is left to the guest.  */
+	if (GUEST_ROUTINE_RETADDR & 1)
+		return false;
+#endif
+
+	switch (r->kind) {
+
+	case GUEST_ROUTINE_MEMCPY:
+	case GUEST_ROUTINE_MEMMOVE:
+	case GUEST_ROUTINE_BCOPY:
+		if (r->kind == GUEST_ROUTINE_BCOPY) {
+			MODE_uint_t tmp = a0;
+			a0 = a1;
+			a1 = tmp;
+		}
+
+		len = a2;
+		if (!COMBINE(guest_routine_mapped)(cpu, a1, len, false) ||
+		    !COMBINE(guest_routine_mapped)(cpu, a0, len, true))
+			return false;
+
+		COMBINE(guest_routine_copy)(cpu, a0, a1, len);
+
+		if (r->kind != GUEST_ROUTINE_BCOPY)
+			GUEST_ROUTINE_RETVAL = GUEST_ROUTINE_ARG(0);
+		break;
+
+	case GUEST_ROUTINE_MEMSET:
+	case GUEST_ROUTINE_BZERO:
+		len = r->kind == GUEST_ROUTINE_BZERO? a1 : a2;
+		if (!COMBINE(guest_routine_mapped)(cpu, a0, len, true))
+			return false;
+
+		for (uint64_t done = 0; done < len; ) {
+			MODE_uint_t d = a0 + done;
+			size_t n = DYNTRANS_PAGESIZE - (d & GUEST_ROUTINE_PAGEMASK);
+
+			if (n > len - done)
+				n = len - done;
+
+			page = COMBINE(guest_routine_page)(cpu, d, true);
+			memset(page + (d & GUEST_ROUTINE_PAGEMASK),
+			    r->kind == GUEST_ROUTINE_BZERO? 0 : a1 & 0xff, n);
+			done += n;
+		}
+
+		if (r->kind == GUEST_ROUTINE_MEMSET)
+			GUEST_ROUTINE_RETVAL = GUEST_ROUTINE_ARG(0);
+		break;
+
+	case GUEST_ROUTINE_STRLEN:
+		for (;;) {
+			size_t n = DYNTRANS_PAGESIZE -
+			    ((a0 + len) & GUEST_ROUTINE_PAGEMASK);
+			unsigned char *p, *nul;
+
+			page = COMBINE(guest_routine_page)(cpu, a0 + len, false);
+			if (page == NULL || len > GUEST_ROUTINE_MAX_LEN)
+				return false;
+
+			p = page + ((a0 + len) & GUEST_ROUTINE_PAGEMASK);
+			nul = (unsigned char *) memchr(p, 0, n);
+			if (nul != NULL) {
+				len += nul - p;
+				break;
+			}
+
+			len += n;
+		}
+
+		GUEST_ROUTINE_RETVAL = len;
+		break;
+
+	default:
+		return false;
+	}
+
+	r->n_calls ++;
+	r->n_bytes += len;
+
+	/*  Roughly one instruction per word, for the emulated clock:  */
+	cpu->n_translated_instrs += len / sizeof(uint32_t);
+
+	cpu->pc = GUEST_ROUTINE_RETADDR;
+	return true;
+}
+
+
+/*
+ *  guest_routine:  The entry instruction of an accelerated guest routine.
+ */
+X(guest_routine)
+{
+	MODE_uint_t pc = cpu->pc & ~(((MODE_uint_t) DYNTRANS_IC_ENTRIES_PER_PAGE
+	    - 1) << DYNTRANS_INSTR_ALIGNMENT_SHIFT);
+	struct guest_routine *r;
+
+	pc += (MODE_uint_t) (ic - cpu->cd.DYNTRANS_ARCH.cur_ic_page)
+	    << DYNTRANS_INSTR_ALIGNMENT_SHIFT;
+
+	r = guest_routines_lookup(cpu->machine, pc, GUEST_ROUTINE_32BIT);
+	if (r == NULL || r->f == NULL || GUEST_ROUTINE_USERSPACE) {
+		/*  The same code at some other address, or in another
+		    address space. Translate it again.  */
+		ic->f = instr(to_be_translated);
+		ic->f(cpu, ic);
+		return;
+	}
+
+	if (!COMBINE(guest_routine_call)(cpu, r)) {
+		r->n_fallbacks ++;
+		((void (*)(struct cpu *, struct DYNTRANS_IC *)) r->f)(cpu, ic);
+		return;
+	}
+
+	quick_pc_to_pointers(cpu);
+}
+
+
+/*
+ *  COMBINE(guest_routine):
+ *
+ *  Called from DYNTRANS_TO_BE_TRANSLATED_TAIL for every translated
+ *  instruction, when the machine has accelerated guest routines.
+ */
+void COMBINE(guest_routine)(struct cpu *cpu, struct DYNTRANS_IC *ic,
+	uint64_t addr)
+{
+	struct guest_routine *r;
+
+#ifdef DYNTRANS_ARM
+	if (cpu->cd.arm.cpsr & ARM_FLAG_T)
+		return;
+#endif
+
+	if (GUEST_ROUTINE_USERSPACE)
+		return;
+
+	r = guest_routines_lookup(cpu->machine, addr, GUEST_ROUTINE_32BIT);
+	if (r == NULL || ic->f == instr(guest_routine))
+		return;
+
+	r->f = (void (*)(struct cpu *, void *)) ic->f;
+	ic->f = instr(guest_routine);
+}
+
+#undef	GUEST_ROUTINE_ARG
+#undef	GUEST_ROUTINE_RETVAL
+#undef	GUEST_ROUTINE_RETADDR
+#undef	GUEST_ROUTINE_USERSPACE
+#undef	GUEST_ROUTINE_32BIT
+#undef	GUEST_ROUTINE_PAGEMASK
+
+/*  Tells DYNTRANS_TO_BE_TRANSLATED_TAIL to call COMBINE(guest_routine):  */
+#define	DYNTRANS_GUEST_ROUTINE_HOOK
+
+#endif	/*  DYNTRANS_GUEST_ROUTINES  */
+
+
+/*****************************************************************************/
+
+
 #ifdef DYNTRANS_TO_BE_TRANSLATED_HEAD
 	bool breakpoint_hit = false;
 
 	/*
 	 *  Check for breakpoints.
 	 */
-	if (!single_step_breakpoint && !cpu->translation_readahead) {
+	if (!single_step_breakpoint && !cpu->translation_readahead &&
+	    cpu->machine->breakpoints.n_addr_bp > 0) {
 		MODE_uint_t curpc = cpu->pc;
-		for (size_t i = 0; i < cpu->machine->breakpoints.n_addr_bp; i++) {
-			struct address_breakpoint *bp = &cpu->machine->breakpoints.addr_bp[i];
+		size_t i = cpu->machine->breakpoints.addr_bp_hash[
+		    BREAKPOINTS_HASH(curpc)];
+		while (i != 0) {
+			struct address_breakpoint *bp = &cpu->machine->breakpoints.addr_bp[i - 1];
+			i = bp->next_in_hash;
 			if (curpc == (MODE_uint_t) bp->addr) {
 				breakpoint_hit = true;
 
@@ -1801,6 +2454,10 @@ cpu->cd.DYNTRANS_ARCH.vph_tlb_entry[r].valid);
 						single_step_breakpoint = true;
 						single_step = true;
 
+						/*  Stop any "step n" or "goto":  */
+						for (int j = 0; j < cpu->machine->ncpus; j++)
+							cpu->machine->cpus[j]->step_budget = 0;
+
 						printf("(The instruction has not yet executed.)\n");
 
 						if (!cpu->machine->instruction_trace &&
@@ -1873,6 +2530,36 @@ cpu->cd.DYNTRANS_ARCH.vph_tlb_entry[r].valid);
 
 	cpu->cd.DYNTRANS_ARCH.combination_check = NULL;
 
+#ifdef DYNTRANS_IDLE_LOOP_DETECTION
+	/*
+	 *  Does this instruction end an idle loop? This is checked after the
+	 *  architecture's combinations, so that hand-written idle loop
+	 *  combinations take precedence.
+	 */
+	if (!single_step && !cpu->machine->instruction_trace
+#ifdef DYNTRANS_DELAYSLOT
+	    && !in_crosspage_delayslot
+#endif
+	    && cpu->machine->allow_instruction_combinations
+	    && cpu->machine->idle_loop_detection)
+		COMBINE(idle_loop)(cpu, ic, addr);
+#endif
+
+#ifdef DYNTRANS_GUEST_ROUTINE_HOOK
+	/*
+	 *  Is this the entry point of an accelerated guest routine? (Not
+	 *  when tracing, since the routine's code is then skipped.)
+	 */
+	if (cpu->machine->guest_routines.n_routines > 0 && !single_step
+	    && !cpu->machine->instruction_trace
+	    && !cpu->machine->show_trace_tree && !breakpoint_hit
+#ifdef DYNTRANS_DELAYSLOT
+	    && !in_crosspage_delayslot
+#endif
+	    )
+		COMBINE(guest_routine)(cpu, ic, addr);
+#endif
+
 	/*  An additional check, to catch some bugs:  */
 	if (ic->f == TO_BE_TRANSLATED) {
 		fatal("INTERNAL ERROR: ic->f not set!\n");
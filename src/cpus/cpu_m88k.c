@@ -345,6 +345,9 @@ void m88k_cpu_tlbdump(struct cpu* cpu, int rawflag)
 
 		printf("cpu%i: CMMU %i (%s)\n", cpu_nr, cmmu_nr,
 		    cmmu_nr & 1? "data" : "instruction");
+		printf("cpu%i: %" PRIu64" BATC hits, %" PRIu64" PATC hits, %"
+		    PRIu64" table walks\n", cpu_nr, cmmu->n_batc_hits,
+		    cmmu->n_patc_hits, cmmu->n_table_walks);
 
 		/*  BATC:  */
 		for (i = 0; i < N_M88200_BATC_REGS; i++) {
@@ -2308,6 +2308,119 @@ void COMBINE(idle)(struct cpu *cpu, struct m88k_instr_call *ic, int low_addr)
 }
 
 
+/*
+ *  Idle loop detection (see DYNTRANS_IDLE_LOOP in cpu_dyntrans.c):
+ *
+ *  Only branches without delay slot can be within the same page, so the
+ *  loop always ends with the branch itself. (Loops ending with bcnd.n are
+ *  handled by COMBINE(idle) above.)
+ */
+static bool m88k_idle_loop_bcnd(void (*f)(struct cpu *,
+	struct m88k_instr_call *))
+{
+	int i;
+
+	for (i = 0; i < 32; i++)
+		if (m88k_bcnd[64 + i] != NULL && f == m88k_bcnd[64 + i])
+			return true;
+
+	return false;
+}
+
+struct m88k_instr_call *COMBINE(idle_loop_branch)(struct cpu *cpu,
+	struct m88k_instr_call *ic, int n_back,
+	struct m88k_instr_call **target, bool *delayed)
+{
+	if (ic->f == instr(br_samepage))
+		*target = (struct m88k_instr_call *) ic->arg[0];
+	else if (ic->f == instr(bb0_samepage) || ic->f == instr(bb1_samepage)
+	    || m88k_idle_loop_bcnd(ic->f))
+		*target = (struct m88k_instr_call *) ic->arg[2];
+	else
+		return NULL;
+
+	return ic;
+}
+
+
+bool COMBINE(idle_loop_instr)(struct cpu *cpu, struct m88k_instr_call *ic,
+	struct idle_loop_regs *regs)
+{
+	void (*f)(struct cpu *, struct m88k_instr_call *) = ic->f;
+	int i;
+
+	if (f == instr(nop) || f == instr(br_samepage))
+		return true;
+
+	if (f == instr(bb0_samepage) || f == instr(bb1_samepage) ||
+	    m88k_idle_loop_bcnd(f)) {
+		regs->reads[regs->n_reads++] = ic->arg[0];
+		return true;
+	}
+
+	/*  tb1 on r0 never traps. (It is used in idle loops.)  */
+	if (f == instr(tb1))
+		return ic->arg[1] == (size_t) &cpu->cd.m88k.r[M88K_ZERO_REG];
+
+	/*  Loads:  arg[0] = d, arg[1] = s1, arg[2] = imm or s2  */
+	for (i = 0; i < M88K_LOADSTORE_NO_PC_SYNC; i++) {
+		if (i & (M88K_LOADSTORE_STORE | M88K_LOADSTORE_USR) ||
+		    f != m88k_loadstore[i])
+			continue;
+
+		regs->reads[regs->n_reads++] = ic->arg[1];
+		if (i & M88K_LOADSTORE_REGISTEROFFSET)
+			regs->reads[regs->n_reads++] = ic->arg[2];
+		regs->writes[regs->n_writes++] = ic->arg[0];
+		if ((i & 3) == 3)
+			regs->writes[regs->n_writes++] = ic->arg[0] +
+			    sizeof(uint32_t);
+		return true;
+	}
+
+	if (f == instr(or_r0_imm0) || f == instr(or_r0_imm)) {
+		regs->writes[regs->n_writes++] = ic->arg[0];
+		return true;
+	}
+
+	/*  Immediate operations:  arg[0] = d, arg[1] = s1  */
+	if (f == instr(or_imm) || f == instr(xor_imm) || f == instr(and_imm) ||
+	    f == instr(and_u_imm) || f == instr(mask_imm) ||
+	    f == instr(addu_imm) || f == instr(subu_imm) ||
+	    f == instr(cmp_imm) || f == instr(extu_imm)) {
+		regs->reads[regs->n_reads++] = ic->arg[1];
+		regs->writes[regs->n_writes++] = ic->arg[0];
+		return true;
+	}
+
+	/*  Register operations:  arg[0] = d, arg[1] = s1, arg[2] = s2  */
+	if (f == instr(or) || f == instr(xor) || f == instr(and) ||
+	    f == instr(addu) || f == instr(subu) || f == instr(cmp) ||
+	    f == instr(or_r0) || f == instr(addu_s2r0)) {
+		regs->reads[regs->n_reads++] = ic->arg[1];
+		regs->reads[regs->n_reads++] = ic->arg[2];
+		regs->writes[regs->n_writes++] = ic->arg[0];
+		return true;
+	}
+
+	return false;
+}
+
+bool COMBINE(idle_loop_interrupts_enabled)(struct cpu *cpu)
+{
+	return !(cpu->cd.m88k.cr[M88K_CR_PSR] & M88K_PSR_IND);
+}
+
+#define DYNTRANS_IDLE_LOOP
+#include "cpu_dyntrans.c"
+#undef  DYNTRANS_IDLE_LOOP
+
+/*  Accelerated guest routines (see DYNTRANS_GUEST_ROUTINES in cpu_dyntrans.c):  */
+#define DYNTRANS_GUEST_ROUTINES
+#include "cpu_dyntrans.c"
+#undef  DYNTRANS_GUEST_ROUTINES
+
+
 /*****************************************************************************/
 
 
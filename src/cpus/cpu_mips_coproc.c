@@ -1034,20 +1034,18 @@ static const char *ccname[16] = {
 #define	FPU_OP_C	8
 #define	FPU_OP_ABS	9
 #define	FPU_OP_NEG	10
+#define	FPU_OP_TRUNC	11
 /*  TODO: CEIL.L, CEIL.W, FLOOR.L, FLOOR.W, RECIP, ROUND.L, ROUND.W, RSQRT  */
 
 
 /*
- *  fpu_store_float_value():
+ *  fpu_store_result():
  *
- *  Stores a float value (actually a double) in fmt format.
+ *  Stores a result (in fmt format) in register fd.
  */
-static void fpu_store_float_value(int fr_flag, struct mips_coproc *cp, int fd,
-	double nf, int fmt, int nan)
+static void fpu_store_result(int fr_flag, struct mips_coproc *cp, int fd,
+	uint64_t r, int fmt)
 {
-	int ieee_fmt = mips_fmt_to_ieee_fmt[fmt];
-	uint64_t r = ieee_store_float_value(nf, ieee_fmt);
-
 	/*
 	 *  TODO: This is for 32-bit mode. It has to be updated later
 	 *        for 64-bit coprocessor functionality!
@@ -1074,24 +1072,30 @@ static void fpu_store_float_value(int fr_flag, struct mips_coproc *cp, int fd,
 
 
 /*
- *  fpu_op():
+ *  fpu_compute():
  *
  *  Perform a floating-point operation. For those of fs and ft that are >= 0,
  *  those numbers are interpreted into local variables.
  *
- *  Only FPU_OP_C (compare) returns anything of interest, 1 for true, 0 for
- *  false.
+ *  The result (in output_fmt format) is returned in *resultp, and
+ *  *has_resultp is set if there is one to store. Nothing is written to the
+ *  registers. Only FPU_OP_C (compare) returns anything of interest, 1 for
+ *  true, 0 for false.
  */
-static int fpu_op(struct cpu *cpu, struct mips_coproc *cp, int op, int fmt,
-	int ft, int fs, int fd, int cond, int output_fmt)
+static int fpu_compute(struct cpu *cpu, struct mips_coproc *cp, int op,
+	int fmt, int ft, int fs, int cond, int output_fmt, uint64_t *resultp,
+	bool *has_resultp)
 {
 	/*  Potentially two input registers, fs and ft  */
 	struct ieee_float_value float_value[2];
-	int unordered, nan, ieee_fmt = mips_fmt_to_ieee_fmt[fmt];
+	int unordered, ieee_fmt = mips_fmt_to_ieee_fmt[fmt];
+	int output_ieee_fmt = mips_fmt_to_ieee_fmt[output_fmt];
 	uint64_t fs_v = 0;
 	double nf;
 	int fr = cpu->cd.mips.coproc[0]->reg[COP0_STATUS] & STATUS_FR ? 1 : 0;
 
+	*has_resultp = op != FPU_OP_C;
+
 	// printf("op %x (fmt %i):\n", op, fmt);
 
 	if (fs >= 0) {
@@ -1121,91 +1125,70 @@ static int fpu_op(struct cpu *cpu, struct mips_coproc *cp, int op, int fmt,
 		nf = float_value[0].f + float_value[1].f;
 		/*  debug("  add: %f + %f = %f\n",
 		    float_value[0].f, float_value[1].f, nf);  */
-		fpu_store_float_value(fr, cp, fd, nf, output_fmt,
-		    float_value[0].nan || float_value[1].nan);
+		*resultp = ieee_store_float_value(nf, output_ieee_fmt);
 		break;
 	case FPU_OP_SUB:
 		nf = float_value[0].f - float_value[1].f;
 		/*  debug("  sub: %f - %f = %f\n",
 		    float_value[0].f, float_value[1].f, nf);  */
-		fpu_store_float_value(fr, cp, fd, nf, output_fmt,
-		    float_value[0].nan || float_value[1].nan);
+		*resultp = ieee_store_float_value(nf, output_ieee_fmt);
 		break;
 	case FPU_OP_MUL:
 		nf = float_value[0].f * float_value[1].f;
 		/*  debug("  mul: %f * %f = %f\n",
 		    float_value[0].f, float_value[1].f, nf);  */
-		fpu_store_float_value(fr, cp, fd, nf, output_fmt,
-		    float_value[0].nan || float_value[1].nan);
+		*resultp = ieee_store_float_value(nf, output_ieee_fmt);
 		break;
 	case FPU_OP_DIV:
-		nan = float_value[0].nan || float_value[1].nan;
-		if (fabs(float_value[1].f) > 0.00000000001)
+		if (ieee_strict || fabs(float_value[1].f) > 0.00000000001)
 			nf = float_value[0].f / float_value[1].f;
 		else {
 			fatal("DIV by zero !!!! TODO\n");
-			nf = 0.0;	/*  TODO  */
-			nan = 1;
 			// mips_cpu_exception(cpu, EXCEPTION_FPE, 0, 0, 1, 0, 0, 0);
+			*has_resultp = false;
 			return 0;
 		}
 		/*  debug("  div: %f / %f = %f\n",
 		    float_value[0].f, float_value[1].f, nf);  */
-		fpu_store_float_value(fr, cp, fd, nf, output_fmt, nan);
+		*resultp = ieee_store_float_value(nf, output_ieee_fmt);
 		break;
 	case FPU_OP_SQRT:
-		nan = float_value[0].nan;
-		if (float_value[0].f >= 0.0)
+		if (ieee_strict || float_value[0].f >= 0.0)
 			nf = sqrt(float_value[0].f);
 		else {
 			fatal("SQRT by less than zero, %f !!!!\n",
 			    float_value[0].f);
 			nf = 0.0;	/*  TODO  */
-			nan = 1;
 		}
 		/*  debug("  sqrt: %f => %f\n", float_value[0].f, nf);  */
-		fpu_store_float_value(fr, cp, fd, nf, output_fmt, nan);
+		*resultp = ieee_store_float_value(nf, output_ieee_fmt);
 		break;
 	case FPU_OP_ABS:
 		nf = fabs(float_value[0].f);
 		/*  debug("  abs: %f => %f\n", float_value[0].f, nf);  */
-		fpu_store_float_value(fr, cp, fd, nf, output_fmt,
-		    float_value[0].nan);
+		*resultp = ieee_store_float_value(nf, output_ieee_fmt);
 		break;
 	case FPU_OP_NEG:
 		nf = - float_value[0].f;
 		/*  debug("  neg: %f => %f\n", float_value[0].f, nf);  */
-		fpu_store_float_value(fr, cp, fd, nf, output_fmt,
-		    float_value[0].nan);
+		*resultp = ieee_store_float_value(nf, output_ieee_fmt);
 		break;
 	case FPU_OP_CVT:
+	case FPU_OP_TRUNC:
 		nf = float_value[0].f;
+
+		/*  Conversion to integer is normally done by truncation,
+		    but cvt.w and cvt.l should use the rounding mode:  */
+		if (ieee_strict && op == FPU_OP_CVT &&
+		    (output_fmt == COP1_FMT_W || output_fmt == COP1_FMT_L))
+			nf = rint(nf);
+
 		/*  debug("  mov: %f => %f\n", float_value[0].f, nf);  */
-		fpu_store_float_value(fr, cp, fd, nf, output_fmt,
-		    float_value[0].nan);
+		*resultp = ieee_store_float_value(nf, output_ieee_fmt);
 		break;
 	case FPU_OP_MOV:
 		/*  Non-arithmetic move:  */
-		/*
-		 *  TODO:  this is for 32-bit mode. It has to be updated later
-		 *		for 64-bit coprocessor stuff.
-		 */
-		if (output_fmt == COP1_FMT_D || output_fmt == COP1_FMT_L) {
-			if (fr)
-				cp->reg[fd] = fs_v;
-			else {
-				cp->reg[fd] = fs_v & 0xffffffffULL;
-				cp->reg[(fd+1) & 31] = (fs_v >> 32) & 0xffffffffULL;
-				if (cp->reg[fd] & 0x80000000ULL)
-					cp->reg[fd] |= 0xffffffff00000000ULL;
-				if (cp->reg[fd+1] & 0x80000000ULL)
-					cp->reg[fd+1] |= 0xffffffff00000000ULL;
-			}
-		} else {
-			cp->reg[fd] = fs_v & 0xffffffffULL;
-			if (cp->reg[fd] & 0x80000000ULL)
-				cp->reg[fd] |= 0xffffffff00000000ULL;
-		}
+		*resultp = fs_v;
 		break;
 	case FPU_OP_C:
 		/*  debug("  c: cond=%i\n", cond);  */
@@ -1214,6 +1197,10 @@ static int fpu_op(struct cpu *cpu, struct mips_coproc *cp, int op, int fmt,
 		if (float_value[0].nan || float_value[1].nan)
 			unordered = 1;
 
+		/*  Conditions 8..15 signal an exception for NaNs:  */
+		if (ieee_strict && unordered && (cond & 8))
+			ieee_strict_raise(IEEE_EXC_INVALID);
+
 		switch (cond) {
 		case 2:	/*  Equal  */
 			return (float_value[0].f == float_value[1].f);
@@ -1258,12 +1245,70 @@ case 15:return !(float_value[0].f > float_value[1].f);	/*  Not greater than  */
 		break;
 	default:
 		fatal("fpu_op(): unimplemented op %i\n", op);
+		*has_resultp = false;
 	}
 
 	return 0;
 }
 
 
+/*
+ *  fpu_op():
+ *
+ *  Perform a floating-point operation (see fpu_compute()), and store its
+ *  result in fd. In strict IEEE mode, the operation is carried out in the
+ *  rounding mode selected in the FCSR, and the exceptions it raised are
+ *  reported in the FCSR's Cause and Flag bits. If any of them is enabled, a
+ *  Floating-Point exception is taken instead, and fd is left unchanged.
+ */
+static int fpu_op(struct cpu *cpu, struct mips_coproc *cp, int op, int fmt,
+	int ft, int fs, int fd, int cond, int output_fmt)
+{
+	uint64_t fcsr = cp->fcr[MIPS_FPU_FCSR], result = 0;
+	int fr = cpu->cd.mips.coproc[0]->reg[COP0_STATUS] & STATUS_FR ? 1 : 0;
+	int res, exceptions;
+	bool has_result;
+
+	if (!ieee_strict || op == FPU_OP_MOV) {
+		res = fpu_compute(cpu, cp, op, fmt, ft, fs, cond, output_fmt,
+		    &result, &has_result);
+		if (has_result)
+			fpu_store_result(fr, cp, fd, result, output_fmt);
+		return res;
+	}
+
+	ieee_strict_begin(fcsr & MIPS_FCSR_RM_MASK);
+	res = fpu_compute(cpu, cp, op, fmt, ft, fs, cond, output_fmt,
+	    &result, &has_result);
+	exceptions = ieee_strict_end();
+
+	/*  Host comparisons may raise Invalid even for quiet conditions:  */
+	if (op == FPU_OP_C && !(cond & 8))
+		exceptions = 0;
+
+	/*  ABS and NEG only change the sign bit:  */
+	if (op == FPU_OP_ABS || op == FPU_OP_NEG)
+		exceptions = 0;
+
+	fcsr &= ~(0x3fULL << MIPS_FCSR_CAUSE_SHIFT);
+	fcsr |= (uint64_t) exceptions << MIPS_FCSR_CAUSE_SHIFT;
+
+	if (exceptions & (fcsr >> MIPS_FCSR_ENABLES_SHIFT) & 0x1f) {
+		cp->fcr[MIPS_FPU_FCSR] = fcsr;
+		mips_cpu_exception(cpu, EXCEPTION_FPE, 0, 0, 1, 0, 0, 0);
+		return res;
+	}
+
+	fcsr |= (uint64_t) exceptions << MIPS_FCSR_FLAGS_SHIFT;
+	cp->fcr[MIPS_FPU_FCSR] = fcsr;
+
+	if (has_result)
+		fpu_store_result(fr, cp, fd, result, output_fmt);
+
+	return res;
+}
+
+
 /*
  *  fpu_function():
  *
@@ -1413,9 +1458,7 @@ static int fpu_function(struct cpu *cpu, struct mips_coproc *cp,
 		if (unassemble_only)
 			return 1;
 
-		/*  TODO: not CVT?  */
-
-		fpu_op(cpu, cp, FPU_OP_CVT, fmt, -1, fs, fd, -1, COP1_FMT_L);
+		fpu_op(cpu, cp, FPU_OP_TRUNC, fmt, -1, fs, fd, -1, COP1_FMT_L);
 		return 1;
 	}
 
@@ -1426,9 +1469,7 @@ static int fpu_function(struct cpu *cpu, struct mips_coproc *cp,
 		if (unassemble_only)
 			return 1;
 
-		/*  TODO: not CVT?  */
-
-		fpu_op(cpu, cp, FPU_OP_CVT, fmt, -1, fs, fd, -1, COP1_FMT_W);
+		fpu_op(cpu, cp, FPU_OP_TRUNC, fmt, -1, fs, fd, -1, COP1_FMT_W);
 		return 1;
 	}
 
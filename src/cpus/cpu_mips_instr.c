@@ -3485,6 +3485,138 @@ void COMBINE(b_daddiu)(struct cpu *cpu, struct mips_instr_call *ic,
 }
 
 
+/*
+ *  Idle loop detection (see DYNTRANS_IDLE_LOOP in cpu_dyntrans.c):
+ *
+ *  Only branches within the same page are considered. Normally the loop
+ *  ends with the branch's delay slot, but if the delay slot is a nop which
+ *  has been combined into the branch (beq_samepage_nop etc.), the branch
+ *  itself is the last instruction of the loop.
+ */
+struct mips_instr_call *COMBINE(idle_loop_branch)(struct cpu *cpu,
+	struct mips_instr_call *ic, int n_back,
+	struct mips_instr_call **target, bool *delayed)
+{
+	void (*f)(struct cpu *, struct mips_instr_call *);
+
+	if (n_back < 1)
+		return NULL;
+
+	f = ic[-1].f;
+	if (f == instr(beq_samepage) || f == instr(bne_samepage) ||
+	    f == instr(b_samepage) || f == instr(blez_samepage) ||
+	    f == instr(bgtz_samepage) || f == instr(bltz_samepage) ||
+	    f == instr(bgez_samepage))
+		*delayed = true;
+	else if (f != instr(beq_samepage_nop) && f != instr(bne_samepage_nop))
+		return NULL;
+
+	*target = (struct mips_instr_call *) ic[-1].arg[2];
+	return &ic[-1];
+}
+
+
+bool COMBINE(idle_loop_instr)(struct cpu *cpu, struct mips_instr_call *ic,
+	struct idle_loop_regs *regs)
+{
+	void (*f)(struct cpu *, struct mips_instr_call *) = ic->f;
+	int i;
+
+	if (f == instr(nop))
+		return true;
+
+	/*  Branches, which only read registers:  */
+	if (f == instr(b_samepage))
+		return true;
+	if (f == instr(beq_samepage) || f == instr(bne_samepage) ||
+	    f == instr(beq_samepage_nop) || f == instr(bne_samepage_nop)) {
+		regs->reads[regs->n_reads++] = ic->arg[0];
+		regs->reads[regs->n_reads++] = ic->arg[1];
+		return true;
+	}
+	if (f == instr(blez_samepage) || f == instr(bgtz_samepage) ||
+	    f == instr(bltz_samepage) || f == instr(bgez_samepage)) {
+		regs->reads[regs->n_reads++] = ic->arg[0];
+		return true;
+	}
+
+	/*  Loads:  arg[0] = rt, arg[1] = rs (base register)  */
+	for (i = 0; i < 32; i++)
+		if (!(i & 8) && f ==
+#ifdef MODE32
+		    mips32_loadstore
+#else
+		    mips_loadstore
+#endif
+		    [i]) {
+			regs->reads[regs->n_reads++] = ic->arg[1];
+			regs->writes[regs->n_writes++] = ic->arg[0];
+			return true;
+		}
+
+	if (f == instr(set)) {
+		regs->writes[regs->n_writes++] = ic->arg[0];
+		return true;
+	}
+
+	/*  Immediate operations:  arg[0] = source, arg[1] = destination  */
+	if (f == instr(addiu) || f == instr(daddiu) || f == instr(andi) ||
+	    f == instr(ori) || f == instr(xori) || f == instr(slti) ||
+	    f == instr(sltiu)) {
+		regs->reads[regs->n_reads++] = ic->arg[0];
+		regs->writes[regs->n_writes++] = ic->arg[1];
+		return true;
+	}
+
+	/*  Shifts:  arg[0] = source, arg[2] = destination  */
+	if (f == instr(sll) || f == instr(srl) || f == instr(sra) ||
+	    f == instr(mov)) {
+		regs->reads[regs->n_reads++] = ic->arg[0];
+		regs->writes[regs->n_writes++] = ic->arg[2];
+		return true;
+	}
+
+	/*  Three-register operations:  arg[2] = destination  */
+	if (f == instr(addu) || f == instr(subu) || f == instr(and) ||
+	    f == instr(or) || f == instr(xor) || f == instr(nor) ||
+	    f == instr(slt) || f == instr(sltu)) {
+		regs->reads[regs->n_reads++] = ic->arg[0];
+		regs->reads[regs->n_reads++] = ic->arg[1];
+		regs->writes[regs->n_writes++] = ic->arg[2];
+		return true;
+	}
+
+	return false;
+}
+
+/*  Interrupts are enabled if IE is set, and (except on R2000/R3000) EXL
+    and ERL are clear. STATUS_IE matches the enable bit on R2000/R3000.  */
+bool COMBINE(idle_loop_interrupts_enabled)(struct cpu *cpu)
+{
+	uint32_t status = cpu->cd.mips.coproc[0]->reg[COP0_STATUS];
+
+	if (cpu->cd.mips.cpu_type.exc_model != EXC3K &&
+	    status & (STATUS_EXL | STATUS_ERL))
+		return false;
+
+	/*  Ugly R5900 special case:  */
+	if (cpu->cd.mips.cpu_type.rev == MIPS_R5900 &&
+	    !(status & R5900_STATUS_EIE))
+		return false;
+
+	return status & STATUS_IE;
+}
+
+#define DYNTRANS_IDLE_LOOP
+#include "cpu_dyntrans.c"
+#undef  DYNTRANS_IDLE_LOOP
+
+/*  Accelerated guest routines (see DYNTRANS_GUEST_ROUTINES in cpu_dyntrans.c):  */
+#define DYNTRANS_GUEST_ROUTINES
+#include "cpu_dyntrans.c"
+#undef  DYNTRANS_GUEST_ROUTINES
+
+
 /*****************************************************************************/
 
 
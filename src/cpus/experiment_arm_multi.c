@@ -40,6 +40,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 int bit_count(unsigned int x)
@@ -112,15 +113,20 @@ int main(int argc, char *argv[])
 
 	/*  Read the opcodes:  */
 	while (!feof(f)) {
-		char s[100];
+		char s[100], *p;
 		s[0] = s[sizeof(s)-1] = '\0';
 		fgets(s, sizeof(s), f);
-		if (s[0] == '0') {
+
+		/*  Skip the count, if any:  */
+		p = strrchr(s, ' ');
+		p = p == NULL? s : p + 1;
+
+		if (p[0] == '0') {
 			if (n_opcodes > max) {
 				fprintf(stderr, "too many opcodes\n");
 				exit(1);
 			}
-			opcode[n_opcodes++] = strtol(s, NULL, 0);
+			opcode[n_opcodes++] = strtol(p, NULL, 0);
 		}
 	}
 
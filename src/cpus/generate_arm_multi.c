@@ -35,6 +35,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 
 /*
@@ -206,7 +207,183 @@ void generate_opcode(uint32_t opcode)
 
 
 /*
- *  main():
+ *  Opcodes which instruction combinations in cpu_arm_instr.c refer to by
+ *  name. These are always generated, whatever the profile says.
+ */
+static uint32_t required_opcodes[] = {
+	0x08b15018, 0x08ac000c, 0x08a05018, 0 };
+
+struct profile_entry {
+	uint32_t	opcode;
+	long long	count;
+	int		first_seen;
+};
+
+static struct profile_entry *entries = NULL;
+static int n_entries = 0;
+
+
+/*
+ *  add_opcode():
+ *
+ *  Adds count to the entry for an opcode (with the condition field
+ *  cleared). Opcodes which cannot be generated are ignored, unless
+ *  fail_on_bad is set.
+ */
+static void add_opcode(uint32_t opcode, long long count, int fail_on_bad)
+{
+	int i;
+
+	opcode &= 0x0fffffff;
+
+	if ((opcode & 0x0e000000) != 0x08000000 || (opcode & 0xffff) == 0 ||
+	    (opcode & 0x00400000) || ((opcode >> 16) & 15) == 15) {
+		if (fail_on_bad) {
+			/*  generate_opcode() explains what is wrong:  */
+			generate_opcode(opcode);
+		}
+		return;
+	}
+
+	for (i=0; i<n_entries; i++)
+		if (entries[i].opcode == opcode) {
+			entries[i].count += count;
+			return;
+		}
+
+	entries = realloc(entries, sizeof(struct profile_entry) *
+	    (n_entries + 1));
+	if (entries == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	entries[n_entries].opcode = opcode;
+	entries[n_entries].count = count;
+	entries[n_entries].first_seen = n_entries;
+	n_entries ++;
+}
+
+
+static int entry_cmp(const void *a, const void *b)
+{
+	const struct profile_entry *ea = a, *eb = b;
+
+	if (ea->count != eb->count)
+		return ea->count > eb->count? -1 : 1;
+
+	return ea->first_seen - eb->first_seen;
+}
+
+
+/*
+ *  read_profile():
+ *
+ *  Reads an instruction profile. Each line is either "count opcode" (as
+ *  produced by "uniq -c"), with a decimal count, or just "opcode", which
+ *  counts once. The output of "gxemul -s w:filename" can thus be used
+ *  directly, but -s must be given the 'w' field only: lines with any other
+ *  fields (such as addresses) are rejected, as they cannot be told apart
+ *  from counts. Opcodes with equal counts keep the order of the file.
+ *
+ *  Instructions other than load/store multiple are skipped, so the profile
+ *  of a whole program can be used.
+ */
+static void read_profile(const char *fname)
+{
+	FILE *f = fopen(fname, "r");
+	char line[200];
+	long long n_total = 0, n_multi = 0;
+	int i, lineno = 0;
+
+	if (f == NULL) {
+		perror(fname);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *p = line, *field[3], *end;
+		long long count = 1;
+		int n_fields = 0, bad = 0;
+
+		lineno ++;
+
+		while (*p) {
+			while (*p == ' ' || *p == '\t' || *p == '\n')
+				p ++;
+			if (*p == '\0' || *p == '#')
+				break;
+			if (n_fields < 3)
+				field[n_fields] = p;
+			n_fields ++;
+			while (*p && *p != ' ' && *p != '\t' && *p != '\n')
+				p ++;
+		}
+
+		if (n_fields == 0)
+			continue;
+
+		/*  A count must be a plain decimal number:  */
+		if (n_fields == 2) {
+			count = strtoll(field[0], &end, 10);
+			if (end == field[0] || (*end != ' ' && *end != '\t'))
+				bad = 1;
+		}
+
+		if (n_fields > 2 || bad) {
+			fprintf(stderr, "%s, line %i: expected \"opcode\" or"
+			    " \"count opcode\" (use -s w only, without other"
+			    " fields)\n", fname, lineno);
+			exit(1);
+		}
+
+		n_total += count;
+		add_opcode(strtoul(field[n_fields - 1], NULL, 16), count, 0);
+	}
+
+	fclose(f);
+
+	for (i=0; i<n_entries; i++)
+		n_multi += entries[i].count;
+
+	if (n_total > n_entries)
+		fprintf(stderr, "%s: %lli instructions, %lli (%.1f%%) load/store"
+		    " multiple, %i distinct\n", fname, n_total, n_multi,
+		    100.0 * n_multi / n_total, n_entries);
+}
+
+
+/*
+ *  select_opcodes():
+ *
+ *  Sorts the profile by decreasing count, and keeps the max_opcodes first
+ *  entries.
+ */
+static void select_opcodes(int max_opcodes)
+{
+	long long n_all = 0, n_selected = 0;
+	int i, n_distinct = n_entries;
+
+	qsort(entries, n_entries, sizeof(struct profile_entry), entry_cmp);
+
+	for (i=0; i<n_entries; i++) {
+		n_all += entries[i].count;
+		if (i < max_opcodes)
+			n_selected += entries[i].count;
+	}
+
+	if (n_entries > max_opcodes)
+		n_entries = max_opcodes;
+
+	if (n_all > n_distinct)
+		fprintf(stderr, "%i opcodes selected, covering %.1f%% of the"
+		    " executed load/store multiple instructions\n",
+		    n_entries, 100.0 * n_selected / n_all);
+}
+
+
+/*
+ *  list_nr():
  *
  *  Normal ARM code seems to only use about a few hundred of the 1^24 possible
  *  load/store multiple instructions. (I'm not counting the s-bit now.)
@@ -220,16 +397,86 @@ void generate_opcode(uint32_t opcode)
  *		  xxxx100P USWLnnnn llllllll llllllll
  *		           ^  ^ ^ ^        ^  ^ ^ ^	(0x00950154)
  */
+static int list_nr(uint32_t zz)
+{
+	return ((zz & 0x00800000) >> 16)
+	    |((zz & 0x00100000) >> 14)
+	    |((zz & 0x00040000) >> 13)
+	    |((zz & 0x00010000) >> 12)
+	    |((zz & 0x00000100) >>  5)
+	    |((zz & 0x00000040) >>  4)
+	    |((zz & 0x00000010) >>  3)
+	    |((zz & 0x00000004) >>  2);
+}
+
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s opcode [..]\n"
+	    "       %s [-l] [-n max_opcodes] -p profile\n"
+	    "\n"
+	    "  -l  list the selected opcodes (with counts), instead of"
+	    " generating code\n"
+	    "  -n  generate at most max_opcodes opcodes (default 256)\n"
+	    "  -p  read opcodes from an instruction profile\n",
+	    progname, progname);
+	exit(1);
+}
+
+
+/*
+ *  main():
+ *
+ *  The opcodes to generate are given either on the command line, or as
+ *  an instruction profile (see read_profile()). In the latter case, the
+ *  max_opcodes most frequently executed ones are generated.
+ *
+ *  To create a new profile from a running program:
+ *
+ *	gxemul -s w:profile.raw ...
+ *	./generate_arm_multi -l -p profile.raw > cpu_arm_multi.txt
+ *
+ *  ("make arm_multi_profile PROFILE=profile.raw" does the latter.)
+ */
 int main(int argc, char *argv[])
 {
-	int i, j;
+	const char *profile = NULL;
+	int i, j, max_opcodes = 256, list_only = 0;
 	int n_used[256];
 
-	if (argc < 2) {
-		fprintf(stderr, "usage: %s opcode [..]\n", argv[0]);
-		exit(1);
+	for (i=1; i<argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-l") == 0)
+			list_only = 1;
+		else if (strcmp(argv[i], "-n") == 0 && i+1 < argc)
+			max_opcodes = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-p") == 0 && i+1 < argc)
+			profile = argv[++i];
+		else
+			usage(argv[0]);
+	}
+
+	if (profile != NULL) {
+		if (i < argc)
+			usage(argv[0]);
+		read_profile(profile);
+		select_opcodes(max_opcodes);
+	} else {
+		if (i >= argc || list_only)
+			usage(argv[0]);
+		for (; i<argc; i++)
+			add_opcode(strtoul(argv[i], NULL, 0), 0, 1);
+	}
+
+	if (list_only) {
+		for (i=0; i<n_entries; i++)
+			printf("%lli 0x%08"PRIx32"\n", entries[i].count,
+			    entries[i].opcode);
+		return 0;
 	}
 
+	for (i=0; required_opcodes[i] != 0; i++)
+		add_opcode(required_opcodes[i], 0, 1);
+
 	printf("\n/*  AUTOMATICALLY GENERATED! Do not edit.  */\n\n"
 	    "#include <stdio.h>\n"
 	    "#include <stdlib.h>\n"
@@ -249,74 +496,36 @@ int main(int argc, char *argv[])
 	printf("\n\n");
 
 	/*  Generate the opcode functions:  */
-	for (i=1; i<argc; i++)
-		generate_opcode(strtol(argv[i], NULL, 0));
+	for (i=0; i<n_entries; i++)
+		generate_opcode(entries[i].opcode);
 
 	/*  Generate 256 small lookup tables:  */
 	for (j=0; j<256; j++) {
-		int n = 0, zz, zz0;
-		for (i=1; i<argc; i++) {
-			zz = strtol(argv[i], NULL, 0);
-			zz = ((zz & 0x00800000) >> 16)
-			    |((zz & 0x00100000) >> 14)
-			    |((zz & 0x00040000) >> 13)
-			    |((zz & 0x00010000) >> 12)
-			    |((zz & 0x00000100) >>  5)
-			    |((zz & 0x00000040) >>  4)
-			    |((zz & 0x00000010) >>  3)
-			    |((zz & 0x00000004) >>  2);
-			if (zz == j)
+		int n = 0;
+		for (i=0; i<n_entries; i++)
+			if (list_nr(entries[i].opcode) == j)
 				n++;
-		}
 		printf("\nuint32_t multi_opcode_%i[%i] = {\n", j, n+1);
-		for (i=1; i<argc; i++) {
-			zz = zz0 = strtol(argv[i], NULL, 0);
-			zz = ((zz & 0x00800000) >> 16)
-			    |((zz & 0x00100000) >> 14)
-			    |((zz & 0x00040000) >> 13)
-			    |((zz & 0x00010000) >> 12)
-			    |((zz & 0x00000100) >>  5)
-			    |((zz & 0x00000040) >>  4)
-			    |((zz & 0x00000010) >>  3)
-			    |((zz & 0x00000004) >>  2);
-			if (zz == j)
-				printf("\t0x%08x,\n", zz0);
-		}
+		for (i=0; i<n_entries; i++)
+			if (list_nr(entries[i].opcode) == j)
+				printf("\t0x%08x,\n", entries[i].opcode);
 		printf("0 };\n");
 	}
 
 	/*  Generate 256 tables with function pointers:  */
 	for (j=0; j<256; j++) {
-		int n = 0, zz, zz0;
-		for (i=1; i<argc; i++) {
-			zz = strtol(argv[i], NULL, 0);
-			zz = ((zz & 0x00800000) >> 16)
-			    |((zz & 0x00100000) >> 14)
-			    |((zz & 0x00040000) >> 13)
-			    |((zz & 0x00010000) >> 12)
-			    |((zz & 0x00000100) >>  5)
-			    |((zz & 0x00000040) >>  4)
-			    |((zz & 0x00000010) >>  3)
-			    |((zz & 0x00000004) >>  2);
-			if (zz == j)
+		int n = 0;
+		for (i=0; i<n_entries; i++)
+			if (list_nr(entries[i].opcode) == j)
 				n++;
-		}
 		n_used[j] = n;
 		if (n == 0)
 			continue;
 		printf("void (*multi_opcode_f_%i[%i])(struct cpu *,"
 		    " struct arm_instr_call *) = {\n", j, n*16);
-		for (i=1; i<argc; i++) {
-			zz = zz0 = strtol(argv[i], NULL, 0);
-			zz = ((zz & 0x00800000) >> 16)
-			    |((zz & 0x00100000) >> 14)
-			    |((zz & 0x00040000) >> 13)
-			    |((zz & 0x00010000) >> 12)
-			    |((zz & 0x00000100) >>  5)
-			    |((zz & 0x00000040) >>  4)
-			    |((zz & 0x00000010) >>  3)
-			    |((zz & 0x00000004) >>  2);
-			if (zz == j) {
+		for (i=0; i<n_entries; i++) {
+			uint32_t zz0 = entries[i].opcode;
+			if (list_nr(zz0) == j) {
 				printf("\tarm_instr_multi_0x%08x__eq,\n", zz0);
 				printf("\tarm_instr_multi_0x%08x__ne,\n", zz0);
 				printf("\tarm_instr_multi_0x%08x__cs,\n", zz0);
@@ -361,4 +570,3 @@ int main(int argc, char *argv[])
 
 	return 0;
 }
-
@@ -94,6 +94,51 @@ void m8820x_mark_page_as_modified(struct cpu *cpu,
 }
 
 
+/*
+ *  m8820x_patc_unlink():
+ *
+ *  Removes PATC entry i from the PATC hash index. Must be called whenever a
+ *  valid PATC entry is invalidated or overwritten.
+ */
+void m8820x_patc_unlink(struct m8820x_cmmu *cmmu, int i)
+{
+	uint8_t *p = &cmmu->patc_hash[M8820X_PATC_HASH(
+	    cmmu->patc_v_and_control[i])];
+
+	while (*p != 0 && *p != i + 1)
+		p = &cmmu->patc_hash_next[*p - 1];
+
+	if (*p != 0)
+		*p = cmmu->patc_hash_next[i];
+
+	cmmu->patc_hash_next[i] = 0;
+}
+
+
+/*
+ *  m8820x_rebuild_batc_index():
+ *
+ *  Fills in the BATC index from the BATC registers. Lower numbered entries
+ *  take precedence, as with a linear search.
+ */
+static void m8820x_rebuild_batc_index(struct m8820x_cmmu *cmmu)
+{
+	int i;
+
+	memset(cmmu->batc_index, 0, sizeof(cmmu->batc_index));
+
+	for (i = N_M88200_BATC_REGS - 1; i >= 0; i--) {
+		uint32_t batc = cmmu->batc[i];
+
+		if (batc & BATC_V)
+			cmmu->batc_index[batc & BATC_SO? 1 : 0][batc >> 19]
+			    = i + 1;
+	}
+
+	cmmu->batc_index_valid = true;
+}
+
+
 /*
  *  m88k_translate_v2p():
  *
@@ -147,25 +192,19 @@ int m88k_translate_v2p(struct cpu *cpu, uint64_t vaddr64,
 	 *  BATC lookup:
 	 *
 	 *  The BATC is a 10-entry array of virtual to physical mappings,
-	 *  where the top 13 bits of the virtual address must match.
+	 *  where the top 13 bits of the virtual address must match. The
+	 *  BATC index gives the matching valid entry (with the right
+	 *  supervisor/user bit) directly.
 	 */
-	for (i=0; i<N_M88200_BATC_REGS; i++) {
-		uint32_t batc = cmmu->batc[i];
-
-		/*  The batc entry must be valid:  */
-		if (!(batc & BATC_V))
-			continue;
-
-		/*  ... and have a matching supervisor/user bit:  */
-		if ((supervisor && !(batc & BATC_SO)) ||
-		    (!supervisor && (batc & BATC_SO)))
-			continue;
+	if (!cmmu->batc_index_valid)
+		m8820x_rebuild_batc_index(cmmu);
 
-		/*  ... and matching virtual address:  */
-		if ((vaddr & 0xfff80000) != (batc & 0xfff80000))
-			continue;
+	i = cmmu->batc_index[supervisor? 1 : 0][vaddr >> 19] - 1;
+	if (i >= 0) {
+		uint32_t batc = cmmu->batc[i];
 
-		/*  A matching BATC entry was found!  */
+		if (!no_exceptions)
+			cmmu->n_batc_hits ++;
 
 		/*  Is it write protected?  */
 		if ((batc & BATC_PROT) && writeflag) {
@@ -183,19 +222,17 @@ int m88k_translate_v2p(struct cpu *cpu, uint64_t vaddr64,
 	 *  PATC lookup:
 	 *
 	 *  The PATC is a 56-entry array of virtual to physical mappings for
-	 *  4 KB pages. If writeflag is set, and a PATC entry is found without
-	 *  the Modified bit set, a page table search must be performed to
-	 *  set the Modified bit in emulated memory.
+	 *  4 KB pages. Only the valid entries in the hash chain for this
+	 *  virtual page need to be checked. If writeflag is set, and a PATC
+	 *  entry is found without the Modified bit set, a page table search
+	 *  must be performed to set the Modified bit in emulated memory.
 	 */
-	for (i=0; i<N_M88200_PATC_ENTRIES; i++) {
+	for (i = cmmu->patc_hash[M8820X_PATC_HASH(vaddr)] - 1; i >= 0;
+	    i = cmmu->patc_hash_next[i] - 1) {
 		uint32_t vaddr_and_control = cmmu->patc_v_and_control[i];
 		uint32_t paddr_and_sbit = cmmu->patc_p_and_supervisorbit[i];
 
-		/*  Skip this entry if the valid bit isn't set:  */
-		if (!(vaddr_and_control & PG_V))
-			continue;
-
-		/*  ... or the virtual addresses don't match:  */
+		/*  Skip this entry if the virtual addresses don't match:  */
 		if ((vaddr & 0xfffff000) != (vaddr_and_control & 0xfffff000))
 			continue;
 
@@ -206,6 +243,8 @@ int m88k_translate_v2p(struct cpu *cpu, uint64_t vaddr64,
 			continue;
 
 		/*  A matching PATC entry was found!  */
+		if (!no_exceptions)
+			cmmu->n_patc_hits ++;
 
 		/*  Is it write protected?  */
 		if ((vaddr_and_control & PG_PROT) && writeflag) {
@@ -240,6 +279,9 @@ int m88k_translate_v2p(struct cpu *cpu, uint64_t vaddr64,
 	/*
 	 *  Attempt a search through page tables, to refill the PATC:
 	 */
+	if (!no_exceptions)
+		cmmu->n_table_walks ++;
+
 	seg_base = (uint32_t *) memory_paddr_to_hostaddr(
 	    cpu->mem, apr & 0xfffff000, 1);
 
@@ -320,10 +362,12 @@ int m88k_translate_v2p(struct cpu *cpu, uint64_t vaddr64,
 		i = cmmu->patc_update_index;
 
 		/*  Invalidate the current entry, if it is valid:  */
-		if (cmmu->patc_v_and_control[i] & PG_V)
+		if (cmmu->patc_v_and_control[i] & PG_V) {
 			cpu->invalidate_translation_caches(cpu,
 			    cmmu->patc_v_and_control[i] & 0xfffff000,
 			    INVALIDATE_VADDR);
+			m8820x_patc_unlink(cmmu, i);
+		}
 
 		/*  ... and write the new one:  */
 		cmmu->patc_update_index ++;
@@ -333,6 +377,11 @@ int m88k_translate_v2p(struct cpu *cpu, uint64_t vaddr64,
 		cmmu->patc_p_and_supervisorbit[i] =
 		    (page_descriptor & 0xfffff000) |
 		    (supervisor? M8820X_PATC_SUPERVISOR_BIT : 0);
+
+		/*  ... and add it to the PATC hash index:  */
+		cmmu->patc_hash_next[i] =
+		    cmmu->patc_hash[M8820X_PATC_HASH(vaddr)];
+		cmmu->patc_hash[M8820X_PATC_HASH(vaddr)] = i + 1;
 	}
 
 	/*  Check for writes to read-only pages:  */
@@ -99,6 +99,12 @@ int MEMORY_RW(struct cpu *cpu, struct memory *mem, uint64_t vaddr,
 			return MEMORY_ACCESS_FAILED;
 	}
 
+	/*  Data watchpoints. (Watched pages are not mapped for dyntrans in
+	    the watched direction, so those accesses end up here.)  */
+	if (cpu->machine->breakpoints.n_watchpoints > 0 && !no_exceptions &&
+	    cache != CACHE_INSTRUCTION)
+		watchpoints_check(cpu, vaddr, len, writeflag);
+
 
 	/*
 	 *  Memory mapped device?
@@ -169,18 +175,10 @@ not just the device in question.
 					    DM_DYNTRANS_WRITE_OK))
 						wf = 0;
 
-					if (writeflag && wf) {
-						if (paddr < mem->devices[i].
-						    dyntrans_write_low)
-							mem->devices[i].
-							dyntrans_write_low =
-							    paddr &~offset_mask;
-						if (paddr >= mem->devices[i].
-						    dyntrans_write_high)
-							mem->devices[i].
-						 	dyntrans_write_high =
-							    paddr | offset_mask;
-					}
+					if (writeflag && wf)
+						memory_device_dyntrans_mark_dirty(
+						    &mem->devices[i], paddr &
+						    ~offset_mask, offset_mask + 1);
 
 					if (mem->devices[i].flags &
 					    DM_EMULATED_RAM) {
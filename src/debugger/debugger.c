@@ -41,6 +41,7 @@
 #include "console.h"
 #include "cpu.h"
 #include "device.h"
+#include "devices.h"
 #include "debugger.h"
 #include "diskimage.h"
 #include "emul.h"
@@ -77,7 +78,6 @@ extern bool emul_show_nr_of_instructions;
 
 int old_quiet_mode = 0;
 
-static int debugger_n_steps_left_before_interaction = 0;
 static volatile bool exit_debugger;
 static volatile bool exit_debugger_to_continue_single_stepping;
 
@@ -137,7 +137,9 @@ void debugger_activate(int x)
 	ctrl_c = 1;
 
 	if (single_step) {
-		/*  Already in the debugger. Just abort the current line.  */
+		/*  Already in the debugger. Just abort the current line
+		    (or any "step n" which is still executing).  */
+		debugger_reset();
 		console_makeavail(MAIN_CONSOLE, 3);
 		printf("^C");
 		fflush(stdout);
@@ -661,10 +663,16 @@ void debugger(void)
 	int i, cmd_len;
 	char *cmd;
 
-	if (debugger_n_steps_left_before_interaction > 0) {
-		debugger_n_steps_left_before_interaction --;
-		return;
-	}
+	/*  Still executing a "step n"?  */
+	for (i=0; i<debugger_machine->ncpus; i++)
+		if (debugger_machine->cpus[i]->running &&
+		    debugger_machine->cpus[i]->step_budget > 0)
+			return;
+
+	/*  Temporary breakpoints (see "goto") only live until the next
+	    time the debugger is entered:  */
+	for (i=0; i<debugger_emul->n_machines; i++)
+		breakpoints_delete_temporary(debugger_emul->machines[i]);
 
 	/*
 	 *  Clear all dyntrans translations, because otherwise things would
@@ -737,7 +745,14 @@ void debugger(void)
  */
 void debugger_reset(void)
 {
-	debugger_n_steps_left_before_interaction = 0;
+	if (debugger_emul == NULL)
+		return;
+
+	for (int i=0; i<debugger_emul->n_machines; i++) {
+		struct machine *m = debugger_emul->machines[i];
+		for (int j=0; j<m->ncpus; j++)
+			m->cpus[j]->step_budget = 0;
+	}
 }
 
 
@@ -29,6 +29,27 @@
  */
 
 
+/*
+ *  debugger_cmd_accel():
+ *
+ *  Shows the accelerated guest routines (-b), with statistics.
+ */
+static void debugger_cmd_accel(struct machine *m, char *args)
+{
+	if (*args) {
+		printf("syntax: accel\n");
+		return;
+	}
+
+	if (m->guest_routines.n_routines == 0) {
+		printf("no accelerated guest routines (use -b to add some)\n");
+		return;
+	}
+
+	guest_routines_show_all(m);
+}
+
+
 /*
  *  debugger_cmd_allsettings():
  */
@@ -148,6 +169,8 @@ static void debugger_cmd_device(struct machine *m, char *args)
 		device_dumplist();
 	} else if (strncmp(args, "add ", 4) == 0) {
 		device_add(m, args+4);
+	} else if (strcmp(args, "cache") == 0) {
+		diskimage_dump_cache_stats(m);
 	} else if (strcmp(args, "consoles") == 0) {
 		console_debug_dump(m);
 	} else if (strncmp(args, "remove ", 7) == 0) {
@@ -187,6 +210,8 @@ return_help:
 	printf("  add name_and_params    add a device to the current "
 	    "machine\n");
 	printf("  all                    list all registered devices\n");
+	printf("  cache                  show disk image block cache"
+	    " statistics\n");
 	printf("  consoles               list all slave consoles\n");
 	printf("  list                   list memory-mapped devices in the"
 	    " current machine\n");
@@ -195,6 +220,83 @@ return_help:
 }
 
 
+/*
+ *  debugger_cmd_diskimage():
+ *
+ *  Show, or take and revert to snapshots of, the copy-on-write disk images
+ *  of the current machine.
+ */
+static void debugger_cmd_diskimage(struct machine *m, char *args)
+{
+	static const char *types[] = DISKIMAGE_TYPES;
+	struct diskimage *d;
+	const char *name = NULL;
+	int n_cow = 0;
+
+	while (args[0] == ' ')
+		args ++;
+
+	if (strncmp(args, "snapshot ", 9) == 0)
+		name = args + 9;
+	else if (strncmp(args, "revert ", 7) == 0)
+		name = args + 7;
+	else if (strncmp(args, "delete ", 7) == 0)
+		name = args + 7;
+	else if (args[0] != '\0' && strcmp(args, "show") != 0) {
+		printf("syntax: diskimage [subcmd [name]]\n");
+		printf("Available subcmds (and args) are:\n");
+		printf("  show            show disk images and snapshots"
+		    " (default)\n");
+		printf("  snapshot name   take a snapshot of all copy-on-write"
+		    " disk images\n");
+		printf("  revert name     revert to a snapshot\n");
+		printf("  delete name     delete a snapshot\n");
+		return;
+	}
+
+	if (name != NULL)
+		while (*name == ' ')
+			name ++;
+
+	for (d = m->first_diskimage; d != NULL; d = d->next) {
+		bool ok = true;
+
+		if (d->cow == NULL) {
+			if (name == NULL)
+				printf("%s id %i: %s\n",
+				    types[d->type], d->id, d->fname);
+			continue;
+		}
+
+		n_cow ++;
+		diskimage_async_drain(d);
+
+		switch (name != NULL ? args[0] : 0) {
+		case 's':
+			ok = diskimage_cow_snapshot_create(d->cow, name);
+			break;
+		case 'r':
+			ok = diskimage_cow_snapshot_revert(d->cow, name);
+			if (d->cache != NULL)
+				diskimage_cache_invalidate(d->cache);
+			break;
+		case 'd':
+			ok = diskimage_cow_snapshot_delete(d->cow, name);
+			break;
+		}
+
+		if (name == NULL || !ok)
+			printf("%s id %i: %s%s\n", types[d->type],
+			    d->id, d->fname, ok ? "" : ": FAILED");
+		if (name == NULL)
+			diskimage_cow_show(d->cow);
+	}
+
+	if (name != NULL && n_cow == 0)
+		printf("This machine has no copy-on-write disk images.\n");
+}
+
+
 /*
  *  debugger_cmd_dump():
  *
@@ -333,6 +435,52 @@ static void debugger_cmd_emul(struct machine *m, char *args)
 }
 
 
+/*
+ *  debugger_cmd_fbsnapshot():
+ *
+ *  Write the contents of a headless framebuffer window to a PNG or PPM file.
+ */
+static void debugger_cmd_fbsnapshot(struct machine *m, char *args)
+{
+	struct fb_window *fbwin;
+	int fb_nr = 0;
+	char *p;
+
+	while (*args == ' ')
+		args ++;
+
+	if (isdigit((unsigned char) args[0])) {
+		fb_nr = strtol(args, &p, 0);
+		args = p;
+		while (*args == ' ')
+			args ++;
+	}
+
+	if (!args[0]) {
+		printf("syntax: fbsnapshot [fb_nr] filename\n");
+		return;
+	}
+
+	if (fb_nr < 0 || fb_nr >= m->x11_md.n_fb_windows) {
+		printf("No framebuffer window nr %i.\n", fb_nr);
+		return;
+	}
+
+	fbwin = m->x11_md.fb_windows[fb_nr];
+	if (!fbwin->headless) {
+		printf("Only headless framebuffer windows (-g) can be saved.\n");
+		return;
+	}
+
+	/*  Convert anything written since the last framebuffer tick:  */
+	dev_fb_update_windows(m, fbwin);
+
+	if (fb_headless_snapshot(fbwin, args))
+		printf("%ix%i pixels written to %s\n", fbwin->x11_fb_winxsize,
+		    fbwin->x11_fb_winysize, args);
+}
+
+
 /*
  *  debugger_cmd_focus():
  *
@@ -397,10 +545,56 @@ print_current_focus_and_return:
 }
 
 
+/*
+ *  debugger_cmd_goto():
+ *
+ *  Continue running until execution reaches a specific address. This is
+ *  implemented as a temporary breakpoint, so execution runs at full speed
+ *  (and not single-stepped) until the address is reached.
+ */
+static void debugger_cmd_goto(struct machine *m, char *args)
+{
+	if (args[0] == '\0') {
+		printf("syntax: goto addr\n");
+		return;
+	}
+
+	if (!breakpoints_add(m, args))
+		return;
+
+	m->breakpoints.addr_bp[m->breakpoints.n_addr_bp - 1].temporary = true;
+
+	/*  Don't stop immediately if addr is the current instruction:  */
+	single_step_breakpoint = true;
+
+	exit_debugger = true;
+}
+
+
 /*  This is defined below.  */
 static void debugger_cmd_help(struct machine *m, char *args);
 
 
+/*
+ *  debugger_cmd_idle():
+ *
+ *  Shows the automatically detected idle loops of all CPUs.
+ */
+static void debugger_cmd_idle(struct machine *m, char *args)
+{
+	if (*args) {
+		printf("syntax: idle\n");
+		return;
+	}
+
+	if (!m->idle_loop_detection)
+		printf("(idle loop detection is turned off)\n");
+
+	for (int i = 0; i < m->ncpus; i++)
+		cpu_show_idle_loops(m->cpus[i]);
+}
+
+
 /*
  *  debugger_cmd_itrace():
  */
@@ -897,7 +1091,7 @@ static void debugger_cmd_reg(struct machine *m, char *args)
  */
 static void debugger_cmd_step(struct machine *m, char *args)
 {
-	int n = 1;
+	int64_t n = 1;
 
 	if (args[0] != '\0') {
 		n = strtoull(args, NULL, 0);
@@ -907,7 +1101,10 @@ static void debugger_cmd_step(struct machine *m, char *args)
 		}
 	}
 
-	debugger_n_steps_left_before_interaction = n - 1;
+	/*  All but the last step are executed without disassembly, see
+	    the step_budget handling in cpu_dyntrans.c.  */
+	for (int i = 0; i < m->ncpus; i++)
+		m->cpus[i]->step_budget = n;
 
 	/*  Special hack, see the main debugger() loop for more info.  */
 	exit_debugger = true;
@@ -1178,6 +1375,86 @@ static void debugger_cmd_version(struct machine *m, char *args)
 }
 
 
+/*
+ *  debugger_cmd_watchpoint():
+ */
+static void debugger_cmd_watchpoint(struct machine *m, char *args)
+{
+	while (args[0] != '\0' && args[0] == ' ')
+		args ++;
+
+	if (args[0] == '\0') {
+		printf("syntax: watchpoint subcmd [args...]\n");
+		printf("Available subcmds (and args) are:\n");
+		printf("  add addr [len [r|w|rw]]   watch len bytes (default 4) at"
+		    " addr,\n");
+		printf("                            for reads and/or writes"
+		    " (default rw)\n");
+		printf("  delete x                  delete watchpoint nr x\n");
+		printf("  show                      show current watchpoints\n");
+		return;
+	}
+
+	if (strcmp(args, "show") == 0) {
+		if (m->breakpoints.n_watchpoints == 0)
+			printf("No watchpoints set.\n");
+		else
+			watchpoints_show_all(m);
+		return;
+	}
+
+	if (strncmp(args, "delete ", 7) == 0) {
+		size_t x = atoi(args + 7);
+
+		if (m->breakpoints.n_watchpoints == 0) {
+			printf("No watchpoints set.\n");
+			return;
+		}
+
+		watchpoints_delete(m, x);
+		return;
+	}
+
+	if (strncmp(args, "add ", 4) == 0) {
+		char addr[MAX_CMD_BUFLEN], type[MAX_CMD_BUFLEN];
+		uint64_t len = 4;
+		int flags = WATCHPOINT_READ | WATCHPOINT_WRITE;
+		char *p;
+
+		strlcpy(addr, args + 4, sizeof(addr));
+		type[0] = '\0';
+
+		p = strchr(addr, ' ');
+		if (p != NULL) {
+			*p++ = '\0';
+			len = strtoull(p, &p, 0);
+			while (*p == ' ')
+				p++;
+			strlcpy(type, p, sizeof(type));
+		}
+
+		if (strcmp(type, "r") == 0)
+			flags = WATCHPOINT_READ;
+		else if (strcmp(type, "w") == 0)
+			flags = WATCHPOINT_WRITE;
+		else if (type[0] != '\0' && strcmp(type, "rw") != 0) {
+			printf("Unknown access type '%s'; use r, w, or rw.\n",
+			    type);
+			return;
+		}
+
+		if (watchpoints_add(m, addr, len, flags)) {
+			// If successful, show the last added watchpoint.
+			watchpoints_show(m, m->breakpoints.n_watchpoints - 1);
+		}
+
+		return;
+	}
+
+	printf("Unknown watchpoint subcommand.\n");
+}
+
+
 /****************************************************************************/
 
 
@@ -1190,6 +1467,9 @@ struct cmd {
 };
 
 static struct cmd cmds[] = {
+	{ "accel", "", 0, debugger_cmd_accel,
+		"show accelerated guest routines" },
+
 	{ "allsettings", "", 0, debugger_cmd_allsettings,
 		"show all settings" },
 
@@ -1205,18 +1485,30 @@ static struct cmd cmds[] = {
 	{ "device", "...", 0, debugger_cmd_device,
 		"show info about (or manipulate) devices" },
 
+	{ "diskimage", "[subcmd [name]]", 0, debugger_cmd_diskimage,
+		"show disk images, manage copy-on-write snapshots" },
+
 	{ "dump", "[addr [endaddr]]", 0, debugger_cmd_dump,
 		"dump memory contents in hex and ASCII" },
 
 	{ "emul", "", 0, debugger_cmd_emul,
 		"Print a summary of the current emulation" },
 
+	{ "fbsnapshot", "[fb_nr] filename", 0, debugger_cmd_fbsnapshot,
+		"write a headless framebuffer to a .png or .ppm file" },
+
 	{ "focus", "x[,y[,z]]", 0, debugger_cmd_focus,
 		"changes focus to cpu x, machine x, emul z" },
 
+	{ "goto", "addr", 0, debugger_cmd_goto,
+		"continue running until addr is reached" },
+
 	{ "help", "", 0, debugger_cmd_help,
 		"Print this help message" },
 
+	{ "idle", "", 0, debugger_cmd_idle,
+		"show automatically detected idle loops" },
+
 	{ "itrace", "", 0, debugger_cmd_itrace,
 		"toggle instruction_trace on or off" },
 
@@ -1274,6 +1566,9 @@ static struct cmd cmds[] = {
 	{ "version", "", 0, debugger_cmd_version,
 		"Print version information" },
 
+	{ "watchpoint", "...", 0, debugger_cmd_watchpoint,
+		"manipulate data watchpoints" },
+
 	/*  Note: NULL handler.  */
 	{ "x = expr", "", 0, NULL, "generic assignment" },
 
@@ -110,6 +110,11 @@ struct asc_data {
 	int		cur_phase;
 	struct scsi_transfer *xferp;
 
+	/*  Asynchronous SCSI command, and what to do when it completes:  */
+	struct diskimage_request *pending;
+	int		pending_select;
+	int		pending_all_done;
+
 	/*  FIFO:  */
 	unsigned char	fifo[ASC_FIFO_LEN];
 	int		fifo_in;
@@ -148,15 +153,20 @@ const char *asc_reg_names[0x10] = {
 };
 
 
-/*  This is referenced below.  */
+/*  These are referenced below.  */
 static int dev_asc_select(struct cpu *cpu, struct asc_data *d, int from_id,
 	int to_id, int dmaflag, int n_messagebytes);
+static void dev_asc_check_pending(struct asc_data *d);
 
 
 DEVICE_TICK(asc)
 {
 	struct asc_data *d = (struct asc_data *) extra;
-	int new_assert = d->reg_ro[NCR_STAT] & NCRSTAT_INT;
+	int new_assert;
+
+	dev_asc_check_pending(d);
+
+	new_assert = d->reg_ro[NCR_STAT] & NCRSTAT_INT;
 
 	if (new_assert && !d->irq_asserted)
 		INTERRUPT_ASSERT(d->irq);
@@ -261,6 +271,124 @@ static void dev_asc_newxfer(struct asc_data *d)
 }
 
 
+/*
+ *  dev_asc_disconnect():
+ *
+ *  Go to the disconnected state after a failed selection or transfer, and
+ *  cause a disconnect interrupt.
+ */
+static void dev_asc_disconnect(struct asc_data *d)
+{
+	d->cur_state = STATE_DISCONNECTED;
+	d->reg_ro[NCR_INTR] |= NCRINTR_DIS;
+	d->reg_ro[NCR_STAT] |= NCRSTAT_INT;
+	d->reg_ro[NCR_STEP] = (d->reg_ro[NCR_STEP] & ~7) | 0;
+	if (d->xferp != NULL)
+		scsi_transfer_free(d->xferp);
+	d->xferp = NULL;
+}
+
+
+/*
+ *  dev_asc_transfer_done():
+ *
+ *  Move on to the next phase, and cause an interrupt, after a transfer.
+ */
+static void dev_asc_transfer_done(struct asc_data *d, int all_done)
+{
+	if (all_done) {
+		if (d->cur_phase == PHASE_MSG_OUT)
+			d->cur_phase = PHASE_COMMAND;
+		else
+			d->cur_phase = PHASE_STATUS;
+	}
+
+	/*
+	 *  Cause an interrupt after the transfer:
+	 *
+	 *  NOTE:  Earlier I had this in here as well:
+	 *	d->reg_ro[NCR_INTR] |= NCRINTR_FC;
+	 *  but Linux/DECstation and OpenBSD/pmax seems to choke on that.
+	 */
+	d->reg_ro[NCR_STAT] |= NCRSTAT_INT;
+	d->reg_ro[NCR_INTR] |= NCRINTR_BS;
+	d->reg_ro[NCR_STAT] = (d->reg_ro[NCR_STAT] & ~7) | d->cur_phase;
+	d->reg_ro[NCR_STEP] = (d->reg_ro[NCR_STEP] & ~7) | 4;	/*  4?  */
+}
+
+
+/*
+ *  dev_asc_select_done():
+ *
+ *  Move on to the phase that the target asked for, and cause an interrupt,
+ *  once the command sent by dev_asc_select() has been carried out.
+ */
+static void dev_asc_select_done(struct asc_data *d, int ok)
+{
+	/*  Cause an interrupt:  */
+	d->reg_ro[NCR_STAT] |= NCRSTAT_INT;
+	d->reg_ro[NCR_INTR] |= NCRINTR_FC;
+	d->reg_ro[NCR_INTR] |= NCRINTR_BS;
+
+	if (ok == 2)
+		d->cur_phase = PHASE_DATA_OUT;
+	else if (d->xferp->data_in != NULL)
+		d->cur_phase = PHASE_DATA_IN;
+	else
+		d->cur_phase = PHASE_STATUS;
+
+	d->reg_ro[NCR_STAT] = (d->reg_ro[NCR_STAT] & ~7) | d->cur_phase;
+	d->reg_ro[NCR_STEP] = (d->reg_ro[NCR_STEP] & ~7) | 4;	/*  DONE (?)  */
+}
+
+
+/*
+ *  dev_asc_check_pending():
+ *
+ *  If an asynchronous SCSI command has completed, then the selection or
+ *  transfer which started it is finished, and the completion interrupt is
+ *  caused. A failed command disconnects, just like a failed synchronous
+ *  selection or transfer.
+ */
+static void dev_asc_check_pending(struct asc_data *d)
+{
+	struct diskimage_request *r = d->pending;
+	int res;
+
+	if (r == NULL || !diskimage_async_poll(r))
+		return;
+
+	res = r->result;
+	diskimage_async_free(r);
+	d->pending = NULL;
+
+	if (d->pending_select)
+		dev_asc_select_done(d, res);
+	else
+		dev_asc_transfer_done(d, d->pending_all_done);
+
+	if (!res)
+		dev_asc_disconnect(d);
+}
+
+
+/*
+ *  dev_asc_submit():
+ *
+ *  Send the current transfer's command to the target, asynchronously. The
+ *  selection or transfer is finished by dev_asc_check_pending(), which is
+ *  called from the tick function.
+ */
+static void dev_asc_submit(struct cpu *cpu, struct asc_data *d, int select,
+	int all_done)
+{
+	d->pending = diskimage_async_scsicommand(cpu, d->reg_wo[NCR_SELID] & 7,
+	    DISKIMAGE_SCSI, d->xferp);
+	d->pending_select = select;
+	d->pending_all_done = all_done;
+}
+
+
 /*
  *  dev_asc_transfer():
  *
@@ -560,28 +688,13 @@ fatal("TODO.......asdgasin\n");
 
 	/*  Redo the command if data was just sent using DATA_OUT:  */
 	if (d->cur_phase == PHASE_DATA_OUT) {
-		res = diskimage_scsicommand(cpu, d->reg_wo[NCR_SELID] & 7,
-		    DISKIMAGE_SCSI, d->xferp);
-	}
-
-	if (all_done) {
-		if (d->cur_phase == PHASE_MSG_OUT)
-			d->cur_phase = PHASE_COMMAND;
-		else
-			d->cur_phase = PHASE_STATUS;
+		dev_asc_submit(cpu, d, 0, all_done);
+		if (!quiet_mode)
+			debug("}");
+		return 1;
 	}
 
-	/*
-	 *  Cause an interrupt after the transfer:
-	 *
-	 *  NOTE:  Earlier I had this in here as well:
-	 *	d->reg_ro[NCR_INTR] |= NCRINTR_FC;
-	 *  but Linux/DECstation and OpenBSD/pmax seems to choke on that.
-	 */
-	d->reg_ro[NCR_STAT] |= NCRSTAT_INT;
-	d->reg_ro[NCR_INTR] |= NCRINTR_BS;
-	d->reg_ro[NCR_STAT] = (d->reg_ro[NCR_STAT] & ~7) | d->cur_phase;
-	d->reg_ro[NCR_STEP] = (d->reg_ro[NCR_STEP] & ~7) | 4;	/*  4?  */
+	dev_asc_transfer_done(d, all_done);
 
 	if (!quiet_mode)
 		debug("}");
@@ -593,14 +706,14 @@ fatal("TODO.......asdgasin\n");
  *  dev_asc_select():
  *
  *  Select a SCSI device, send msg bytes (if any), and send command bytes.
- *  (Call diskimage_scsicommand() to handle the command.)
+ *  (The command is then carried out asynchronously; see dev_asc_submit().)
  *
  *  Return value: 1 if ok, 0 on error.
  */
 static int dev_asc_select(struct cpu *cpu, struct asc_data *d, int from_id,
 	int to_id, int dmaflag, int n_messagebytes)
 {
-	int ok, len, i, ch;
+	int len, i, ch;
 
 	if (!quiet_mode)
 		debug(" { SELECT id %i: ", to_id);
@@ -717,28 +830,12 @@ static int dev_asc_select(struct cpu *cpu, struct asc_data *d, int from_id,
 	/*
 	 *  Call the SCSI device to perform the command:
 	 */
-	ok = diskimage_scsicommand(cpu, to_id, DISKIMAGE_SCSI, d->xferp);
-
-
-	/*  Cause an interrupt:  */
-	d->reg_ro[NCR_STAT] |= NCRSTAT_INT;
-	d->reg_ro[NCR_INTR] |= NCRINTR_FC;
-	d->reg_ro[NCR_INTR] |= NCRINTR_BS;
-
-	if (ok == 2)
-		d->cur_phase = PHASE_DATA_OUT;
-	else if (d->xferp->data_in != NULL)
-		d->cur_phase = PHASE_DATA_IN;
-	else
-		d->cur_phase = PHASE_STATUS;
-
-	d->reg_ro[NCR_STAT] = (d->reg_ro[NCR_STAT] & ~7) | d->cur_phase;
-	d->reg_ro[NCR_STEP] = (d->reg_ro[NCR_STEP] & ~7) | 4;	/*  DONE (?)  */
+	dev_asc_submit(cpu, d, 1, 0);
 
 	if (!quiet_mode)
 		debug("}");
 
-	return ok;
+	return 1;
 }
 
 
@@ -808,6 +905,8 @@ DEVICE_ACCESS(asc)
 	if (writeflag == MEM_WRITE)
 		idata = memory_readmax64(cpu, data, len);
 
+	dev_asc_check_pending(d);
+
 #if 0
 	/*  Debug stuff useful when trying to make dev_asc compatible
 	    with the 'arc' emulation mode, which is different from
@@ -898,6 +997,16 @@ DEVICE_ACCESS(asc)
 		if (!quiet_mode)
 			debug(" ");
 
+		/*
+		 *  A new command while the previous one is still being
+		 *  carried out by the target: finish the previous one first,
+		 *  so that its transfer and interrupt are not lost.
+		 */
+		if (d->pending != NULL) {
+			diskimage_async_wait(d->pending);
+			dev_asc_check_pending(d);
+		}
+
 		/*  TODO:  Perhaps turn off others here too?  */
 		d->reg_ro[NCR_INTR] &= ~NCRINTR_SBR;
 
@@ -1073,16 +1182,8 @@ DEVICE_ACCESS(asc)
 
 				if (ok)
 					d->cur_state = STATE_INITIATOR;
-				else {
-					d->cur_state = STATE_DISCONNECTED;
-					d->reg_ro[NCR_INTR] |= NCRINTR_DIS;
-					d->reg_ro[NCR_STAT] |= NCRSTAT_INT;
-					d->reg_ro[NCR_STEP] =
-					    (d->reg_ro[NCR_STEP] & ~7) | 0;
-					if (d->xferp != NULL)
-						scsi_transfer_free(d->xferp);
-					d->xferp = NULL;
-				}
+				else
+					dev_asc_disconnect(d);
 			} else {
 				/*
 				 *  Selection failed, non-existant scsi ID:
@@ -1110,16 +1211,8 @@ DEVICE_ACCESS(asc)
 
 				ok = dev_asc_transfer(cpu, d,
 				    idata & NCRCMD_DMA? 1 : 0);
-				if (!ok) {
-					d->cur_state = STATE_DISCONNECTED;
-					d->reg_ro[NCR_INTR] |= NCRINTR_DIS;
-					d->reg_ro[NCR_STAT] |= NCRSTAT_INT;
-					d->reg_ro[NCR_STEP] = (d->reg_ro[
-					    NCR_STEP] & ~7) | 0;
-					if (d->xferp != NULL)
-						scsi_transfer_free(d->xferp);
-					d->xferp = NULL;
-				}
+				if (!ok)
+					dev_asc_disconnect(d);
 			}
 break;
 
@@ -1152,16 +1245,8 @@ break;
 
 				ok = dev_asc_transfer(cpu, d,
 				    idata & NCRCMD_DMA? 1 : 0);
-				if (!ok) {
-					d->cur_state = STATE_DISCONNECTED;
-					d->reg_ro[NCR_INTR] |= NCRINTR_DIS;
-					d->reg_ro[NCR_STAT] |= NCRSTAT_INT;
-					d->reg_ro[NCR_STEP] = (d->reg_ro[
-					    NCR_STEP] & ~7) | 0;
-					if (d->xferp != NULL)
-						scsi_transfer_free(d->xferp);
-					d->xferp = NULL;
-				}
+				if (!ok)
+					dev_asc_disconnect(d);
 			}
 			break;
 
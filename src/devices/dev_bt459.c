@@ -109,9 +109,7 @@ struct bt459_data {
 static void bt459_update_X_cursor(struct cpu *cpu, struct bt459_data *d)
 {
 	int i, x,y, xmax=0, ymax=0;
-#ifdef WITH_X11
 	int bw_only = 1;
-#endif
 
 	/*  First, let's calculate the size of the cursor:  */
 	for (y=0; y<64; y++)
@@ -126,10 +124,8 @@ static void bt459_update_X_cursor(struct cpu *cpu, struct bt459_data *d)
 				int color = (data >> (6-2*i)) & 3;
 				if (color != 0)
 					xmax = x + i;
-#ifdef WITH_X11
 				if (color != 0 && color != 3)
 					bw_only = 0;
-#endif
 			}
 		}
 
@@ -146,7 +142,6 @@ static void bt459_update_X_cursor(struct cpu *cpu, struct bt459_data *d)
 	 *	BT459_REG_CCOLOR_2, 3 = reverse of color 1/2.
 	 */
 
-#ifdef WITH_X11
 	if (cpu->machine->x11_md.in_use && d->vfb_data->fb_window != NULL) {
 		for (y=0; y<=ymax; y++) {
 			for (x=0; x<=xmax; x+=4) {
@@ -210,7 +205,6 @@ printf("\n");
 		if (d->cursor_on)
 			d->cursor_on ++;
 	}
-#endif
 }
 
 
@@ -29,6 +29,12 @@
  *
  *  Basic "disk" device. This is a simple test device which can be used to
  *  read and write data from disk devices.
+ *
+ *  Besides the one-sector-at-a-time register interface, there is a DMA
+ *  mode, where the guest queues multi-sector requests in a descriptor ring
+ *  in physical memory (see dev_disk.h). DMA requests are carried out
+ *  asynchronously, using diskimage_async_submit(), and completion is
+ *  signaled with an interrupt.
  */
 
 #include <stdio.h>
@@ -47,8 +53,18 @@
 
 extern int verbose;
 
-#define	SECTOR_SIZE	512
+#define	SECTOR_SIZE		512
+#define	DEV_DISK_TICK_SHIFT	14
+
 
+struct disk_dma_request {
+	struct diskimage_request *req;		/*  NULL if not submitted  */
+	uint64_t	desc_addr;
+	uint64_t	paddr;
+	int		writeflag;
+	unsigned char	*buf;
+	size_t		len;
+};
 
 struct disk_data {
 	uint64_t	offset;
@@ -56,9 +72,189 @@ struct disk_data {
 	int		command;
 	int		status;
 	unsigned char	*buf;
+
+	/*  DMA mode:  */
+	uint64_t	dma_ring;
+	int		dma_ring_size;
+	int		dma_head;		/*  written by the guest  */
+	int		dma_submitted;		/*  next to submit  */
+	int		dma_tail;		/*  next to complete  */
+	int		dma_irq_pending;
+	struct disk_dma_request dma[DEV_DISK_DMA_MAX_RING_SIZE];
+
+	struct interrupt irq;
 };
 
 
+/*
+ *  disk_dma_set_status():
+ *
+ *  Writes the status word of a descriptor in guest memory.
+ */
+static void disk_dma_set_status(struct cpu *cpu, uint64_t desc_addr,
+	int status)
+{
+	unsigned char word[4];
+
+	memory_writemax64(cpu, word, sizeof(word), status);
+	cpu->memory_rw(cpu, cpu->mem, desc_addr + DEV_DISK_DMA_DESC_STATUS,
+	    word, sizeof(word), MEM_WRITE, PHYSICAL | NO_EXCEPTIONS);
+}
+
+
+/*
+ *  disk_dma_submit():
+ *
+ *  Reads the descriptors that the guest has added to the ring since the last
+ *  time, and submits them as asynchronous disk image requests. Write data is
+ *  copied from guest memory at this point.
+ */
+static void disk_dma_submit(struct cpu *cpu, struct disk_data *d)
+{
+	while (d->dma_submitted != d->dma_head) {
+		struct disk_dma_request *r = &d->dma[d->dma_submitted];
+		unsigned char desc[DEV_DISK_DMA_DESC_SIZE];
+		uint64_t offset;
+		uint32_t n_sectors, disk_id, operation;
+
+		r->desc_addr = d->dma_ring + (uint64_t) d->dma_submitted *
+		    DEV_DISK_DMA_DESC_SIZE;
+		r->req = NULL;
+		r->buf = NULL;
+
+		d->dma_submitted = (d->dma_submitted + 1) % d->dma_ring_size;
+
+		if (!cpu->memory_rw(cpu, cpu->mem, r->desc_addr, desc,
+		    sizeof(desc), MEM_READ, PHYSICAL | NO_EXCEPTIONS)) {
+			fatal("[ disk: could not read DMA descriptor at "
+			    "0x%llx ]\n", (long long) r->desc_addr);
+			continue;
+		}
+
+		r->paddr   = memory_readmax64(cpu, desc +
+		    DEV_DISK_DMA_DESC_PADDR, 8);
+		offset     = memory_readmax64(cpu, desc +
+		    DEV_DISK_DMA_DESC_OFFSET, 8);
+		n_sectors  = memory_readmax64(cpu, desc +
+		    DEV_DISK_DMA_DESC_N_SECTORS, 4);
+		disk_id    = memory_readmax64(cpu, desc +
+		    DEV_DISK_DMA_DESC_ID, 4);
+		operation  = memory_readmax64(cpu, desc +
+		    DEV_DISK_DMA_DESC_OPERATION, 4);
+
+		r->writeflag = operation == DEV_DISK_OPERATION_WRITE;
+		r->len = (size_t) n_sectors * SECTOR_SIZE;
+
+		if (n_sectors == 0 || n_sectors > DEV_DISK_DMA_MAX_SECTORS ||
+		    (offset & (SECTOR_SIZE-1)) ||
+		    operation > DEV_DISK_OPERATION_WRITE) {
+			fatal("[ disk: bad DMA descriptor at 0x%llx: offset "
+			    "%lli, %i sectors, operation %i ]\n",
+			    (long long) r->desc_addr, (long long) offset,
+			    (int) n_sectors, (int) operation);
+			continue;
+		}
+
+		CHECK_ALLOCATION(r->buf = (unsigned char *) malloc(r->len));
+
+		if (r->writeflag && !cpu->memory_rw(cpu, cpu->mem, r->paddr,
+		    r->buf, r->len, MEM_READ, PHYSICAL | NO_EXCEPTIONS)) {
+			free(r->buf);
+			r->buf = NULL;
+			continue;
+		}
+
+		if (verbose >= 2)
+			debug("[ disk: DMA %s disk %i offset %lli, %i sectors"
+			    " ]\n", r->writeflag ? "WRITE" : "READ",
+			    (int) disk_id, (long long) offset, (int) n_sectors);
+
+		r->req = diskimage_async_submit(cpu->machine, disk_id,
+		    DISKIMAGE_IDE, r->writeflag, offset, r->buf, r->len);
+	}
+}
+
+
+/*
+ *  disk_dma_complete():
+ *
+ *  Retires finished DMA requests, in ring order: read data is copied to
+ *  guest memory, and the descriptor's status is set. If any request was
+ *  retired, the interrupt is asserted.
+ */
+static void disk_dma_complete(struct cpu *cpu, struct disk_data *d)
+{
+	bool retired = false;
+
+	while (d->dma_tail != d->dma_submitted) {
+		struct disk_dma_request *r = &d->dma[d->dma_tail];
+		int status = DEV_DISK_DMA_STATUS_ERROR;
+
+		if (r->req != NULL) {
+			if (!diskimage_async_poll(r->req))
+				break;
+
+			if (diskimage_async_wait(r->req))
+				status = DEV_DISK_DMA_STATUS_OK;
+
+			diskimage_async_free(r->req);
+			r->req = NULL;
+		}
+
+		if (status == DEV_DISK_DMA_STATUS_OK && !r->writeflag &&
+		    !cpu->memory_rw(cpu, cpu->mem, r->paddr, r->buf, r->len,
+		    MEM_WRITE, PHYSICAL | NO_EXCEPTIONS))
+			status = DEV_DISK_DMA_STATUS_ERROR;
+
+		free(r->buf);
+		r->buf = NULL;
+
+		disk_dma_set_status(cpu, r->desc_addr, status);
+
+		d->dma_tail = (d->dma_tail + 1) % d->dma_ring_size;
+		retired = true;
+	}
+
+	if (retired) {
+		d->dma_irq_pending = 1;
+		INTERRUPT_ASSERT(d->irq);
+	}
+}
+
+
+/*
+ *  disk_dma_reset():
+ *
+ *  Waits for any outstanding DMA requests, and empties the ring.
+ */
+static void disk_dma_reset(struct cpu *cpu, struct disk_data *d)
+{
+	if (d->dma_tail != d->dma_submitted) {
+		fatal("[ disk: WARNING! DMA ring changed while requests "
+		    "were in progress ]\n");
+
+		for (int i = 0; i < DEV_DISK_DMA_MAX_RING_SIZE; i++) {
+			if (d->dma[i].req != NULL)
+				diskimage_async_free(d->dma[i].req);
+			free(d->dma[i].buf);
+			d->dma[i].req = NULL;
+			d->dma[i].buf = NULL;
+		}
+	}
+
+	d->dma_head = d->dma_submitted = d->dma_tail = 0;
+}
+
+
+DEVICE_TICK(disk)
+{
+	struct disk_data *d = (struct disk_data *) extra;
+
+	if (d->dma_tail != d->dma_submitted)
+		disk_dma_complete(cpu, d);
+}
+
+
 DEVICE_ACCESS(disk_buf)
 {
 	struct disk_data *d = (struct disk_data *) extra;
@@ -145,6 +341,71 @@ DEVICE_ACCESS(disk)
 		}
 		break;
 
+	case DEV_DISK_DMA_RING:
+		if (writeflag == MEM_READ) {
+			odata = d->dma_ring;
+		} else {
+			disk_dma_reset(cpu, d);
+			d->dma_ring = idata;
+		}
+		break;
+
+	case DEV_DISK_DMA_RING_HIGH32:
+		if (writeflag == MEM_READ) {
+			odata = d->dma_ring >> 32;
+		} else {
+			disk_dma_reset(cpu, d);
+			d->dma_ring = (uint32_t)d->dma_ring | (idata << 32);
+		}
+		break;
+
+	case DEV_DISK_DMA_RING_SIZE:
+		if (writeflag == MEM_READ) {
+			odata = d->dma_ring_size;
+		} else {
+			disk_dma_reset(cpu, d);
+			if (idata < 1 || idata > DEV_DISK_DMA_MAX_RING_SIZE) {
+				fatal("[ disk: DMA ring size %lli is not"
+				    " supported ]\n", (long long) idata);
+				idata = 0;
+			}
+			d->dma_ring_size = idata;
+		}
+		break;
+
+	case DEV_DISK_DMA_HEAD:
+		if (writeflag == MEM_READ) {
+			odata = d->dma_head;
+		} else if (d->dma_ring_size == 0 ||
+		    idata >= (uint64_t) d->dma_ring_size) {
+			fatal("[ disk: bad DMA head index %lli ]\n",
+			    (long long) idata);
+		} else {
+			d->dma_head = idata;
+			disk_dma_submit(cpu, d);
+			disk_dma_complete(cpu, d);
+		}
+		break;
+
+	case DEV_DISK_DMA_TAIL:
+		if (writeflag == MEM_READ) {
+			disk_dma_complete(cpu, d);
+			odata = d->dma_tail;
+		} else {
+			fatal("[ disk: WARNING: write to DMA tail ]\n");
+		}
+		break;
+
+	case DEV_DISK_DMA_IRQ:
+		if (writeflag == MEM_READ) {
+			disk_dma_complete(cpu, d);
+			odata = d->dma_irq_pending;
+		} else {
+			d->dma_irq_pending = 0;
+			INTERRUPT_DEASSERT(d->irq);
+		}
+		break;
+
 	default:if (writeflag == MEM_WRITE) {
 			fatal("[ disk: unimplemented write to "
 			    "offset 0x%x: data=0x%x ]\n", (int)
@@ -171,6 +432,8 @@ DEVINIT(disk)
 	CHECK_ALLOCATION(d = (struct disk_data *) malloc(sizeof(struct disk_data)));
 	memset(d, 0, sizeof(struct disk_data));
 
+	INTERRUPT_CONNECT(devinit->interrupt_path, d->irq);
+
 	nlen = strlen(devinit->name) + 30;
 	CHECK_ALLOCATION(n1 = (char *) malloc(nlen));
 	CHECK_ALLOCATION(n2 = (char *) malloc(nlen));
@@ -191,6 +454,9 @@ DEVINIT(disk)
 	    (void *)d, DM_DYNTRANS_OK | DM_DYNTRANS_WRITE_OK |
 	    DM_READS_HAVE_NO_SIDE_EFFECTS, d->buf);
 
+	machine_add_tickfunction(devinit->machine,
+	    dev_disk_tick, d, DEV_DISK_TICK_SHIFT);
+
 	return 1;
 }
 
@@ -29,6 +29,10 @@
  *
  *  Basic "ethernet" network device. This is a simple test device which can
  *  be used to send and receive packets to/from a simulated ethernet network.
+ *
+ *  Packets can either be copied through the buffer one at a time, or be
+ *  sent and received in batches using descriptor rings in guest memory,
+ *  with interrupt coalescing (see dev_ether.h).
  */
 
 #include <stdio.h>
@@ -48,6 +52,13 @@
 
 #define	DEV_ETHER_TICK_SHIFT	14
 
+struct ether_ring {
+	uint64_t		addr;
+	int			size;		/*  0 = not in use  */
+	int			head;		/*  written by the guest  */
+	int			tail;		/*  next for the device  */
+};
+
 struct ether_data {
 	struct nic_data		nic;
 
@@ -57,25 +68,274 @@ struct ether_data {
 	int			status;
 	int			packet_len;
 
+	/*  Ring mode:  */
+	struct ether_ring	rx_ring;
+	struct ether_ring	tx_ring;
+	int			ring_irq;
+	int			coalesce_packets;
+	int			coalesce_ticks;
+	int			n_uncoalesced;		/*  packets  */
+	int			uncoalesced_bits;
+	int			ticks_uncoalesced;
+
 	struct interrupt	irq;
 };
 
 
+/*
+ *  ether_update_irq():
+ *
+ *  Asserts the interrupt if there is anything for the guest to look at.
+ */
+static void ether_update_irq(struct ether_data *d)
+{
+	if (d->status || d->ring_irq)
+		INTERRUPT_ASSERT(d->irq);
+	else
+		INTERRUPT_DEASSERT(d->irq);
+}
+
+
+/*
+ *  ether_ring_completed():
+ *
+ *  Called when a ring descriptor has been handed back to the guest.
+ *  Completions are collected until there are enough of them to be worth an
+ *  interrupt (or until the tick function decides that they have waited for
+ *  long enough).
+ */
+static void ether_ring_completed(struct ether_data *d, int bit)
+{
+	d->n_uncoalesced ++;
+	d->uncoalesced_bits |= bit;
+
+	if (d->n_uncoalesced >= d->coalesce_packets) {
+		d->ring_irq |= d->uncoalesced_bits;
+		d->n_uncoalesced = d->uncoalesced_bits = 0;
+		d->ticks_uncoalesced = 0;
+	}
+}
+
+
+/*
+ *  ether_ring_put_desc():
+ *
+ *  Writes back the length and status fields of a descriptor, and advances
+ *  the ring's tail.
+ */
+static void ether_ring_put_desc(struct cpu *cpu, struct ether_ring *ring,
+	uint32_t length, uint32_t status)
+{
+	unsigned char buf[8];
+	uint64_t desc_addr = ring->addr + (uint64_t) ring->tail *
+	    DEV_ETHER_DESC_SIZE;
+
+	memory_writemax64(cpu, buf, 4, length);
+	memory_writemax64(cpu, buf + 4, 4, status);
+	cpu->memory_rw(cpu, cpu->mem, desc_addr + DEV_ETHER_DESC_LENGTH,
+	    buf, sizeof(buf), MEM_WRITE, PHYSICAL | NO_EXCEPTIONS);
+
+	ring->tail = (ring->tail + 1) % ring->size;
+}
+
+
+/*
+ *  ether_ring_get_desc():
+ *
+ *  Reads the buffer address and length of the descriptor at the ring's
+ *  tail. Returns 0 if the descriptor could not be read.
+ */
+static int ether_ring_get_desc(struct cpu *cpu, struct ether_ring *ring,
+	uint64_t *paddr, uint32_t *length)
+{
+	unsigned char desc[DEV_ETHER_DESC_SIZE];
+	uint64_t desc_addr = ring->addr + (uint64_t) ring->tail *
+	    DEV_ETHER_DESC_SIZE;
+
+	if (!cpu->memory_rw(cpu, cpu->mem, desc_addr, desc, sizeof(desc),
+	    MEM_READ, PHYSICAL | NO_EXCEPTIONS)) {
+		fatal("[ ether: could not read descriptor at 0x%llx ]\n",
+		    (long long) desc_addr);
+		return 0;
+	}
+
+	*paddr = memory_readmax64(cpu, desc + DEV_ETHER_DESC_PADDR, 8);
+	*length = memory_readmax64(cpu, desc + DEV_ETHER_DESC_LENGTH, 4);
+	return 1;
+}
+
+
+/*
+ *  ether_ring_tx():
+ *
+ *  Sends all packets that the guest has queued in the transmit ring.
+ */
+static void ether_ring_tx(struct cpu *cpu, struct ether_data *d)
+{
+	struct ether_ring *ring = &d->tx_ring;
+
+	while (ring->tail != ring->head) {
+		uint32_t status = DEV_ETHER_DESC_STATUS_DONE;
+		uint64_t paddr = 0;
+		uint32_t len;
+
+		if (!ether_ring_get_desc(cpu, ring, &paddr, &len))
+			len = 0;
+
+		if (len == 0 || len > DEV_ETHER_BUFFER_SIZE ||
+		    !cpu->memory_rw(cpu, cpu->mem, paddr, d->buf, len,
+		    MEM_READ, PHYSICAL | NO_EXCEPTIONS))
+			status |= DEV_ETHER_DESC_STATUS_ERROR;
+		else if (cpu->machine->emul->net != NULL)
+			net_ethernet_tx(cpu->machine->emul->net, &d->nic,
+			    d->buf, len);
+
+		ether_ring_put_desc(cpu, ring, len, status);
+		ether_ring_completed(d, DEV_ETHER_RING_IRQ_TX);
+	}
+}
+
+
+/*
+ *  ether_ring_rx():
+ *
+ *  Moves incoming packets into the guest's receive buffers, for as long as
+ *  there are both packets and buffers.
+ */
+static void ether_ring_rx(struct cpu *cpu, struct ether_data *d)
+{
+	struct net *net = cpu->machine->emul->net;
+	struct ether_ring *ring = &d->rx_ring;
+
+	if (net == NULL || ring->tail == ring->head ||
+	    !net_ethernet_rx_avail(net, &d->nic))
+		return;
+
+	while (ring->tail != ring->head) {
+		uint32_t status = DEV_ETHER_DESC_STATUS_DONE;
+		int packet_len;
+		uint64_t paddr = 0;
+		uint32_t buf_len;
+
+		if (!net_ethernet_rx_copy(net, &d->nic, d->buf,
+		    sizeof(d->buf), &packet_len))
+			break;
+
+		if (!ether_ring_get_desc(cpu, ring, &paddr, &buf_len))
+			buf_len = 0;
+		if (buf_len > sizeof(d->buf))
+			buf_len = sizeof(d->buf);
+
+		if ((uint32_t) packet_len > buf_len) {
+			packet_len = buf_len;
+			status |= DEV_ETHER_DESC_STATUS_TRUNCATED;
+		}
+
+		if (packet_len > 0 && !cpu->memory_rw(cpu, cpu->mem, paddr,
+		    d->buf, packet_len, MEM_WRITE, PHYSICAL | NO_EXCEPTIONS))
+			status |= DEV_ETHER_DESC_STATUS_ERROR;
+
+		ether_ring_put_desc(cpu, ring, packet_len, status);
+		ether_ring_completed(d, DEV_ETHER_RING_IRQ_RX);
+	}
+}
+
+
+/*
+ *  ether_ring_access():
+ *
+ *  Accesses to the registers of one of the rings.
+ */
+static void ether_ring_access(struct cpu *cpu, struct ether_data *d,
+	struct ether_ring *ring, int reg, int writeflag, uint64_t idata,
+	uint64_t *odata)
+{
+	switch (reg) {
+
+	case DEV_ETHER_RING_ADDR:
+		if (writeflag == MEM_READ)
+			*odata = ring->addr;
+		else
+			ring->addr = idata;
+		break;
+
+	case DEV_ETHER_RING_ADDR_HIGH32:
+		if (writeflag == MEM_READ)
+			*odata = ring->addr >> 32;
+		else
+			ring->addr = (uint32_t)ring->addr | (idata << 32);
+		break;
+
+	case DEV_ETHER_RING_SIZE:
+		if (writeflag == MEM_READ) {
+			*odata = ring->size;
+			break;
+		}
+		if (idata > DEV_ETHER_MAX_RING_SIZE) {
+			fatal("[ ether: ring size %lli is not supported ]\n",
+			    (long long) idata);
+			idata = 0;
+		}
+		ring->size = idata;
+		ring->head = ring->tail = 0;
+		break;
+
+	case DEV_ETHER_RING_HEAD:
+		if (writeflag == MEM_READ) {
+			*odata = ring->head;
+			break;
+		}
+		if (idata >= (uint64_t) ring->size) {
+			fatal("[ ether: bad ring head index %lli ]\n",
+			    (long long) idata);
+			break;
+		}
+		ring->head = idata;
+		if (ring == &d->tx_ring)
+			ether_ring_tx(cpu, d);
+		else
+			ether_ring_rx(cpu, d);
+		ether_update_irq(d);
+		break;
+
+	case DEV_ETHER_RING_TAIL:
+		if (writeflag == MEM_READ)
+			*odata = ring->tail;
+		else
+			fatal("[ ether: WARNING: write to ring tail ]\n");
+		break;
+
+	default:fatal("[ ether: unimplemented %s ring register 0x%x ]\n",
+		    ring == &d->tx_ring ? "TX" : "RX", reg);
+	}
+}
+
+
 DEVICE_TICK(ether)
 {  
 	struct ether_data *d = (struct ether_data *) extra;
 	int r = 0;
 
-	d->status &= ~DEV_ETHER_STATUS_MORE_PACKETS_AVAILABLE;
-	if (cpu->machine->emul->net != NULL)
-		r = net_ethernet_rx_avail(cpu->machine->emul->net, &d->nic);
-	if (r)
-		d->status |= DEV_ETHER_STATUS_MORE_PACKETS_AVAILABLE;
+	if (d->rx_ring.size > 0) {
+		ether_ring_rx(cpu, d);
+	} else {
+		d->status &= ~DEV_ETHER_STATUS_MORE_PACKETS_AVAILABLE;
+		if (cpu->machine->emul->net != NULL)
+			r = net_ethernet_rx_avail(cpu->machine->emul->net,
+			    &d->nic);
+		if (r)
+			d->status |= DEV_ETHER_STATUS_MORE_PACKETS_AVAILABLE;
+	}
 
-	if (d->status)
-		INTERRUPT_ASSERT(d->irq);
-	else
-		INTERRUPT_DEASSERT(d->irq);
+	/*  Don't let coalesced completions wait for too long:  */
+	if (d->n_uncoalesced > 0 &&
+	    ++ d->ticks_uncoalesced >= d->coalesce_ticks) {
+		d->ring_irq |= d->uncoalesced_bits;
+		d->n_uncoalesced = d->uncoalesced_bits = 0;
+		d->ticks_uncoalesced = 0;
+	}
+
+	ether_update_irq(d);
 }
 
 
@@ -96,12 +356,29 @@ DEVICE_ACCESS(ether)
 {
 	struct ether_data *d = (struct ether_data *) extra;
 	uint64_t idata = 0, odata = 0;
-	unsigned char *incoming_ptr;
 	int incoming_len;
 
 	if (writeflag == MEM_WRITE)
 		idata = memory_readmax64(cpu, data, len);
 
+	if (relative_addr + DEV_ETHER_BUFFER_SIZE >= DEV_ETHER_RX_RING_BASE &&
+	    relative_addr + DEV_ETHER_BUFFER_SIZE < DEV_ETHER_RX_RING_BASE +
+	    DEV_ETHER_RING_REGS_LEN) {
+		ether_ring_access(cpu, d, &d->rx_ring, relative_addr +
+		    DEV_ETHER_BUFFER_SIZE - DEV_ETHER_RX_RING_BASE, writeflag,
+		    idata, &odata);
+		goto do_return;
+	}
+
+	if (relative_addr + DEV_ETHER_BUFFER_SIZE >= DEV_ETHER_TX_RING_BASE &&
+	    relative_addr + DEV_ETHER_BUFFER_SIZE < DEV_ETHER_TX_RING_BASE +
+	    DEV_ETHER_RING_REGS_LEN) {
+		ether_ring_access(cpu, d, &d->tx_ring, relative_addr +
+		    DEV_ETHER_BUFFER_SIZE - DEV_ETHER_TX_RING_BASE, writeflag,
+		    idata, &odata);
+		goto do_return;
+	}
+
 	/*  Note: relative_addr + DEV_ETHER_BUFFER_SIZE to get the same
 	    offsets as in the header file:  */
 
@@ -111,7 +388,7 @@ DEVICE_ACCESS(ether)
 		if (writeflag == MEM_READ) {
 			odata = d->status;
 			d->status = 0;
-			INTERRUPT_DEASSERT(d->irq);
+			ether_update_irq(d);
 		} else
 			fatal("[ ether: WARNING: write to status ]\n");
 		break;
@@ -148,16 +425,14 @@ DEVICE_ACCESS(ether)
 				fatal("[ ether: RECEIVE but no net? ]\n");
 			else {
 				d->status &= ~DEV_ETHER_STATUS_PACKET_RECEIVED;
-				if (net_ethernet_rx(cpu->machine->emul->net,
-				    &d->nic, &incoming_ptr, &incoming_len)) {
+				if (net_ethernet_rx_copy(cpu->machine->emul->net,
+				    &d->nic, d->buf, DEV_ETHER_BUFFER_SIZE,
+				    &incoming_len)) {
 					d->status |=
 					    DEV_ETHER_STATUS_PACKET_RECEIVED;
 					if (incoming_len>DEV_ETHER_BUFFER_SIZE)
 						incoming_len =
 						    DEV_ETHER_BUFFER_SIZE;
-					memcpy(d->buf, incoming_ptr,
-					    incoming_len);
-					free(incoming_ptr);
 					d->packet_len = incoming_len;
 				}
 			}
@@ -190,6 +465,29 @@ DEVICE_ACCESS(ether)
 		}
 		break;
 
+	case DEV_ETHER_RING_IRQ:
+		if (writeflag == MEM_READ)
+			odata = d->ring_irq;
+		else {
+			d->ring_irq &= ~idata;
+			ether_update_irq(d);
+		}
+		break;
+
+	case DEV_ETHER_COALESCE_PACKETS:
+		if (writeflag == MEM_READ)
+			odata = d->coalesce_packets;
+		else
+			d->coalesce_packets = idata < 1 ? 1 : idata;
+		break;
+
+	case DEV_ETHER_COALESCE_TICKS:
+		if (writeflag == MEM_READ)
+			odata = d->coalesce_ticks;
+		else
+			d->coalesce_ticks = idata < 1 ? 1 : idata;
+		break;
+
 	default:if (writeflag == MEM_WRITE) {
 			fatal("[ ether: unimplemented write to "
 			    "offset 0x%x: data=0x%x ]\n", (int)
@@ -200,6 +498,7 @@ DEVICE_ACCESS(ether)
 		}
 	}
 
+do_return:
 	if (writeflag == MEM_READ)
 		memory_writemax64(cpu, data, len, odata);
 
@@ -217,6 +516,9 @@ DEVINIT(ether)
 	CHECK_ALLOCATION(d = (struct ether_data *) malloc(sizeof(struct ether_data)));
 	memset(d, 0, sizeof(struct ether_data));
 
+	d->coalesce_packets = 1;
+	d->coalesce_ticks = 1;
+
 	nlen = strlen(devinit->name) + 80;
 	CHECK_ALLOCATION(n1 = (char *) malloc(nlen));
 	CHECK_ALLOCATION(n2 = (char *) malloc(nlen));
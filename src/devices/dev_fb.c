@@ -62,6 +62,9 @@
 
 #define	FB_TICK_SHIFT		19
 
+/*  Ranges of dyntrans-written pages redrawn separately, per tick:  */
+#define	FB_MAX_DIRTY_RANGES	16
+
 
 /*  #define FB_DEBUG  */
 
@@ -178,7 +181,6 @@ void dev_fb_resize(struct vfb_data *d, int new_xsize, int new_ysize)
 
 	set_title(d);
 
-#ifdef WITH_X11
 	if (d->fb_window != NULL) {
 		x11_fb_resize(d->fb_window, d->x11_xsize, d->x11_ysize);
 		if (d->fb_window->name != NULL)
@@ -186,7 +188,6 @@ void dev_fb_resize(struct vfb_data *d, int new_xsize, int new_ysize)
 		d->fb_window->name = strdup(d->title);
 		x11_set_standard_properties(d->fb_window);
 	}
-#endif
 }
 
 
@@ -205,7 +206,6 @@ void dev_fb_setcursor(struct vfb_data *d, int cursor_x, int cursor_y, int on,
 	if (cursor_y + cursor_ysize >= d->ysize)
 		cursor_y = d->ysize - cursor_ysize;
 
-#ifdef WITH_X11
 	if (d->fb_window != NULL) {
 		d->fb_window->cursor_x      = cursor_x;
 		d->fb_window->cursor_y      = cursor_y;
@@ -213,7 +213,6 @@ void dev_fb_setcursor(struct vfb_data *d, int cursor_x, int cursor_y, int on,
 		d->fb_window->cursor_xsize  = cursor_xsize;
 		d->fb_window->cursor_ysize  = cursor_ysize;
 	}
-#endif
 
 	/*  debug("dev_fb_setcursor(%i,%i, size %i,%i, on=%i)\n",
 	    cursor_x, cursor_y, cursor_xsize, cursor_ysize, on);  */
@@ -312,17 +311,96 @@ void framebuffer_blockcopyfill(struct vfb_data *d, int fillflag, int fill_r,
 }
 
 
-#ifdef WITH_X11
+/*
+ *  fb_source_rgb():
+ *
+ *  Returns the color of a framebuffer pixel as 8-bit r, g, and b values.
+ *  (Used when scaling down, where the pixels are averaged.)
+ */
+static void fb_source_rgb(struct vfb_data *d, int x, int y,
+	int *r, int *g, int *b)
+{
+	size_t fb_addr = ((size_t) y * d->xsize + x) * d->bit_depth;
+	/*  fb_addr is now which _bit_ in the framebuffer  */
+	int c;
+
+	if (d->bit_depth < 8) {
+		int shift = fb_addr & 7;
+
+		/*  HPC is reverse:  */
+		if (d->vfb_type == VFB_HPC || d->vfb_type == VFB_REVERSEBITS)
+			shift = 8 - d->bit_depth - shift;
+
+		c = (d->framebuffer[fb_addr >> 3] >> shift) &
+		    ((1 << d->bit_depth) - 1);
+	} else if (d->bit_depth == 8) {
+		c = d->framebuffer[fb_addr >> 3];
+	} else {
+		fb_addr >>= 3;
+
+		switch (d->bit_depth) {
+		case 24:
+		case 32:
+			*r = d->framebuffer[fb_addr];
+			*g = d->framebuffer[fb_addr + 1];
+			*b = d->framebuffer[fb_addr + 2];
+			break;
+		case 16:
+			c = d->framebuffer[fb_addr] +
+			    (d->framebuffer[fb_addr + 1] << 8);
+			if (d->vfb_type != VFB_HPC) {
+				/*  HUH? TODO:  */
+				*r = (d->framebuffer[fb_addr] >> 3) * 8;
+				*g = ((d->framebuffer[fb_addr] << 5) +
+				    (d->framebuffer[fb_addr + 1] >> 5)) * 4;
+				*b = (d->framebuffer[fb_addr + 1] & 31) * 8;
+			} else if (d->color32k) {
+				*r = ((c >> 11) & 31) * 8;
+				*g = ((c >> 5) & 31) * 8;
+				*b = (c & 31) * 8;
+			} else if (d->psp_15bit) {
+				*r = (c & 31) * 8;
+				*g = ((c >> 5) & 31) * 8;
+				*b = ((c >> 10) & 31) * 8;
+			} else {
+				*r = ((c >> 11) & 31) * 8;
+				*g = ((c >> 5) & 63) * 4;
+				*b = (c & 31) * 8;
+			}
+			break;
+		default:
+			*r = *g = *b = random() & 255;
+		}
+		return;
+	}
+
+	*r = d->rgb_palette[c*3 + 0];
+	*g = d->rgb_palette[c*3 + 1];
+	*b = d->rgb_palette[c*3 + 2];
+}
 
-#define	REDRAW	redraw_fallback
-#include "fb_include.c"
-#undef REDRAW
 
+/*
+ *  The 24-bit little-endian variants are also used for headless windows
+ *  (see src/console/fb_headless.c), so they are built even without X11.
+ */
 #define FB_24
 #define REDRAW	redraw_24
 #include "fb_include.c"
 #undef REDRAW
+#define FB_SCALEDOWN
+#define REDRAW	redraw_24_sd
+#include "fb_include.c"
+#undef REDRAW
+#undef FB_SCALEDOWN
 #undef FB_24
+
+#ifdef WITH_X11
+
+#define	REDRAW	redraw_fallback
+#include "fb_include.c"
+#undef REDRAW
+
 #define FB_16
 #define REDRAW	redraw_16
 #include "fb_include.c"
@@ -358,11 +436,6 @@ void framebuffer_blockcopyfill(struct vfb_data *d, int fillflag, int fill_r,
 #include "fb_include.c"
 #undef REDRAW
 
-#define FB_24
-#define REDRAW	redraw_24_sd
-#include "fb_include.c"
-#undef REDRAW
-#undef FB_24
 #define FB_16
 #define REDRAW	redraw_16_sd
 #include "fb_include.c"
@@ -392,7 +465,9 @@ void framebuffer_blockcopyfill(struct vfb_data *d, int fillflag, int fill_r,
 #undef FB_15
 #undef FB_BO
 
-void (*redraw[2 * 4 * 2])(struct vfb_data *, int, int) = {
+#undef FB_SCALEDOWN
+
+void (*redraw[2 * 4 * 2])(struct vfb_data *, int, int, int, int) = {
 	redraw_fallback, redraw_fallback,
 	redraw_15, redraw_15_bo,
 	redraw_16, redraw_16_bo,
@@ -405,84 +480,132 @@ void (*redraw[2 * 4 * 2])(struct vfb_data *, int, int) = {
 #endif	/*  WITH_X11  */
 
 
-DEVICE_TICK(fb)
+/*
+ *  fb_extend_update_region():
+ *
+ *  Extends the update region to cover framebuffer bytes low .. high. An
+ *  update covering more than one line covers all of the affected lines.
+ */
+static void fb_extend_update_region(struct vfb_data *d, uint64_t low,
+	uint64_t high)
 {
-	struct vfb_data *d = (struct vfb_data *) extra;
-#ifdef WITH_X11
-	int need_to_flush_x11 = 0;
-	int need_to_redraw_cursor = 0;
-#endif
+	int x1 = (low % d->bytes_per_line) * 8 / d->bit_depth;
+	int y1 = low / d->bytes_per_line;
+	int x2 = (high % d->bytes_per_line) * 8 / d->bit_depth;
+	int y2 = high / d->bytes_per_line;
+
+	if (y1 != y2) {
+		x1 = 0;
+		x2 = d->xsize - 1;
+	}
 
-	if (!cpu->machine->x11_md.in_use)
-		return;
+	if (x1 < d->update_x1 || d->update_x1 == -1)	d->update_x1 = x1;
+	if (x2 > d->update_x2 || d->update_x2 == -1)	d->update_x2 = x2;
+	if (y1 < d->update_y1 || d->update_y1 == -1)	d->update_y1 = y1;
+	if (y2 > d->update_y2 || d->update_y2 == -1)	d->update_y2 = y2;
 
-	do {
-		uint64_t high, low = (uint64_t)(int64_t) -1;
-		int x, y;
+	if (d->update_y1 != d->update_y2) {
+		d->update_x1 = 0;
+		d->update_x2 = d->xsize-1;
+	}
+}
 
-		memory_device_dyntrans_access(cpu, cpu->mem,
-		    extra, &low, &high);
-		if ((int64_t)low == -1)
-			break;
 
-		/*  printf("low=%016llx high=%016llx\n",
-		    (long long)low, (long long)high);  */
+/*
+ *  fb_update():
+ *
+ *  Redraws the update region (if any) in the host's window, and clears the
+ *  update region. Sets *hit_cursor if the region overlapped the old cursor.
+ */
+static void fb_update(struct vfb_data *d, int *hit_cursor)
+{
+	int q = d->vfb_scaledown;
 
-		x = (low % d->bytes_per_line) * 8 / d->bit_depth;
-		y = low / d->bytes_per_line;
-		if (x < d->update_x1 || d->update_x1 == -1)
-			d->update_x1 = x;
-		if (x > d->update_x2 || d->update_x2 == -1)
-			d->update_x2 = x;
-		if (y < d->update_y1 || d->update_y1 == -1)
-			d->update_y1 = y;
-		if (y > d->update_y2 || d->update_y2 == -1)
-			d->update_y2 = y;
+	if (d->update_x2 == -1)
+		return;
 
-		x = ((low+7) % d->bytes_per_line) * 8 / d->bit_depth;
-		y = (low+7) / d->bytes_per_line;
-		if (x < d->update_x1 || d->update_x1 == -1)
-			d->update_x1 = x;
-		if (x > d->update_x2 || d->update_x2 == -1)
-			d->update_x2 = x;
-		if (y < d->update_y1 || d->update_y1 == -1)
-			d->update_y1 = y;
-		if (y > d->update_y2 || d->update_y2 == -1)
-			d->update_y2 = y;
+	if (((d->update_x1 >= d->fb_window->OLD_cursor_x &&
+	      d->update_x1 < (d->fb_window->OLD_cursor_x +
+	      d->fb_window->OLD_cursor_xsize)) ||
+	     (d->update_x2 >= d->fb_window->OLD_cursor_x &&
+	      d->update_x2 < (d->fb_window->OLD_cursor_x +
+	      d->fb_window->OLD_cursor_xsize)) ||
+	     (d->update_x1 <  d->fb_window->OLD_cursor_x &&
+	      d->update_x2 >= (d->fb_window->OLD_cursor_x +
+	      d->fb_window->OLD_cursor_xsize)) ) &&
+	   ( (d->update_y1 >= d->fb_window->OLD_cursor_y &&
+	      d->update_y1 < (d->fb_window->OLD_cursor_y +
+	      d->fb_window->OLD_cursor_ysize)) ||
+	     (d->update_y2 >= d->fb_window->OLD_cursor_y &&
+	      d->update_y2 < (d->fb_window->OLD_cursor_y +
+	      d->fb_window->OLD_cursor_ysize)) ||
+	     (d->update_y1 <  d->fb_window->OLD_cursor_y &&
+	      d->update_y2 >= (d->fb_window->OLD_cursor_y +
+	     d->fb_window->OLD_cursor_ysize)) ) )
+		*hit_cursor = 1;
+
+	/*  Pixels smaller than a byte are redrawn a whole byte at a time:  */
+	if (d->bit_depth < 8) {
+		int ppb = 8 / d->bit_depth;
+		d->update_x1 = d->update_x1 / ppb * ppb;
+		d->update_x2 = d->update_x2 / ppb * ppb + ppb - 1;
+	}
 
-		x = (high % d->bytes_per_line) * 8 / d->bit_depth;
-		y = high / d->bytes_per_line;
-		if (x < d->update_x1 || d->update_x1 == -1)
-			d->update_x1 = x;
-		if (x > d->update_x2 || d->update_x2 == -1)
-			d->update_x2 = x;
-		if (y < d->update_y1 || d->update_y1 == -1)
-			d->update_y1 = y;
-		if (y > d->update_y2 || d->update_y2 == -1)
-			d->update_y2 = y;
+	if (d->update_x1 >= d->visible_xsize)
+		d->update_x1 = d->visible_xsize - 1;
+	if (d->update_x2 >= d->visible_xsize)
+		d->update_x2 = d->visible_xsize - 1;
+	if (d->update_y1 >= d->visible_ysize)
+		d->update_y1 = d->visible_ysize - 1;
+	if (d->update_y2 >= d->visible_ysize)
+		d->update_y2 = d->visible_ysize - 1;
+
+	/*  Without these, we might miss the rightmost/bottom pixel:  */
+	d->update_x2 += (q - 1);
+	d->update_y2 += (q - 1);
+
+	d->update_x1 = d->update_x1 / q * q;
+	d->update_x2 = d->update_x2 / q * q;
+	d->update_y1 = d->update_y1 / q * q;
+	d->update_y2 = d->update_y2 / q * q;
+
+	x11_fb_wait(d->fb_window);
+	d->redraw_func(d, d->update_x1, d->update_y1,
+	    d->update_x2, d->update_y2);
+
+	x11_fb_put_rect(d->fb_window, d->update_x1 / q, d->update_y1 / q,
+	    (d->update_x2 - d->update_x1) / q + 1,
+	    (d->update_y2 - d->update_y1) / q + 1);
+
+	d->update_x1 = d->update_y1 = 99999;
+	d->update_x2 = d->update_y2 = -1;
+}
 
-		x = ((high+7) % d->bytes_per_line) * 8 / d->bit_depth;
-		y = (high+7) / d->bytes_per_line;
-		if (x < d->update_x1 || d->update_x1 == -1)
-			d->update_x1 = x;
-		if (x > d->update_x2 || d->update_x2 == -1)
-			d->update_x2 = x;
-		if (y < d->update_y1 || d->update_y1 == -1)
-			d->update_y1 = y;
-		if (y > d->update_y2 || d->update_y2 == -1)
-			d->update_y2 = y;
 
-		/*
-		 *  An update covering more than one line will automatically
-		 *  force an update of all the affected lines:
-		 */
-		if (d->update_y1 != d->update_y2) {
-			d->update_x1 = 0;
-			d->update_x2 = d->xsize-1;
-		}
-	} while (0);
+DEVICE_TICK(fb)
+{
+	struct vfb_data *d = (struct vfb_data *) extra;
+	struct memory_dirty_range ranges[FB_MAX_DIRTY_RANGES];
+	int i, n_ranges, need_to_redraw_cursor = 0;
+
+	if (!cpu->machine->x11_md.in_use)
+		return;
+
+	/*
+	 *  First the region written to via dev_fb_access() (or by other
+	 *  devices), then each range of pages written to via dyntrans, one at
+	 *  a time, so that scattered small updates (e.g. a blinking cursor
+	 *  and a clock) do not cause everything in between to be redrawn.
+	 */
+	fb_update(d, &need_to_redraw_cursor);
+
+	n_ranges = memory_device_dyntrans_dirty(cpu, cpu->mem, extra,
+	    ranges, FB_MAX_DIRTY_RANGES);
+	for (i=0; i<n_ranges; i++) {
+		fb_extend_update_region(d, ranges[i].low, ranges[i].high);
+		fb_update(d, &need_to_redraw_cursor);
+	}
 
-#ifdef WITH_X11
 	/*  Do we need to redraw the cursor?  */
 	if (d->fb_window->cursor_on != d->fb_window->OLD_cursor_on ||
 	    d->fb_window->cursor_x != d->fb_window->OLD_cursor_x ||
@@ -491,98 +614,16 @@ DEVICE_TICK(fb)
 	    d->fb_window->cursor_ysize != d->fb_window->OLD_cursor_ysize)
 		need_to_redraw_cursor = 1;
 
-	if (d->update_x2 != -1) {
-		if (((d->update_x1 >= d->fb_window->OLD_cursor_x &&
-		      d->update_x1 < (d->fb_window->OLD_cursor_x +
-		      d->fb_window->OLD_cursor_xsize)) ||
-		     (d->update_x2 >= d->fb_window->OLD_cursor_x &&
-		      d->update_x2 < (d->fb_window->OLD_cursor_x +
-		      d->fb_window->OLD_cursor_xsize)) ||
-		     (d->update_x1 <  d->fb_window->OLD_cursor_x &&
-		      d->update_x2 >= (d->fb_window->OLD_cursor_x +
-		      d->fb_window->OLD_cursor_xsize)) ) &&
-		   ( (d->update_y1 >= d->fb_window->OLD_cursor_y &&
-		      d->update_y1 < (d->fb_window->OLD_cursor_y +
-		      d->fb_window->OLD_cursor_ysize)) ||
-		     (d->update_y2 >= d->fb_window->OLD_cursor_y &&
-		      d->update_y2 < (d->fb_window->OLD_cursor_y +
-		      d->fb_window->OLD_cursor_ysize)) ||
-		     (d->update_y1 <  d->fb_window->OLD_cursor_y &&
-		      d->update_y2 >= (d->fb_window->OLD_cursor_y +
-		     d->fb_window->OLD_cursor_ysize)) ) )
-			need_to_redraw_cursor = 1;
-	}
-
 	if (need_to_redraw_cursor) {
 		/*  Remove old cursor, if any:  */
 		if (d->fb_window->OLD_cursor_on) {
-			XPutImage(d->fb_window->x11_display,
-			    d->fb_window->x11_fb_window,
-			    d->fb_window->x11_fb_gc, d->fb_window->fb_ximage,
-			    d->fb_window->OLD_cursor_x/d->vfb_scaledown,
-			    d->fb_window->OLD_cursor_y/d->vfb_scaledown,
+			x11_fb_put_rect(d->fb_window,
 			    d->fb_window->OLD_cursor_x/d->vfb_scaledown,
 			    d->fb_window->OLD_cursor_y/d->vfb_scaledown,
 			    d->fb_window->OLD_cursor_xsize/d->vfb_scaledown + 1,
 			    d->fb_window->OLD_cursor_ysize/d->vfb_scaledown +1);
 		}
-	}
-#endif
-
-	if (d->update_x2 != -1) {
-#ifdef WITH_X11
-		int y;
-		int addr, addr2;
-#endif
-		int q = d->vfb_scaledown;
-
-		if (d->update_x1 >= d->visible_xsize)
-			d->update_x1 = d->visible_xsize - 1;
-		if (d->update_x2 >= d->visible_xsize)
-			d->update_x2 = d->visible_xsize - 1;
-		if (d->update_y1 >= d->visible_ysize)
-			d->update_y1 = d->visible_ysize - 1;
-		if (d->update_y2 >= d->visible_ysize)
-			d->update_y2 = d->visible_ysize - 1;
-
-		/*  Without these, we might miss the rightmost/bottom pixel:  */
-		d->update_x2 += (q - 1);
-		d->update_y2 += (q - 1);
-
-		d->update_x1 = d->update_x1 / q * q;
-		d->update_x2 = d->update_x2 / q * q;
-		d->update_y1 = d->update_y1 / q * q;
-		d->update_y2 = d->update_y2 / q * q;
-
-#ifdef WITH_X11
-		addr  = d->update_y1 * d->bytes_per_line +
-		    d->update_x1 * d->bit_depth / 8;
-		addr2 = d->update_y1 * d->bytes_per_line +
-		    d->update_x2 * d->bit_depth / 8;
-
-		for (y=d->update_y1; y<=d->update_y2; y+=q) {
-			d->redraw_func(d, addr, addr2 - addr);
-			addr  += d->bytes_per_line * q;
-			addr2 += d->bytes_per_line * q;
-		}
-
-		XPutImage(d->fb_window->x11_display, d->fb_window->
-		    x11_fb_window, d->fb_window->x11_fb_gc, d->fb_window->
-		    fb_ximage, d->update_x1/d->vfb_scaledown, d->update_y1/
-		    d->vfb_scaledown, d->update_x1/d->vfb_scaledown,
-		    d->update_y1/d->vfb_scaledown,
-		    (d->update_x2 - d->update_x1)/d->vfb_scaledown + 1,
-		    (d->update_y2 - d->update_y1)/d->vfb_scaledown + 1);
-
-		need_to_flush_x11 = 1;
-#endif
-
-		d->update_x1 = d->update_y1 = 99999;
-		d->update_x2 = d->update_y2 = -1;
-	}
 
-#ifdef WITH_X11
-	if (need_to_redraw_cursor) {
 		/*  Paint new cursor:  */
 		if (d->fb_window->cursor_on) {
 			x11_redraw_cursor(cpu->machine,
@@ -594,15 +635,38 @@ DEVICE_TICK(fb)
 			    cursor_xsize;
 			d->fb_window->OLD_cursor_ysize = d->fb_window->
 			    cursor_ysize;
-			need_to_flush_x11 = 1;
 		}
 	}
-#endif
 
-#ifdef WITH_X11
-	if (need_to_flush_x11)
-		XFlush(d->fb_window->x11_display);
-#endif
+	x11_fb_flush(d->fb_window);
+}
+
+
+/*
+ *  dev_fb_update_windows():
+ *
+ *  Brings framebuffer windows up to date with the emulated framebuffer
+ *  memory, outside of the regular ticks (e.g. before a snapshot). If fbwin
+ *  is NULL, all of the machine's framebuffers are updated.
+ */
+void dev_fb_update_windows(struct machine *machine, struct fb_window *fbwin)
+{
+	struct cpu *cpu = machine->cpus[machine->bootstrap_cpu];
+	int i;
+
+	for (i=0; i<machine->tick_functions.n_entries; i++) {
+		struct vfb_data *d;
+
+		if (machine->tick_functions.f[i] != dev_fb_tick)
+			continue;
+
+		d = (struct vfb_data *) machine->tick_functions.extra[i];
+		if (d->fb_window == NULL ||
+		    (fbwin != NULL && d->fb_window != fbwin))
+			continue;
+
+		dev_fb_tick(cpu, d);
+	}
 }
 
 
@@ -834,23 +898,28 @@ struct vfb_data *dev_fb_init(struct machine *machine, struct memory *mem,
 	CHECK_ALLOCATION(d->name = strdup(name));
 	set_title(d);
 
-#ifdef WITH_X11
 	if (machine->x11_md.in_use) {
-		int i = 0;
 		d->fb_window = x11_fb_init(d->x11_xsize, d->x11_ysize,
 		    d->title, machine->x11_md.scaledown, machine);
-		switch (d->fb_window->x11_screen_depth) {
-		case 15: i = 2; break;
-		case 16: i = 4; break;
-		case 24: i = 6; break;
+		if (d->fb_window->headless) {
+			d->redraw_func = d->vfb_scaledown > 1?
+			    redraw_24_sd : redraw_24;
+		} else {
+#ifdef WITH_X11
+			int i = 0;
+			switch (d->fb_window->x11_screen_depth) {
+			case 15: i = 2; break;
+			case 16: i = 4; break;
+			case 24: i = 6; break;
+			}
+			if (d->fb_window->fb_ximage->byte_order)
+				i ++;
+			if (d->vfb_scaledown > 1)
+				i += 8;
+			d->redraw_func = redraw[i];
+#endif
 		}
-		if (d->fb_window->fb_ximage->byte_order)
-			i ++;
-		if (d->vfb_scaledown > 1)
-			i += 8;
-		d->redraw_func = redraw[i];
 	} else
-#endif
 		d->fb_window = NULL;
 
 	nlen = strlen(name) + 10;
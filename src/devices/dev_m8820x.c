@@ -88,10 +88,19 @@ static void m8820x_command(struct cpu *cpu, struct m8820x_data *d)
 		if (cmd == CMMU_FLUSH_SUPER_ALL || cmd == CMMU_FLUSH_SUPER_PAGE)
 			super = M8820X_PATC_SUPERVISOR_BIT;
 
-		for (size_t i = 0; i < N_M88200_PATC_ENTRIES; i++) {
+		/*
+		 *  All entries are scanned when flushing everything. For a
+		 *  single page, only the entries in the PATC hash chain for
+		 *  that page need to be checked.
+		 */
+		int next;
+		for (int i = all? 0 : cmmu->patc_hash[M8820X_PATC_HASH(sar)] - 1;
+		    i >= 0 && i < N_M88200_PATC_ENTRIES; i = next) {
 			uint32_t v = cmmu->patc_v_and_control[i];
 			uint32_t p = cmmu->patc_p_and_supervisorbit[i];
 
+			next = all? i + 1 : cmmu->patc_hash_next[i] - 1;
+
 			/*  Already invalid? Then skip this entry.  */
 			if (!(v & PG_V))
 				continue;
@@ -106,6 +115,7 @@ static void m8820x_command(struct cpu *cpu, struct m8820x_data *d)
 				continue;
 
 			/*  Finally, invalidate the entry:  */
+			m8820x_patc_unlink(cmmu, i);
 			cmmu->patc_v_and_control[i] = v & ~PG_V;
 
 			if (!all)
@@ -134,7 +144,8 @@ DEVICE_ACCESS(m8820x)
 	struct m8820x_data *d = (struct m8820x_data *) extra;
 	struct cpu* c = cpu->machine->cpus[d->cpu_nr];
 	uint32_t *regs = c->cd.m88k.cmmu[d->cmmu_nr]->reg;
-	uint32_t *batc = c->cd.m88k.cmmu[d->cmmu_nr]->batc;
+	struct m8820x_cmmu *cmmu = c->cd.m88k.cmmu[d->cmmu_nr];
+	uint32_t *batc = cmmu->batc;
 
 	if (writeflag == MEM_WRITE)
 		idata = memory_readmax64(cpu, data, len);
@@ -205,6 +216,8 @@ DEVICE_ACCESS(m8820x)
 			old = batc[i];
 			batc[i] = idata;
 			if (old != idata) {
+				cmmu->batc_index_valid = false;
+
 				/*  TODO: Perhaps don't invalidate everything?  */
 				c->invalidate_translation_caches(c, 0, INVALIDATE_ALL);
 			}
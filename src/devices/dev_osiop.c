@@ -83,6 +83,10 @@ struct osiop_data {
 	struct scsi_transfer	*xferp;
 	size_t			data_offset;
 
+	/*  Asynchronous SCSI command; SCRIPTS wait until it completes:  */
+	struct diskimage_request *pending;
+	int			pending_rerun;
+
 	/*  Cached emulated physical RAM page lookup:  */
 	uint32_t		last_phys_page;
 	uint8_t			*last_host_page;
@@ -121,6 +125,22 @@ static void osiop_new_xfer(struct osiop_data *d, int target_scsi_id)
 }
 
 
+/*
+ *  osiop_submit():
+ *
+ *  Send the current transfer's command to the selected target. The command
+ *  is carried out asynchronously, and SCRIPTS execution is held until
+ *  osiop_check_pending() has seen it complete. rerun is non-zero when the
+ *  command is rerun to write out data that was just moved in DATA_OUT.
+ */
+static void osiop_submit(struct cpu *cpu, struct osiop_data *d, int rerun)
+{
+	d->pending = diskimage_async_scsicommand(cpu, d->selected_id,
+	    DISKIMAGE_SCSI, d->xferp);
+	d->pending_rerun = rerun;
+}
+
+
 static int osiop_get_scsi_phase(struct osiop_data *d)
 {
 	return OSIOP_PHASE(d->reg[OSIOP_SOCL]);
@@ -135,6 +155,45 @@ static void osiop_set_scsi_phase(struct osiop_data *d, int phase)
 }
 
 
+/*
+ *  osiop_check_pending():
+ *
+ *  If an asynchronous SCSI command has completed, then move on to the
+ *  phase that the target asked for, so that SCRIPTS may continue.
+ */
+static void osiop_check_pending(struct osiop_data *d)
+{
+	struct diskimage_request *r = d->pending;
+	int res;
+
+	if (r == NULL || !diskimage_async_poll(r))
+		return;
+
+	res = r->result;
+	diskimage_async_free(r);
+	d->pending = NULL;
+
+	if (res == 0) {
+		fatal("osiop TODO: error%s\n",
+		    d->pending_rerun? " on rerun" : "");
+		exit(1);
+	}
+
+	if (d->pending_rerun) {
+		/*  Stay at data out phase if the target wants more data.  */
+		if (res != 2)
+			osiop_set_scsi_phase(d, STATUS_PHASE);
+	} else {
+		if (res == 2)
+			osiop_set_scsi_phase(d, DATA_OUT_PHASE);
+		else if (d->xferp->data_in_len > 0)
+			osiop_set_scsi_phase(d, DATA_IN_PHASE);
+		else
+			osiop_set_scsi_phase(d, STATUS_PHASE);
+	}
+}
+
+
 /*
  *  osiop_update_sip_and_dip():
  *
@@ -334,7 +393,6 @@ int osiop_execute_scripts_instr(struct cpu *cpu, struct osiop_data *d)
 			uint32_t dsa = *dsap;
 			uint32_t addr, xfer_byte_count, xfer_addr;
 			int32_t tmp = ofs2 << 8;
-			int res;
 			size_t i;
 
 			tmp >>= 8;
@@ -416,21 +474,9 @@ int osiop_execute_scripts_instr(struct cpu *cpu, struct osiop_data *d)
 					xfer_byte_count --;
 				}
 
-				res = diskimage_scsicommand(cpu,
-				    d->selected_id, DISKIMAGE_SCSI, d->xferp);
-				if (res == 0) {
-					fatal("osiop TODO: error\n");
-					exit(1);
-				}
-
+				/*  The next phase is set on completion:  */
+				osiop_submit(cpu, d, 0);
 				d->data_offset = 0;
-				
-				if (res == 2)
-					osiop_set_scsi_phase(d, DATA_OUT_PHASE);
-				else if (d->xferp->data_in_len > 0)
-					osiop_set_scsi_phase(d, DATA_IN_PHASE);
-				else
-					osiop_set_scsi_phase(d, STATUS_PHASE);
 				break;
 
 			case DATA_OUT_PHASE:
@@ -448,16 +494,7 @@ int osiop_execute_scripts_instr(struct cpu *cpu, struct osiop_data *d)
 				}
 
 				/*  Rerun the command to actually write out the data:  */
-				res = diskimage_scsicommand(cpu,
-				    d->selected_id, DISKIMAGE_SCSI, d->xferp);
-				if (res == 0) {
-					fatal("osiop TODO: error on rerun\n");
-					exit(1);
-				} else if (res == 2) {
-					/*  Stay at data out phase.  */
-				} else {
-					osiop_set_scsi_phase(d, STATUS_PHASE);
-				}
+				osiop_submit(cpu, d, 1);
 				break;
 
 			case DATA_IN_PHASE:
@@ -783,17 +820,20 @@ int osiop_execute_scripts_instr(struct cpu *cpu, struct osiop_data *d)
  *  osiop_execute_scripts():
  *
  *  Interprets SCRIPTS machine code by reading one instruction word at a time,
- *  and executing it.
+ *  and executing it. Execution stops (until a later tick) while a SCSI
+ *  command is being carried out.
  */
 void osiop_execute_scripts(struct cpu *cpu, struct osiop_data *d)
 {
 	int n = 0;
 
+	osiop_check_pending(d);
+
 	if (osiop_debug)
 		debug("{ SCRIPTS start }\n");
 
-	while (d->scripts_running && n < MAX_SCRIPTS_PER_CHUNK &&
-	    osiop_execute_scripts_instr(cpu, d))
+	while (d->scripts_running && d->pending == NULL &&
+	    n < MAX_SCRIPTS_PER_CHUNK && osiop_execute_scripts_instr(cpu, d))
 		n++;
 
 	if (osiop_debug)	
@@ -80,6 +80,9 @@ static int ta_debug = 0;		// Dumps TA commands
 
 #define	PVR_MARGIN		16
 
+/*  Max. number of dirty VRAM ranges looked at per tick:  */
+#define	PVR_MAX_DIRTY_RANGES	8
+
 #define	VRAM_SIZE		(8*1048576)
 
 /*  DMA:  */
@@ -2277,7 +2280,8 @@ void pvr_extend_update_region(struct pvr_data *d, uint64_t low, uint64_t high)
 DEVICE_TICK(pvr_fb)
 {
 	struct pvr_data *d = (struct pvr_data *) extra;
-	uint64_t high, low = (uint64_t)(int64_t) -1;
+	struct memory_dirty_range ranges[PVR_MAX_DIRTY_RANGES];
+	int i, n_ranges;
 	int vram_ofs = REG(PVRREG_DIWADDRL), pixels_to_copy;
 	int bytes_per_line = d->xsize * d->bytes_per_pixel;
 	int fb_ofs, p;
@@ -2341,9 +2345,10 @@ DEVICE_TICK(pvr_fb)
 		d->fb->update_y1 = 0; d->fb->update_y2 = d->fb->ysize - 1;
 	}
 
-	memory_device_dyntrans_access(cpu, cpu->mem, extra, &low, &high);
-	if ((int64_t)low != -1)
-		pvr_extend_update_region(d, low, high);
+	n_ranges = memory_device_dyntrans_dirty(cpu, cpu->mem, extra,
+	    ranges, PVR_MAX_DIRTY_RANGES);
+	for (i=0; i<n_ranges; i++)
+		pvr_extend_update_region(d, ranges[i].low, ranges[i].high);
 
 	if (d->fb_update_x1 == -1)
 		return;
@@ -56,6 +56,9 @@
 #define	MAX_RETRACE_SCANLINES	420
 #define	N_IS1_READ_THRESHOLD	50
 
+/*  Max. number of dirty video memory ranges looked at per tick:  */
+#define	VGA_MAX_DIRTY_RANGES	8
+
 #define	GFX_ADDR_WINDOW		0x18000
 
 #define	VGA_FB_ADDR	0x1c00000000ULL
@@ -504,17 +507,19 @@ static void vga_update_cursor(struct machine *machine, struct vga_data *d)
 DEVICE_TICK(vga)
 {
 	struct vga_data *d = (struct vga_data *) extra;
-	int64_t low = -1, high;
+	struct memory_dirty_range ranges[VGA_MAX_DIRTY_RANGES];
+	int i, n_ranges;
 
 	vga_update_cursor(cpu->machine, d);
 
 	/*  TODO: text vs graphics tick?  */
-	memory_device_dyntrans_access(cpu, cpu->mem, extra,
-	    (uint64_t *) &low, (uint64_t *) &high);
+	n_ranges = memory_device_dyntrans_dirty(cpu, cpu->mem, extra,
+	    ranges, VGA_MAX_DIRTY_RANGES);
 
-	if (low != -1) {
+	for (i=0; i<n_ranges; i++) {
 		int base = ((d->crtc_reg[VGA_CRTC_START_ADDR_HIGH] << 8)
 		    + d->crtc_reg[VGA_CRTC_START_ADDR_LOW]) * 2;
+		int64_t low = ranges[i].low, high = ranges[i].high;
 		int new_u_y1, new_u_y2;
 		debug("[ dev_vga_tick: dyntrans access, %" PRIx64" .. %"
 		    PRIx64" ]\n", (uint64_t) low, (uint64_t) high);
@@ -69,6 +69,10 @@ struct wdc_data {
 
 	int		int_assert;
 
+	/*  Asynchronous disk request in progress (the controller is busy):  */
+	struct diskimage_request *pending;
+	unsigned char	*pending_buf;
+
 	int		write_in_progress;
 	int		write_count;
 	int64_t		write_offset;
@@ -98,10 +102,15 @@ struct wdc_data {
 #define COMMAND_RESET	0x100
 
 
+static void wdc_check_pending(struct wdc_data *d);
+
+
 DEVICE_TICK(wdc)
 { 
 	struct wdc_data *d = (struct wdc_data *) extra;
 
+	wdc_check_pending(d);
+
 	if (d->int_assert)
 		INTERRUPT_ASSERT(d->irq);
 }
@@ -260,15 +269,92 @@ static void wdc_initialize_identify_struct(struct cpu *cpu, struct wdc_data *d)
 }
 
 
+/*
+ *  wdc_check_pending():
+ *
+ *  If an asynchronous read or write has completed, then the data is moved
+ *  into the inbuf (for reads), and the completion interrupt is asserted.
+ *  A failed request ends the command with ERR in the status register and
+ *  ABRT in the error register, and no data.
+ */
+static void wdc_check_pending(struct wdc_data *d)
+{
+	struct diskimage_request *r = d->pending;
+
+	if (r == NULL || !diskimage_async_poll(r))
+		return;
+
+	if (!r->result) {
+		d->error |= WDCE_ABRT;
+		d->write_in_progress = 0;
+		d->write_count = 0;
+	} else if (!r->writeflag) {
+		if (d->inbuf_head + r->len <= WDC_INBUF_SIZE) {
+			memcpy(d->inbuf + d->inbuf_head, r->buf, r->len);
+			d->inbuf_head += r->len;
+			if (d->inbuf_head == WDC_INBUF_SIZE)
+				d->inbuf_head = 0;
+		} else {
+			for (size_t i=0; i<r->len; i++)
+				wdc_addtoinbuf(d, r->buf[i]);
+		}
+	} else {
+		if (d->write_count == 0)
+			d->write_in_progress = 0;
+	}
+
+	diskimage_async_free(r);
+	free(d->pending_buf);
+	d->pending = NULL;
+	d->pending_buf = NULL;
+
+	d->int_assert = 1;
+}
+
+
+/*
+ *  wdc_submit():
+ *
+ *  Start an asynchronous read or write. buf is freed when the request
+ *  has completed.
+ *
+ *  If the guest issues a new command before the previous request's
+ *  completion has been collected, the previous request is waited for and
+ *  completed first, so that its data and interrupt are not lost.
+ */
+static void wdc_submit(struct cpu *cpu, struct wdc_data *d, int writeflag,
+	uint64_t offset, unsigned char *buf, size_t len)
+{
+	if (d->pending != NULL) {
+		diskimage_async_wait(d->pending);
+		wdc_check_pending(d);
+	}
+
+	d->pending_buf = buf;
+	d->pending = diskimage_async_submit(cpu->machine,
+	    d->drive + d->base_drive, DISKIMAGE_IDE, writeflag, offset,
+	    buf, len);
+
+	if (d->pending == NULL) {
+		free(d->pending_buf);
+		d->pending_buf = NULL;
+		d->error |= WDCE_ABRT;
+		d->int_assert = 1;
+		return;
+	}
+
+	/*  Without I/O threads, the request may already be done:  */
+	wdc_check_pending(d);
+}
+
+
 /*
  *  wdc__read():
  */
 void wdc__read(struct cpu *cpu, struct wdc_data *d)
 {
-#define MAX_SECTORS_PER_CHUNK	64
-	const int max_sectors_per_chunk = MAX_SECTORS_PER_CHUNK;
-	unsigned char buf[512 * MAX_SECTORS_PER_CHUNK];
-	int i, cyl = d->cyl_hi * 256+ d->cyl_lo;
+	unsigned char *buf;
+	int cyl = d->cyl_hi * 256+ d->cyl_lo;
 	int count = d->seccnt? d->seccnt : 256;
 	uint64_t offset = 512 * (d->sector - 1
 	    + (int64_t)d->head * d->sectors_per_track[d->drive] +
@@ -282,31 +368,13 @@ void wdc__read(struct cpu *cpu, struct wdc_data *d)
 	printf("WDC read from offset %lli\n", (long long)offset);
 #endif
 
-	while (count > 0) {
-		int to_read = count > max_sectors_per_chunk?
-		    max_sectors_per_chunk : count;
-
-		/*  TODO: result code from the read?  */
-
-		if (d->inbuf_head + 512 * to_read <= WDC_INBUF_SIZE) {
-			diskimage_access(cpu->machine, d->drive + d->base_drive,
-			    DISKIMAGE_IDE, 0, offset,
-			    d->inbuf + d->inbuf_head, 512 * to_read);
-			d->inbuf_head += 512 * to_read;
-			if (d->inbuf_head == WDC_INBUF_SIZE)
-				d->inbuf_head = 0;
-		} else {
-			diskimage_access(cpu->machine, d->drive + d->base_drive,
-			    DISKIMAGE_IDE, 0, offset, buf, 512 * to_read);
-			for (i=0; i<512 * to_read; i++)
-				wdc_addtoinbuf(d, buf[i]);
-		}
-
-		offset += 512 * to_read;
-		count -= to_read;
-	}
-
-	d->int_assert = 1;
+	/*
+	 *  The whole transfer is read in one asynchronous request. The
+	 *  controller is busy (and the guest keeps running) until it has
+	 *  completed.
+	 */
+	CHECK_ALLOCATION(buf = (unsigned char *) malloc(512 * count));
+	wdc_submit(cpu, d, 0, offset, buf, 512 * count);
 }
 
 
@@ -331,8 +399,6 @@ void wdc__write(struct cpu *cpu, struct wdc_data *d)
 	d->write_in_progress = d->cur_command;
 	d->write_count = count;
 	d->write_offset = offset;
-
-	/*  TODO: result code?  */
 }
 
 
@@ -345,6 +411,11 @@ void wdc__write(struct cpu *cpu, struct wdc_data *d)
 static int status_byte(struct wdc_data *d, struct cpu *cpu)
 {
 	int odata = 0;
+
+	wdc_check_pending(d);
+	if (d->pending != NULL)
+		return WDCS_BSY;
+
 	if (diskimage_exist(cpu->machine, d->drive + d->base_drive,
 	    DISKIMAGE_IDE))
 		odata |= WDCS_DRDY | WDCS_DSC;
@@ -395,6 +466,12 @@ void wdc_command(struct cpu *cpu, struct wdc_data *d, int idata)
 {
 	size_t i;
 
+	/*  A new command can not be started while the drive is busy:  */
+	if (d->pending != NULL) {
+		diskimage_async_wait(d->pending);
+		wdc_check_pending(d);
+	}
+
 	d->cur_command = idata;
 	d->atapi_cmd_in_progress = 0;
 	d->error = 0;
@@ -740,13 +817,14 @@ DEVICE_ACCESS(wdc)
 			    inbuf_len % 512 == 0) ) {
 				int count = (d->write_in_progress ==
 				    WDCC_WRITEMULTI)? d->write_count : 1;
-				unsigned char *buf, *b;
+				unsigned char *buf;
+				uint64_t offset = d->write_offset;
 
 				CHECK_ALLOCATION(buf = (unsigned char *) malloc(512 * count));
-				b = buf;
 
 				if (d->inbuf_tail+512*count <= WDC_INBUF_SIZE) {
-					b = d->inbuf + d->inbuf_tail;
+					memcpy(buf, d->inbuf + d->inbuf_tail,
+					    512 * count);
 					d->inbuf_tail = (d->inbuf_tail + 512
 					    * count) % WDC_INBUF_SIZE;
 				} else {
@@ -754,19 +832,12 @@ DEVICE_ACCESS(wdc)
 						buf[i] = wdc_get_inbuf(d);
 				}
 
-				diskimage_access(cpu->machine,
-				    d->drive + d->base_drive, DISKIMAGE_IDE, 1,
-				    d->write_offset, b, 512 * count);
-
 				d->write_count -= count;
 				d->write_offset += 512 * count;
 
-				d->int_assert = 1;
-
-				if (d->write_count == 0)
-					d->write_in_progress = 0;
-
-				free(buf);
+				/*  The interrupt is asserted, and
+				    write_in_progress cleared, on completion:  */
+				wdc_submit(cpu, d, 1, offset, buf, 512 * count);
 			}
 		}
 		break;
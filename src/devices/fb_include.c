@@ -33,42 +33,66 @@
  *  FB_16 for 16-bit X11 color.
  *  FB_15 for 15-bit X11 color.
  *  (Default is to fallback to grayscale.)
+ *
+ *  For 15, 16, and 24-bit X11 color, pixels are converted one framebuffer
+ *  row at a time and stored directly into the XImage's data, in the XImage's
+ *  byte order. The inner loops have no function calls, bounds checks, or
+ *  per-pixel address calculations, so that the compiler can vectorize the
+ *  truecolor cases. Palette colors are converted into X11 pixel values only
+ *  once per redraw.
  */
 
 
-#ifdef macro_put_pixel1
-#undef macro_put_pixel1
+#ifdef macro_pixel
+#undef macro_pixel
+#endif
+#ifdef macro_store_pixel
+#undef macro_store_pixel
+#endif
+#ifdef FB_PIXEL_T
+#undef FB_PIXEL_T
+#endif
+#ifdef FB_DIRECT
+#undef FB_DIRECT
 #endif
 
-/*  Combine the color into an X11 long and display it:  */	\
-/*  TODO:  construct color in a more portable way:  */		\
+/*  Combine the color into an X11 pixel value, in the XImage's byte order:  */
 
 #ifdef FB_24
+#define	FB_PIXEL_T	uint32_t
 #ifdef FB_BO
-#define macro_put_pixel1 color = (b << 16) + (g << 8) + r
+#define macro_pixel(r,g,b) BE32_TO_HOST(((b) << 16) + ((g) << 8) + (r))
 #else
-#define macro_put_pixel1 color = (r << 16) + (g << 8) + b
+#define macro_pixel(r,g,b) LE32_TO_HOST(((r) << 16) + ((g) << 8) + (b))
 #endif
 
 #else	/*  !24  */
 #ifdef FB_16
+#define	FB_PIXEL_T	uint16_t
 #ifdef FB_BO
-#define macro_put_pixel1 color = ((b >> 3) << 11) + ((g >> 2) << 5) + (r >> 3)
+#define macro_pixel(r,g,b) BE16_TO_HOST(				\
+	((b) >> 3 << 11) + ((g) >> 2 << 5) + ((r) >> 3))
 #else
-#define macro_put_pixel1 color = ((r >> 3) << 11) + ((g >> 2) << 5) + (b >> 3)
+#define macro_pixel(r,g,b) LE16_TO_HOST(				\
+	((r) >> 3 << 11) + ((g) >> 2 << 5) + ((b) >> 3))
 #endif
 
 #else	/*  !16  */
 #ifdef FB_15
+#define	FB_PIXEL_T	uint16_t
 #ifdef FB_BO
-#define macro_put_pixel1 color = ((b >> 3) << 10) + ((g >> 3) << 5) + (r >> 3)
+#define macro_pixel(r,g,b) BE16_TO_HOST(				\
+	((b) >> 3 << 10) + ((g) >> 3 << 5) + ((r) >> 3))
 #else
-#define macro_put_pixel1 color = ((r >> 3) << 10) + ((g >> 3) << 5) + (b >> 3)
+#define macro_pixel(r,g,b) LE16_TO_HOST(				\
+	((r) >> 3 << 10) + ((g) >> 3 << 5) + ((b) >> 3))
 #endif
 
 #else	/*  !15  */
-#define	macro_put_pixel1 color = d->fb_window->x11_graycolor[15 * 	\
-		(r + g + b) / (255 * 3)].pixel
+/*  Unknown pixel layout; let Xlib store the pixels.  */
+#define	FB_PIXEL_T	unsigned long
+#define	macro_pixel(r,g,b) fbwin->x11_graycolor[15 * 			\
+	((r) + (g) + (b)) / (255 * 3)].pixel
 
 #endif	/*  !15  */
 
@@ -77,124 +101,131 @@
 #endif	/*  !24  */
 
 
-#ifdef macro_put_pixel
-#undef macro_put_pixel
+#if defined(FB_24) || defined(FB_16) || defined(FB_15)
+#define	FB_DIRECT
+#define	macro_store_pixel(x, y, color)	dst[x] = (color)
+#else
+#define	macro_store_pixel(x, y, color)	XPutPixel(fbwin->fb_ximage, x, y, color)
 #endif
 
-#define macro_put_pixel		macro_put_pixel1;			\
-	if (x>=0 && x<d->x11_xsize && y>=0 && y<d->x11_ysize)		\
-		XPutPixel(d->fb_window->fb_ximage, x, y, color);	\
-
 
-void REDRAW(struct vfb_data *d, int addr, int len)
+/*
+ *  REDRAW(d, x1, y1, x2, y2):
+ *
+ *  Converts the framebuffer pixels x1..x2, y1..y2 (inclusive) into the
+ *  XImage. Without FB_SCALEDOWN, the coordinates must be multiples of the
+ *  scaledown factor.
+ */
+void REDRAW(struct vfb_data *d, int x1, int y1, int x2, int y2)
 {
-	int x, y, pixel, npixels;
-	long color;
+	struct fb_window *fbwin = d->fb_window;
+#ifdef FB_DIRECT
+	FB_PIXEL_T *dst;
+#endif
+	int x, y;
 
 #ifndef FB_SCALEDOWN
 
-	/*  Which framebuffer pixel does addr correspond to?  */
-	pixel = addr * 8 / d->bit_depth;
-	y = pixel / d->xsize;
-	x = pixel % d->xsize;
+	FB_PIXEL_T pal[256];
 
-	/*  How many framebuffer pixels? (len doesn't include the last pixel)  */
-	npixels = len * 8 / d->bit_depth;
-	npixels += d->bit_depth >= 8 ? 1 : (8 / d->bit_depth);
+	if (d->bit_depth <= 8)
+		for (x=0; x < (1 << d->bit_depth); x++)
+			pal[x] = macro_pixel(d->rgb_palette[x*3 + 0],
+			    d->rgb_palette[x*3 + 1], d->rgb_palette[x*3 + 2]);
 
-	if (d->bit_depth < 8) {
-		for (pixel=0; pixel<npixels; pixel++) {
-			int c, r, g, b;
-			size_t fb_addr = (y * d->xsize + x) * d->bit_depth;
-			/*  fb_addr is now which _bit_ in the framebuffer  */
+	if (x2 >= d->x11_xsize)
+		x2 = d->x11_xsize - 1;
+	if (y2 >= d->x11_ysize)
+		y2 = d->x11_ysize - 1;
 
-			c = d->framebuffer[fb_addr >> 3];
-			fb_addr &= 7;
+	for (y=y1; y<=y2; y++) {
+		const unsigned char *src = d->framebuffer +
+		    (size_t) y * d->bytes_per_line;
 
-			/*  HPC is reverse:  */
-			if (d->vfb_type == VFB_HPC || d->vfb_type == VFB_REVERSEBITS)
-				fb_addr = 8 - d->bit_depth - fb_addr;
-
-			c = (c >> fb_addr) & ((1<<d->bit_depth) - 1);
-			/*  c <<= (8 - d->bit_depth);  */
-
-			r = d->rgb_palette[c*3 + 0];
-			g = d->rgb_palette[c*3 + 1];
-			b = d->rgb_palette[c*3 + 2];
+#ifdef FB_DIRECT
+		dst = (FB_PIXEL_T *) (fbwin->ximage_data +
+		    (size_t) y * fbwin->ximage_bytes_per_line);
+#endif
 
-			macro_put_pixel;
-			x++;
-		}
-	} else if (d->bit_depth == 8) {
-		for (pixel=0; pixel<npixels; pixel++) {
-			int c, r, g, b;
-			size_t fb_addr = y * d->xsize + x;
-			/*  fb_addr is now which byte in framebuffer  */
-
-			c = d->framebuffer[fb_addr];
-			r = d->rgb_palette[c*3 + 0];
-			g = d->rgb_palette[c*3 + 1];
-			b = d->rgb_palette[c*3 + 2];
-
-			macro_put_pixel;
-			x++;
-		}
-	} else {	/*  d->bit_depth > 8  */
-		for (pixel=0; pixel<npixels; pixel++) {
-			int r, g, b;
-			size_t fb_addr = (y * d->xsize + x) * d->bit_depth;
-			/*  fb_addr is now which byte in framebuffer  */
-
-			/*  > 8 bits color.  */
-			fb_addr >>= 3;
-			switch (d->bit_depth) {
-			case 24:
-			case 32:
-				r = d->framebuffer[fb_addr];
-				g = d->framebuffer[fb_addr + 1];
-				b = d->framebuffer[fb_addr + 2];
-				break;
-			case 16:
-				if (d->vfb_type == VFB_HPC) {
-					b = d->framebuffer[fb_addr] +
-					    (d->framebuffer[fb_addr+1] << 8);
-
-					if (d->color32k) {
-						r = b >> 11;
-						g = b >> 5;
-						r = r & 31;
-						g = (g & 31) * 2;
-						b = b & 31;
-					} else if (d->psp_15bit) {
-						int tmp;
-						r = (b >> 10) & 0x1f;
-						g = (b >>  5) & 0x1f;
-						b = b & 0x1f;
-						g <<= 1;
-						tmp = r; r = b; b = tmp;
-					} else {
-						r = (b >> 11) & 0x1f;
-						g = (b >>  5) & 0x3f;
-						b = b & 0x1f;
-					}
-				} else {
-				    r = d->framebuffer[fb_addr] >> 3;
-/*  HUH? TODO:  */
-				    g = (d->framebuffer[fb_addr] << 5) +
-				      (d->framebuffer[fb_addr + 1] >>5);
-				    b = d->framebuffer[fb_addr + 1]&31;
+		switch (d->bit_depth) {
+
+		case 8:	for (x=x1; x<=x2; x++)
+				macro_store_pixel(x, y, pal[src[x]]);
+			break;
+
+		case 24:
+			for (x=x1; x<=x2; x++)
+				macro_store_pixel(x, y, macro_pixel(src[x*3],
+				    src[x*3 + 1], src[x*3 + 2]));
+			break;
+
+		case 32:
+			for (x=x1; x<=x2; x++)
+				macro_store_pixel(x, y, macro_pixel(src[x*4],
+				    src[x*4 + 1], src[x*4 + 2]));
+			break;
+
+		case 16:
+			if (d->vfb_type != VFB_HPC) {
+				/*  HUH? TODO:  */
+				for (x=x1; x<=x2; x++) {
+					int r = src[x*2] >> 3;
+					int g = (src[x*2] << 5) +
+					    (src[x*2 + 1] >> 5);
+					int b = src[x*2 + 1] & 31;
+					macro_store_pixel(x, y,
+					    macro_pixel(r*8, g*4, b*8));
+				}
+			} else if (d->color32k) {
+				for (x=x1; x<=x2; x++) {
+					int c = src[x*2] + (src[x*2 + 1] << 8);
+					macro_store_pixel(x, y, macro_pixel(
+					    ((c >> 11) & 31) * 8,
+					    ((c >> 5) & 31) * 8, (c & 31) * 8));
+				}
+			} else if (d->psp_15bit) {
+				for (x=x1; x<=x2; x++) {
+					int c = src[x*2] + (src[x*2 + 1] << 8);
+					macro_store_pixel(x, y, macro_pixel(
+					    (c & 31) * 8, ((c >> 5) & 31) * 8,
+					    ((c >> 10) & 31) * 8));
+				}
+			} else {
+				for (x=x1; x<=x2; x++) {
+					int c = src[x*2] + (src[x*2 + 1] << 8);
+					macro_store_pixel(x, y, macro_pixel(
+					    ((c >> 11) & 31) * 8,
+					    ((c >> 5) & 63) * 4, (c & 31) * 8));
+				}
+			}
+			break;
+
+		default:
+			if (d->bit_depth < 8) {
+				int bd = d->bit_depth, mask = (1 << bd) - 1;
+				int reverse = d->vfb_type == VFB_HPC ||
+				    d->vfb_type == VFB_REVERSEBITS;
+
+				for (x=x1; x<=x2; x++) {
+					size_t bit = ((size_t) y * d->xsize + x)
+					    * bd;
+					int shift = bit & 7;
+
+					/*  HPC is reverse:  */
+					if (reverse)
+						shift = 8 - bd - shift;
+
+					macro_store_pixel(x, y, pal[(d->
+					    framebuffer[bit >> 3] >> shift)
+					    & mask]);
+				}
+			} else {
+				for (x=x1; x<=x2; x++) {
+					int c = random() & 255;
+					macro_store_pixel(x, y,
+					    macro_pixel(c, c, c));
 				}
-
-				r *= 8;
-				g *= 4;
-				b *= 8;
-				break;
-			default:
-				r = g = b = random() & 255;
 			}
-
-			macro_put_pixel;
-			x++;
 		}
 	}
 
@@ -203,163 +234,40 @@ void REDRAW(struct vfb_data *d, int addr, int len)
 	/*  scaledown > 1:  */
 	int scaledown = d->vfb_scaledown;
 	int scaledownXscaledown = scaledown * scaledown;
+	int ox1 = x1 / scaledown, ox2 = x2 / scaledown;
+	int oy1 = y1 / scaledown, oy2 = y2 / scaledown;
+
+	if (ox2 >= d->x11_xsize)
+		ox2 = d->x11_xsize - 1;
+	if (oy2 >= d->x11_ysize)
+		oy2 = d->x11_ysize - 1;
+
+	for (y=oy1; y<=oy2; y++) {
+#ifdef FB_DIRECT
+		dst = (FB_PIXEL_T *) (fbwin->ximage_data +
+		    (size_t) y * fbwin->ximage_bytes_per_line);
+#endif
 
-	/*  Which framebuffer pixel does addr correspond to?  */
-	pixel = addr * 8 / d->bit_depth;
-	y = pixel / d->xsize;
-	x = pixel % d->xsize;
-
-	/*  How many framebuffer pixels?  */
-	npixels = len * 8 / d->bit_depth;
-
-	/*  Which x11 pixel?  */
-	x /= scaledown;
-	y /= scaledown;
-
-	/*  How many x11 pixels:  */
-	npixels /= scaledown;
-	if (npixels == 0)
-		npixels = 1;
-
-	if (d->bit_depth < 8) {
-		for (pixel=0; pixel<npixels; pixel++) {
-			int subx, suby, r, g, b;
-			int64_t color_r = 0, color_g = 0, color_b = 0;
-			for (suby=0; suby<scaledown; suby++)
-			    for (subx=0; subx<scaledown; subx++) {
-				int fb_x, fb_y, fb_addr, c;
-
-				fb_x = x * scaledown + subx;
-				fb_y = y * scaledown + suby;
-				fb_addr = fb_y * d->xsize + fb_x;
-				fb_addr = fb_addr * d->bit_depth;
-				/*  fb_addr is now which _bit_ in
-				    the framebuffer  */
-
-				c = d->framebuffer[fb_addr >> 3];
-				fb_addr &= 7;
-
-				/*  HPC is reverse:  */
-				if (d->vfb_type == VFB_HPC || d->vfb_type == VFB_REVERSEBITS)
-					fb_addr = 8 - d->bit_depth - fb_addr;
-
-				c = (c >> fb_addr) & ((1<<d->bit_depth) - 1);
-				/*  c <<= (8 - d->bit_depth);  */
-
-				r = d->rgb_palette[c*3 + 0];
-				g = d->rgb_palette[c*3 + 1];
-				b = d->rgb_palette[c*3 + 2];
-
-				color_r += r;
-				color_g += g;
-				color_b += b;
-			    }
-
-			r = color_r / scaledownXscaledown;
-			g = color_g / scaledownXscaledown;
-			b = color_b / scaledownXscaledown;
-			macro_put_pixel;
-			x++;
-		}
-	} else if (d->bit_depth == 8) {
-		for (pixel=0; pixel<npixels; pixel++) {
+		for (x=ox1; x<=ox2; x++) {
 			int subx, suby, r, g, b;
-			int64_t color_r = 0, color_g = 0, color_b = 0;
-			for (suby=0; suby<scaledown; suby++)
-			    for (subx=0; subx<scaledown; subx++) {
-				int fb_x, fb_y, fb_addr, c;
-
-				fb_x = x * scaledown + subx;
-				fb_y = y * scaledown + suby;
-				fb_addr = fb_y * d->xsize + fb_x;
-				/*  fb_addr is which _byte_ in framebuffer  */
-				c = d->framebuffer[fb_addr] * 3;
-				r = d->rgb_palette[c + 0];
-				g = d->rgb_palette[c + 1];
-				b = d->rgb_palette[c + 2];
-				color_r += r;
-				color_g += g;
-				color_b += b;
-			    }
+			int color_r = 0, color_g = 0, color_b = 0;
 
-			r = color_r / scaledownXscaledown;
-			g = color_g / scaledownXscaledown;
-			b = color_b / scaledownXscaledown;
-			macro_put_pixel;
-			x++;
-		}
-	} else {
-		/*  Generic > 8 bit bit-depth:  */
-		for (pixel=0; pixel<npixels; pixel++) {
-			int subx, suby, r, g, b;
-			int64_t color_r = 0, color_g = 0, color_b = 0;
 			for (suby=0; suby<scaledown; suby++)
-			    for (subx=0; subx<scaledown; subx++) {
-				int fb_x, fb_y, fb_addr;
-
-				fb_x = x * scaledown + subx;
-				fb_y = y * scaledown + suby;
-				fb_addr = fb_y * d->xsize + fb_x;
-				fb_addr = (fb_addr * d->bit_depth) >> 3;
-				/*  fb_addr is which _byte_ in framebuffer  */
-
-				/*  > 8 bits color.  */
-				switch (d->bit_depth) {
-				case 24:
-				case 32:
-					r = d->framebuffer[fb_addr];
-					g = d->framebuffer[fb_addr + 1];
-					b = d->framebuffer[fb_addr + 2];
-					break;
-				case 16:
-					if (d->vfb_type == VFB_HPC) {
-						b = d->framebuffer[fb_addr] +
-						    (d->framebuffer[fb_addr+1] << 8);
-
-						if (d->color32k) {
-							r = b >> 11;
-							g = b >> 5;
-							r = r & 31;
-							g = (g & 31) * 2;
-							b = b & 31;
-						} else if (d->psp_15bit) {
-							int tmp;
-							r = (b >> 10) & 0x1f;
-							g = (b >>  5) & 0x1f;
-							b = b & 0x1f;
-							g <<= 1;
-							tmp = r; r = b; b = tmp;
-						} else {
-							r = (b >> 11) & 0x1f;
-							g = (b >>  5) & 0x3f;
-							b = b & 0x1f;
-						}
-					} else {
-					    r = d->framebuffer[fb_addr] >> 3;
-/*  HUH? TODO:  */
-					    g = (d->framebuffer[fb_addr] << 5) +
-					      (d->framebuffer[fb_addr + 1] >>5);
-					    b = d->framebuffer[fb_addr + 1]&31;
-					}
-
-					r *= 8;
-					g *= 4;
-					b *= 8;
-					break;
-				default:
-					r = g = b = random() & 255;
+				for (subx=0; subx<scaledown; subx++) {
+					fb_source_rgb(d, x * scaledown + subx,
+					    y * scaledown + suby, &r, &g, &b);
+					color_r += r;
+					color_g += g;
+					color_b += b;
 				}
-				color_r += r;
-				color_g += g;
-				color_b += b;
-			    }
+
 			r = color_r / scaledownXscaledown;
 			g = color_g / scaledownXscaledown;
 			b = color_b / scaledownXscaledown;
-			macro_put_pixel;
-			x++;
+			macro_store_pixel(x, y, macro_pixel(r, g, b));
 		}
 	}
+
 #endif	/*  FB_SCALEDOWN  */
 }
 
@@ -39,6 +39,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include "cpu.h"
@@ -97,9 +98,140 @@ static int my_fseek(FILE *f, off_t offset, int whence)
 }
 
 
+/*
+ *  diskimage_pread(), diskimage_pwrite():
+ *
+ *  Like pread() and pwrite(), but retry on EINTR and on short transfers.
+ *  Returns the number of bytes transferred.
+ */
+size_t diskimage_pread(int fd, unsigned char *buf, size_t len, off_t offset)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t res = pread(fd, buf + done, len - done, offset + done);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res <= 0)
+			break;
+		done += res;
+	}
+
+	return done;
+}
+
+size_t diskimage_pwrite(int fd, unsigned char *buf, size_t len, off_t offset)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t res = pwrite(fd, buf + done, len - done, offset + done);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res <= 0)
+			break;
+		done += res;
+	}
+
+	return done;
+}
+
+
+/*
+ *  diskimage_read_base():
+ *
+ *  Reads from the disk image file itself (not from any overlay), using the
+ *  disk image's I/O method. Returns the number of bytes read.
+ */
+static size_t diskimage_read_base(struct diskimage *d, off_t offset,
+	unsigned char *buf, size_t len)
+{
+	switch (d->io_method) {
+
+	case DISKIMAGE_IO_MMAP:
+		if (offset < 0 || (uint64_t) offset >= d->mmap_len)
+			return 0;
+		if (len > d->mmap_len - offset)
+			len = d->mmap_len - offset;
+		memcpy(buf, d->mmap_base + offset, len);
+		return len;
+
+	case DISKIMAGE_IO_PREAD:
+		return diskimage_pread(fileno(d->f), buf, len, offset);
+
+	case DISKIMAGE_IO_COW:
+		return diskimage_cow_read(d->cow, offset, buf, len);
+
+	case DISKIMAGE_IO_COMPRESSED:
+		return diskimage_compressed_read(d->compressed, offset, buf,
+		    len);
+
+	default:
+		if (my_fseek(d->f, offset, SEEK_SET) != 0) {
+			fatal("[ diskimage__internal_access(): fseek() failed"
+			    " on disk id %i ]\n", d->id);
+			return 0;
+		}
+		return fread(buf, 1, len, d->f);
+	}
+}
+
+
+/*
+ *  diskimage_write_base():
+ *
+ *  Writes to the disk image file itself (not to any overlay), using the
+ *  disk image's I/O method. Returns the number of bytes written.
+ */
+static size_t diskimage_write_base(struct diskimage *d, off_t offset,
+	unsigned char *buf, size_t len)
+{
+	switch (d->io_method) {
+
+	case DISKIMAGE_IO_MMAP:
+	case DISKIMAGE_IO_COMPRESSED:
+		/*  These are only used for read-only disk images.  */
+		return 0;
+
+	case DISKIMAGE_IO_PREAD:
+		return diskimage_pwrite(fileno(d->f), buf, len, offset);
+
+	case DISKIMAGE_IO_COW:
+		return diskimage_cow_write(d->cow, offset, buf, len);
+
+	default:
+		if (my_fseek(d->f, offset, SEEK_SET) != 0) {
+			fatal("[ diskimage__internal_access(): fseek() failed"
+			    " on disk id %i ]\n", d->id);
+			return 0;
+		}
+		return fwrite(buf, 1, len, d->f);
+	}
+}
+
+
 /**************************************************************************/
 
 
+/*
+ *  diskimage_find():
+ *
+ *  Returns the disk image with a specific id (for a specific type), or NULL
+ *  if there is no such disk image.
+ */
+struct diskimage *diskimage_find(struct machine *machine, int id, int type)
+{
+	struct diskimage *d = machine->first_diskimage;
+
+	while (d != NULL) {
+		if (d->type == type && d->id == id)
+			return d;
+		d = d->next;
+	}
+	return NULL;
+}
+
+
 /*
  *  diskimage_exist():
  *
@@ -163,6 +295,20 @@ bool diskimage_add_overlay(struct diskimage *d, char *overlay_basename, bool rem
 		return false;
 	}
 
+	/*  Keep the entire bitmap in memory:  */
+	struct stat st;
+	overlay.bitmap_len = 0;
+	overlay.bitmap = NULL;
+	overlay.dirty_start = overlay.dirty_end = 0;
+
+	if (fstat(fileno(overlay.f_bitmap), &st) == 0 && st.st_size > 0) {
+		overlay.bitmap_len = st.st_size;
+		CHECK_ALLOCATION(overlay.bitmap = (unsigned char *)
+		    malloc(overlay.bitmap_len));
+		overlay.bitmap_len = diskimage_pread(fileno(overlay.f_bitmap),
+		    overlay.bitmap, overlay.bitmap_len, 0);
+	}
+
 	d->nr_of_overlays ++;
 
 	CHECK_ALLOCATION(d->overlays = (struct diskimage_overlay *) realloc(d->overlays,
@@ -187,7 +333,8 @@ bool diskimage_add_overlay(struct diskimage *d, char *overlay_basename, bool rem
 /*
  *  diskimage_recalc_size():
  *
- *  Recalculate a disk's size by stat()-ing it.
+ *  Recalculate a disk's size by stat()-ing it. (Copy-on-write and compressed
+ *  images have their virtual size stored in the image itself.)
  *  d is assumed to be non-NULL.
  */
 bool diskimage_recalc_size(struct diskimage *d)
@@ -196,11 +343,17 @@ bool diskimage_recalc_size(struct diskimage *d)
 	int res;
 	int64_t size = 0;
 
-	res = stat(d->fname, &st);
-	if (res)
-		return false;
+	if (d->cow != NULL) {
+		size = diskimage_cow_size(d->cow);
+	} else if (d->compressed != NULL) {
+		size = diskimage_compressed_size(d->compressed);
+	} else {
+		res = stat(d->fname, &st);
+		if (res)
+			return false;
 
-	size = st.st_size;
+		size = st.st_size;
+	}
 
 	/*
 	 *  TODO:  CD-ROM devices, such as /dev/cd0c, how can one
@@ -369,102 +522,233 @@ static size_t diskimage_access__cdrom(struct diskimage *d, off_t offset,
 	off_t aligned_offset;
 	size_t bytes_read, total_copied = 0;
 	unsigned char cdrom_buf[CDROM_SECTOR_SIZE];
-	off_t buf_ofs, i = 0;
 
 	/*  printf("diskimage_access__cdrom(): offset=0x%llx size=%lli\n",
 	    (long long)offset, (long long)len);  */
 
 	aligned_offset = (offset / CDROM_SECTOR_SIZE) * CDROM_SECTOR_SIZE;
-	my_fseek(d->f, aligned_offset, SEEK_SET);
 
 	while (len != 0) {
-		bytes_read = fread(cdrom_buf, 1, CDROM_SECTOR_SIZE, d->f);
-		if (bytes_read != CDROM_SECTOR_SIZE)
-			return 0;
+		size_t buf_ofs = offset - aligned_offset, chunk;
+
+		/*  Whole sectors can be read directly into buf:  */
+		if (buf_ofs == 0 && len >= CDROM_SECTOR_SIZE) {
+			chunk = len - (len % CDROM_SECTOR_SIZE);
+			bytes_read = diskimage_read_base(d, aligned_offset,
+			    buf + total_copied, chunk);
+			if (bytes_read != chunk)
+				return 0;
+		} else {
+			bytes_read = diskimage_read_base(d, aligned_offset,
+			    cdrom_buf, CDROM_SECTOR_SIZE);
+			if (bytes_read != CDROM_SECTOR_SIZE)
+				return 0;
 
-		/*  Copy (part of) cdrom_buf into buf:  */
-		buf_ofs = offset - aligned_offset;
-		while (buf_ofs < CDROM_SECTOR_SIZE && len != 0) {
-			buf[i ++] = cdrom_buf[buf_ofs ++];
-			total_copied ++;
-			len --;
+			/*  Copy (part of) cdrom_buf into buf:  */
+			chunk = CDROM_SECTOR_SIZE - buf_ofs;
+			if (chunk > len)
+				chunk = len;
+			memcpy(buf + total_copied, cdrom_buf + buf_ofs, chunk);
 		}
 
-		aligned_offset += CDROM_SECTOR_SIZE;
-		offset = aligned_offset;
+		total_copied += chunk;
+		len -= chunk;
+
+		aligned_offset = (offset + chunk) / CDROM_SECTOR_SIZE
+		    * CDROM_SECTOR_SIZE;
+		offset += chunk;
 	}
 
 	return total_copied;
 }
 
 
-/*  Helper function.  */
+/*
+ *  overlay_set_block_in_use():
+ *
+ *  Marks a block as present in an overlay. Only the in-memory bitmap is
+ *  updated; overlay_flush_bitmap() writes the changed range to the bitmap
+ *  file.
+ */
 static void overlay_set_block_in_use(struct diskimage *d,
 	int overlay_nr, off_t ofs)
 {
+	struct diskimage_overlay *o = &d->overlays[overlay_nr];
 	off_t bit_nr = ofs / OVERLAY_BLOCK_SIZE;
-	off_t bitmap_file_offset = bit_nr / 8;
-	int res;
-	unsigned char data;
-
-	res = my_fseek(d->overlays[overlay_nr].f_bitmap,
-	    bitmap_file_offset, SEEK_SET);
-	if (res) {
-		perror("my_fseek");
-		fprintf(stderr, "Could not seek in bitmap file?"
-		    " offset = %lli, read\n", (long long)bitmap_file_offset);
-		exit(1);
+	size_t byte_nr = bit_nr / 8;
+
+	if (byte_nr >= o->bitmap_len) {
+		size_t new_len = o->bitmap_len * 2;
+		if (new_len <= byte_nr)
+			new_len = byte_nr + 4096;
+
+		CHECK_ALLOCATION(o->bitmap = (unsigned char *)
+		    realloc(o->bitmap, new_len));
+		memset(o->bitmap + o->bitmap_len, 0, new_len - o->bitmap_len);
+		o->bitmap_len = new_len;
 	}
 
-	/*  Read the original bitmap data, and OR in the new bit:  */
-	res = fread(&data, 1, 1, d->overlays[overlay_nr].f_bitmap);
-	if (res != 1)
-		data = 0x00;
+	if (o->bitmap[byte_nr] & (1 << (bit_nr & 7)))
+		return;
 
-	data |= (1 << (bit_nr & 7));
+	o->bitmap[byte_nr] |= (1 << (bit_nr & 7));
 
-	/*  Write it back:  */
-	res = my_fseek(d->overlays[overlay_nr].f_bitmap,
-	    bitmap_file_offset, SEEK_SET);
-	if (res) {
-		perror("my_fseek");
-		fprintf(stderr, "Could not seek in bitmap file?"
-		    " offset = %lli, write\n", (long long)bitmap_file_offset);
-		exit(1);
+	if (o->dirty_start == o->dirty_end) {
+		o->dirty_start = byte_nr;
+		o->dirty_end = byte_nr + 1;
+	} else {
+		if (byte_nr < o->dirty_start)
+			o->dirty_start = byte_nr;
+		if (byte_nr >= o->dirty_end)
+			o->dirty_end = byte_nr + 1;
 	}
-	res = fwrite(&data, 1, 1, d->overlays[overlay_nr].f_bitmap);
-	if (res != 1) {
+}
+
+
+/*
+ *  overlay_flush_bitmap():
+ *
+ *  Writes the changed part of an overlay's in-memory bitmap to its
+ *  bitmap file.
+ */
+static void overlay_flush_bitmap(struct diskimage *d, int overlay_nr)
+{
+	struct diskimage_overlay *o = &d->overlays[overlay_nr];
+	size_t len = o->dirty_end - o->dirty_start;
+
+	if (len == 0)
+		return;
+
+	if (diskimage_pwrite(fileno(o->f_bitmap), o->bitmap + o->dirty_start,
+	    len, o->dirty_start) != len) {
 		fprintf(stderr, "Could not write to bitmap file. Aborting.\n");
 		exit(1);
 	}
-	
+
+	o->dirty_start = o->dirty_end = 0;
+
 	if (do_fsync)
-		fsync(fileno(d->overlays[overlay_nr].f_bitmap));
+		fsync(fileno(o->f_bitmap));
 }
 
 
 /*  Helper function.  */
 static int overlay_has_block(struct diskimage *d, int overlay_nr, off_t ofs)
 {
+	struct diskimage_overlay *o = &d->overlays[overlay_nr];
 	off_t bit_nr = ofs / OVERLAY_BLOCK_SIZE;
-	off_t bitmap_file_offset = bit_nr / 8;
-	int res;
-	unsigned char data;
+	size_t byte_nr = bit_nr / 8;
 
-	res = my_fseek(d->overlays[overlay_nr].f_bitmap,
-	    bitmap_file_offset, SEEK_SET);
-	if (res != 0)
+	if (byte_nr >= o->bitmap_len)
 		return 0;
 
-	/*  The seek succeeded, now read the bit:  */
-	res = fread(&data, 1, 1, d->overlays[overlay_nr].f_bitmap);
-	if (res != 1)
-		return 0;
+	return o->bitmap[byte_nr] & (1 << (bit_nr & 7))? 1 : 0;
+}
 
-	if (data & (1 << (bit_nr & 7)))
-		return 1;
 
-	return 0;
+/*
+ *  overlay_block_source():
+ *
+ *  Returns the number of the last overlay that has the block at offset ofs,
+ *  or -1 if the data should be read from the base disk image.
+ */
+static int overlay_block_source(struct diskimage *d, off_t ofs)
+{
+	int overlay_nr;
+
+	for (overlay_nr = d->nr_of_overlays-1; overlay_nr >= 0; overlay_nr --)
+		if (overlay_has_block(d, overlay_nr, ofs))
+			break;
+
+	return overlay_nr;
+}
+
+
+/*
+ *  diskimage_flush():
+ *
+ *  Makes sure that everything written to a disk image (and its overlays)
+ *  has reached the host's files, and asks the host to fsync them.
+ */
+void diskimage_flush(struct diskimage *d)
+{
+	diskimage_async_drain(d);
+
+	for (int i = 0; i < d->nr_of_overlays; i++) {
+		overlay_flush_bitmap(d, i);
+		fsync(fileno(d->overlays[i].f_data));
+		fsync(fileno(d->overlays[i].f_bitmap));
+	}
+
+	if (d->cow != NULL)
+		diskimage_cow_flush(d->cow);
+	else if (d->f != NULL)
+		fsync(fileno(d->f));
+}
+
+
+/*
+ *  diskimage_unmap():
+ *
+ *  Removes the mapping of a DISKIMAGE_IO_MMAP image, and goes back to
+ *  positional I/O.
+ */
+static void diskimage_unmap(struct diskimage *d)
+{
+	if (d->mmap_base == NULL)
+		return;
+
+	munmap(d->mmap_base, d->mmap_len);
+	d->mmap_base = NULL;
+	d->mmap_len = 0;
+	d->io_method = DISKIMAGE_IO_PREAD;
+}
+
+
+/*
+ *  diskimage_close_all():
+ *
+ *  Writes out everything that is still pending for a machine's disk images,
+ *  and then closes and frees them. Called when the machine is destroyed.
+ */
+void diskimage_close_all(struct machine *machine)
+{
+	struct diskimage *d = machine->first_diskimage;
+
+	while (d != NULL) {
+		struct diskimage *next = d->next;
+
+		diskimage_async_drain(d);
+
+		for (int i = 0; i < d->nr_of_overlays; i++) {
+			overlay_flush_bitmap(d, i);
+			fclose(d->overlays[i].f_data);
+			fclose(d->overlays[i].f_bitmap);
+			free(d->overlays[i].bitmap);
+			free(d->overlays[i].overlay_basename);
+		}
+		free(d->overlays);
+
+		diskimage_unmap(d);
+
+		if (d->cow != NULL) {
+			diskimage_cow_flush(d->cow);
+			diskimage_cow_close(d->cow);
+		}
+		if (d->compressed != NULL)
+			diskimage_compressed_close(d->compressed);
+		if (d->cache != NULL)
+			diskimage_cache_free(d->cache);
+		if (d->f != NULL)
+			fclose(d->f);
+
+		free(d->fname);
+		free(d);
+
+		d = next;
+	}
+
+	machine->first_diskimage = NULL;
 }
 
 
@@ -481,17 +765,14 @@ static size_t fwrite_helper(off_t offset, unsigned char *buf,
 
 	/*  Fast return-path for the case when no overlays are used:  */
 	if (d->nr_of_overlays == 0) {
-		int res = my_fseek(d->f, offset, SEEK_SET);
-		if (res != 0) {
-			fatal("[ diskimage__internal_access(): fseek() failed"
-			    " on disk id %i \n", d->id);
-			return 0;
-		}
-
-		size_t written = fwrite(buf, 1, len, d->f);
+		size_t written = diskimage_write_base(d, offset, buf, len);
 
-		if (do_fsync)
-			fsync(fileno(d->f));
+		if (do_fsync) {
+			if (d->cow != NULL)
+				diskimage_cow_flush(d->cow);
+			else
+				fsync(fileno(d->f));
+		}
 
 		return written;
 	}
@@ -508,36 +789,27 @@ static size_t fwrite_helper(off_t offset, unsigned char *buf,
 		abort();
 	}
 
-	/*  Split the write into OVERLAY_BLOCK_SIZE writes:  */
-	for (curofs = offset; curofs < (off_t) (offset+len);
-	     curofs += OVERLAY_BLOCK_SIZE) {
-		/*  Always write to the last overlay:  */
-		int overlay_nr = d->nr_of_overlays-1;
-		off_t lenwritten;
-		int res = my_fseek(d->overlays[overlay_nr].f_data,
-		    curofs, SEEK_SET);
-		if (res != 0) {
-			fatal("[ diskimage: fwrite_helper(): fseek()"
-			    " failed on disk id %i ]\n", d->id);
-			return 0;
-		}
-
-		lenwritten = fwrite(buf, 1, OVERLAY_BLOCK_SIZE,
-		    d->overlays[overlay_nr].f_data);
-		if (lenwritten != OVERLAY_BLOCK_SIZE) {
-			fatal("[ diskimage: fwrite_helper(): fwrite to"
-			    " overlay failed on disk id %i ]\n", d->id);
-			exit(1);
-		}
-
-		buf += OVERLAY_BLOCK_SIZE;
+	/*
+	 *  Always write to the last overlay. The data is written in one go,
+	 *  and then the blocks are marked as in use in the bitmap (which is
+	 *  then written to the bitmap file once for the whole transfer).
+	 */
+	int overlay_nr = d->nr_of_overlays-1;
+	if (diskimage_pwrite(fileno(d->overlays[overlay_nr].f_data), buf, len,
+	    offset) != len) {
+		fatal("[ diskimage: fwrite_helper(): write to"
+		    " overlay failed on disk id %i ]\n", d->id);
+		exit(1);
+	}
 
-		if (do_fsync)
-			fsync(fileno(d->overlays[overlay_nr].f_data));
+	if (do_fsync)
+		fsync(fileno(d->overlays[overlay_nr].f_data));
 
-		/*  Mark this block in the last overlay as in use:  */
+	for (curofs = offset; curofs < (off_t) (offset+len);
+	     curofs += OVERLAY_BLOCK_SIZE)
 		overlay_set_block_in_use(d, overlay_nr, curofs);
-	}
+
+	overlay_flush_bitmap(d, overlay_nr);
 
 	return len;
 }
@@ -548,7 +820,8 @@ static size_t fwrite_helper(off_t offset, unsigned char *buf,
  *
  *  Internal helper function. Reads from a disk image file, or if the
  *  disk image has overlays, from the last overlay that has the specific
- *  data (or the disk image file itself).
+ *  data (or the disk image file itself). Returns the number of bytes read,
+ *  which is less than len at the end of the file, or on read errors.
  */
 static size_t fread_helper(off_t offset, unsigned char *buf,
 	size_t len, struct diskimage *d)
@@ -557,67 +830,78 @@ static size_t fread_helper(off_t offset, unsigned char *buf,
 	size_t totallenread = 0;
 
 	/*  Fast return-path for the case when no overlays are used:  */
-	if (d->nr_of_overlays == 0) {
-		int res = my_fseek(d->f, offset, SEEK_SET);
-		if (res != 0) {
-			fatal("[ diskimage__internal_access(): fseek() failed"
-			    " on disk id %i \n", d->id);
-			return 0;
-		}
+	if (d->nr_of_overlays == 0)
+		return diskimage_read_base(d, offset, buf, len);
 
-		return fread(buf, 1, len, d->f);
-	}
+	/*
+	 *  Split the read into runs of consecutive blocks that come from the
+	 *  same overlay (or from the base disk image), and read each run
+	 *  with a single transfer:
+	 */
+	for (curofs=offset; len != 0; ) {
+		int overlay_nr = overlay_block_source(d, curofs);
+		off_t run_end = (curofs | (OVERLAY_BLOCK_SIZE-1)) + 1;
+		size_t lenread, lentoread;
 
-	/*  Split the read into OVERLAY_BLOCK_SIZE reads:  */
-	for (curofs=offset; len != 0;
-	    curofs = (curofs | (OVERLAY_BLOCK_SIZE-1)) + 1) {
-		/*  Find the overlay, if any, that has this block:  */
-		off_t lenread, lentoread;
-		int overlay_nr;
-		for (overlay_nr = d->nr_of_overlays-1;
-		    overlay_nr >= 0; overlay_nr --) {
-			if (overlay_has_block(d, overlay_nr, curofs))
-				break;
-		}
+		while (run_end < (off_t) (curofs + len) &&
+		    overlay_block_source(d, run_end) == overlay_nr)
+			run_end += OVERLAY_BLOCK_SIZE;
 
-		lentoread = len > OVERLAY_BLOCK_SIZE? OVERLAY_BLOCK_SIZE : len;
+		lentoread = run_end - curofs;
+		if (lentoread > len)
+			lentoread = len;
 
 		if (overlay_nr >= 0) {
 			/*  Read from overlay:  */
-			int res = my_fseek(d->overlays[overlay_nr].f_data,
-			    curofs, SEEK_SET);
-			if (res != 0) {
-				fatal("[ diskimage__internal_access(): fseek()"
-				    " failed on disk id %i \n", d->id);
-				return 0;
-			}
-			lenread = fread(buf, 1, lentoread,
-			    d->overlays[overlay_nr].f_data);
+			lenread = diskimage_pread(
+			    fileno(d->overlays[overlay_nr].f_data),
+			    buf, lentoread, curofs);
 		} else {
 			/*  Read from the base disk image:  */
-			int res = my_fseek(d->f, curofs, SEEK_SET);
-			if (res != 0) {
-				fatal("[ diskimage__internal_access(): fseek()"
-				    " failed on disk id %i \n", d->id);
-				return 0;
-			}
-			lenread = fread(buf, 1, lentoread, d->f);
+			lenread = diskimage_read_base(d, curofs, buf,
+			    lentoread);
 		}
 
+		totallenread += lenread;
+
+		/*  Stop at end of file or on errors, and let the caller see
+		    how much could actually be read:  */
 		if (lenread != lentoread) {
 			fatal("[ INCOMPLETE READ from disk id %i, offset"
 			    " %lli ]\n", d->id, (long long)curofs);
+			break;
 		}
 
 		len -= lentoread;
-		totallenread += lenread;
-		buf += OVERLAY_BLOCK_SIZE;
+		curofs += lentoread;
+		buf += lentoread;
 	}
 
 	return totallenread;
 }
 
 
+/*
+ *  diskimage_read_uncached():
+ *
+ *  Reads from a disk image (or its overlays), bypassing the block cache.
+ */
+static size_t diskimage_read_uncached(struct diskimage *d, off_t offset,
+	unsigned char *buf, size_t len)
+{
+	/*
+	 *  Special case for CD-ROMs. Actually, this is not needed
+	 *  for .iso images, only for physical CDROMS on some OSes,
+	 *  such as FreeBSD. (Mapped images can not be physical
+	 *  CD-ROMs.)
+	 */
+	if (d->is_a_cdrom && d->io_method != DISKIMAGE_IO_MMAP)
+		return diskimage_access__cdrom(d, offset, buf, len);
+	else
+		return fread_helper(offset, buf, len, d);
+}
+
+
 /*
  *  diskimage__internal_access():
  *
@@ -644,16 +928,15 @@ int diskimage__internal_access(struct diskimage *d, int writeflag,
 			return 0;
 
 		lendone = fwrite_helper(offset, buf, len, d);
+
+		if (d->cache != NULL && lendone > 0)
+			diskimage_cache_write(d->cache, offset, buf, lendone);
 	} else {
-		/*
-		 *  Special case for CD-ROMs. Actually, this is not needed
-		 *  for .iso images, only for physical CDROMS on some OSes,
-		 *  such as FreeBSD.
-		 */
-		if (d->is_a_cdrom)
-			lendone = diskimage_access__cdrom(d, offset, buf, len);
+		if (d->cache != NULL)
+			lendone = diskimage_cache_read(d->cache, d, offset,
+			    buf, len, diskimage_read_uncached);
 		else
-			lendone = fread_helper(offset, buf, len, d);
+			lendone = diskimage_read_uncached(d, offset, buf, len);
 
 		if (lendone >= 0 && lendone < (ssize_t)len)
 			memset(buf + lendone, 0, len - lendone);
@@ -689,13 +972,7 @@ int diskimage__internal_access(struct diskimage *d, int writeflag,
 int diskimage_access(struct machine *machine, int id, int type, int writeflag,
 	off_t offset, unsigned char *buf, size_t len)
 {
-	struct diskimage *d = machine->first_diskimage;
-
-	while (d != NULL) {
-		if (d->type == type && d->id == id)
-			break;
-		d = d->next;
-	}
+	struct diskimage *d = diskimage_find(machine, id, type);
 
 	if (d == NULL) {
 		fatal("[ diskimage_access(): ERROR: trying to access a "
@@ -704,6 +981,9 @@ int diskimage_access(struct machine *machine, int id, int type, int writeflag,
 		return 0;
 	}
 
+	/*  Let any asynchronous requests to the same disk finish first:  */
+	diskimage_async_drain(d);
+
 	offset -= d->override_base_offset;
 	if (offset < 0 && offset + d->override_base_offset >= 0) {
 		debug("[ reading before start of disk image ]\n");
@@ -738,11 +1018,15 @@ int get_default_disk_type_for_machine(struct machine *machine)
  *
  *	b	specifies that this is a bootable device
  *	c	CD-ROM (instead of a normal DISK)
+ *	CNAME;	use the copy-on-write image NAME, which is created as a clone
+ *		of the given disk image file if it does not exist yet
  *	d	DISK (this is the default)
  *	f	FLOPPY (instead of SCSI)
  *	gH;S;	set geometry (H=heads, S=sectors per track, cylinders are
  *		automatically calculated). (This is ignored for floppies.)
  *	i	IDE (instead of SCSI)
+ *	kSIZE;	use a block cache of SIZE KB (default: no cache)
+ *	m	mmap the image file (implies read-only, unless R is used)
  *	oOFS;	set base offset in bytes, when booting from an ISO9660 fs
  *	r       read-only (don't allow changes to the file)
  *	s	SCSI (this is the default)
@@ -760,11 +1044,13 @@ int diskimage_add(struct machine *machine, char *fname)
 	struct diskimage *d, *d2;
 	int id = 0, override_heads=0, override_spt=0;
 	int64_t override_base_offset=0;
+	int64_t cache_size = DISKIMAGE_DEFAULT_CACHE_SIZE;
 	char *cp;
 	int prefix_b=0, prefix_c=0, prefix_d=0, prefix_f=0, prefix_g=0;
 	int prefix_i=0, prefix_r=0, prefix_s=0, prefix_t=0, prefix_id=-1;
-	int prefix_o=0, prefix_V=0;
-	bool prefix_R = false;
+	int prefix_m=0, prefix_o=0, prefix_V=0;
+	bool prefix_R = false, prefix_C = false;
+	char cow_name[1000];
 
 	if (fname == NULL) {
 		debugmsg(SUBSYS_DISK, "diskimage_add()", VERBOSITY_ERROR,
@@ -794,6 +1080,19 @@ int diskimage_add(struct machine *machine, char *fname)
 			case 'c':
 				prefix_c = 1;
 				break;
+			case 'C':
+				prefix_C = true;
+				snprintf(cow_name, sizeof(cow_name), "%.*s",
+				    (int) strcspn(fname, ";:"), fname);
+				fname += strcspn(fname, ";:");
+				if (*fname == ';')
+					fname ++;
+				if (cow_name[0] == '\0') {
+					fatal("The C prefix requires a file"
+					    " name.\n");
+					return -1;
+				}
+				break;
 			case 'd':
 				prefix_d = 1;
 				break;
@@ -824,6 +1123,21 @@ int diskimage_add(struct machine *machine, char *fname)
 			case 'i':
 				prefix_i = 1;
 				break;
+			case 'k':
+				cache_size = (int64_t) atoi(fname) * 1024;
+				while (*fname != '\0' && *fname != ':'
+				    && *fname != ';')
+					fname ++;
+				if (*fname == ';')
+					fname ++;
+				if (cache_size < 0) {
+					fatal("Bad cache size.\n");
+					return -1;
+				}
+				break;
+			case 'm':
+				prefix_m = 1;
+				break;
 			case 'o':
 				prefix_o = 1;
 				override_base_offset = atoi(fname);
@@ -863,6 +1177,41 @@ int diskimage_add(struct machine *machine, char *fname)
 		}
 	}
 
+	/*
+	 *  Copy-on-write clone: Create the clone, with the given file as
+	 *  its base image, unless it already exists. The clone is then used
+	 *  instead of the given file.
+	 */
+	if (prefix_C) {
+		if (prefix_V || prefix_t) {
+			debugmsg(SUBSYS_DISK, "", VERBOSITY_ERROR,
+			    "the C prefix can not be used for overlays"
+			    " or tapes");
+			return -1;
+		}
+
+		if (access(cow_name, F_OK) != 0) {
+			char *base = realpath(fname, NULL);
+
+			if (base == NULL) {
+				debugmsg(SUBSYS_DISK, "", VERBOSITY_ERROR,
+				    "%s: %s", fname, strerror(errno));
+				return -1;
+			}
+
+			bool created = diskimage_cow_create(cow_name, base, 0);
+			free(base);
+			if (!created)
+				return -1;
+
+			debugmsg(SUBSYS_DISK, "", VERBOSITY_INFO,
+			    "created copy-on-write image '%s', backed by '%s'",
+			    cow_name, fname);
+		}
+
+		fname = cow_name;
+	}
+
 	/*  Allocate a new diskimage struct:  */
 	CHECK_ALLOCATION(d = (struct diskimage *) malloc(sizeof(struct diskimage)));
 	memset(d, 0, sizeof(struct diskimage));
@@ -1009,7 +1358,11 @@ int diskimage_add(struct machine *machine, char *fname)
 		return -1;
 	}
 
-	if (d->is_a_cdrom || prefix_r) {
+	/*  Compressed images can only be written to via an overlay.  */
+	bool compressed = !d->is_a_tape && diskimage_compressed_probe(fname);
+
+	if (d->is_a_cdrom || prefix_r || ((prefix_m || compressed) &&
+	    !prefix_R)) {
 		d->writable = 0;
 	} else if (!d->writable) {
 		if (prefix_R) {
@@ -1036,6 +1389,56 @@ int diskimage_add(struct machine *machine, char *fname)
 		return -1;
 	}
 
+	/*
+	 *  Tapes are read sequentially, using the FILE's current position.
+	 *  Everything else uses positional I/O (or mmap, if requested).
+	 */
+	d->io_method = d->is_a_tape ? DISKIMAGE_IO_STDIO : DISKIMAGE_IO_PREAD;
+
+	if (!d->is_a_tape && diskimage_cow_probe(fname)) {
+		d->cow = diskimage_cow_open(fname, d->writable && !prefix_R);
+		if (d->cow == NULL)
+			return -1;
+
+		d->io_method = DISKIMAGE_IO_COW;
+		diskimage_recalc_size(d);
+	} else if (compressed) {
+		d->compressed = diskimage_compressed_open(fname);
+		if (d->compressed == NULL)
+			return -1;
+
+		d->io_method = DISKIMAGE_IO_COMPRESSED;
+		diskimage_recalc_size(d);
+	}
+
+	if (prefix_m && d->io_method == DISKIMAGE_IO_PREAD) {
+		struct stat st;
+
+		if (fstat(fileno(d->f), &st) == 0 && st.st_size > 0 &&
+		    (uint64_t) st.st_size == (size_t) st.st_size) {
+			void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+			    fileno(d->f), 0);
+
+			if (p != MAP_FAILED) {
+				d->mmap_base = (unsigned char *) p;
+				d->mmap_len = st.st_size;
+				d->io_method = DISKIMAGE_IO_MMAP;
+			}
+		}
+
+		if (d->io_method != DISKIMAGE_IO_MMAP)
+			debugmsg(SUBSYS_DISK, "", VERBOSITY_WARNING,
+			    "could not mmap '%s'; using normal file I/O",
+			    fname);
+	}
+
+	/*  Mapped images are already in memory, compressed images have
+	    their own cache of decompressed chunks, and tapes are sequential
+	    streams, so only the other kinds of images are cached:  */
+	if (d->io_method == DISKIMAGE_IO_PREAD ||
+	    d->io_method == DISKIMAGE_IO_COW)
+		d->cache = diskimage_cache_new(cache_size);
+
 	/*  Calculate which ID to use:  */
 	if (prefix_id == -1) {
 		int start = 0;
@@ -1124,6 +1527,7 @@ int diskimage_add(struct machine *machine, char *fname)
 			debugmsg(SUBSYS_DISK, "", VERBOSITY_ERROR,
 			    "could not add overlay name '%s'",
 			    fname);
+			diskimage_unmap(d);
 			return -1;
 		}
 	}
@@ -1280,6 +1684,14 @@ void diskimage_dump_info(struct machine *machine)
 		else
 			debug(" (%lli %i-byte blocks)", (long long)d->nr_of_logical_blocks, d->logical_block_size);
 
+		if (d->io_method == DISKIMAGE_IO_MMAP)
+			debug(" (mmap)");
+		if (d->io_method == DISKIMAGE_IO_COW)
+			debug(" (copy-on-write)");
+		if (d->io_method == DISKIMAGE_IO_COMPRESSED)
+			debug(" (compressed)");
+		if (d->cache != NULL)
+			debug(" (cached)");
 		if (d->is_boot_device)
 			debug(" (BOOT)");
 		debug("\n");
@@ -1297,3 +1709,23 @@ void diskimage_dump_info(struct machine *machine)
 	}
 }
 
+
+/*
+ *  diskimage_dump_cache_stats():
+ *
+ *  Prints block cache statistics for all disk images of a machine.
+ */
+void diskimage_dump_cache_stats(struct machine *machine)
+{
+	struct diskimage *d;
+
+	for (d = machine->first_diskimage; d != NULL; d = d->next) {
+		printf("%s id %i: ", diskimage_types[d->type], d->id);
+
+		if (d->cache != NULL) {
+			diskimage_async_drain(d);
+			diskimage_cache_show(d->cache);
+		} else
+			printf("no cache\n");
+	}
+}
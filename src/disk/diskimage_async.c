@@ -0,0 +1,373 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Asynchronous disk image requests.
+ *
+ *  A disk controller device submits a request with diskimage_async_submit()
+ *  (or a whole SCSI command with diskimage_async_scsicommand()), and then
+ *  lets the guest continue running. A small pool of host threads
+ *  carries out the actual file I/O. The controller checks for completion
+ *  with diskimage_async_poll() (typically from its tick function, and when
+ *  the guest reads its status register), and raises its completion
+ *  interrupt once the request is done.
+ *
+ *  Requests to the same disk image are served by at most one worker thread
+ *  at a time, in submission order, so the disk image code (overlays,
+ *  copy-on-write images, etc.) never sees concurrent accesses to the same
+ *  disk image. Synchronous accesses (diskimage_access() and the SCSI
+ *  command code) first wait for all outstanding requests to that disk
+ *  image, using diskimage_async_drain().
+ *
+ *  Without pthreads, requests are carried out synchronously at submit time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "diskimage.h"
+#include "misc.h"
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+
+#define	DISKIMAGE_ASYNC_WORKERS		4
+
+
+static void diskimage_async_execute(struct diskimage_request *r)
+{
+	if (r->xferp != NULL)
+		r->result = diskimage__scsicommand(r->cpu, r->scsi_id,
+		    r->scsi_type, r->xferp, false);
+	else
+		r->result = diskimage__internal_access(r->d, r->writeflag,
+		    r->offset, r->buf, r->len);
+}
+
+
+#ifdef HAVE_PTHREADS
+
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t async_done_cond = PTHREAD_COND_INITIALIZER;
+
+/*  Requests that have not been picked up by a worker yet, in FIFO order:  */
+static struct diskimage_request *async_queue_head = NULL;
+static struct diskimage_request *async_queue_tail = NULL;
+
+static int async_n_workers = 0;
+static int async_n_outstanding = 0;
+
+
+/*
+ *  async_dequeue():
+ *
+ *  Returns the first queued request whose disk image is not already being
+ *  served by another worker, or NULL. Called with async_lock held.
+ */
+static struct diskimage_request *async_dequeue(void)
+{
+	struct diskimage_request *r, *prev = NULL;
+
+	for (r = async_queue_head; r != NULL; prev = r, r = r->next) {
+		if (r->d->async_busy)
+			continue;
+
+		if (prev == NULL)
+			async_queue_head = r->next;
+		else
+			prev->next = r->next;
+		if (async_queue_tail == r)
+			async_queue_tail = prev;
+
+		r->next = NULL;
+		r->d->async_busy = true;
+		return r;
+	}
+
+	return NULL;
+}
+
+
+static void *async_worker(void *arg)
+{
+	pthread_mutex_lock(&async_lock);
+
+	for (;;) {
+		struct diskimage_request *r = async_dequeue();
+
+		if (r == NULL) {
+			pthread_cond_wait(&async_work_cond, &async_lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&async_lock);
+		diskimage_async_execute(r);
+		pthread_mutex_lock(&async_lock);
+
+		r->done = true;
+		r->d->async_busy = false;
+		r->d->async_pending --;
+		async_n_outstanding --;
+
+		/*  Other requests to the same disk may now be served:  */
+		pthread_cond_broadcast(&async_work_cond);
+		pthread_cond_broadcast(&async_done_cond);
+	}
+
+	return NULL;
+}
+
+
+/*
+ *  async_wait_all():
+ *
+ *  Makes sure that all submitted writes have reached the disk images before
+ *  the emulator exits.
+ */
+static void async_wait_all(void)
+{
+	pthread_mutex_lock(&async_lock);
+	while (async_n_outstanding > 0)
+		pthread_cond_wait(&async_done_cond, &async_lock);
+	pthread_mutex_unlock(&async_lock);
+}
+
+
+/*
+ *  async_start_workers():
+ *
+ *  Starts the worker threads the first time a request is submitted.
+ *  Returns false if no threads could be started. Called with async_lock
+ *  held.
+ */
+static bool async_start_workers(void)
+{
+	if (async_n_workers != 0)
+		return async_n_workers > 0;
+
+	for (int i = 0; i < DISKIMAGE_ASYNC_WORKERS; i++) {
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, async_worker, NULL) != 0)
+			break;
+
+		pthread_detach(thread);
+		async_n_workers ++;
+	}
+
+	if (async_n_workers == 0) {
+		debugmsg(SUBSYS_DISK, "async", VERBOSITY_WARNING,
+		    "could not start any I/O threads; disk I/O will be"
+		    " synchronous");
+		async_n_workers = -1;
+		return false;
+	}
+
+	atexit(async_wait_all);
+	return true;
+}
+
+#endif	/*  HAVE_PTHREADS  */
+
+
+/*
+ *  async_enqueue():
+ *
+ *  Queues a request for the worker threads, or carries it out at once if
+ *  there are no worker threads.
+ */
+static void async_enqueue(struct diskimage_request *r)
+{
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&async_lock);
+
+	if (async_start_workers()) {
+		if (async_queue_tail == NULL)
+			async_queue_head = r;
+		else
+			async_queue_tail->next = r;
+		async_queue_tail = r;
+
+		r->d->async_pending ++;
+		async_n_outstanding ++;
+
+		pthread_cond_signal(&async_work_cond);
+		pthread_mutex_unlock(&async_lock);
+		return;
+	}
+
+	pthread_mutex_unlock(&async_lock);
+#endif
+
+	diskimage_async_execute(r);
+	r->done = true;
+}
+
+
+/*
+ *  diskimage_async_submit():
+ *
+ *  Submits a read or write request for a disk image. Returns NULL if there
+ *  is no such disk image. Otherwise, the returned request must be freed
+ *  with diskimage_async_free() once it has completed.
+ */
+struct diskimage_request *diskimage_async_submit(struct machine *machine,
+	int id, int type, int writeflag, off_t offset, unsigned char *buf,
+	size_t len)
+{
+	struct diskimage *d = diskimage_find(machine, id, type);
+	struct diskimage_request *r;
+
+	if (d == NULL)
+		return NULL;
+
+	CHECK_ALLOCATION(r = (struct diskimage_request *) malloc(sizeof(struct diskimage_request)));
+	memset(r, 0, sizeof(struct diskimage_request));
+
+	r->d = d;
+	r->writeflag = writeflag;
+	r->offset = offset - d->override_base_offset;
+	r->buf = buf;
+	r->len = len;
+
+	/*  Same as diskimage_access():  */
+	if (r->offset < 0 && offset >= 0) {
+		memset(buf, 0, len);
+		r->result = 1;
+		r->done = true;
+		return r;
+	}
+
+	async_enqueue(r);
+	return r;
+}
+
+
+/*
+ *  diskimage_async_scsicommand():
+ *
+ *  Submits a SCSI command (see diskimage_scsicommand()) to be carried out
+ *  asynchronously. The returned request must be freed with
+ *  diskimage_async_free() once it has completed; its result is the return
+ *  value of diskimage_scsicommand(). If there is no such disk image, the
+ *  command is carried out at once.
+ */
+struct diskimage_request *diskimage_async_scsicommand(struct cpu *cpu,
+	int id, int type, struct scsi_transfer *xferp)
+{
+	struct diskimage_request *r;
+
+	CHECK_ALLOCATION(r = (struct diskimage_request *) malloc(sizeof(struct diskimage_request)));
+	memset(r, 0, sizeof(struct diskimage_request));
+
+	r->d = diskimage_find(cpu->machine, id, type);
+	r->cpu = cpu;
+	r->scsi_id = id;
+	r->scsi_type = type;
+	r->xferp = xferp;
+
+	if (r->d == NULL) {
+		r->result = diskimage_scsicommand(cpu, id, type, xferp);
+		r->done = true;
+		return r;
+	}
+
+	async_enqueue(r);
+	return r;
+}
+
+
+/*
+ *  diskimage_async_poll():
+ *
+ *  Returns true if a request has completed.
+ */
+bool diskimage_async_poll(struct diskimage_request *r)
+{
+#ifdef HAVE_PTHREADS
+	bool done;
+
+	pthread_mutex_lock(&async_lock);
+	done = r->done;
+	pthread_mutex_unlock(&async_lock);
+
+	return done;
+#else
+	return r->done;
+#endif
+}
+
+
+/*
+ *  diskimage_async_wait():
+ *
+ *  Waits for a request to complete, and returns its result (1 on success,
+ *  0 on failure, as for diskimage_access()).
+ */
+int diskimage_async_wait(struct diskimage_request *r)
+{
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&async_lock);
+	while (!r->done)
+		pthread_cond_wait(&async_done_cond, &async_lock);
+	pthread_mutex_unlock(&async_lock);
+#endif
+
+	return r->result;
+}
+
+
+/*
+ *  diskimage_async_free():
+ *
+ *  Frees a request, waiting for it to complete first if necessary.
+ */
+void diskimage_async_free(struct diskimage_request *r)
+{
+	diskimage_async_wait(r);
+	free(r);
+}
+
+
+/*
+ *  diskimage_async_drain():
+ *
+ *  Waits until all outstanding requests to a disk image have completed.
+ */
+void diskimage_async_drain(struct diskimage *d)
+{
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&async_lock);
+	while (d->async_pending > 0)
+		pthread_cond_wait(&async_done_cond, &async_lock);
+	pthread_mutex_unlock(&async_lock);
+#endif
+}
@@ -0,0 +1,360 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Disk image block cache, with read-ahead for sequential access.
+ *
+ *  Guest operating systems tend to read disks in small chunks. The cache
+ *  keeps recently used DISKIMAGE_CACHE_LINE_SIZE-byte lines of a disk
+ *  image in memory, so that consecutive small reads only result in one
+ *  host read per line. When a run of sequential reads is detected, the
+ *  lines following the current read are also fetched ahead of time, in a
+ *  window that doubles (up to half the cache) as the run continues.
+ *
+ *  The cache belongs to the disk image, so it is shared by all controllers
+ *  that access the image. Writes go straight through to the disk image,
+ *  and update any cached lines they overlap.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diskimage.h"
+#include "misc.h"
+
+
+struct diskimage_cache_line {
+	int64_t		line_nr;	/*  -1 if the line is unused  */
+	uint64_t	last_use;
+	bool		from_readahead;
+	int		hash_next;
+	unsigned char	*data;
+};
+
+struct diskimage_cache {
+	int		n_lines;
+	struct diskimage_cache_line *lines;
+
+	int		n_buckets;
+	int		*buckets;
+
+	uint64_t	use_counter;
+
+	/*  End of the data in the image, including writes that have made
+	    the image file longer since its size was last calculated:  */
+	off_t		data_end;
+
+	/*  Sequential access detection:  */
+	off_t		next_sequential_offset;
+	int		sequential_run;
+
+	/*  Statistics:  */
+	uint64_t	n_hits;
+	uint64_t	n_misses;
+	uint64_t	n_readahead;
+	uint64_t	n_readahead_used;
+};
+
+
+/*
+ *  diskimage_cache_new():
+ *
+ *  Allocates a cache of (approximately) size bytes. Returns NULL if size is
+ *  too small to hold even a single cache line.
+ */
+struct diskimage_cache *diskimage_cache_new(size_t size)
+{
+	struct diskimage_cache *c;
+	int n_lines = size / DISKIMAGE_CACHE_LINE_SIZE;
+
+	if (n_lines < 1)
+		return NULL;
+
+	CHECK_ALLOCATION(c = (struct diskimage_cache *) malloc(sizeof(struct diskimage_cache)));
+	memset(c, 0, sizeof(struct diskimage_cache));
+
+	c->n_lines = n_lines;
+	CHECK_ALLOCATION(c->lines = (struct diskimage_cache_line *) malloc(
+	    sizeof(struct diskimage_cache_line) * n_lines));
+
+	for (int i = 0; i < n_lines; i++) {
+		c->lines[i].line_nr = -1;
+		c->lines[i].last_use = 0;
+		c->lines[i].from_readahead = false;
+		c->lines[i].hash_next = -1;
+		CHECK_ALLOCATION(c->lines[i].data = (unsigned char *)
+		    malloc(DISKIMAGE_CACHE_LINE_SIZE));
+	}
+
+	c->n_buckets = n_lines * 2;
+	CHECK_ALLOCATION(c->buckets = (int *) malloc(sizeof(int) * c->n_buckets));
+	for (int i = 0; i < c->n_buckets; i++)
+		c->buckets[i] = -1;
+
+	c->next_sequential_offset = -1;
+
+	return c;
+}
+
+
+void diskimage_cache_free(struct diskimage_cache *c)
+{
+	for (int i = 0; i < c->n_lines; i++)
+		free(c->lines[i].data);
+
+	free(c->lines);
+	free(c->buckets);
+	free(c);
+}
+
+
+static int cache_lookup(struct diskimage_cache *c, int64_t line_nr)
+{
+	int i = c->buckets[line_nr % c->n_buckets];
+
+	while (i >= 0 && c->lines[i].line_nr != line_nr)
+		i = c->lines[i].hash_next;
+
+	return i;
+}
+
+
+static void cache_unlink(struct diskimage_cache *c, int i)
+{
+	int *p = &c->buckets[c->lines[i].line_nr % c->n_buckets];
+
+	while (*p != i)
+		p = &c->lines[*p].hash_next;
+
+	*p = c->lines[i].hash_next;
+	c->lines[i].hash_next = -1;
+	c->lines[i].line_nr = -1;
+}
+
+
+/*
+ *  cache_load():
+ *
+ *  Reads a line from the disk image into the least recently used slot of
+ *  the cache, and returns the slot. The last line of an image may be only
+ *  partially backed by data; only that part is read, and the rest is
+ *  zero-filled.
+ */
+static int cache_load(struct diskimage_cache *c, struct diskimage *d,
+	int64_t line_nr, diskimage_cache_fill_fn fill, bool readahead)
+{
+	struct diskimage_cache_line *l;
+	off_t line_offset = (off_t) line_nr * DISKIMAGE_CACHE_LINE_SIZE;
+	size_t n = 0, fill_len = DISKIMAGE_CACHE_LINE_SIZE;
+	int victim = 0;
+
+	for (int i = 1; i < c->n_lines && c->lines[victim].line_nr >= 0; i++)
+		if (c->lines[i].line_nr < 0 ||
+		    c->lines[i].last_use < c->lines[victim].last_use)
+			victim = i;
+
+	l = &c->lines[victim];
+	if (l->line_nr >= 0)
+		cache_unlink(c, victim);
+
+	if (line_offset + DISKIMAGE_CACHE_LINE_SIZE > c->data_end)
+		fill_len = c->data_end > line_offset ?
+		    c->data_end - line_offset : 0;
+
+	if (fill_len > 0)
+		n = fill(d, line_offset, l->data, fill_len);
+	if (n < DISKIMAGE_CACHE_LINE_SIZE)
+		memset(l->data + n, 0, DISKIMAGE_CACHE_LINE_SIZE - n);
+
+	l->line_nr = line_nr;
+	l->last_use = ++ c->use_counter;
+	l->from_readahead = readahead;
+	l->hash_next = c->buckets[line_nr % c->n_buckets];
+	c->buckets[line_nr % c->n_buckets] = victim;
+
+	return victim;
+}
+
+
+/*
+ *  diskimage_cache_read():
+ *
+ *  Reads from a disk image via its cache. fill is used to read lines that
+ *  are not in the cache. Returns len.
+ */
+size_t diskimage_cache_read(struct diskimage_cache *c, struct diskimage *d,
+	off_t offset, unsigned char *buf, size_t len,
+	diskimage_cache_fill_fn fill)
+{
+	off_t end = offset + len;
+	size_t total = len;
+
+	if (c->data_end < d->total_size)
+		c->data_end = d->total_size;
+
+	if (offset == c->next_sequential_offset)
+		c->sequential_run ++;
+	else
+		c->sequential_run = 0;
+	c->next_sequential_offset = end;
+
+	while (len > 0) {
+		int64_t line_nr = offset / DISKIMAGE_CACHE_LINE_SIZE;
+		size_t in_line = offset % DISKIMAGE_CACHE_LINE_SIZE;
+		size_t n = DISKIMAGE_CACHE_LINE_SIZE - in_line;
+		int i = cache_lookup(c, line_nr);
+
+		if (n > len)
+			n = len;
+
+		if (i >= 0) {
+			c->n_hits ++;
+			if (c->lines[i].from_readahead) {
+				c->n_readahead_used ++;
+				c->lines[i].from_readahead = false;
+			}
+			c->lines[i].last_use = ++ c->use_counter;
+		} else {
+			c->n_misses ++;
+			i = cache_load(c, d, line_nr, fill, false);
+		}
+
+		memcpy(buf, c->lines[i].data + in_line, n);
+
+		offset += n;
+		buf += n;
+		len -= n;
+	}
+
+	/*
+	 *  Read ahead, if this read continued a run of sequential reads.
+	 *  The window starts at one line, and doubles for every further
+	 *  sequential read, up to half of the cache.
+	 */
+	if (c->sequential_run > 0 && end < c->data_end) {
+		int window = c->n_lines / 2;
+		int64_t line_nr = (end + DISKIMAGE_CACHE_LINE_SIZE - 1)
+		    / DISKIMAGE_CACHE_LINE_SIZE;
+
+		if (c->sequential_run < 16 &&
+		    (1 << (c->sequential_run - 1)) < window)
+			window = 1 << (c->sequential_run - 1);
+
+		for (int j = 0; j < window; j++, line_nr ++) {
+			if ((off_t) line_nr * DISKIMAGE_CACHE_LINE_SIZE >=
+			    c->data_end)
+				break;
+			if (cache_lookup(c, line_nr) >= 0)
+				continue;
+
+			cache_load(c, d, line_nr, fill, true);
+			c->n_readahead ++;
+		}
+	}
+
+	return total;
+}
+
+
+/*
+ *  diskimage_cache_write():
+ *
+ *  Called after data has been written to a disk image, to update any cached
+ *  lines that the write overlapped.
+ */
+void diskimage_cache_write(struct diskimage_cache *c, off_t offset,
+	const unsigned char *buf, size_t len)
+{
+	/*  Writes past the end (e.g. into the last, rounded-up, cylinder of
+	    an IDE disk) make the image file longer:  */
+	if (offset + (off_t) len > c->data_end)
+		c->data_end = offset + len;
+
+	while (len > 0) {
+		int64_t line_nr = offset / DISKIMAGE_CACHE_LINE_SIZE;
+		size_t in_line = offset % DISKIMAGE_CACHE_LINE_SIZE;
+		size_t n = DISKIMAGE_CACHE_LINE_SIZE - in_line;
+		int i = cache_lookup(c, line_nr);
+
+		if (n > len)
+			n = len;
+
+		if (i >= 0)
+			memcpy(c->lines[i].data + in_line, buf, n);
+
+		offset += n;
+		buf += n;
+		len -= n;
+	}
+
+	/*  A write breaks any sequential read run.  */
+	c->next_sequential_offset = -1;
+}
+
+
+/*
+ *  diskimage_cache_invalidate():
+ *
+ *  Throws away all cached data, e.g. when the contents of the disk image
+ *  have changed without going through the cache.
+ */
+void diskimage_cache_invalidate(struct diskimage_cache *c)
+{
+	for (int i = 0; i < c->n_lines; i++) {
+		c->lines[i].line_nr = -1;
+		c->lines[i].hash_next = -1;
+		c->lines[i].from_readahead = false;
+	}
+
+	for (int i = 0; i < c->n_buckets; i++)
+		c->buckets[i] = -1;
+
+	c->next_sequential_offset = -1;
+}
+
+
+/*
+ *  diskimage_cache_show():
+ *
+ *  Prints cache statistics.
+ */
+void diskimage_cache_show(struct diskimage_cache *c)
+{
+	uint64_t n_accesses = c->n_hits + c->n_misses;
+
+	printf("%i KB cache (%i lines): %" PRIu64" line accesses, ",
+	    (int) (c->n_lines * (DISKIMAGE_CACHE_LINE_SIZE / 1024)),
+	    c->n_lines, n_accesses);
+
+	if (n_accesses > 0)
+		printf("%.1f%% hits", 100.0 * c->n_hits / n_accesses);
+	else
+		printf("no hits");
+
+	printf(", %" PRIu64" lines read ahead (%" PRIu64" used)\n",
+	    c->n_readahead, c->n_readahead_used);
+}
@@ -0,0 +1,382 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Block-compressed read-only disk images.
+ *
+ *  The image is split into fixed-size chunks, which are compressed
+ *  independently, so that any part of the image can be read without
+ *  decompressing what comes before it. (experiments/compress_diskimage.c
+ *  creates such images.)
+ *
+ *  File layout (all numbers are little-endian):
+ *
+ *	 0  "GXemuCMP"
+ *	 8  version (uint32)
+ *	12  chunk size in bytes (uint32)
+ *	16  uncompressed image size in bytes (uint64)
+ *	24  number of chunks (uint64)
+ *	32  (reserved, up to offset 64)
+ *	64  chunk index: number of chunks + 1 file offsets (uint64). Chunk i
+ *	    is stored at index[i], and is index[i+1] - index[i] bytes long.
+ *
+ *  Each chunk is compressed in the LZ4 block format. A chunk whose stored
+ *  length equals its uncompressed length is stored uncompressed.
+ *
+ *  Recently used decompressed chunks are kept in a small LRU cache.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "diskimage.h"
+#include "misc.h"
+
+
+#define	CMP_MAGIC		"GXemuCMP"
+#define	CMP_VERSION		1
+#define	CMP_HEADER_SIZE		64
+#define	CMP_MAX_CHUNK_SIZE	(4 * 1048576)
+
+#define	CMP_N_CACHED_CHUNKS	32
+
+
+struct cmp_cached_chunk {
+	int64_t		chunk_nr;	/*  -1 if unused  */
+	uint64_t	last_use;
+	unsigned char	*data;
+};
+
+struct diskimage_compressed {
+	int		fd;
+
+	uint32_t	chunk_size;
+	uint64_t	size;
+	uint64_t	n_chunks;
+	uint64_t	*index;
+
+	unsigned char	*compressed_buf;
+
+	uint64_t	use_counter;
+	struct cmp_cached_chunk cache[CMP_N_CACHED_CHUNKS];
+};
+
+
+static uint64_t get_le64(const unsigned char *p)
+{
+	uint64_t x = 0;
+	for (int i = 7; i >= 0; i--)
+		x = (x << 8) | p[i];
+	return x;
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+/*
+ *  lz4_decompress():
+ *
+ *  Decompresses an LZ4 block. Returns the number of bytes written to dst, or
+ *  -1 if the compressed data is corrupt (or would not fit in dst).
+ */
+static ssize_t lz4_decompress(const unsigned char *src, size_t src_len,
+	unsigned char *dst, size_t dst_len)
+{
+	const unsigned char *ip = src, *iend = src + src_len;
+	unsigned char *op = dst, *oend = dst + dst_len;
+
+	while (ip < iend) {
+		unsigned int token = *ip++;
+		size_t len = token >> 4;
+
+		/*  Literals:  */
+		if (len == 15) {
+			unsigned int b;
+			do {
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+
+		if (len > (size_t) (iend - ip) || len > (size_t) (oend - op))
+			return -1;
+
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/*  The last sequence consists of literals only.  */
+		if (ip >= iend)
+			break;
+
+		/*  Match:  */
+		if (iend - ip < 2)
+			return -1;
+
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if (offset == 0 || offset > (size_t) (op - dst))
+			return -1;
+
+		len = (token & 15) + 4;
+		if ((token & 15) == 15) {
+			unsigned int b;
+			do {
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+
+		if (len > (size_t) (oend - op))
+			return -1;
+
+		/*  Matches may overlap the output, so copy byte by byte:  */
+		const unsigned char *match = op - offset;
+		while (len-- > 0)
+			*op++ = *match++;
+	}
+
+	return op - dst;
+}
+
+
+/*
+ *  diskimage_compressed_probe():
+ *
+ *  Returns true if fname is a block-compressed disk image.
+ */
+bool diskimage_compressed_probe(const char *fname)
+{
+	unsigned char buf[8];
+	int fd = open(fname, O_RDONLY);
+	bool res;
+
+	if (fd < 0)
+		return false;
+
+	res = diskimage_pread(fd, buf, 8, 0) == 8 &&
+	    memcmp(buf, CMP_MAGIC, 8) == 0;
+
+	close(fd);
+	return res;
+}
+
+
+/*
+ *  diskimage_compressed_open():
+ *
+ *  Opens a block-compressed disk image, and reads its chunk index. Returns
+ *  NULL on failure.
+ */
+struct diskimage_compressed *diskimage_compressed_open(const char *fname)
+{
+	unsigned char hdr[CMP_HEADER_SIZE], *buf;
+	struct diskimage_compressed *c;
+	size_t index_len;
+
+	CHECK_ALLOCATION(c = (struct diskimage_compressed *) malloc(sizeof(struct diskimage_compressed)));
+	memset(c, 0, sizeof(struct diskimage_compressed));
+
+	c->fd = open(fname, O_RDONLY);
+	if (c->fd < 0 ||
+	    diskimage_pread(c->fd, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr, CMP_MAGIC, 8) != 0) {
+		debugmsg(SUBSYS_DISK, "compressed", VERBOSITY_ERROR,
+		    "'%s' is not a readable compressed disk image", fname);
+		goto fail;
+	}
+
+	c->chunk_size = get_le32(hdr + 12);
+	c->size = get_le64(hdr + 16);
+	c->n_chunks = get_le64(hdr + 24);
+
+	if (get_le32(hdr + 8) != CMP_VERSION || c->chunk_size == 0 ||
+	    c->chunk_size > CMP_MAX_CHUNK_SIZE ||
+	    c->n_chunks != (c->size + c->chunk_size - 1) / c->chunk_size) {
+		debugmsg(SUBSYS_DISK, "compressed", VERBOSITY_ERROR,
+		    "'%s': unsupported version, or bad header", fname);
+		goto fail;
+	}
+
+	index_len = (c->n_chunks + 1) * 8;
+	CHECK_ALLOCATION(buf = (unsigned char *) malloc(index_len));
+	CHECK_ALLOCATION(c->index = (uint64_t *) malloc((c->n_chunks + 1) * sizeof(uint64_t)));
+
+	if (diskimage_pread(c->fd, buf, index_len, CMP_HEADER_SIZE)
+	    != index_len) {
+		debugmsg(SUBSYS_DISK, "compressed", VERBOSITY_ERROR,
+		    "'%s': could not read the chunk index", fname);
+		free(buf);
+		goto fail;
+	}
+
+	for (uint64_t i = 0; i <= c->n_chunks; i++)
+		c->index[i] = get_le64(buf + i*8);
+	free(buf);
+
+	for (uint64_t i = 0; i < c->n_chunks; i++)
+		if (c->index[i+1] < c->index[i] ||
+		    c->index[i+1] - c->index[i] > c->chunk_size) {
+			debugmsg(SUBSYS_DISK, "compressed", VERBOSITY_ERROR,
+			    "'%s': corrupt chunk index", fname);
+			goto fail;
+		}
+
+	CHECK_ALLOCATION(c->compressed_buf = (unsigned char *) malloc(c->chunk_size));
+
+	for (int i = 0; i < CMP_N_CACHED_CHUNKS; i++) {
+		c->cache[i].chunk_nr = -1;
+		CHECK_ALLOCATION(c->cache[i].data = (unsigned char *) malloc(c->chunk_size));
+	}
+
+	return c;
+
+fail:
+	if (c->fd >= 0)
+		close(c->fd);
+	free(c->index);
+	free(c);
+	return NULL;
+}
+
+
+void diskimage_compressed_close(struct diskimage_compressed *c)
+{
+	for (int i = 0; i < CMP_N_CACHED_CHUNKS; i++)
+		free(c->cache[i].data);
+
+	close(c->fd);
+	free(c->compressed_buf);
+	free(c->index);
+	free(c);
+}
+
+
+uint64_t diskimage_compressed_size(struct diskimage_compressed *c)
+{
+	return c->size;
+}
+
+
+/*
+ *  cmp_get_chunk():
+ *
+ *  Returns a pointer to the decompressed contents of a chunk, or NULL if
+ *  the chunk could not be read.
+ */
+static unsigned char *cmp_get_chunk(struct diskimage_compressed *c,
+	uint64_t chunk_nr)
+{
+	struct cmp_cached_chunk *slot = &c->cache[0];
+	size_t clen, ulen;
+
+	for (int i = 0; i < CMP_N_CACHED_CHUNKS; i++) {
+		if (c->cache[i].chunk_nr == (int64_t) chunk_nr) {
+			c->cache[i].last_use = ++ c->use_counter;
+			return c->cache[i].data;
+		}
+
+		if (c->cache[i].last_use < slot->last_use)
+			slot = &c->cache[i];
+	}
+
+	clen = c->index[chunk_nr + 1] - c->index[chunk_nr];
+	ulen = c->chunk_size;
+	if (chunk_nr == c->n_chunks - 1 && c->size % c->chunk_size != 0)
+		ulen = c->size % c->chunk_size;
+
+	slot->chunk_nr = -1;
+
+	if (clen == ulen) {
+		if (diskimage_pread(c->fd, slot->data, ulen,
+		    c->index[chunk_nr]) != ulen)
+			return NULL;
+	} else {
+		if (diskimage_pread(c->fd, c->compressed_buf, clen,
+		    c->index[chunk_nr]) != clen ||
+		    lz4_decompress(c->compressed_buf, clen, slot->data, ulen)
+		    != (ssize_t) ulen) {
+			fatal("[ compressed disk image: chunk %lli is"
+			    " corrupt ]\n", (long long) chunk_nr);
+			return NULL;
+		}
+	}
+
+	slot->chunk_nr = chunk_nr;
+	slot->last_use = ++ c->use_counter;
+
+	return slot->data;
+}
+
+
+/*
+ *  diskimage_compressed_read():
+ *
+ *  Reads from a compressed disk image. Returns the number of bytes read.
+ */
+size_t diskimage_compressed_read(struct diskimage_compressed *c,
+	uint64_t offset, unsigned char *buf, size_t len)
+{
+	size_t total = 0;
+
+	while (len > 0 && offset < c->size) {
+		uint64_t chunk_nr = offset / c->chunk_size;
+		size_t in_chunk = offset % c->chunk_size;
+		size_t n = c->chunk_size - in_chunk;
+		unsigned char *data;
+
+		if (n > len)
+			n = len;
+		if (n > c->size - offset)
+			n = c->size - offset;
+
+		data = cmp_get_chunk(c, chunk_nr);
+		if (data == NULL)
+			break;
+
+		memcpy(buf, data + in_chunk, n);
+
+		offset += n;
+		buf += n;
+		len -= n;
+		total += n;
+	}
+
+	return total;
+}
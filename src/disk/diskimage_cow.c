@@ -0,0 +1,886 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Copy-on-write sparse disk images.
+ *
+ *  File layout (all numbers are little-endian):
+ *
+ *	0x0000	Header (first cluster):
+ *		  0  "GXemuCOW"
+ *		  8  version (uint32)
+ *		 12  cluster size in bytes (uint32)
+ *		 16  virtual disk size in bytes (uint64)
+ *		 24  file offset of the current cluster index (uint64)
+ *		 32  number of snapshots (uint32)
+ *		 40  file offset of the snapshot table (uint64)
+ *		 64  base image file name, nul-terminated (empty = no base)
+ *
+ *	Cluster index: one uint64 per cluster of the virtual disk. 0 means
+ *	that the cluster is not allocated, and is read from the base image
+ *	(or as zeroes, if there is no base image). Otherwise it is the file
+ *	offset of the cluster's data. If COW_ENTRY_SHARED is set, the cluster
+ *	is also used by a snapshot, and must be copied before it is written.
+ *
+ *	Snapshot table: one entry per snapshot, containing the snapshot's
+ *	name, the file offset of a saved copy of the cluster index, and the
+ *	time the snapshot was taken.
+ *
+ *  The base image may be a raw image or another copy-on-write image, so
+ *  cloning an image is just a matter of creating a new (almost empty) file
+ *  which refers to it. A relative base image name is relative to the
+ *  directory of the image which refers to it.
+ *
+ *  Space is never reclaimed: clusters that are no longer used by the current
+ *  state or any snapshot (e.g. after reverting to a snapshot) are simply
+ *  left in the file.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "diskimage.h"
+#include "misc.h"
+
+
+#define	COW_MAGIC			"GXemuCOW"
+#define	COW_VERSION			1
+#define	COW_HEADER_SIZE			4096
+#define	COW_BASE_NAME_OFS		64
+#define	COW_BASE_NAME_LEN		(COW_HEADER_SIZE - COW_BASE_NAME_OFS)
+#define	COW_DEFAULT_CLUSTER_SIZE	65536
+#define	COW_ENTRY_SHARED		1
+
+#define	COW_SNAPSHOT_NAME_LEN		48
+#define	COW_SNAPSHOT_ENTRY_SIZE		64
+
+#define	COW_MAX_CHAIN_DEPTH		16
+
+
+struct cow_snapshot {
+	char		name[COW_SNAPSHOT_NAME_LEN];
+	uint64_t	index_offset;
+	uint64_t	time;
+};
+
+struct diskimage_cow {
+	char		*fname;
+	int		fd;
+	bool		writable;
+
+	uint32_t	cluster_size;
+	uint64_t	size;
+	uint64_t	n_clusters;
+
+	uint64_t	index_offset;
+	uint64_t	*index;
+
+	/*  File offset where the next cluster will be allocated:  */
+	uint64_t	next_free;
+
+	int		n_snapshots;
+	struct cow_snapshot *snapshots;
+	uint64_t	snapshot_table_offset;
+
+	/*  The base image is either another COW image, or a raw file:  */
+	char		base_name[COW_BASE_NAME_LEN];
+	struct diskimage_cow *base_cow;
+	int		base_fd;
+	uint64_t	base_size;
+
+	unsigned char	*cluster_buf;
+};
+
+
+static uint64_t get_le64(const unsigned char *p)
+{
+	uint64_t x = 0;
+	for (int i = 7; i >= 0; i--)
+		x = (x << 8) | p[i];
+	return x;
+}
+
+static void put_le64(unsigned char *p, uint64_t x)
+{
+	for (int i = 0; i < 8; i++, x >>= 8)
+		p[i] = x;
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(unsigned char *p, uint32_t x)
+{
+	for (int i = 0; i < 4; i++, x >>= 8)
+		p[i] = x;
+}
+
+
+/*
+ *  cow_resolve_base_name():
+ *
+ *  Base image names which are not absolute are relative to the directory
+ *  of the image that refers to them.
+ */
+static void cow_resolve_base_name(const char *fname, const char *base_name,
+	char *buf, size_t bufsize)
+{
+	const char *slash = strrchr(fname, '/');
+
+	if (base_name[0] == '/' || slash == NULL)
+		snprintf(buf, bufsize, "%s", base_name);
+	else
+		snprintf(buf, bufsize, "%.*s/%s", (int) (slash - fname),
+		    fname, base_name);
+}
+
+
+/*
+ *  cow_write_header():
+ */
+static bool cow_write_header(struct diskimage_cow *c)
+{
+	unsigned char hdr[COW_HEADER_SIZE];
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, COW_MAGIC, 8);
+	put_le32(hdr + 8, COW_VERSION);
+	put_le32(hdr + 12, c->cluster_size);
+	put_le64(hdr + 16, c->size);
+	put_le64(hdr + 24, c->index_offset);
+	put_le32(hdr + 32, c->n_snapshots);
+	put_le64(hdr + 40, c->snapshot_table_offset);
+	strlcpy((char *) hdr + COW_BASE_NAME_OFS, c->base_name,
+	    COW_BASE_NAME_LEN);
+
+	return diskimage_pwrite(c->fd, hdr, sizeof(hdr), 0) == sizeof(hdr);
+}
+
+
+/*
+ *  cow_alloc():
+ *
+ *  Allocates len bytes (rounded up to whole clusters) at the end of the
+ *  file, and returns the file offset.
+ */
+static uint64_t cow_alloc(struct diskimage_cow *c, uint64_t len)
+{
+	uint64_t ofs = c->next_free;
+
+	len = (len + c->cluster_size - 1) & ~((uint64_t) c->cluster_size - 1);
+	c->next_free += len;
+
+	return ofs;
+}
+
+
+/*
+ *  cow_write_index():
+ *
+ *  Writes a complete cluster index to the file at offset ofs. If
+ *  strip_shared is set, the COW_ENTRY_SHARED flags are not written.
+ */
+static bool cow_write_index(struct diskimage_cow *c, uint64_t *index,
+	uint64_t ofs, bool strip_shared)
+{
+	size_t len = c->n_clusters * 8;
+	unsigned char *buf;
+	bool ok;
+
+	CHECK_ALLOCATION(buf = (unsigned char *) malloc(len));
+
+	for (uint64_t i = 0; i < c->n_clusters; i++)
+		put_le64(buf + i*8, strip_shared ?
+		    index[i] & ~(uint64_t) COW_ENTRY_SHARED : index[i]);
+
+	ok = diskimage_pwrite(c->fd, buf, len, ofs) == len;
+
+	free(buf);
+	return ok;
+}
+
+
+/*
+ *  cow_read_index():
+ */
+static bool cow_read_index(struct diskimage_cow *c, uint64_t *index,
+	uint64_t ofs)
+{
+	size_t len = c->n_clusters * 8;
+	unsigned char *buf;
+	bool ok;
+
+	CHECK_ALLOCATION(buf = (unsigned char *) malloc(len));
+
+	ok = diskimage_pread(c->fd, buf, len, ofs) == len;
+	for (uint64_t i = 0; ok && i < c->n_clusters; i++)
+		index[i] = get_le64(buf + i*8);
+
+	free(buf);
+	return ok;
+}
+
+
+/*
+ *  cow_write_snapshot_table():
+ *
+ *  Writes the snapshot table to a newly allocated area at the end of the
+ *  file, and then updates the header to point to it.
+ */
+static bool cow_write_snapshot_table(struct diskimage_cow *c)
+{
+	size_t len = c->n_snapshots * COW_SNAPSHOT_ENTRY_SIZE;
+	unsigned char *buf;
+	bool ok = true;
+
+	c->snapshot_table_offset = 0;
+
+	if (len > 0) {
+		CHECK_ALLOCATION(buf = (unsigned char *) malloc(len));
+		memset(buf, 0, len);
+
+		for (int i = 0; i < c->n_snapshots; i++) {
+			unsigned char *p = buf + i * COW_SNAPSHOT_ENTRY_SIZE;
+			memcpy(p, c->snapshots[i].name, COW_SNAPSHOT_NAME_LEN);
+			put_le64(p + COW_SNAPSHOT_NAME_LEN,
+			    c->snapshots[i].index_offset);
+			put_le64(p + COW_SNAPSHOT_NAME_LEN + 8,
+			    c->snapshots[i].time);
+		}
+
+		c->snapshot_table_offset = cow_alloc(c, len);
+		ok = diskimage_pwrite(c->fd, buf, len,
+		    c->snapshot_table_offset) == len;
+		free(buf);
+	}
+
+	return ok && cow_write_header(c);
+}
+
+
+/*
+ *  diskimage_cow_probe():
+ *
+ *  Returns true if fname is a copy-on-write disk image.
+ */
+bool diskimage_cow_probe(const char *fname)
+{
+	unsigned char buf[8];
+	int fd = open(fname, O_RDONLY);
+	bool res;
+
+	if (fd < 0)
+		return false;
+
+	res = diskimage_pread(fd, buf, 8, 0) == 8 &&
+	    memcmp(buf, COW_MAGIC, 8) == 0;
+
+	close(fd);
+	return res;
+}
+
+
+static struct diskimage_cow *cow_open(const char *fname, bool writable,
+	int depth);
+
+/*
+ *  cow_open_base():
+ */
+static bool cow_open_base(struct diskimage_cow *c, int depth)
+{
+	char name[COW_BASE_NAME_LEN + 1024];
+	struct stat st;
+
+	c->base_fd = -1;
+
+	if (c->base_name[0] == '\0')
+		return true;
+
+	cow_resolve_base_name(c->fname, c->base_name, name, sizeof(name));
+
+	if (diskimage_cow_probe(name)) {
+		c->base_cow = cow_open(name, false, depth + 1);
+		if (c->base_cow == NULL)
+			return false;
+		c->base_size = c->base_cow->size;
+		return true;
+	}
+
+	c->base_fd = open(name, O_RDONLY);
+	if (c->base_fd < 0 || fstat(c->base_fd, &st) != 0) {
+		debugmsg(SUBSYS_DISK, "cow", VERBOSITY_ERROR,
+		    "could not open base image '%s' of '%s': %s",
+		    name, c->fname, strerror(errno));
+		return false;
+	}
+
+	c->base_size = st.st_size;
+	return true;
+}
+
+
+/*
+ *  cow_open():
+ */
+static struct diskimage_cow *cow_open(const char *fname, bool writable,
+	int depth)
+{
+	unsigned char hdr[COW_HEADER_SIZE];
+	struct diskimage_cow *c;
+	struct stat st;
+
+	if (depth > COW_MAX_CHAIN_DEPTH) {
+		debugmsg(SUBSYS_DISK, "cow", VERBOSITY_ERROR,
+		    "too many levels of base images at '%s'", fname);
+		return NULL;
+	}
+
+	CHECK_ALLOCATION(c = (struct diskimage_cow *) malloc(sizeof(struct diskimage_cow)));
+	memset(c, 0, sizeof(struct diskimage_cow));
+	c->base_fd = -1;
+
+	CHECK_ALLOCATION(c->fname = strdup(fname));
+	c->writable = writable;
+
+	c->fd = open(fname, writable ? O_RDWR : O_RDONLY);
+	if (c->fd < 0 || fstat(c->fd, &st) != 0 ||
+	    diskimage_pread(c->fd, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr, COW_MAGIC, 8) != 0) {
+		debugmsg(SUBSYS_DISK, "cow", VERBOSITY_ERROR,
+		    "'%s' is not a readable copy-on-write disk image", fname);
+		goto fail;
+	}
+
+	c->cluster_size = get_le32(hdr + 12);
+	c->size = get_le64(hdr + 16);
+	c->index_offset = get_le64(hdr + 24);
+	c->n_snapshots = get_le32(hdr + 32);
+	c->snapshot_table_offset = get_le64(hdr + 40);
+	memcpy(c->base_name, hdr + COW_BASE_NAME_OFS, COW_BASE_NAME_LEN);
+	c->base_name[COW_BASE_NAME_LEN - 1] = '\0';
+
+	if (get_le32(hdr + 8) != COW_VERSION || c->cluster_size < 4096 ||
+	    (c->cluster_size & (c->cluster_size - 1)) != 0) {
+		debugmsg(SUBSYS_DISK, "cow", VERBOSITY_ERROR,
+		    "'%s': unsupported version or cluster size", fname);
+		goto fail;
+	}
+
+	c->n_clusters = c->size / c->cluster_size +
+	    (c->size % c->cluster_size != 0);
+	c->next_free = ((uint64_t) st.st_size + c->cluster_size - 1)
+	    & ~((uint64_t) c->cluster_size - 1);
+
+	/*  The index must fit in the file, and in memory:  */
+	if (c->index_offset > (uint64_t) st.st_size ||
+	    c->n_clusters > ((uint64_t) st.st_size - c->index_offset) / 8 ||
+	    c->n_clusters > (SIZE_MAX - 8) / sizeof(uint64_t)) {
+		debugmsg(SUBSYS_DISK, "cow", VERBOSITY_ERROR,
+		    "'%s': the cluster index does not fit in the file", fname);
+		goto fail;
+	}
+
+	if (c->n_snapshots < 0 || (c->n_snapshots > 0 &&
+	    (c->snapshot_table_offset > (uint64_t) st.st_size ||
+	    (uint64_t) c->n_snapshots > ((uint64_t) st.st_size -
+	    c->snapshot_table_offset) / COW_SNAPSHOT_ENTRY_SIZE))) {
+		debugmsg(SUBSYS_DISK, "cow", VERBOSITY_ERROR,
+		    "'%s': the snapshot table does not fit in the file", fname);
+		goto fail;
+	}
+
+	CHECK_ALLOCATION(c->index = (uint64_t *) malloc(c->n_clusters * 8 + 8));
+	CHECK_ALLOCATION(c->cluster_buf = (unsigned char *) malloc(c->cluster_size));
+
+	if (!cow_read_index(c, c->index, c->index_offset)) {
+		debugmsg(SUBSYS_DISK, "cow", VERBOSITY_ERROR,
+		    "'%s': could not read the cluster index", fname);
+		goto fail;
+	}
+
+	if (c->n_snapshots > 0) {
+		size_t len = c->n_snapshots * COW_SNAPSHOT_ENTRY_SIZE;
+		unsigned char *buf;
+
+		CHECK_ALLOCATION(buf = (unsigned char *) malloc(len));
+		CHECK_ALLOCATION(c->snapshots = (struct cow_snapshot *)
+		    malloc(sizeof(struct cow_snapshot) * c->n_snapshots));
+
+		if (diskimage_pread(c->fd, buf, len,
+		    c->snapshot_table_offset) != len) {
+			debugmsg(SUBSYS_DISK, "cow", VERBOSITY_ERROR,
+			    "'%s': could not read the snapshot table", fname);
+			free(buf);
+			goto fail;
+		}
+
+		for (int i = 0; i < c->n_snapshots; i++) {
+			unsigned char *p = buf + i * COW_SNAPSHOT_ENTRY_SIZE;
+			memcpy(c->snapshots[i].name, p, COW_SNAPSHOT_NAME_LEN);
+			c->snapshots[i].name[COW_SNAPSHOT_NAME_LEN-1] = '\0';
+			c->snapshots[i].index_offset =
+			    get_le64(p + COW_SNAPSHOT_NAME_LEN);
+			c->snapshots[i].time =
+			    get_le64(p + COW_SNAPSHOT_NAME_LEN + 8);
+		}
+
+		free(buf);
+	}
+
+	if (!cow_open_base(c, depth))
+		goto fail;
+
+	return c;
+
+fail:
+	if (c->fd >= 0)
+		close(c->fd);
+	free(c->index);
+	free(c->cluster_buf);
+	free(c->snapshots);
+	free(c->fname);
+	free(c);
+	return NULL;
+}
+
+
+/*
+ *  diskimage_cow_open():
+ *
+ *  Opens a copy-on-write disk image, and (recursively) its base images.
+ *  Returns NULL on failure.
+ */
+struct diskimage_cow *diskimage_cow_open(const char *fname, bool writable)
+{
+	return cow_open(fname, writable, 0);
+}
+
+
+/*
+ *  diskimage_cow_create():
+ *
+ *  Creates a new, empty, copy-on-write disk image. If base_name is non-NULL,
+ *  the new image is a clone of that image (which may be a raw image or
+ *  another copy-on-write image), and if size is 0, the base image's size is
+ *  used. Existing files are not overwritten.
+ */
+bool diskimage_cow_create(const char *fname, const char *base_name,
+	uint64_t size)
+{
+	struct diskimage_cow c;
+	bool ok;
+
+	memset(&c, 0, sizeof(c));
+	c.fname = (char *) fname;
+	c.cluster_size = COW_DEFAULT_CLUSTER_SIZE;
+
+	if (base_name != NULL) {
+		char name[COW_BASE_NAME_LEN + 1024];
+
+		if (strlen(base_name) >= COW_BASE_NAME_LEN) {
+			debugmsg(SUBSYS_DISK, "cow", VERBOSITY_ERROR,
+			    "base image name too long");
+			return false;
+		}
+
+		strlcpy(c.base_name, base_name, sizeof(c.base_name));
+
+		if (size == 0) {
+			cow_resolve_base_name(fname, base_name, name,
+			    sizeof(name));
+
+			if (diskimage_cow_probe(name)) {
+				struct diskimage_cow *base =
+				    diskimage_cow_open(name, false);
+				if (base == NULL)
+					return false;
+				size = base->size;
+				diskimage_cow_close(base);
+			} else {
+				struct stat st;
+				if (stat(name, &st) != 0) {
+					debugmsg(SUBSYS_DISK, "cow",
+					    VERBOSITY_ERROR, "%s: %s",
+					    name, strerror(errno));
+					return false;
+				}
+				size = st.st_size;
+			}
+		}
+	}
+
+	if (size == 0) {
+		debugmsg(SUBSYS_DISK, "cow", VERBOSITY_ERROR,
+		    "can not create a zero-sized disk image");
+		return false;
+	}
+
+	c.size = size;
+	c.n_clusters = (size + c.cluster_size - 1) / c.cluster_size;
+	c.index_offset = c.cluster_size;
+	c.next_free = c.index_offset;
+	cow_alloc(&c, c.n_clusters * 8);
+
+	c.fd = open(fname, O_RDWR | O_CREAT | O_EXCL, 0666);
+	if (c.fd < 0) {
+		debugmsg(SUBSYS_DISK, "cow", VERBOSITY_ERROR,
+		    "%s: %s", fname, strerror(errno));
+		return false;
+	}
+
+	/*  The (all zeroes) index is a hole in the file.  */
+	ok = ftruncate(c.fd, c.next_free) == 0 && cow_write_header(&c);
+
+	close(c.fd);
+
+	if (!ok) {
+		debugmsg(SUBSYS_DISK, "cow", VERBOSITY_ERROR,
+		    "could not write '%s'", fname);
+		unlink(fname);
+	}
+
+	return ok;
+}
+
+
+/*
+ *  diskimage_cow_close():
+ */
+void diskimage_cow_close(struct diskimage_cow *c)
+{
+	if (c->base_cow != NULL)
+		diskimage_cow_close(c->base_cow);
+	if (c->base_fd >= 0)
+		close(c->base_fd);
+
+	close(c->fd);
+	free(c->index);
+	free(c->cluster_buf);
+	free(c->snapshots);
+	free(c->fname);
+	free(c);
+}
+
+
+uint64_t diskimage_cow_size(struct diskimage_cow *c)
+{
+	return c->size;
+}
+
+
+/*
+ *  cow_read_unallocated():
+ *
+ *  Reads data for clusters that are not allocated in this image.
+ */
+static void cow_read_unallocated(struct diskimage_cow *c, uint64_t offset,
+	unsigned char *buf, size_t len)
+{
+	size_t done = 0;
+
+	if (c->base_cow != NULL)
+		done = diskimage_cow_read(c->base_cow, offset, buf, len);
+	else if (c->base_fd >= 0 && offset < c->base_size) {
+		size_t n = len;
+		if (n > c->base_size - offset)
+			n = c->base_size - offset;
+		done = diskimage_pread(c->base_fd, buf, n, offset);
+	}
+
+	if (done < len)
+		memset(buf + done, 0, len - done);
+}
+
+
+/*
+ *  diskimage_cow_read():
+ *
+ *  Reads from a copy-on-write disk image. Returns the number of bytes read
+ *  (which is less than len only when reading past the end of the disk).
+ */
+size_t diskimage_cow_read(struct diskimage_cow *c, uint64_t offset,
+	unsigned char *buf, size_t len)
+{
+	size_t total = 0;
+
+	while (len > 0 && offset < c->size) {
+		uint64_t cluster = offset / c->cluster_size;
+		size_t in_cluster = offset % c->cluster_size;
+		size_t n = c->cluster_size - in_cluster;
+		uint64_t entry = c->index[cluster] & ~(uint64_t) COW_ENTRY_SHARED;
+
+		if (n > len)
+			n = len;
+
+		if (entry != 0) {
+			size_t done = diskimage_pread(c->fd, buf, n,
+			    entry + in_cluster);
+			if (done < n)
+				memset(buf + done, 0, n - done);
+		} else
+			cow_read_unallocated(c, offset, buf, n);
+
+		offset += n;
+		buf += n;
+		len -= n;
+		total += n;
+	}
+
+	return total;
+}
+
+
+/*
+ *  diskimage_cow_write():
+ *
+ *  Writes to a copy-on-write disk image. Clusters which are not yet
+ *  allocated, or which are shared with a snapshot, are first copied to a
+ *  newly allocated cluster. Returns the number of bytes written.
+ */
+size_t diskimage_cow_write(struct diskimage_cow *c, uint64_t offset,
+	unsigned char *buf, size_t len)
+{
+	size_t total = 0;
+
+	if (!c->writable)
+		return 0;
+
+	while (len > 0 && offset < c->size) {
+		uint64_t cluster = offset / c->cluster_size;
+		size_t in_cluster = offset % c->cluster_size;
+		size_t n = c->cluster_size - in_cluster;
+		uint64_t entry = c->index[cluster];
+
+		if (n > len)
+			n = len;
+
+		if (entry != 0 && !(entry & COW_ENTRY_SHARED)) {
+			if (diskimage_pwrite(c->fd, buf, n,
+			    entry + in_cluster) != n)
+				break;
+		} else {
+			unsigned char le[8];
+			uint64_t new_entry;
+
+			/*  Copy the old contents, unless all of it is
+			    about to be overwritten:  */
+			if (n != c->cluster_size)
+				diskimage_cow_read(c, offset - in_cluster,
+				    c->cluster_buf, c->cluster_size);
+			memcpy(c->cluster_buf + in_cluster, buf, n);
+
+			new_entry = cow_alloc(c, c->cluster_size);
+			if (diskimage_pwrite(c->fd, c->cluster_buf,
+			    c->cluster_size, new_entry) != c->cluster_size)
+				break;
+
+			/*  Only update the index once the data is there:  */
+			put_le64(le, new_entry);
+			if (diskimage_pwrite(c->fd, le, 8,
+			    c->index_offset + cluster * 8) != 8)
+				break;
+
+			c->index[cluster] = new_entry;
+		}
+
+		offset += n;
+		buf += n;
+		len -= n;
+		total += n;
+	}
+
+	return total;
+}
+
+
+void diskimage_cow_flush(struct diskimage_cow *c)
+{
+	fsync(c->fd);
+}
+
+
+static struct cow_snapshot *cow_find_snapshot(struct diskimage_cow *c,
+	const char *name)
+{
+	for (int i = 0; i < c->n_snapshots; i++)
+		if (strcmp(c->snapshots[i].name, name) == 0)
+			return &c->snapshots[i];
+
+	return NULL;
+}
+
+
+/*
+ *  diskimage_cow_snapshot_create():
+ *
+ *  Takes a snapshot of the current state of the disk image. This saves a
+ *  copy of the cluster index, and marks all allocated clusters as shared,
+ *  so that they are copied before being written to again.
+ */
+bool diskimage_cow_snapshot_create(struct diskimage_cow *c, const char *name)
+{
+	struct cow_snapshot *s;
+
+	if (!c->writable) {
+		printf("%s: the disk image is read-only\n", c->fname);
+		return false;
+	}
+
+	if (name[0] == '\0' || strlen(name) >= COW_SNAPSHOT_NAME_LEN) {
+		printf("Invalid snapshot name.\n");
+		return false;
+	}
+
+	if (cow_find_snapshot(c, name) != NULL) {
+		printf("%s: snapshot '%s' already exists\n", c->fname, name);
+		return false;
+	}
+
+	CHECK_ALLOCATION(c->snapshots = (struct cow_snapshot *) realloc(
+	    c->snapshots, sizeof(struct cow_snapshot) * (c->n_snapshots+1)));
+	s = &c->snapshots[c->n_snapshots];
+	memset(s, 0, sizeof(struct cow_snapshot));
+	strlcpy(s->name, name, sizeof(s->name));
+	s->time = time(NULL);
+	s->index_offset = cow_alloc(c, c->n_clusters * 8);
+
+	if (!cow_write_index(c, c->index, s->index_offset, true))
+		return false;
+
+	for (uint64_t i = 0; i < c->n_clusters; i++)
+		if (c->index[i] != 0)
+			c->index[i] |= COW_ENTRY_SHARED;
+
+	c->n_snapshots ++;
+
+	if (!cow_write_index(c, c->index, c->index_offset, false) ||
+	    !cow_write_snapshot_table(c))
+		return false;
+
+	fsync(c->fd);
+	return true;
+}
+
+
+/*
+ *  diskimage_cow_snapshot_revert():
+ *
+ *  Throws away all changes made since a snapshot was taken. The snapshot
+ *  itself is kept, so it is possible to revert to it again later.
+ */
+bool diskimage_cow_snapshot_revert(struct diskimage_cow *c, const char *name)
+{
+	struct cow_snapshot *s = cow_find_snapshot(c, name);
+
+	if (s == NULL)
+		return false;
+
+	if (!c->writable) {
+		printf("%s: the disk image is read-only\n", c->fname);
+		return false;
+	}
+
+	if (!cow_read_index(c, c->index, s->index_offset))
+		return false;
+
+	for (uint64_t i = 0; i < c->n_clusters; i++)
+		if (c->index[i] != 0)
+			c->index[i] |= COW_ENTRY_SHARED;
+
+	if (!cow_write_index(c, c->index, c->index_offset, false))
+		return false;
+
+	fsync(c->fd);
+	return true;
+}
+
+
+/*
+ *  diskimage_cow_snapshot_delete():
+ *
+ *  Removes a snapshot from the snapshot table. (The space used by clusters
+ *  which only the snapshot used is not reclaimed.)
+ */
+bool diskimage_cow_snapshot_delete(struct diskimage_cow *c, const char *name)
+{
+	struct cow_snapshot *s = cow_find_snapshot(c, name);
+	int i;
+
+	if (s == NULL)
+		return false;
+
+	if (!c->writable) {
+		printf("%s: the disk image is read-only\n", c->fname);
+		return false;
+	}
+
+	i = s - c->snapshots;
+	memmove(&c->snapshots[i], &c->snapshots[i+1],
+	    sizeof(struct cow_snapshot) * (c->n_snapshots - i - 1));
+	c->n_snapshots --;
+
+	return cow_write_snapshot_table(c);
+}
+
+
+/*
+ *  diskimage_cow_show():
+ *
+ *  Prints information about a copy-on-write disk image and its snapshots.
+ */
+void diskimage_cow_show(struct diskimage_cow *c)
+{
+	uint64_t n_allocated = 0;
+
+	for (uint64_t i = 0; i < c->n_clusters; i++)
+		if (c->index[i] != 0)
+			n_allocated ++;
+
+	printf("    copy-on-write: %lli of %lli %i KB clusters allocated",
+	    (long long) n_allocated, (long long) c->n_clusters,
+	    (int) (c->cluster_size / 1024));
+	if (c->base_name[0])
+		printf(", base image '%s'", c->base_name);
+	printf("\n");
+
+	for (int i = 0; i < c->n_snapshots; i++) {
+		time_t t = c->snapshots[i].time;
+		char tbuf[64];
+
+		strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S",
+		    localtime(&t));
+		printf("    snapshot '%s' (%s)\n", c->snapshots[i].name, tbuf);
+	}
+}
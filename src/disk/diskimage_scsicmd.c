@@ -204,9 +204,12 @@ static void diskimage__switch_tape(struct diskimage *d)
 
 
 /*
- *  diskimage_scsicommand():
+ *  diskimage__scsicommand():
  *
- *  Perform a SCSI command on a disk image.
+ *  Perform a SCSI command on a disk image. If drain is true, then any
+ *  asynchronous requests to the disk image are waited for first. (An
+ *  asynchronous SCSI command is already being served in order, by the
+ *  thread that calls this function with drain = false.)
  *
  *  The xferp points to a scsi_transfer struct, containing msg_out, command,
  *  and data_out coming from the SCSI controller device.  This function
@@ -218,8 +221,8 @@ static void diskimage__switch_tape(struct diskimage *d)
  *	1 if otherwise ok,
  *	0 on error.
  */
-int diskimage_scsicommand(struct cpu *cpu, int id, int type,
-	struct scsi_transfer *xferp)
+int diskimage__scsicommand(struct cpu *cpu, int id, int type,
+	struct scsi_transfer *xferp, bool drain)
 {
 	char namebuf[16];
 	int retlen, i, q;
@@ -266,6 +269,10 @@ int diskimage_scsicommand(struct cpu *cpu, int id, int type,
 		return 0;
 	}
 
+	/*  Asynchronous requests to the disk must complete before this one:  */
+	if (drain)
+		diskimage_async_drain(d);
+
 	// TODO: debugmsg:ify the rest of the debug messages...
 	debug("[ diskimage_scsicommand(id=%i) cmd=0x%02x: ", id, xferp->cmd[0]);
 
@@ -744,10 +751,7 @@ xferp->data_in[4] = 0x2c - 4;	/*  Additional length  */
 			debug(" (weird len=%i)", xferp->cmd_len);
 
 		/*  TODO: actualy care about cmd[]  */
-		/*  TODO: Move to diskimage.cc and make sure that both
-			d->f is fsynced AND any overlays and overlay bitmap
-			files are fsynced too!  */
-		fsync(fileno(d->f));
+		diskimage_flush(d);
 
 		diskimage__return_default_status_and_message(xferp);
 		break;
@@ -1150,3 +1154,16 @@ xferp->data_in[4] = 0x2c - 4;	/*  Additional length  */
 	return 1;
 }
 
+
+
+/*
+ *  diskimage_scsicommand():
+ *
+ *  Perform a SCSI command on a disk image, synchronously. See
+ *  diskimage__scsicommand() for the return values.
+ */
+int diskimage_scsicommand(struct cpu *cpu, int id, int type,
+	struct scsi_transfer *xferp)
+{
+	return diskimage__scsicommand(cpu, id, type, xferp, true);
+}
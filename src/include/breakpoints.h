@@ -43,14 +43,49 @@ struct address_breakpoint {
 
 	bool		break_execution;
 	uint64_t	every_n_hits;
+
+	/*  Removed the next time the debugger is entered ("goto").  */
+	bool		temporary;
+
+	/*  Next breakpoint in the same hash chain, plus one (0 = none).  */
+	size_t		next_in_hash;
+};
+
+#define	WATCHPOINT_READ			1
+#define	WATCHPOINT_WRITE		2
+
+struct data_watchpoint {
+	char		*string;
+	uint64_t	addr;
+	uint64_t	len;
+	int		flags;		/*  WATCHPOINT_READ | WATCHPOINT_WRITE  */
+
+	uint64_t	total_hit_count;
 };
 
+/*
+ *  Execution breakpoints are looked up via a small hash table, indexed by
+ *  the low bits of the address. Entries are the breakpoint index plus one,
+ *  so that 0 means an empty bucket. Only the low 32 bits of the address
+ *  are used for hashing, so that 32-bit emulation modes (which compare
+ *  truncated addresses) hash to the same bucket.
+ */
+#define	BREAKPOINTS_HASH_SIZE		256
+#define	BREAKPOINTS_HASH(addr)		((((uint32_t)(addr) >> 1) ^ \
+					  ((uint32_t)(addr) >> 9)) & \
+					 (BREAKPOINTS_HASH_SIZE - 1))
+
 struct breakpoints {
 	size_t				n_addr_bp;
 	struct address_breakpoint	*addr_bp;
+	size_t				addr_bp_hash[BREAKPOINTS_HASH_SIZE];
+
+	size_t				n_watchpoints;
+	struct data_watchpoint		*watchpoints;
 };
 
 
+struct cpu;
 struct machine;
 
 void breakpoints_show(struct machine *, size_t i);
@@ -59,6 +94,17 @@ void breakpoints_parse_all(struct machine *);
 bool breakpoints_add_without_lookup(struct machine *, const char *);
 bool breakpoints_add(struct machine *, const char *string);
 void breakpoints_delete(struct machine *machine, size_t i);
+void breakpoints_delete_temporary(struct machine *machine);
+
+void watchpoints_show(struct machine *, size_t i);
+void watchpoints_show_all(struct machine *);
+bool watchpoints_add(struct machine *, const char *string, uint64_t len,
+	int flags);
+void watchpoints_delete(struct machine *machine, size_t i);
+int watchpoints_page_flags(struct machine *, uint64_t vaddr_page,
+	uint64_t pagesize, bool is_32bit);
+void watchpoints_check(struct cpu *, uint64_t vaddr, size_t len,
+	int writeflag);
 
 
 #endif	/*  BREAKPOINTS_H  */
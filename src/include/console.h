@@ -61,6 +61,7 @@ int console_change_inputability(int handle, int inputability);
 void console_init_main(struct emul *);
 void console_debug_dump(struct machine *);
 void console_allow_slaves(int);
+int console_allow_sockets(const char *spec);
 
 void console_init(void);
 void console_deinit(void);
@@ -339,16 +339,57 @@ struct cpu_family {
  *  A check, which should be performed after e.g. device memory accesses, or
  *  after anything that could trigger a breakpoint (debugmsg output). It breaks
  *  out of the dyntrans loop quickly.
+ *
+ *  The current instruction is not counted. The break flag may already have
+ *  been set (e.g. by a watchpoint hit during the access), and the count may
+ *  be 0 early in a block, so the decrement is done below the flag.
  */
+#define	N_BREAK_OUT_UNCOUNTED(cpu)	\
+	(cpu)->n_translated_instrs = ((cpu)->n_translated_instrs & \
+	    ~N_BREAK_OUT_OF_DYNTRANS_LOOP) + N_BREAK_OUT_OF_DYNTRANS_LOOP - 1
 #define	BREAK_DYNTRANS_CHECK(cpu)	{if (!(cpu)->running || about_to_enter_single_step) {	\
 	SYNCH_PC; \
-	(cpu)->n_translated_instrs --; \
-	(cpu)->n_translated_instrs |= N_BREAK_OUT_OF_DYNTRANS_LOOP; \
+	N_BREAK_OUT_UNCOUNTED(cpu); \
 	cpu->cd.DYNTRANS_ARCH.next_ic = &nothing_call; return; }}
 
 // Max nr of instructions to translated in advance.
 #define	MAX_DYNTRANS_READAHEAD		128
 
+/*
+ *  Automatically detected idle loops (see DYNTRANS_IDLE_LOOP in
+ *  cpu_dyntrans.c):  Short loops that only read registers or memory are
+ *  recognized when they are translated. Once such a loop has spun
+ *  IDLE_LOOP_MIN_ITERATIONS times in a row, the CPU is considered to be idle.
+ */
+#define	N_IDLE_LOOPS			64
+#define	IDLE_LOOP_MAX_INSTRS		8
+#define	IDLE_LOOP_MIN_ITERATIONS	128
+
+/*  Registers read and written by one instruction in a loop, as host
+    pointers. (Condition flags count as a register.)  */
+#define	IDLE_LOOP_MAX_READS		4
+#define	IDLE_LOOP_MAX_WRITES		2
+struct idle_loop_regs {
+	int		n_reads;
+	int		n_writes;
+	size_t		reads[IDLE_LOOP_MAX_READS];
+	size_t		writes[IDLE_LOOP_MAX_WRITES];
+};
+
+struct idle_loop {
+	void		*ic;		/*  the loop's branch; NULL if unused  */
+	void		*target_ic;	/*  the loop's first instruction  */
+	void		(*f)(struct cpu *, void *);	/*  original branch  */
+
+	uint64_t	pc;		/*  address of the loop's first instr.  */
+	int		n_instrs;
+	int		iterations;	/*  consecutive iterations so far  */
+
+	/*  Statistics:  */
+	uint64_t	n_iterations;
+	uint64_t	n_idle;
+};
+
 #define	DEFAULT_DYNTRANS_CACHE_SIZE	(96*1048576)
 #define	DYNTRANS_CACHE_MARGIN		200000
 
@@ -442,6 +483,16 @@ struct cpu {
 	bool		is_halted;
 	bool		has_been_idling;
 
+	/*  Automatically detected idle loops, hashed on the branch's ic:  */
+	struct idle_loop idle_loops[N_IDLE_LOOPS];
+
+	/*
+	 *  Number of single-steps still to be executed before the debugger
+	 *  interacts with the user again ("step n"). While this is non-zero,
+	 *  run_instr executes instructions without disassembling them.
+	 */
+	int64_t		step_budget;
+
 	/*
 	 *  Dynamic translation:
 	 *
@@ -511,6 +562,7 @@ void cpu_functioncall_trace_return(struct cpu *);
 
 void cpu_create_or_reset_tc(struct cpu *);
 void cpu_break_out_of_dyntrans_loop(struct cpu *);
+void cpu_show_idle_loops(struct cpu *);
 
 void cpu_run_init(struct machine *machine);
 
@@ -83,6 +83,21 @@ struct arm_cpu_type_def {
 #define	ARM_ADDR_TO_PAGENR(a)		((a) >> (ARM_IC_ENTRIES_SHIFT \
 					+ ARM_INSTR_ALIGNMENT_SHIFT))
 
+/*
+ *  Thumb code is translated in half pages, one instruction call per 16-bit
+ *  halfword, using the same translation page struct as ARM code. The Thumb
+ *  pages of a physical page are linked from the (otherwise unused) last
+ *  instruction call of the page's ARM translation page: arg[0] and arg[1]
+ *  point to the Thumb pages for the lower and upper half. In a Thumb page,
+ *  arg[0] of the same entry points back to the ARM page.
+ */
+#define	ARM_THUMB_INSTR_ALIGNMENT_SHIFT	1
+#define	ARM_THUMB_PAGESIZE		(ARM_IC_ENTRIES_PER_PAGE << \
+					ARM_THUMB_INSTR_ALIGNMENT_SHIFT)
+#define	ARM_THUMB_PC_TO_IC_ENTRY(a)	(((a)>>ARM_THUMB_INSTR_ALIGNMENT_SHIFT) \
+					& (ARM_IC_ENTRIES_PER_PAGE-1))
+#define	ARM_THUMB_PAGE_LINK		(ARM_IC_ENTRIES_PER_PAGE + 1)
+
 #define	ARM_F_N		8	/*  Same as ARM_FLAG_*, but        */
 #define	ARM_F_Z		4	/*  for the 'flags' field instead  */
 #define	ARM_F_C		2	/*  of cpsr.                       */
@@ -162,7 +177,6 @@ struct arm_cpu {
 	uint32_t		und_r13_r14[2];
 
 	uint32_t		tmp_pc;		/*  Used for load/stores  */
-	uint32_t		tmp_branch;	/*  Set by THUMB branch prefix instruction  */
 
 	/*
 	 *  Flag/status registers:
@@ -247,6 +261,7 @@ struct arm_cpu {
 	DYNTRANS_ITC(arm)
 	VPH_TLBS(arm,ARM)
 	VPH32_16BITVPHENTRIES(arm,ARM)
+	struct arm_tc_physpage		*thumb_physpage_template;
 
 	/*  ARM specific: */
 	uint32_t			is_userpage[N_VPH32_ENTRIES/32];
@@ -301,7 +316,6 @@ void arm_translation_table_set_l1(struct cpu *cpu, uint32_t vaddr,
 void arm_translation_table_set_l1_b(struct cpu *cpu, uint32_t vaddr,
 	uint32_t paddr);
 void arm_exception(struct cpu *, int);
-int arm_cpu_interpret_thumb_SLOW(struct cpu*);
 int arm_run_instr(struct cpu *cpu);
 void arm_update_translation_table(struct cpu *cpu, uint64_t vaddr_page,
 	unsigned char *host_page, int writeflag, uint64_t paddr_page);
@@ -324,6 +338,7 @@ void arm_coproc_xscale_14(struct cpu *cpu, int opcode1, int opcode2, int l_bit,
 /*  cpu_arm_instr.c:  */
 void arm_push(struct cpu* cpu, uint32_t* np, int p_bit, int u_bit, int s_bit, int w_bit, uint16_t regs);
 void arm_pop(struct cpu* cpu, uint32_t* np, int p_bit, int u_bit, int s_bit, int w_bit, uint32_t iw);
+void arm_thumb_pc_to_pointers(struct cpu *);
 
 /*  memory_arm.c:  */
 int arm_translate_v2p(struct cpu *cpu, uint64_t vaddr,
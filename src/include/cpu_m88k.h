@@ -218,12 +218,36 @@ DYNTRANS_MISC_DECLARATIONS(m88k,M88K,uint32_t)
 #define	N_M88200_PATC_ENTRIES		56
 #define	M8820X_PATC_SUPERVISOR_BIT	0x00000001
 
+#define	M8820X_PATC_HASH_SIZE		64
+#define	M8820X_PATC_HASH(vaddr)		(((vaddr) >> 12) & (M8820X_PATC_HASH_SIZE - 1))
+#define	M8820X_BATC_INDEX_SIZE		8192	/*  top 13 bits  */
+
 struct m8820x_cmmu {
 	uint32_t	reg[M8820X_LENGTH / sizeof(uint32_t)];
 	uint32_t	batc[N_M88200_BATC_REGS];
 	uint32_t	patc_v_and_control[N_M88200_PATC_ENTRIES];
 	uint32_t	patc_p_and_supervisorbit[N_M88200_PATC_ENTRIES];
 	int		patc_update_index;
+
+	/*
+	 *  Lookup indices (used by m88k_translate_v2p). Entry numbers are
+	 *  stored plus one, so that 0 (as in a zeroed struct) means "none".
+	 *
+	 *  The PATC index chains all valid PATC entries, hashed on the
+	 *  virtual page number. The BATC index maps the top 13 bits of a
+	 *  virtual address to the first matching valid BATC entry, for user
+	 *  [0] and supervisor [1] mode. It is rebuilt on the next lookup
+	 *  whenever batc_index_valid is cleared.
+	 */
+	uint8_t		patc_hash[M8820X_PATC_HASH_SIZE];
+	uint8_t		patc_hash_next[N_M88200_PATC_ENTRIES];
+	bool		batc_index_valid;
+	uint8_t		batc_index[2][M8820X_BATC_INDEX_SIZE];
+
+	/*  Statistics (shown by tlbdump):  */
+	uint64_t	n_batc_hits;
+	uint64_t	n_patc_hits;
+	uint64_t	n_table_walks;
 };
 
 
@@ -294,6 +318,7 @@ void m88k_exception(struct cpu *cpu, int vector, int is_trap);
 /*  memory_m88k.c:  */
 int m88k_translate_v2p(struct cpu *cpu, uint64_t vaddr,
 	uint64_t *return_addr, int flags);
+void m8820x_patc_unlink(struct m8820x_cmmu *cmmu, int i);
 
 
 #endif	/*  CPU_M88K_H  */
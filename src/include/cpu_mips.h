@@ -92,6 +92,10 @@ struct mips_tlb {
 #define	MIPS_FPU_FCIR			0
 #define	MIPS_FPU_FCCR			25
 #define	MIPS_FPU_FCSR			31
+#define	   MIPS_FCSR_RM_MASK		   0x00000003
+#define	   MIPS_FCSR_FLAGS_SHIFT	   2
+#define	   MIPS_FCSR_ENABLES_SHIFT	   7
+#define	   MIPS_FCSR_CAUSE_SHIFT	   12
 #define	   MIPS_FCSR_FCC0_SHIFT		   23
 #define	   MIPS_FCSR_FCC1_SHIFT		   25
 
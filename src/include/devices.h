@@ -50,6 +50,7 @@
 #include "interrupt.h"
 
 struct cpu;
+struct fb_window;
 struct machine;
 struct memory;
 struct pci_data;
@@ -226,7 +227,7 @@ struct vfb_data {
 	char		*name;
 	char		title[100];
 
-	void (*redraw_func)(struct vfb_data *, int, int);
+	void (*redraw_func)(struct vfb_data *, int, int, int, int);
 
 	/*  These should always be in sync:  */
 	unsigned char	*framebuffer;
@@ -244,6 +245,7 @@ void framebuffer_blockcopyfill(struct vfb_data *d, int fillflag, int fill_r,
 	int fill_g, int fill_b, int x1, int y1, int x2, int y2,
 	int from_x, int from_y);
 void dev_fb_tick(struct cpu *, void *);
+void dev_fb_update_windows(struct machine *, struct fb_window *);
 int dev_fb_access(struct cpu *cpu, struct memory *mem, uint64_t relative_addr,
 	unsigned char *data, size_t len, int writeflag, void *);
 struct vfb_data *dev_fb_init(struct machine *machine, struct memory *mem,
@@ -46,6 +46,24 @@
 #define	DISKIMAGE_TYPES		{ "(NONE)", "SCSI", "IDE", "FLOPPY" }
 
 
+/*  How the host file of a disk image is accessed:  */
+#define	DISKIMAGE_IO_STDIO	0	/*  fseek/fread/fwrite (tapes)  */
+#define	DISKIMAGE_IO_PREAD	1	/*  pread/pwrite (the default)  */
+#define	DISKIMAGE_IO_MMAP	2	/*  mmap, read-only images only  */
+#define	DISKIMAGE_IO_COW	3	/*  copy-on-write image, diskimage_cow.c  */
+#define	DISKIMAGE_IO_COMPRESSED	4	/*  read-only, diskimage_compressed.c  */
+
+
+/*
+ *  Default size of the block cache, and the size of each cached line. The
+ *  cache is off unless the kSIZE; prefix is used: with the host's page cache
+ *  warm, random sector reads are several times slower through 64 KB lines
+ *  than with plain pread (see experiments/disk_bench.c).
+ */
+#define	DISKIMAGE_DEFAULT_CACHE_SIZE	0
+#define	DISKIMAGE_CACHE_LINE_SIZE	65536
+
+
 /*  512 bytes per overlay block. Don't change this.  */
 #define	OVERLAY_BLOCK_SIZE	512
 
@@ -53,6 +71,13 @@ struct diskimage_overlay {
 	char		*overlay_basename;
 	FILE		*f_data;
 	FILE		*f_bitmap;
+
+	/*  In-memory copy of the bitmap file, and its unwritten range
+	    (dirty_start <= byte offset < dirty_end):  */
+	unsigned char	*bitmap;
+	size_t		bitmap_len;
+	size_t		dirty_start;
+	size_t		dirty_end;
 };
 
 struct diskimage {
@@ -64,6 +89,25 @@ struct diskimage {
 	char		*fname;
 	FILE		*f;
 
+	/*  DISKIMAGE_IO_*, and the mapping when using DISKIMAGE_IO_MMAP:  */
+	int		io_method;
+	unsigned char	*mmap_base;
+	size_t		mmap_len;
+
+	/*  Copy-on-write image, when using DISKIMAGE_IO_COW:  */
+	struct diskimage_cow *cow;
+
+	/*  Compressed image, when using DISKIMAGE_IO_COMPRESSED:  */
+	struct diskimage_compressed *compressed;
+
+	/*  Block cache (NULL if disabled):  */
+	struct diskimage_cache *cache;
+
+	/*  Asynchronous requests that have not completed yet, and whether
+	    a worker thread is currently serving this disk image:  */
+	int		async_pending;
+	bool		async_busy;
+
 	/*  Overlays:  */
 	int		nr_of_overlays;
 	struct diskimage_overlay *overlays;
@@ -92,6 +136,34 @@ struct diskimage {
 };
 
 
+/*
+ *  Asynchronous disk request: either a read or write, or (if xferp is
+ *  non-NULL) a whole SCSI command. Requests to the same disk image are
+ *  carried out in the order they were submitted. The buffer (or the SCSI
+ *  transfer) must stay untouched until the request has completed.
+ */
+struct diskimage_request {
+	struct diskimage_request *next;
+
+	struct diskimage	*d;
+	int			writeflag;
+	off_t			offset;
+	unsigned char		*buf;
+	size_t			len;
+
+	/*  SCSI command:  */
+	struct cpu		*cpu;
+	int			scsi_id;
+	int			scsi_type;
+	struct scsi_transfer	*xferp;
+
+	/*  Set when the request has completed:  */
+	bool			done;
+	int			result;		/*  As diskimage_access(), or
+						    diskimage_scsicommand()  */
+};
+
+
 /*  Transfer command, sent from a SCSI controller device to a disk:  */
 struct scsi_transfer {
 	struct scsi_transfer	*next_free;
@@ -119,6 +191,9 @@ struct scsi_transfer {
 
 
 struct machine;
+struct diskimage_cache;
+struct diskimage_compressed;
+struct diskimage_cow;
 
 
 /*  diskimage_scsicmd.c:  */
@@ -126,11 +201,15 @@ struct scsi_transfer *scsi_transfer_alloc(void);
 void scsi_transfer_free(struct scsi_transfer *);
 void scsi_transfer_allocbuf(size_t *lenp, unsigned char **pp,
 	size_t want_len, int clearflag);
+int diskimage__scsicommand(struct cpu *cpu, int id, int type,
+	struct scsi_transfer *, bool drain);
 int diskimage_scsicommand(struct cpu *cpu, int id, int type,
 	struct scsi_transfer *);
 
 
 /*  diskimage.c:  */
+size_t diskimage_pread(int fd, unsigned char *buf, size_t len, off_t offset);
+size_t diskimage_pwrite(int fd, unsigned char *buf, size_t len, off_t offset);
 int64_t diskimage_getsize(struct machine *machine, int id, int type);
 int64_t diskimage_get_baseoffset(struct machine *machine, int id, int type);
 void diskimage_set_baseoffset(struct machine *machine, int id, int type, int64_t offset);
@@ -140,17 +219,74 @@ int diskimage__internal_access(struct diskimage *d, int writeflag,
 	off_t offset, unsigned char *buf, size_t len);
 int diskimage_access(struct machine *machine, int id, int type, int writeflag,
 	off_t offset, unsigned char *buf, size_t len);
+struct diskimage *diskimage_find(struct machine *machine, int id, int type);
 bool diskimage_add_overlay(struct diskimage *d, char *overlay_basename,
 	bool remove_after_open);
+void diskimage_flush(struct diskimage *d);
 bool diskimage_recalc_size(struct diskimage *d);
 int diskimage_exist(struct machine *machine, int id, int type);
 int diskimage_bootdev(struct machine *machine, int *typep);
 int diskimage_add(struct machine *machine, char *fname);
+void diskimage_close_all(struct machine *machine);
 int diskimage_getname(struct machine *machine, int id, int type,
 	char *buf, size_t bufsize);
 int diskimage_is_a_cdrom(struct machine *machine, int id, int type);
 int diskimage_is_a_tape(struct machine *machine, int id, int type);
 void diskimage_dump_info(struct machine *machine);
+void diskimage_dump_cache_stats(struct machine *machine);
+
+
+/*  diskimage_async.c:  */
+struct diskimage_request *diskimage_async_submit(struct machine *machine,
+	int id, int type, int writeflag, off_t offset, unsigned char *buf,
+	size_t len);
+struct diskimage_request *diskimage_async_scsicommand(struct cpu *cpu,
+	int id, int type, struct scsi_transfer *xferp);
+bool diskimage_async_poll(struct diskimage_request *r);
+int diskimage_async_wait(struct diskimage_request *r);
+void diskimage_async_free(struct diskimage_request *r);
+void diskimage_async_drain(struct diskimage *d);
+
+
+/*  diskimage_cache.c:  */
+typedef size_t (*diskimage_cache_fill_fn)(struct diskimage *d, off_t offset,
+	unsigned char *buf, size_t len);
+struct diskimage_cache *diskimage_cache_new(size_t size);
+void diskimage_cache_free(struct diskimage_cache *c);
+size_t diskimage_cache_read(struct diskimage_cache *c, struct diskimage *d,
+	off_t offset, unsigned char *buf, size_t len,
+	diskimage_cache_fill_fn fill);
+void diskimage_cache_write(struct diskimage_cache *c, off_t offset,
+	const unsigned char *buf, size_t len);
+void diskimage_cache_invalidate(struct diskimage_cache *c);
+void diskimage_cache_show(struct diskimage_cache *c);
+
+
+/*  diskimage_compressed.c:  */
+bool diskimage_compressed_probe(const char *fname);
+struct diskimage_compressed *diskimage_compressed_open(const char *fname);
+void diskimage_compressed_close(struct diskimage_compressed *c);
+uint64_t diskimage_compressed_size(struct diskimage_compressed *c);
+size_t diskimage_compressed_read(struct diskimage_compressed *c,
+	uint64_t offset, unsigned char *buf, size_t len);
+
+
+/*  diskimage_cow.c:  */
+bool diskimage_cow_probe(const char *fname);
+struct diskimage_cow *diskimage_cow_open(const char *fname, bool writable);
+bool diskimage_cow_create(const char *fname, const char *base_name,
+	uint64_t size);
+void diskimage_cow_close(struct diskimage_cow *c);
+uint64_t diskimage_cow_size(struct diskimage_cow *c);
+size_t diskimage_cow_read(struct diskimage_cow *c, uint64_t offset,
+	unsigned char *buf, size_t len);
+size_t diskimage_cow_write(struct diskimage_cow *c, uint64_t offset,
+	unsigned char *buf, size_t len);
+void diskimage_cow_flush(struct diskimage_cow *c);
+bool diskimage_cow_snapshot_create(struct diskimage_cow *c, const char *name);
+bool diskimage_cow_snapshot_revert(struct diskimage_cow *c, const char *name);
+bool diskimage_cow_snapshot_delete(struct diskimage_cow *c, const char *name);
+void diskimage_cow_show(struct diskimage_cow *c);
 
 
 /*
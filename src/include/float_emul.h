@@ -45,7 +45,25 @@ struct ieee_float_value {
 #define	IEEE_FMT_W		3	/*  word, 32-bit integer  */
 #define	IEEE_FMT_L		4	/*  long, 64-bit integer  */
 
+/*  Rounding modes, for strict mode:  */
+#define	IEEE_ROUND_NEAREST	0
+#define	IEEE_ROUND_ZERO		1
+#define	IEEE_ROUND_UP		2	/*  towards +infinity  */
+#define	IEEE_ROUND_DOWN		3	/*  towards -infinity  */
+
+/*  Exception flags, for strict mode:  */
+#define	IEEE_EXC_INEXACT	0x01
+#define	IEEE_EXC_UNDERFLOW	0x02
+#define	IEEE_EXC_OVERFLOW	0x04
+#define	IEEE_EXC_DIVBYZERO	0x08
+#define	IEEE_EXC_INVALID	0x10
+
+extern bool ieee_strict;
+
 void ieee_interpret_float_value(uint64_t x, struct ieee_float_value *fvp, int fmt);
 uint64_t ieee_store_float_value(double nf, int fmt);
+void ieee_strict_begin(int rounding_mode);
+void ieee_strict_raise(int exceptions);
+int ieee_strict_end(void);
 
 #endif	/*  FLOAT_EMUL_H  */
@@ -0,0 +1,97 @@
+#ifndef	GUEST_ROUTINES_H
+#define	GUEST_ROUTINES_H
+
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Accelerated guest routines (memcpy, memset, strlen, ...), see
+ *  src/core/guest_routines.c.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "misc.h"
+
+struct cpu;
+struct machine;
+
+#define	GUEST_ROUTINE_MEMCPY		0	/*  memcpy(dst, src, len)  */
+#define	GUEST_ROUTINE_MEMMOVE		1	/*  memmove(dst, src, len)  */
+#define	GUEST_ROUTINE_BCOPY		2	/*  bcopy(src, dst, len)  */
+#define	GUEST_ROUTINE_MEMSET		3	/*  memset(dst, c, len)  */
+#define	GUEST_ROUTINE_BZERO		4	/*  bzero(dst, len)  */
+#define	GUEST_ROUTINE_STRLEN		5	/*  strlen(s)  */
+#define	N_GUEST_ROUTINE_KINDS		6
+
+#define	GUEST_ROUTINE_KIND_NAMES	{ "memcpy", "memmove", "bcopy", \
+					  "memset", "bzero", "strlen" }
+
+/*  Longer operations are left to the guest's own code.  */
+#define	GUEST_ROUTINE_MAX_LEN		(16 * 1048576)
+
+struct guest_routine {
+	char		*symbol;
+	int		kind;		/*  GUEST_ROUTINE_*  */
+	bool		optional;	/*  Silently ignored if not found.  */
+
+	bool		resolved;
+	uint64_t	addr;
+
+	/*  The translated entry instruction, used as fallback:  */
+	void		(*f)(struct cpu *, void *);
+
+	/*  Statistics:  */
+	uint64_t	n_calls;
+	uint64_t	n_fallbacks;
+	uint64_t	n_bytes;
+
+	/*  Next routine in the same hash chain, plus one (0 = none).  */
+	size_t		next_in_hash;
+};
+
+/*  Same hashing as for breakpoints:  */
+#define	GUEST_ROUTINES_HASH_SIZE	64
+#define	GUEST_ROUTINES_HASH(addr)	((((uint32_t)(addr) >> 1) ^ \
+					  ((uint32_t)(addr) >> 9)) & \
+					 (GUEST_ROUTINES_HASH_SIZE - 1))
+
+struct guest_routines {
+	size_t			n_routines;
+	struct guest_routine	*routines;
+	size_t			hash[GUEST_ROUTINES_HASH_SIZE];
+};
+
+
+struct guest_routine *guest_routines_lookup(struct machine *, uint64_t addr,
+	bool is_32bit);
+bool guest_routines_add_without_lookup(struct machine *, const char *spec);
+void guest_routines_parse_all(struct machine *);
+void guest_routines_show_all(struct machine *);
+
+#endif	/*  GUEST_ROUTINES_H  */
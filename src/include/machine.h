@@ -32,6 +32,7 @@
 #include <sys/types.h>
 
 #include "breakpoints.h"
+#include "guest_routines.h"
 #include "symbol.h"
 
 struct cpu_family;
@@ -80,6 +81,11 @@ struct x11_md {
 	char	**display_names;
 	int	current_display_name_nr;	/*  updated by x11.c  */
 
+	/*  Headless framebuffers (-g), and VNC servers for them (-w):  */
+	bool	headless;
+	char	*snapshot_prefix;
+	int	vnc_port;			/*  0 = no VNC server  */
+
 	int	n_fb_windows;
 	struct fb_window **fb_windows;
 };
@@ -147,11 +153,13 @@ struct machine {
 	char	*bootarg;
 
 	struct breakpoints breakpoints;
+	struct guest_routines guest_routines;
 
 	int	instruction_trace;
 	int	show_trace_tree;
 	int	emulated_hz;
 	int	allow_instruction_combinations;
+	int	idle_loop_detection;
 	int	force_netboot;
 	uint64_t file_loaded_end_addr;
 	char	*boot_kernel_filename;
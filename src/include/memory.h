@@ -60,8 +60,22 @@ struct memory_device {
 
 	unsigned char	*dyntrans_data;
 
-	uint64_t	dyntrans_write_low;
-	uint64_t	dyntrans_write_high;
+	/*
+	 *  Pages of a DM_DYNTRANS_WRITE_OK device which may have been written
+	 *  to via dyntrans since the device last asked (one bit per
+	 *  DYNTRANS_DIRTY_PAGE_SIZE bytes). See memory_device_dyntrans_dirty().
+	 */
+	uint64_t	*dyntrans_dirty;
+	uint64_t	n_dyntrans_dirty;
+};
+
+#define	DYNTRANS_DIRTY_PAGE_SHIFT	12
+#define	DYNTRANS_DIRTY_PAGE_SIZE	(1 << DYNTRANS_DIRTY_PAGE_SHIFT)
+
+/*  A range of dirty device memory, relative to the device's base address:  */
+struct memory_dirty_range {
+	uint64_t	low;
+	uint64_t	high;		/*  the last dirty byte  */
 };
 
 
@@ -143,8 +157,10 @@ unsigned char *memory_paddr_to_hostaddr(struct memory *mem,
 #define	MEMORY_ACCESS_OK_WRITE		2
 #define	MEMORY_NOT_FULL_PAGE		256
 
-void memory_device_dyntrans_access(struct cpu *, struct memory *mem,
-	void *extra, uint64_t *low, uint64_t *high);
+void memory_device_dyntrans_mark_dirty(struct memory_device *dev,
+	uint64_t offset, uint64_t len);
+int memory_device_dyntrans_dirty(struct cpu *, struct memory *mem,
+	void *extra, struct memory_dirty_range *ranges, int max_ranges);
 
 #define DEVICE_ACCESS(x)	int dev_ ## x ## _access(struct cpu *cpu, \
 	struct memory *mem, uint64_t relative_addr, unsigned char *data,  \
@@ -37,7 +37,8 @@
 #include <netdb.h>
 
 struct emul;
-struct ethernet_packet_link;
+struct net_packet;
+struct net_packet_queue;
 struct remote_net;
 
 
@@ -90,12 +91,15 @@ struct tcp_connection {
 	unsigned char	inside_ip_address[4];
 	int		inside_tcp_port;
 	uint32_t	inside_timestamp;
+	int		inside_window;	/*  in bytes  */
+	int		inside_window_shift;
 
-	/*  TODO:  tx and rx buffers?  */
+	/*  Data from the outside which the guest has not acked yet:  */
 	unsigned char	*incoming_buf;
 	int		incoming_buf_rounds;
 	int		incoming_buf_len;
 	uint32_t	incoming_buf_seqnr;
+	int		outside_eof;	/*  FIN once the buffer is acked  */
 
 	uint32_t	inside_seqnr;
 	uint32_t	inside_acknr;
@@ -119,12 +123,16 @@ struct nic_data {
 	struct net	*net;		/* net we belong to */
 	uint8_t		mac_address[6];	/* our MAC address */
 	int		promiscuous_mode;/* receive all packets */
+	struct net_packet_queue *queue;	/* incoming packets */
 };
 
 /*****************************************************************************/
 
-#define	MAX_TCP_CONNECTIONS	100
-#define	MAX_UDP_CONNECTIONS	100
+/*  The connection tables grow on demand, up to these limits:  */
+#define	INITIAL_TCP_CONNECTIONS	16
+#define	INITIAL_UDP_CONNECTIONS	16
+#define	MAX_TCP_CONNECTIONS	4096
+#define	MAX_UDP_CONNECTIONS	4096
 
 struct net {
 	/*  The emul struct which this net belong to:  */
@@ -152,11 +160,19 @@ struct net {
 
 	int64_t		timestamp;
 
-	struct ethernet_packet_link *first_ethernet_packet;
-	struct ethernet_packet_link *last_ethernet_packet;
+	/*  Free packet buffers (see net_packet.c):  */
+	struct net_packet *free_packets;
+	int		n_packet_buffers;
+	uint64_t	n_packet_allocs;
+	uint64_t	n_packet_pool_misses;
 
-	struct udp_connection udp_connections[MAX_UDP_CONNECTIONS];
-	struct tcp_connection tcp_connections[MAX_TCP_CONNECTIONS];
+	int		n_udp_connections;
+	struct udp_connection *udp_connections;
+	int		n_tcp_connections;
+	struct tcp_connection *tcp_connections;
+
+	/*  Readiness notification for the gateway's sockets, or -1:  */
+	int		epoll_fd;
 
 	/*  Distributed network:  */
 	int		local_port;
@@ -193,15 +209,25 @@ void net_ip_broadcast(struct net *net, struct nic_data *nic,
         unsigned char *packet, int len);
 void net_ip(struct net *net, struct nic_data *nic, unsigned char *packet,
 	int len);
-void net_udp_rx_avail(struct net *net, struct nic_data *nic);
-void net_tcp_rx_avail(struct net *net, struct nic_data *nic);
+void net_ip_rx_avail(struct net *net, struct nic_data *nic);
+
+/*  net_packet.c:  */
+struct net_packet *net_packet_alloc(struct net *net, size_t len);
+void net_packet_free(struct net *net, struct net_packet *p);
+void net_packet_enqueue(struct net *net, struct nic_data *nic,
+	struct net_packet *p);
+struct net_packet *net_packet_dequeue(struct nic_data *nic);
+bool net_packet_queue_empty(struct nic_data *nic);
+int net_packet_queue_space(struct nic_data *nic);
+void net_packet_queue_init(struct nic_data *nic);
+void net_packet_dumpinfo(struct net *net);
 
 /*  net.c:  */
-struct ethernet_packet_link *net_allocate_ethernet_packet_link(
-	struct net *net, struct nic_data *nic, size_t len);
 int net_ethernet_rx_avail(struct net *net, struct nic_data *nic);
 int net_ethernet_rx(struct net *net, struct nic_data *nic,
 	unsigned char **packetp, int *lenp);
+int net_ethernet_rx_copy(struct net *net, struct nic_data *nic,
+	unsigned char *buf, int maxlen, int *lenp);
 void net_ethernet_tx(struct net *net, struct nic_data *nic,
 	unsigned char *packet, int len);
 void net_dumpinfo(struct net *net);
@@ -216,15 +242,33 @@ struct net *net_init(struct emul *emul, int init_flags,
 
 
 /*
- *  This is for internal use in src/net.c:
+ *  This is for internal use in src/net/:
+ *
+ *  Packets are allocated from a pool of NET_PACKET_BUF_SIZE-byte buffers.
+ *  (Larger packets, e.g. from a tap device with a large MTU, are allocated
+ *  separately.) Each NIC has a ring queue of incoming packets, which holds
+ *  at most NET_PACKET_QUEUE_LEN - 1 packets; packets arriving when the
+ *  queue is full are dropped.
  */
-struct ethernet_packet_link {
-	struct ethernet_packet_link *prev;
-	struct ethernet_packet_link *next;
+#define	NET_PACKET_BUF_SIZE	2048
+#define	NET_PACKET_QUEUE_LEN	512	/*  must be a power of two  */
 
-	struct nic_data	*nic;
-	unsigned char	*data;
+struct net_packet {
+	struct net_packet *next_free;
+	size_t		buf_size;
 	int		len;
+	unsigned char	*data;
+};
+
+struct net_packet_queue {
+	struct net_packet *slot[NET_PACKET_QUEUE_LEN];
+	unsigned int	head;		/*  only written by the consumer  */
+	unsigned int	tail;		/*  only written by the producer  */
+
+	/*  Statistics:  */
+	uint64_t	n_enqueued;
+	uint64_t	n_dropped;
+	unsigned int	max_depth;
 };
 
 struct remote_net {
@@ -240,7 +284,8 @@ struct remote_net {
 #define	TCP_OUTSIDE_DISCONNECTED	3
 #define	TCP_OUTSIDE_DISCONNECTED2	4
 
-#define	TCP_INCOMING_BUF_LEN	2000
+#define	TCP_INCOMING_BUF_LEN	65536
+#define	TCP_SEGMENT_LEN		1400
 
 #define	NET_ADDR_IPV4		1
 #define	NET_ADDR_IPV6		2
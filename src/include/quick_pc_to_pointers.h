@@ -16,17 +16,16 @@
 		DYNTRANS_PC_TO_POINTERS(cpu);				\
 }
 
+#else
+#define quick_pc_to_pointers(cpu)	DYNTRANS_PC_TO_POINTERS(cpu)
+#endif
+
 #ifndef quick_pc_to_pointers_arm
 #define	quick_pc_to_pointers_arm(cpu) {					\
 	if (cpu->cd.arm.cpsr & ARM_FLAG_T) {				\
-		cpu->cd.arm.next_ic = &nothing_call;			\
+		arm_thumb_pc_to_pointers(cpu);				\
 	} else								\
 		quick_pc_to_pointers(cpu);				\
 }
 #endif
 
-#else
-#define quick_pc_to_pointers(cpu)	DYNTRANS_PC_TO_POINTERS(cpu)
-#endif
-
-
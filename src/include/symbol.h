@@ -35,22 +35,49 @@
 
 /*  This should actually only be used within symbol.c:  */
 struct symbol {
-	struct symbol	*next;
 	uint64_t	addr;
 	uint64_t	len;
-	char		*name;
+	const char	*name;		/*  Raw name, in the string pool.  */
+	char		*demangled;	/*  NULL until first displayed.  */
 	int		type;
+	int		len_computed;	/*  len was 0, and is recalculated.  */
 
 	int		n_args;
 	/*  TODO: argument types  */
+
+	/*  Next symbol in the same name hash chain, plus one (0 = none).  */
+	int		next_in_hash;
+};
+
+/*  Interned symbol name strings are allocated from chunks like this:  */
+#define	SYMBOL_STRPOOL_CHUNKSIZE	65536
+struct symbol_strpool {
+	struct symbol_strpool	*next;
+	size_t			used;
+	char			data[SYMBOL_STRPOOL_CHUNKSIZE];
 };
 
 
 struct symbol_context {
-	struct symbol	*first_symbol;
-	int		sorted_array;
+	/*  All symbols, in one contiguous array:  */
+	struct symbol	*symbols;
 	int		n_symbols;
+	int		max_symbols;
+
+	/*
+	 *  Once symbol_recalc_sizes() has been called, sorted_array is set,
+	 *  and the first n_sorted symbols are sorted by address. Symbols
+	 *  added after that are sorted in the next time an address lookup
+	 *  is done.
+	 */
+	int		sorted_array;
+	int		n_sorted;
+
+	/*  Name lookup: hash table of symbol indices plus one.  */
+	int		*name_hash;
+	int		n_name_hash;
 
+	struct symbol_strpool	*strpool;
 };
 
 /*  symbol.c:  */
@@ -14,6 +14,12 @@
 #define	    DEV_DISK_ID			    0x0010
 #define	    DEV_DISK_START_OPERATION	    0x0020
 #define	    DEV_DISK_STATUS		    0x0030
+#define	    DEV_DISK_DMA_RING		    0x0040
+#define	    DEV_DISK_DMA_RING_HIGH32	    0x0048
+#define	    DEV_DISK_DMA_RING_SIZE	    0x0050
+#define	    DEV_DISK_DMA_HEAD		    0x0060
+#define	    DEV_DISK_DMA_TAIL		    0x0070
+#define	    DEV_DISK_DMA_IRQ		    0x0080
 #define	    DEV_DISK_BUFFER		    0x4000
 
 #define	    DEV_DISK_BUFFER_LEN		0x200
@@ -23,4 +29,51 @@
 #define	DEV_DISK_OPERATION_WRITE	1
 
 
+/*
+ *  DMA mode:
+ *
+ *  The guest sets up a ring of DEV_DISK_DMA_RING_SIZE descriptors in
+ *  physical memory, and writes its physical address to DEV_DISK_DMA_RING
+ *  (and DEV_DISK_DMA_RING_HIGH32). Writing the ring size resets the head and
+ *  tail indices to zero.
+ *
+ *  To queue requests, the guest fills in descriptors starting at the current
+ *  head index, and then writes the index following the last filled in
+ *  descriptor to DEV_DISK_DMA_HEAD. The device carries out the requests in
+ *  the background; as each one finishes, its status word is set and
+ *  DEV_DISK_DMA_TAIL (the index of the first descriptor that has not
+ *  completed yet) moves forward. When the tail has moved, the device's
+ *  interrupt is asserted, and DEV_DISK_DMA_IRQ reads as non-zero. Writing
+ *  to DEV_DISK_DMA_IRQ acknowledges the interrupt.
+ *
+ *  The ring is empty when head == tail, so at most ring size - 1 requests
+ *  can be queued at a time.
+ *
+ *  The data for a write request is fetched from guest memory when the head
+ *  index is written, so a write must not be queued together with an earlier
+ *  read that fills in the same memory. Requests to the same disk reach the
+ *  disk in ring order.
+ *
+ *  Descriptor fields are in the guest's byte order. The offset must be a
+ *  multiple of the sector size.
+ */
+
+#define	DEV_DISK_DMA_MAX_RING_SIZE	256
+#define	DEV_DISK_DMA_MAX_SECTORS	2048
+
+/*  Descriptor layout:  */
+#define	DEV_DISK_DMA_DESC_PADDR		0x00	/*  64-bit: physical address  */
+#define	DEV_DISK_DMA_DESC_OFFSET	0x08	/*  64-bit: offset on disk  */
+#define	DEV_DISK_DMA_DESC_N_SECTORS	0x10	/*  32-bit: nr of sectors  */
+#define	DEV_DISK_DMA_DESC_ID		0x14	/*  32-bit: IDE ID  */
+#define	DEV_DISK_DMA_DESC_OPERATION	0x18	/*  32-bit: read or write  */
+#define	DEV_DISK_DMA_DESC_STATUS	0x1c	/*  32-bit: set by the device  */
+#define	DEV_DISK_DMA_DESC_SIZE		0x20
+
+/*  Descriptor status:  */
+#define	DEV_DISK_DMA_STATUS_PENDING	0
+#define	DEV_DISK_DMA_STATUS_OK		1
+#define	DEV_DISK_DMA_STATUS_ERROR	2
+
+
 #endif	/*  TESTMACHINE_DISK_H  */
@@ -17,6 +17,19 @@
 #define	    DEV_ETHER_PACKETLENGTH	    0x4010
 #define	    DEV_ETHER_COMMAND		    0x4020
 #define	    DEV_ETHER_MAC		    0x4040
+#define	    DEV_ETHER_RING_IRQ		    0x4050
+#define	    DEV_ETHER_COALESCE_PACKETS	    0x4060
+#define	    DEV_ETHER_COALESCE_TICKS	    0x4070
+#define	    DEV_ETHER_RX_RING_BASE	    0x4100
+#define	    DEV_ETHER_TX_RING_BASE	    0x4200
+
+/*  Registers of each ring, relative to DEV_ETHER_xX_RING_BASE:  */
+#define	DEV_ETHER_RING_ADDR		0x00
+#define	DEV_ETHER_RING_ADDR_HIGH32	0x08
+#define	DEV_ETHER_RING_SIZE		0x10
+#define	DEV_ETHER_RING_HEAD		0x20
+#define	DEV_ETHER_RING_TAIL		0x30
+#define	DEV_ETHER_RING_REGS_LEN		0x100
 
 /*  Status bits:  */
 #define	DEV_ETHER_STATUS_PACKET_RECEIVED		1
@@ -27,4 +40,59 @@
 #define	DEV_ETHER_COMMAND_TX		1
 
 
+/*
+ *  Ring mode:
+ *
+ *  Instead of copying packets through the buffer one at a time, the guest
+ *  can set up a receive ring and a transmit ring of descriptors in physical
+ *  memory, each pointing to a packet buffer in physical memory. Each ring
+ *  is set up by writing its physical address (DEV_ETHER_RING_ADDR and
+ *  DEV_ETHER_RING_ADDR_HIGH32) and then its size (DEV_ETHER_RING_SIZE,
+ *  which also resets the head and tail indices to zero).
+ *
+ *  The device owns the descriptors from tail up to (but not including)
+ *  head, and the guest owns the ones from head up to tail, i.e. the device
+ *  has nothing to do when head == tail. The guest hands descriptors to the
+ *  device by writing the index following the last one to
+ *  DEV_ETHER_RING_HEAD; the device hands them back by moving
+ *  DEV_ETHER_RING_TAIL forward.
+ *
+ *  Transmit: The guest fills in the buffer address and packet length of
+ *  each packet to send, and writes the new head index. All the packets are
+ *  sent at once.
+ *
+ *  Receive: The guest fills in the buffer address and buffer size of empty
+ *  buffers, and writes the new head index. As packets arrive, the device
+ *  fills the buffers, and sets the length and status of their descriptors.
+ *  Once the receive ring has been set up, the DEV_ETHER_COMMAND_RX command
+ *  and the PACKET_RECEIVED/MORE_PACKETS_AVAILABLE status bits are not used.
+ *
+ *  Interrupt coalescing: The interrupt is asserted when at least
+ *  DEV_ETHER_COALESCE_PACKETS packets (default 1) have been sent or received
+ *  since the last interrupt, or when at least one has and the device has
+ *  ticked DEV_ETHER_COALESCE_TICKS times (default 1) since then. Reading
+ *  DEV_ETHER_RING_IRQ tells which rings have completed descriptors;
+ *  writing the same bits back acknowledges them.
+ *
+ *  Descriptor fields are in the guest's byte order.
+ */
+
+#define	DEV_ETHER_MAX_RING_SIZE		1024
+
+/*  Descriptor layout:  */
+#define	DEV_ETHER_DESC_PADDR		0x00	/*  64-bit: buffer address  */
+#define	DEV_ETHER_DESC_LENGTH		0x08	/*  32-bit: length  */
+#define	DEV_ETHER_DESC_STATUS		0x0c	/*  32-bit: set by the device  */
+#define	DEV_ETHER_DESC_SIZE		0x10
+
+/*  Descriptor status bits:  */
+#define	DEV_ETHER_DESC_STATUS_DONE	1
+#define	DEV_ETHER_DESC_STATUS_TRUNCATED	2	/*  RX buffer too small  */
+#define	DEV_ETHER_DESC_STATUS_ERROR	4
+
+/*  Ring interrupt status bits:  */
+#define	DEV_ETHER_RING_IRQ_RX		1
+#define	DEV_ETHER_RING_IRQ_TX		2
+
+
 #endif	/*  TESTMACHINE_ETHER_H  */
@@ -38,6 +38,11 @@ struct emul;
 
 #ifdef WITH_X11
 #include <X11/Xlib.h>
+#ifdef WITH_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
 #endif
 
 
@@ -52,22 +57,13 @@ struct fb_window {
 	int		fb_number;
 	char		*name;
 
-#ifdef WITH_X11
 	/*  x11_fb_winxsize > 0 for a valid fb_window  */
 	int		x11_fb_winxsize, x11_fb_winysize;
 	int		scaledown;
-	Display		*x11_display;
 
-	int		x11_screen;
-	int		x11_screen_depth;
-	unsigned long	fg_color;
-	unsigned long	bg_color;
-	XColor		x11_graycolor[N_GRAYCOLORS];
-	Window		x11_fb_window;
-	GC		x11_fb_gc;
-
-	XImage		*fb_ximage;
+	/*  Converted pixels (the XImage's data, or the headless buffer):  */
 	unsigned char	*ximage_data;
+	int		ximage_bytes_per_line;
 
 	/*  -1 means transparent, 0 and up are grayscales  */
 	int		cursor_pixels[CURSOR_MAXY][CURSOR_MAXX];
@@ -82,6 +78,34 @@ struct fb_window {
 	int		OLD_cursor_ysize;
 	int		OLD_cursor_on;
 
+	/*  Headless windows (-g) have no X11 display:  */
+	bool		headless;
+	char		*snapshot_prefix;	/*  NULL = no automatic ones  */
+	bool		headless_changed;
+	int		headless_flushes;
+	int		n_snapshots;
+	uint64_t	snapshot_hash;		/*  of the last snapshot  */
+	struct fb_vnc	*vnc;			/*  NULL without -w  */
+
+#ifdef WITH_X11
+	Display		*x11_display;
+
+	int		x11_screen;
+	int		x11_screen_depth;
+	unsigned long	fg_color;
+	unsigned long	bg_color;
+	XColor		x11_graycolor[N_GRAYCOLORS];
+	Window		x11_fb_window;
+	GC		x11_fb_gc;
+
+	XImage		*fb_ximage;
+#ifdef WITH_XSHM
+	/*  The XImage is in shared memory, if the server supports it:  */
+	bool		use_shm;
+	bool		shm_put_pending;	/*  server may still read it  */
+	XShmSegmentInfo	shminfo;
+#endif
+
 	/*  Host's X11 cursor:  */
 	Cursor		host_cursor;
 	Pixmap		host_cursor_pixmap;
@@ -93,6 +117,9 @@ void x11_putpixel_fb(struct machine *, int, int x, int y, int color);
 #ifdef WITH_X11
 void x11_putimage_fb(struct machine *, int);
 #endif
+void x11_fb_put_rect(struct fb_window *, int x, int y, int w, int h);
+void x11_fb_flush(struct fb_window *);
+void x11_fb_wait(struct fb_window *);
 void x11_init(struct machine *);
 void x11_fb_resize(struct fb_window *win, int new_xsize, int new_ysize);
 void x11_set_standard_properties(struct fb_window *fb_window);
@@ -100,5 +127,20 @@ struct fb_window *x11_fb_init(int xsize, int ysize, char *name,
 	int scaledown, struct machine *);
 void x11_check_event(struct emul *emul);
 
+/*  fb_headless.c:  */
+void fb_headless_init(struct fb_window *fbwin, struct machine *m);
+void fb_headless_resize(struct fb_window *fbwin, int xsize, int ysize);
+void fb_headless_update(struct fb_window *fbwin, int x, int y, int w, int h);
+void fb_headless_flush(struct fb_window *fbwin);
+void fb_headless_get_row(struct fb_window *fbwin, int y, unsigned char *rgb);
+bool fb_headless_snapshot(struct fb_window *fbwin, const char *fname);
+
+/*  fb_vnc.c:  */
+void fb_vnc_init(struct fb_window *fbwin, struct machine *m);
+void fb_vnc_resize(struct fb_window *fbwin);
+void fb_vnc_update(struct fb_window *fbwin, int x, int y, int w, int h);
+void fb_vnc_poll(struct fb_window *fbwin);
+void fb_vnc_flush(struct fb_window *fbwin);
+
 
 #endif	/*  X11_H  */
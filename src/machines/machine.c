@@ -84,6 +84,7 @@ struct machine *machine_new(char *name, struct emul *emul, int id)
 					    emul.c for other pagesizes.  */
 	m->prom_emulation = 1;
 	m->allow_instruction_combinations = 1;
+	m->idle_loop_detection = 1;
 	m->byte_order_override = NO_BYTE_ORDER_OVERRIDE;
 	m->boot_kernel_filename = strdup("");
 	m->boot_string_argument = NULL;
@@ -109,6 +110,9 @@ struct machine *machine_new(char *name, struct emul *emul, int id)
 	settings_add(m->settings, "allow_instruction_combinations", 0,
 	    SETTINGS_TYPE_INT, SETTINGS_FORMAT_YESNO,
 	    (void *) &m->allow_instruction_combinations);
+	settings_add(m->settings, "idle_loop_detection", 1,
+	    SETTINGS_TYPE_INT, SETTINGS_FORMAT_YESNO,
+	    (void *) &m->idle_loop_detection);
 	settings_add(m->settings, "n_gfx_cards", 0,
 	    SETTINGS_TYPE_INT, SETTINGS_FORMAT_DECIMAL,
 	    (void *) &m->n_gfx_cards);
@@ -132,6 +136,8 @@ void machine_destroy(struct machine *machine)
 	for (i=0; i<machine->ncpus; i++)
 		cpu_destroy(machine->cpus[i]);
 
+	diskimage_close_all(machine);
+
 	if (machine->name != NULL)
 	 	free(machine->name);
 
@@ -331,6 +337,7 @@ void machine_statistics_init(struct machine *machine, char *fname)
 		case 'v':
 		case 'i':
 		case 'p':
+		case 'w':
 			CHECK_ALLOCATION(machine->statistics.fields = (char *) realloc(
 			    machine->statistics.fields, strlen(
 			    machine->statistics.fields) + 2));
@@ -397,7 +404,7 @@ void machine_dumpinfo(struct machine *m)
 		debug("Bootstrap cpu is nr %i\n", m->bootstrap_cpu);
 
 	if (m->x11_md.in_use) {
-		debug("Using X11");
+		debug(m->x11_md.headless? "Headless framebuffer" : "Using X11");
 		if (m->x11_md.scaledown > 1)
 			debug(", scaledown %i", m->x11_md.scaledown);
 		if (m->x11_md.scaleup > 1)
@@ -632,11 +639,18 @@ bool machine_run(struct machine *machine)
 	struct cpu **cpus = machine->cpus;
 	int ncpus = machine->ncpus;
 	bool any_running = false;
+	int64_t n_steps = 1;
 
 	for (int i=0; i<ncpus; i++) {
 		if (cpus[i]->running) {
+			int64_t budget_before = cpus[i]->step_budget;
+
 			any_running = true;
 			cpus[i]->run_instr(cpus[i]);
+
+			/*  "step n" may execute many steps in one go:  */
+			if (budget_before - cpus[i]->step_budget > n_steps)
+				n_steps = budget_before - cpus[i]->step_budget;
 		}
 	}
 
@@ -654,7 +668,7 @@ bool machine_run(struct machine *machine)
 
 	for (int te=0; te<machine->tick_functions.n_entries; te++) {
 		machine->tick_functions.ticks_till_next[te] -=
-		    single_step ? 1 : N_SAFE_DYNTRANS_LIMIT;
+		    single_step ? n_steps : N_SAFE_DYNTRANS_LIMIT;
 
 		if (machine->tick_functions.ticks_till_next[te] <= 0) {
 			while (machine->tick_functions.ticks_till_next[te]<=0) {
@@ -53,43 +53,9 @@
 #include "misc.h"
 #include "net.h"
 
-
-/*
- *  net_allocate_ethernet_packet_link():
- *
- *  This routine allocates an ethernet_packet_link struct, and adds it at
- *  the end of the packet chain.  A data buffer is allocated, and the data,
- *  nic, and len fields of the link are set.
- *
- *  Note: The data buffer is not zeroed.
- *
- *  Return value is a pointer to the link on success. It doesn't return on
- *  failure.
- */
-struct ethernet_packet_link *net_allocate_ethernet_packet_link(
-	struct net *net, struct nic_data *nic, size_t len)
-{
-	struct ethernet_packet_link *lp;
-
-	CHECK_ALLOCATION(lp = (struct ethernet_packet_link *)
-	    malloc(sizeof(struct ethernet_packet_link)));
-
-	lp->len = len;
-	lp->nic = nic;
-	CHECK_ALLOCATION(lp->data = (unsigned char *) malloc(len));
-
-	lp->next = NULL;
-
-	/*  Add last in the link chain:  */
-	lp->prev = net->last_ethernet_packet;
-	if (lp->prev != NULL)
-		lp->prev->next = lp;
-	else
-		net->first_ethernet_packet = lp;
-	net->last_ethernet_packet = lp;
-
-	return lp;
-}
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
 
 
 /*
@@ -148,7 +114,7 @@ static void net_arp(struct net *net, struct nic_data *nic,
 	    packet[2] == 0x08 && packet[3] == 0x00 &&
 	    packet[4] == 0x06 && packet[5] == 0x04) {
 		int r = (packet[6] << 8) + packet[7];
-		struct ethernet_packet_link *lp;
+		struct net_packet *lp;
 
 		switch (r) {
 		case 1:		/*  Request  */
@@ -157,8 +123,7 @@ static void net_arp(struct net *net, struct nic_data *nic,
 			if (memcmp(packet+24, net->gateway_ipv4_addr, 4) != 0)
 				break;
 
-			lp = net_allocate_ethernet_packet_link(
-			    net, nic, 60 + 14);
+			lp = net_packet_alloc(net, 60 + 14);
 
 			/*  Copy the old packet first:  */
 			memset(lp->data, 0, 60 + 14);
@@ -180,10 +145,10 @@ static void net_arp(struct net *net, struct nic_data *nic,
 			/*  This is a Reply:  */
 			lp->data[6 + 14] = 0x00; lp->data[7 + 14] = 0x02;
 
+			net_packet_enqueue(net, nic, lp);
 			break;
 		case 3:		/*  Reverse Request  */
-			lp = net_allocate_ethernet_packet_link(
-			    net, nic, 60 + 14);
+			lp = net_packet_alloc(net, 60 + 14);
 
 			/*  Copy the old packet first:  */
 			memset(lp->data, 0, 60 + 14);
@@ -220,6 +185,8 @@ static void net_arp(struct net *net, struct nic_data *nic,
 			lp->data[25 + 14] =  0;
 			lp->data[26 + 14] =  0;
 			lp->data[27 + 14] =  q;
+
+			net_packet_enqueue(net, nic, lp);
 			break;
 		case 2:		/*  Reply  */
 		case 4:		/*  Reverse Reply  */
@@ -289,18 +256,18 @@ int net_ethernet_rx_avail(struct net *net, struct nic_data *nic)
 				/*  Add the packet to all "our" NICs on this
 				    network:  */
 				for (i=0; i<net->n_nics; i++) {
-					struct ethernet_packet_link *lp;
-					lp = net_allocate_ethernet_packet_link(
-					    net, net->nic_data[i], res);
+					struct net_packet *lp;
+					lp = net_packet_alloc(net, res);
 					memcpy(lp->data, buf, res);
+					net_packet_enqueue(net,
+					    net->nic_data[i], lp);
 				}
 			}
 		} while (res != -1 && nreceived < 100);
 	}
 
 	/*  IP protocol specific:  */
-	net_udp_rx_avail(net, nic);
-	net_tcp_rx_avail(net, nic);
+	net_ip_rx_avail(net, nic);
 
 	return net_ethernet_rx(net, nic, NULL, NULL);
 }
@@ -314,59 +281,65 @@ int net_ethernet_rx_avail(struct net *net, struct nic_data *nic)
  *
  *  Return value is 1 if there was a packet available. *packetp and *lenp
  *  will be set to the packet's data pointer and length, respectively, and
- *  the packet will be removed from the linked list). If there was no packet
- *  available, 0 is returned.
+ *  the packet will be removed from the NIC's queue). The data has been
+ *  allocated with malloc(), and should be freed by the caller. If there was
+ *  no packet available, 0 is returned.
  *
- *  If packetp is NULL, then the search is aborted as soon as a packet with
- *  the correct 'nic' field is found, and a 1 is returned, but as packetp
- *  is NULL we can't return the actual packet. (This is the internal form
+ *  If packetp is NULL, then 1 is returned if there is a packet for the
+ *  'nic', but the packet is left in the queue. (This is the internal form
  *  if net_ethernet_rx_avail().)
+ *
+ *  NICs that copy the packet to a buffer of their own anyway should use
+ *  net_ethernet_rx_copy() instead.
  */
 int net_ethernet_rx(struct net *net, struct nic_data *nic,
 	unsigned char **packetp, int *lenp)
 {
-	struct ethernet_packet_link *lp, *prev;
+	struct net_packet *p;
 
 	if (net == NULL)
 		return 0;
 
-	/*  Find the first packet which has the right 'nic' field.  */
+	if (packetp == NULL || lenp == NULL)
+		return !net_packet_queue_empty(nic);
 
-	lp = net->first_ethernet_packet;
-	prev = NULL;
-	while (lp != NULL) {
-		if (lp->nic == nic) {
-			/*  We found a packet for this controller!  */
-			if (packetp == NULL || lenp == NULL)
-				return 1;
+	p = net_packet_dequeue(nic);
+	if (p == NULL)
+		return 0;
 
-			/*  Let's return it:  */
-			(*packetp) = lp->data;
-			(*lenp) = lp->len;
+	CHECK_ALLOCATION(*packetp = (unsigned char *) malloc(p->len));
+	memcpy(*packetp, p->data, p->len);
+	*lenp = p->len;
 
-			/*  Remove this link from the linked list:  */
-			if (prev == NULL)
-				net->first_ethernet_packet = lp->next;
-			else
-				prev->next = lp->next;
+	net_packet_free(net, p);
+	return 1;
+}
 
-			if (lp->next == NULL)
-				net->last_ethernet_packet = prev;
-			else
-				lp->next->prev = prev;
 
-			free(lp);
+/*
+ *  net_ethernet_rx_copy():
+ *
+ *  Like net_ethernet_rx(), but copies the packet to a buffer provided by the
+ *  caller. Packets longer than maxlen are truncated, but *lenp is set to the
+ *  full length of the packet.
+ */
+int net_ethernet_rx_copy(struct net *net, struct nic_data *nic,
+	unsigned char *buf, int maxlen, int *lenp)
+{
+	struct net_packet *p;
 
-			/*  ... and return successfully:  */
-			return 1;
-		}
+	if (net == NULL)
+		return 0;
 
-		prev = lp;
-		lp = lp->next;
-	}
+	p = net_packet_dequeue(nic);
+	if (p == NULL)
+		return 0;
+
+	memcpy(buf, p->data, p->len < maxlen ? p->len : maxlen);
+	*lenp = p->len;
 
-	/*  No packet found. :-(  */
-	return 0;
+	net_packet_free(net, p);
+	return 1;
 }
 
 
@@ -410,12 +383,12 @@ void net_ethernet_tx(struct net *net, struct nic_data *nic,
 	if (!for_the_gateway && nic != NULL && net->n_nics > 0) {
 		for (i=0; i<net->n_nics; i++)
 			if (nic != net->nic_data[i]) {
-				struct ethernet_packet_link *lp;
-				lp = net_allocate_ethernet_packet_link(net,
-				    net->nic_data[i], len);
+				struct net_packet *lp;
+				lp = net_packet_alloc(net, len);
 
 				/*  Copy the entire packet:  */
 				memcpy(lp->data, packet, len);
+				net_packet_enqueue(net, net->nic_data[i], lp);
 			}
 	}
 
@@ -609,6 +582,7 @@ void net_add_nic(struct net *net, struct nic_data *nic)
 	 */
 	nic->net = net;
 	nic->promiscuous_mode = 0;
+	net_packet_queue_init(nic);
 
 	net->n_nics++;
 	CHECK_ALLOCATION(net->nic_data = (struct nic_data **)
@@ -659,7 +633,7 @@ static void net_gateway_init(struct net *net)
  */
 void net_dumpinfo(struct net *net)
 {
-	int iadd = 1;
+	int iadd = 1, n_tcp, n_udp;
 	struct remote_net *rnp;
 
 	debugmsg(SUBSYS_NET, "", VERBOSITY_INFO, "");
@@ -669,6 +643,7 @@ void net_dumpinfo(struct net *net)
 	if (net->tapdev) {
 		debugmsg(SUBSYS_NET, "tap", VERBOSITY_INFO,
 		    "using device %s", net->tapdev);
+		net_packet_dumpinfo(net);
 		debug_indentation(-iadd);
 		return;
 	}
@@ -683,6 +658,14 @@ void net_dumpinfo(struct net *net)
 	debug(" (max outgoing: TCP=%i, UDP=%i)\n",
 	    MAX_TCP_CONNECTIONS, MAX_UDP_CONNECTIONS);
 
+	n_tcp = n_udp = 0;
+	for (int i=0; i<net->n_tcp_connections; i++)
+		n_tcp += net->tcp_connections[i].in_use? 1 : 0;
+	for (int i=0; i<net->n_udp_connections; i++)
+		n_udp += net->udp_connections[i].in_use? 1 : 0;
+	debug("connections: TCP=%i, UDP=%i (%s)\n", n_tcp, n_udp,
+	    net->epoll_fd >= 0? "epoll" : "polled");
+
 	debug("gateway+nameserver: ");
 	net_debugaddr(&net->gateway_ipv4_addr, NET_ADDR_IPV4);
 	debug(" (");
@@ -710,6 +693,8 @@ void net_dumpinfo(struct net *net)
 	}
 	debug_indentation(-iadd);
 
+	net_packet_dumpinfo(net);
+
 	debug_indentation(-iadd);
 	debug_indentation(-iadd);
 }
@@ -747,9 +732,10 @@ struct net *net_init(struct emul *emul, int init_flags,
 
 	/*  Sane defaults:  */
 	net->timestamp = 0;
-	net->first_ethernet_packet = net->last_ethernet_packet = NULL;
+	net->free_packets = NULL;
 	net->tapdev = NULL;
 	net->tap_fd = -1;
+	net->epoll_fd = -1;
 
 	/*
 	 *  If we're using a tap device, attempt to initialize it and
@@ -789,6 +775,15 @@ struct net *net_init(struct emul *emul, int init_flags,
 	net->nameserver_known = 0;
 	parse_resolvconf(net);
 
+#ifdef HAVE_EPOLL
+	/*  Readiness notification for the gateway's outgoing connections.
+	    (Without it, every connection is polled.)  */
+	net->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (net->epoll_fd < 0)
+		debugmsg(SUBSYS_NET, "epoll", VERBOSITY_WARNING,
+		    "epoll_create1(): %s; polling instead", strerror(errno));
+#endif
+
 	/*  Distributed network? Then add remote hosts:  */
 	if (local_port != 0) {
 		struct sockaddr_in si_self;
@@ -42,10 +42,95 @@
 #include "misc.h"
 #include "net.h"
 
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 
 /*  #define debug fatal  */
 static int net_ip_debug = 0;	// replace by debugmsg(....)
 
+/*  Gateway sockets are identified by their connection id, with this bit
+    set for TCP connections:  */
+#define	NET_IP_WATCH_TCP	0x80000000
+
+#define	NET_IP_MAX_EVENTS	64
+
+/*  Unacknowledged TCP data is resent after this many rx rounds:  */
+#define	TCP_RESEND_ROUNDS	10000
+
+
+/*
+ *  net_ip_watch():
+ *
+ *  Adds a gateway socket to the epoll set, or changes the events it is
+ *  watched for if modify is set. The socket is watched for incoming data,
+ *  and also for writability if want_write is set (this is how a
+ *  non-blocking connect() is seen to complete). Closing a socket removes
+ *  it from the set automatically.
+ */
+static void net_ip_watch(struct net *net, int fd, uint32_t id, bool modify,
+	bool want_write)
+{
+#ifdef HAVE_EPOLL
+	struct epoll_event ev;
+
+	if (net->epoll_fd < 0)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (want_write? EPOLLOUT : 0);
+	ev.data.u32 = id;
+
+	if (epoll_ctl(net->epoll_fd, modify? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+	    fd, &ev) < 0)
+		debugmsg(SUBSYS_NET, "epoll", VERBOSITY_WARNING,
+		    "epoll_ctl(): %s", strerror(errno));
+#endif
+}
+
+
+/*
+ *  net_ip_unwatch():
+ *
+ *  Stops watching a socket which is still open, but which there is nothing
+ *  more to receive from.
+ */
+static void net_ip_unwatch(struct net *net, int fd)
+{
+#ifdef HAVE_EPOLL
+	if (net->epoll_fd >= 0)
+		epoll_ctl(net->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+}
+
+
+/*
+ *  net_ip_grow_connections():
+ *
+ *  Called when all slots of a connection table are in use. Doubles the size
+ *  of the table (but to no more than max_n entries), and returns the index
+ *  of the first new slot, or -1 if the table may not grow any further.
+ *  The new slots are zeroed, i.e. not in use.
+ */
+static int net_ip_grow_connections(void **table, int *n, size_t entry_size,
+	int initial_n, int max_n)
+{
+	int old_n = *n, new_n = old_n == 0? initial_n : old_n * 2;
+
+	if (new_n > max_n)
+		new_n = max_n;
+	if (new_n <= old_n)
+		return -1;
+
+	CHECK_ALLOCATION(*table = realloc(*table, entry_size * new_n));
+	memset((char *) *table + entry_size * old_n, 0,
+	    entry_size * (new_n - old_n));
+	*n = new_n;
+
+	return old_n;
+}
+
 
 
 /*
@@ -162,7 +247,7 @@ static void net_ip_icmp(struct net *net, struct nic_data *nic,
 	unsigned char *packet, int len)
 {
 	int type;
-	struct ethernet_packet_link *lp;
+	struct net_packet *lp;
 
 	type = packet[34];
 
@@ -170,7 +255,7 @@ static void net_ip_icmp(struct net *net, struct nic_data *nic,
 	case 8:	/*  ECHO request  */
 		debugmsg(SUBSYS_NET, "ICMP", VERBOSITY_DEBUG, "ECHO request");
 
-		lp = net_allocate_ethernet_packet_link(net, nic, len);
+		lp = net_packet_alloc(net, len);
 
 		/*  Copy the old packet first:  */
 		memcpy(lp->data + 12, packet + 12, len - 12);
@@ -195,6 +280,7 @@ static void net_ip_icmp(struct net *net, struct nic_data *nic,
 		/*  Recalculate IP header checksum:  */
 		net_ip_checksum(lp->data + 14, 10, 20);
 
+		net_packet_enqueue(net, nic, lp);
 		break;
 	default:
 		debugmsg(SUBSYS_NET, "ICMP", VERBOSITY_WARNING, "type %i not yet implemented", type);
@@ -232,7 +318,7 @@ static void tcp_closeconnection(struct net *net, int con_id)
 void net_ip_tcp_connectionreply(struct net *net, struct nic_data *nic,
 	int con_id, int connecting, unsigned char *data, int datalen, int rst)
 {
-	struct ethernet_packet_link *lp;
+	struct net_packet *lp;
 	int tcp_length, ip_len, option_len = 20;
 
 	if (connecting)
@@ -242,7 +328,7 @@ void net_ip_tcp_connectionreply(struct net *net, struct nic_data *nic,
 	net->tcp_connections[con_id].tcp_id ++;
 	tcp_length = 20 + option_len + datalen;
 	ip_len = 20 + tcp_length;
-	lp = net_allocate_ethernet_packet_link(net, nic, 14 + ip_len);
+	lp = net_packet_alloc(net, 14 + ip_len);
 
 	/*  Ethernet header:  */
 	memcpy(lp->data + 0, net->tcp_connections[con_id].ethernet_address, 6);
@@ -352,6 +438,8 @@ void net_ip_tcp_connectionreply(struct net *net, struct nic_data *nic,
 
 	if (connecting)
 		net->tcp_connections[con_id].outside_seqnr ++;
+
+	net_packet_enqueue(net, nic, lp);
 }
 
 
@@ -456,7 +544,7 @@ static void net_ip_tcp(struct net *net, struct nic_data *nic,
 
 	/*  Does this packet belong to a current connection?  */
 	con_id = free_con_id = -1;
-	for (i=0; i<MAX_TCP_CONNECTIONS; i++) {
+	for (i=0; i<net->n_tcp_connections; i++) {
 		if (!net->tcp_connections[i].in_use)
 			free_con_id = i;
 		if (net->tcp_connections[i].in_use &&
@@ -504,6 +592,13 @@ static void net_ip_tcp(struct net *net, struct nic_data *nic,
 		    packet[30], packet[31], packet[32], packet[33], dstport);
 
 		/*  Find a free connection id to use:  */
+		if (free_con_id < 0)
+			free_con_id = net_ip_grow_connections(
+			    (void **) &net->tcp_connections,
+			    &net->n_tcp_connections,
+			    sizeof(struct tcp_connection),
+			    INITIAL_TCP_CONNECTIONS, MAX_TCP_CONNECTIONS);
+
 		if (free_con_id < 0) {
 #if 1
 			/*
@@ -520,7 +615,7 @@ static void net_ip_tcp(struct net *net, struct nic_data *nic,
 			free_con_id = 0;
 
 			fatal("[ NO FREE TCP SLOTS, REUSING OLDEST ONE ]\n");
-			for (i=0; i<MAX_TCP_CONNECTIONS; i++)
+			for (i=0; i<net->n_tcp_connections; i++)
 				if (net->tcp_connections[i].
 				    last_used_timestamp < oldest) {
 					oldest = net->tcp_connections[i].
@@ -532,8 +627,33 @@ static void net_ip_tcp(struct net *net, struct nic_data *nic,
 		}
 
 		con_id = free_con_id;
+
+		/*  (The incoming buffer of an old connection is reused.)  */
+		unsigned char *incoming_buf =
+		    net->tcp_connections[con_id].incoming_buf;
 		memset(&net->tcp_connections[con_id], 0,
 		    sizeof(struct tcp_connection));
+		net->tcp_connections[con_id].incoming_buf = incoming_buf;
+
+		/*  The window scale option, if the guest OS sent one:  */
+		for (i=34+20; data_offset <= len && i+1 < data_offset &&
+		    packet[i] != 0; ) {
+			if (packet[i] == 1) {		/*  NOP  */
+				i ++;
+				continue;
+			}
+			if (packet[i+1] < 2)
+				break;
+			if (packet[i] == 3 && packet[i+1] == 3 &&
+			    i+2 < data_offset)
+				net->tcp_connections[con_id].
+				    inside_window_shift = packet[i+2] > 14?
+				    14 : packet[i+2];
+			i += packet[i+1];
+		}
+
+		/*  (The window in a SYN packet is never scaled.)  */
+		net->tcp_connections[con_id].inside_window = window;
 
 		memcpy(net->tcp_connections[con_id].ethernet_address,
 		    packet + 6, 6);
@@ -562,6 +682,9 @@ static void net_ip_tcp(struct net *net, struct nic_data *nic,
 		fcntl(net->tcp_connections[con_id].socket, F_SETFL,
 		    res | O_NONBLOCK);
 
+		net_ip_watch(net, net->tcp_connections[con_id].socket,
+		    con_id | NET_IP_WATCH_TCP, false, true);
+
 		remote_ip.sin_family = AF_INET;
 		memcpy((unsigned char *)&remote_ip.sin_addr,
 		    net->tcp_connections[con_id].outside_ip_address, 4);
@@ -627,16 +750,36 @@ static void net_ip_tcp(struct net *net, struct nic_data *nic,
 	}
 
 	if (ack) {
-debug("ACK %i bytes, inside_acknr=%u outside_seqnr=%u\n",
- net->tcp_connections[con_id].incoming_buf_len,
- net->tcp_connections[con_id].inside_acknr,
- net->tcp_connections[con_id].outside_seqnr);
-		net->tcp_connections[con_id].inside_acknr = acknr;
-		if (net->tcp_connections[con_id].inside_acknr ==
-		    net->tcp_connections[con_id].outside_seqnr &&
-		    net->tcp_connections[con_id].incoming_buf_len != 0) {
-debug("  all acked\n");
-			net->tcp_connections[con_id].incoming_buf_len = 0;
+		struct tcp_connection *tc = &net->tcp_connections[con_id];
+		int32_t acked = (int32_t)(acknr - tc->incoming_buf_seqnr);
+
+		tc->inside_acknr = acknr;
+		tc->inside_window = window << tc->inside_window_shift;
+
+		/*  Forget about the data that the guest OS has received:  */
+		if (tc->incoming_buf_len != 0 && acked > 0) {
+			if (acked >= tc->incoming_buf_len)
+				tc->incoming_buf_len = 0;
+			else {
+				tc->incoming_buf_len -= acked;
+				memmove(tc->incoming_buf, tc->incoming_buf +
+				    acked, tc->incoming_buf_len);
+			}
+
+			tc->incoming_buf_seqnr += acked;
+			tc->incoming_buf_rounds = 0;
+		}
+
+		/*  If the outside closed the connection while there was
+		    still data in flight, then send the FIN now:  */
+		if (tc->outside_eof && tc->incoming_buf_len == 0 &&
+		    tc->state == TCP_OUTSIDE_CONNECTED) {
+			debug("[ all data acked; TCP connection %i is "
+			    "now disconnected ]\n", con_id);
+			tc->outside_eof = 0;
+			tc->state = TCP_OUTSIDE_DISCONNECTED;
+			net_ip_tcp_connectionreply(net, nic, con_id, 0,
+			    NULL, 0, 0);
 		}
 	}
 
@@ -775,7 +918,7 @@ static void net_ip_udp(struct net *net, struct nic_data *nic,
 
 	/*  Is this "connection" new, or a currently ongoing one?  */
 	con_id = free_con_id = -1;
-	for (i=0; i<MAX_UDP_CONNECTIONS; i++) {
+	for (i=0; i<net->n_udp_connections; i++) {
 		if (!net->udp_connections[i].in_use)
 			free_con_id = i;
 		if (net->udp_connections[i].in_use &&
@@ -795,13 +938,19 @@ static void net_ip_udp(struct net *net, struct nic_data *nic,
 		debug("ONGOING");
 	else {
 		debug("NEW");
+		if (free_con_id < 0)
+			free_con_id = net_ip_grow_connections(
+			    (void **) &net->udp_connections,
+			    &net->n_udp_connections,
+			    sizeof(struct udp_connection),
+			    INITIAL_UDP_CONNECTIONS, MAX_UDP_CONNECTIONS);
 		if (free_con_id < 0) {
 			int64_t oldest = net->
 			    udp_connections[0].last_used_timestamp;
 			free_con_id = 0;
 
 			debug(", NO FREE SLOTS, REUSING OLDEST ONE");
-			for (int j=0; j<MAX_UDP_CONNECTIONS; j++)
+			for (int j=0; j<net->n_udp_connections; j++)
 				if (net->udp_connections[j].last_used_timestamp < oldest) {
 					oldest = net->udp_connections[j].last_used_timestamp;
 					free_con_id = j;
@@ -838,6 +987,9 @@ static void net_ip_udp(struct net *net, struct nic_data *nic,
 		res = fcntl(net->udp_connections[con_id].socket, F_GETFL);
 		fcntl(net->udp_connections[con_id].socket, F_SETFL,
 		    res | O_NONBLOCK);
+
+		net_ip_watch(net, net->udp_connections[con_id].socket,
+		    con_id, false, false);
 	}
 
 	debug(", connection id %i\n", con_id);
@@ -949,7 +1101,7 @@ void net_ip(struct net *net, struct nic_data *nic, unsigned char *packet,
 static void net_ip_broadcast_dhcp(struct net *net, struct nic_data *nic,
 	unsigned char *packet, int len)
 {
-	struct ethernet_packet_link *lp;
+	struct net_packet *lp;
         int i, reply_len;
 
 	if (ENOUGH_VERBOSITY(SUBSYS_NET, VERBOSITY_DEBUG)) {
@@ -1017,7 +1169,7 @@ static void net_ip_broadcast_dhcp(struct net *net, struct nic_data *nic,
 #endif
 
         reply_len = 307;
-        lp = net_allocate_ethernet_packet_link(net, nic, reply_len);
+        lp = net_packet_alloc(net, reply_len);
 
         /*  From old packet, copy everything before options field:  */
         memcpy(lp->data, packet, 278);
@@ -1139,6 +1291,8 @@ static void net_ip_broadcast_dhcp(struct net *net, struct nic_data *nic,
 
 		debugmsg(SUBSYS_NET, "IPv4 DHCP REPLY", VERBOSITY_DEBUG, "%s", s);
 	}
+
+	net_packet_enqueue(net, nic, lp);
 }
 
 
@@ -1257,30 +1411,348 @@ void net_ip_broadcast(struct net *net, struct nic_data *nic,
 }
 
 
+/*
+ *  net_udp_receive():
+ *
+ *  Receives one UDP packet (from the outside world) on a connection, and
+ *  turns it into one or more ethernet packets for the emulated operating
+ *  system. Returns the number of ethernet packets, or 0 if there was
+ *  nothing to receive.
+ */
+static int net_udp_receive(struct net *net, struct nic_data *nic, int con_id)
+{
+	ssize_t res;
+	unsigned char buf[66000];
+	unsigned char udp_data[66008];
+	struct sockaddr_in from;
+	socklen_t from_len = sizeof(from);
+	int ip_len, udp_len;
+	struct net_packet *lp;
+	int max_per_packet;
+	int bytes_converted = 0;
+	int this_packets_data_length;
+	int fragment_ofs = 0;
+	int n_packets = 0;
+
+	res = recvfrom(net->udp_connections[con_id].socket, buf,
+	    sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+
+	/*  No more incoming UDP on this connection?  */
+	if (res < 0)
+		return 0;
+
+	net->timestamp ++;
+	net->udp_connections[con_id].last_used_timestamp =
+	    net->timestamp;
+
+	net->udp_connections[con_id].udp_id ++;
+
+	/*
+	 *  Special case for the nameserver:  If a UDP packet is
+	 *  received from the nameserver (if the nameserver's IP is
+	 *  known), fake it so that it comes from the gateway instead.
+	 */
+	if (net->udp_connections[con_id].fake_ns)
+		memcpy(((unsigned char *)(&from))+4,
+		    &net->gateway_ipv4_addr[0], 4);
+
+	/*
+	 *  We now have a UDP packet of size 'res' which we need
+	 *  turn into one or more ethernet packets for the emulated
+	 *  operating system.  Ethernet packets are at most 1518
+	 *  bytes long. With some margin, that means we can have
+	 *  about 1500 bytes per packet.
+	 *
+	 *	Ethernet = 14 bytes
+	 *	IP = 20 bytes
+	 *	(UDP = 8 bytes + data)
+	 *
+	 *  So data can be at most max_per_packet - 34. For UDP
+	 *  fragments, each multiple should (?) be a multiple of
+	 *  8 bytes, except the last which doesn't have any such
+	 *  restriction.
+	 */
+	max_per_packet = 1500;
+
+	/*  UDP:  */
+	udp_len = res + 8;
+	/*  from[2..3] = outside_udp_port  */
+	udp_data[0] = ((unsigned char *)&from)[2];
+	udp_data[1] = ((unsigned char *)&from)[3];
+	udp_data[2] = (net->udp_connections[con_id].
+	    inside_udp_port >> 8) & 0xff;
+	udp_data[3] = net->udp_connections[con_id].
+	    inside_udp_port & 0xff;
+	udp_data[4] = udp_len >> 8;
+	udp_data[5] = udp_len & 0xff;
+	udp_data[6] = 0;
+	udp_data[7] = 0;
+	memcpy(udp_data + 8, buf, res);
+	/*
+	 *  TODO:  UDP checksum, if necessary. At least NetBSD
+	 *  and OpenBSD accept UDP packets with 0x0000 in the
+	 *  checksum field anyway.
+	 */
+
+	while (bytes_converted < udp_len) {
+		this_packets_data_length = udp_len - bytes_converted;
+
+		/*  Do we need to fragment?  */
+		if (this_packets_data_length > max_per_packet-34) {
+			this_packets_data_length =
+			    max_per_packet - 34;
+			while (this_packets_data_length & 7)
+				this_packets_data_length --;
+		}
+
+		ip_len = 20 + this_packets_data_length;
+
+		lp = net_packet_alloc(net,
+		    14 + 20 + this_packets_data_length);
+
+		/*  Ethernet header:  */
+		memcpy(lp->data + 0, net->udp_connections[con_id].
+		    ethernet_address, 6);
+		memcpy(lp->data + 6, net->gateway_ethernet_addr, 6);
+		lp->data[12] = 0x08;	/*  IP = 0x0800  */
+		lp->data[13] = 0x00;
+
+		/*  IP header:  */
+		lp->data[14] = 0x45;	/*  ver  */
+		lp->data[15] = 0x00;	/*  tos  */
+		lp->data[16] = ip_len >> 8;
+		lp->data[17] = ip_len & 0xff;
+		lp->data[18] = net->udp_connections[con_id].udp_id >> 8;
+		lp->data[19] = net->udp_connections[con_id].udp_id
+		    & 0xff;
+		lp->data[20] = (fragment_ofs >> 8);
+		if (bytes_converted + this_packets_data_length
+		    < udp_len)
+			lp->data[20] |= 0x20;	/*  More fragments  */
+		lp->data[21] = fragment_ofs & 0xff;
+		lp->data[22] = 0x40;	/*  ttl  */
+		lp->data[23] = 17;	/*  p = UDP  */
+		lp->data[26] = ((unsigned char *)&from)[4];
+		lp->data[27] = ((unsigned char *)&from)[5];
+		lp->data[28] = ((unsigned char *)&from)[6];
+		lp->data[29] = ((unsigned char *)&from)[7];
+		memcpy(lp->data + 30, net->udp_connections[con_id].
+		    inside_ip_address, 4);
+		net_ip_checksum(lp->data + 14, 10, 20);
+
+		memcpy(lp->data+34, udp_data + bytes_converted,
+		    this_packets_data_length);
+
+		net_packet_enqueue(net, nic, lp);
+
+		bytes_converted += this_packets_data_length;
+		fragment_ofs = bytes_converted / 8;
+
+		n_packets ++;
+	}
+
+	return n_packets;
+}
+
+
+/*
+ *  net_ip_rx_budget():
+ *
+ *  Returns how many more packets may be sent to the guest OS during this
+ *  rx round: no more than what is left of the per-round limit, and no more
+ *  than what fits in the NIC's incoming queue.
+ */
+static int net_ip_rx_budget(struct nic_data *nic, int received, int max)
+{
+	int space = net_packet_queue_space(nic);
+
+	if (received >= max)
+		return 0;
+
+	return max - received < space? max - received : space;
+}
+
+
+/*
+ *  net_tcp_send():
+ *
+ *  Sends data to the guest OS on a TCP connection, split into segments of
+ *  at most TCP_SEGMENT_LEN bytes. Returns the number of segments sent.
+ */
+static int net_tcp_send(struct net *net, struct nic_data *nic, int con_id,
+	unsigned char *data, int len)
+{
+	int n_segments = 0;
+
+	while (len > 0) {
+		int n = len < TCP_SEGMENT_LEN? len : TCP_SEGMENT_LEN;
+
+		net_ip_tcp_connectionreply(net, nic, con_id, 0, data, n, 0);
+
+		data += n;
+		len -= n;
+		n_segments ++;
+	}
+
+	return n_segments;
+}
+
+
+/*
+ *  net_tcp_connected():
+ *
+ *  Called when the outside socket of a connection which is being set up
+ *  has become writable, i.e. when connect() has either succeeded or failed.
+ */
+static void net_tcp_connected(struct net *net, struct nic_data *nic,
+	int con_id)
+{
+	struct tcp_connection *tc = &net->tcp_connections[con_id];
+	socklen_t err_len = sizeof(int);
+	int err = 0;
+
+	if (getsockopt(tc->socket, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0)
+		err = errno;
+
+	if (err != 0) {
+		debugmsg(SUBSYS_NET, "TCP", VERBOSITY_WARNING,
+		    "connection %i could not be established: %s",
+		    con_id, strerror(err));
+		tc->state = TCP_OUTSIDE_DISCONNECTED;
+		net_ip_unwatch(net, tc->socket);
+		return;
+	}
+
+	tc->state = TCP_OUTSIDE_CONNECTED;
+	debug("CHANGING TO TCP_OUTSIDE_CONNECTED\n");
+	net_ip_tcp_connectionreply(net, nic, con_id, 1, NULL, 0, 0);
+
+	/*  From now on, only incoming data is interesting:  */
+	net_ip_watch(net, tc->socket, con_id | NET_IP_WATCH_TCP, true, false);
+}
+
+
+/*
+ *  net_tcp_resend():
+ *
+ *  Does this connection have unacknowledged data?  Then, if enough number
+ *  of rounds have passed, try to resend it using the old value of seqnr.
+ *  The resend is postponed until all of the data fits within max_segments.
+ *  Returns the number of segments sent.
+ */
+static int net_tcp_resend(struct net *net, struct nic_data *nic, int con_id,
+	int max_segments)
+{
+	struct tcp_connection *tc = &net->tcp_connections[con_id];
+
+	if (tc->incoming_buf_len == 0 ||
+	    ++ tc->incoming_buf_rounds <= TCP_RESEND_ROUNDS)
+		return 0;
+
+	if ((tc->incoming_buf_len + TCP_SEGMENT_LEN - 1) / TCP_SEGMENT_LEN >
+	    max_segments)
+		return 0;
+
+	debug("  at seqnr %u but backing back to %u, resending %i bytes\n",
+	    tc->outside_seqnr, tc->incoming_buf_seqnr, tc->incoming_buf_len);
+
+	tc->incoming_buf_rounds = 0;
+	tc->outside_seqnr = tc->incoming_buf_seqnr;
+
+	return net_tcp_send(net, nic, con_id, tc->incoming_buf,
+	    tc->incoming_buf_len);
+}
+
+
+/*
+ *  net_tcp_receive():
+ *
+ *  Reads incoming data from the outside socket of a TCP connection, and
+ *  sends it on to the guest OS. The data is kept in the connection's
+ *  incoming buffer until the guest OS has acknowledged it. No more is read
+ *  than fits in the buffer and in the guest OS' receive window, or than can
+ *  be sent as max_segments segments. Returns the number of segments sent.
+ *
+ *  Data which is left unread is picked up in a later rx round.
+ */
+static int net_tcp_receive(struct net *net, struct nic_data *nic, int con_id,
+	int max_segments)
+{
+	struct tcp_connection *tc = &net->tcp_connections[con_id];
+	int window = TCP_INCOMING_BUF_LEN, room, n_segments = 0;
+	ssize_t res;
+
+	if (tc->outside_eof || max_segments <= 0)
+		return 0;
+
+	if (tc->incoming_buf == NULL)
+		CHECK_ALLOCATION(tc->incoming_buf = (unsigned char *)
+		    malloc(TCP_INCOMING_BUF_LEN));
+
+	/*  Don't receive unless the guest OS is ready!  */
+	if (tc->inside_window < window)
+		window = tc->inside_window;
+	room = window - tc->incoming_buf_len;
+	if (room <= 0 || (room < TCP_SEGMENT_LEN && tc->incoming_buf_len != 0))
+		return 0;
+	if (room > max_segments * TCP_SEGMENT_LEN)
+		room = max_segments * TCP_SEGMENT_LEN;
+
+	res = read(tc->socket, tc->incoming_buf + tc->incoming_buf_len, room);
+	if (res > 0) {
+		if (tc->incoming_buf_len == 0) {
+			tc->incoming_buf_rounds = 0;
+			tc->incoming_buf_seqnr = tc->outside_seqnr;
+		}
+
+		debug("  putting %i bytes (seqnr %u) in the incoming buf\n",
+		    (int) res, tc->outside_seqnr);
+
+		n_segments = net_tcp_send(net, nic, con_id,
+		    tc->incoming_buf + tc->incoming_buf_len, res);
+		tc->incoming_buf_len += res;
+	} else if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return 0;
+	} else {
+		if (res < 0)
+			debug("[ TCP: read() on connection %i: errno = %i ]\n",
+			    con_id, errno);
+
+		net_ip_unwatch(net, tc->socket);
+
+		if (tc->incoming_buf_len != 0) {
+			/*  FIN once the data in flight has been acked.  */
+			tc->outside_eof = 1;
+		} else {
+			tc->state = TCP_OUTSIDE_DISCONNECTED;
+			debug("CHANGING TO TCP_OUTSIDE_DISCONNECTED, read"
+			    " res=%i\n", (int) res);
+			net_ip_tcp_connectionreply(net, nic, con_id, 0,
+			    NULL, 0, 0);
+			n_segments = 1;
+		}
+	}
+
+	net->timestamp ++;
+	tc->last_used_timestamp = net->timestamp;
+
+	return n_segments;
+}
+
+
 /*
  *  net_udp_rx_avail():
  *
- *  Receive any available UDP packets (from the outside world).
+ *  Receive any available UDP packets (from the outside world), by polling
+ *  every UDP connection. (Used when epoll is not available.)
  */
-void net_udp_rx_avail(struct net *net, struct nic_data *nic)
+static void net_udp_rx_avail(struct net *net, struct nic_data *nic)
 {
 	int received_packets_this_tick = 0;
 	int max_packets_this_tick = 200;
-	int con_id;
-
-	for (con_id=0; con_id<MAX_UDP_CONNECTIONS; con_id++) {
-		ssize_t res;
-		unsigned char buf[66000];
-		unsigned char udp_data[66008];
-		struct sockaddr_in from;
-		socklen_t from_len = sizeof(from);
-		int ip_len, udp_len;
-		struct ethernet_packet_link *lp;
-		int max_per_packet;
-		int bytes_converted = 0;
-		int this_packets_data_length;
-		int fragment_ofs = 0;
+	int con_id, n;
 
+	for (con_id=0; con_id<net->n_udp_connections; con_id++) {
 		if (received_packets_this_tick > max_packets_this_tick)
 			break;
 
@@ -1293,125 +1765,12 @@ void net_udp_rx_avail(struct net *net, struct nic_data *nic)
 			continue;
 		}
 
-		res = recvfrom(net->udp_connections[con_id].socket, buf,
-		    sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
-
-		/*  No more incoming UDP on this connection?  */
-		if (res < 0)
-			continue;
-
-		net->timestamp ++;
-		net->udp_connections[con_id].last_used_timestamp =
-		    net->timestamp;
-
-		net->udp_connections[con_id].udp_id ++;
-
-		/*
-		 *  Special case for the nameserver:  If a UDP packet is
-		 *  received from the nameserver (if the nameserver's IP is
-		 *  known), fake it so that it comes from the gateway instead.
-		 */
-		if (net->udp_connections[con_id].fake_ns)
-			memcpy(((unsigned char *)(&from))+4,
-			    &net->gateway_ipv4_addr[0], 4);
-
-		/*
-		 *  We now have a UDP packet of size 'res' which we need
-		 *  turn into one or more ethernet packets for the emulated
-		 *  operating system.  Ethernet packets are at most 1518
-		 *  bytes long. With some margin, that means we can have
-		 *  about 1500 bytes per packet.
-		 *
-		 *	Ethernet = 14 bytes
-		 *	IP = 20 bytes
-		 *	(UDP = 8 bytes + data)
-		 *
-		 *  So data can be at most max_per_packet - 34. For UDP
-		 *  fragments, each multiple should (?) be a multiple of
-		 *  8 bytes, except the last which doesn't have any such
-		 *  restriction.
-		 */
-		max_per_packet = 1500;
-
-		/*  UDP:  */
-		udp_len = res + 8;
-		/*  from[2..3] = outside_udp_port  */
-		udp_data[0] = ((unsigned char *)&from)[2];
-		udp_data[1] = ((unsigned char *)&from)[3];
-		udp_data[2] = (net->udp_connections[con_id].
-		    inside_udp_port >> 8) & 0xff;
-		udp_data[3] = net->udp_connections[con_id].
-		    inside_udp_port & 0xff;
-		udp_data[4] = udp_len >> 8;
-		udp_data[5] = udp_len & 0xff;
-		udp_data[6] = 0;
-		udp_data[7] = 0;
-		memcpy(udp_data + 8, buf, res);
-		/*
-		 *  TODO:  UDP checksum, if necessary. At least NetBSD
-		 *  and OpenBSD accept UDP packets with 0x0000 in the
-		 *  checksum field anyway.
-		 */
-
-		while (bytes_converted < udp_len) {
-			this_packets_data_length = udp_len - bytes_converted;
-
-			/*  Do we need to fragment?  */
-			if (this_packets_data_length > max_per_packet-34) {
-				this_packets_data_length =
-				    max_per_packet - 34;
-				while (this_packets_data_length & 7)
-					this_packets_data_length --;
-			}
-
-			ip_len = 20 + this_packets_data_length;
-
-			lp = net_allocate_ethernet_packet_link(net, nic,
-			    14 + 20 + this_packets_data_length);
-
-			/*  Ethernet header:  */
-			memcpy(lp->data + 0, net->udp_connections[con_id].
-			    ethernet_address, 6);
-			memcpy(lp->data + 6, net->gateway_ethernet_addr, 6);
-			lp->data[12] = 0x08;	/*  IP = 0x0800  */
-			lp->data[13] = 0x00;
-
-			/*  IP header:  */
-			lp->data[14] = 0x45;	/*  ver  */
-			lp->data[15] = 0x00;	/*  tos  */
-			lp->data[16] = ip_len >> 8;
-			lp->data[17] = ip_len & 0xff;
-			lp->data[18] = net->udp_connections[con_id].udp_id >> 8;
-			lp->data[19] = net->udp_connections[con_id].udp_id
-			    & 0xff;
-			lp->data[20] = (fragment_ofs >> 8);
-			if (bytes_converted + this_packets_data_length
-			    < udp_len)
-				lp->data[20] |= 0x20;	/*  More fragments  */
-			lp->data[21] = fragment_ofs & 0xff;
-			lp->data[22] = 0x40;	/*  ttl  */
-			lp->data[23] = 17;	/*  p = UDP  */
-			lp->data[26] = ((unsigned char *)&from)[4];
-			lp->data[27] = ((unsigned char *)&from)[5];
-			lp->data[28] = ((unsigned char *)&from)[6];
-			lp->data[29] = ((unsigned char *)&from)[7];
-			memcpy(lp->data + 30, net->udp_connections[con_id].
-			    inside_ip_address, 4);
-			net_ip_checksum(lp->data + 14, 10, 20);
-
-			memcpy(lp->data+34, udp_data + bytes_converted,
-			    this_packets_data_length);
-
-			bytes_converted += this_packets_data_length;
-			fragment_ofs = bytes_converted / 8;
-
-			received_packets_this_tick ++;
-		}
-
-		/*  This makes sure we check this connection AGAIN
-		    for more incoming UDP packets, before moving to the
-		    next connection:  */
-		con_id --;
+		/*  Receive everything that is available on this connection,
+		    before moving to the next connection:  */
+		while (net_ip_rx_budget(nic, received_packets_this_tick,
+		    max_packets_this_tick) > 0 &&
+		    (n = net_udp_receive(net, nic, con_id)) > 0)
+			received_packets_this_tick += n;
 	}
 }
 
@@ -1419,168 +1778,148 @@ void net_udp_rx_avail(struct net *net, struct nic_data *nic)
 /*
  *  net_tcp_rx_avail():
  *
- *  Receive any available TCP packets (from the outside world).
+ *  Receive any available TCP packets (from the outside world), by polling
+ *  every TCP connection with select(). (Used when epoll is not available.)
  */
-void net_tcp_rx_avail(struct net *net, struct nic_data *nic)
+static void net_tcp_rx_avail(struct net *net, struct nic_data *nic)
 {
 	int received_packets_this_tick = 0;
 	int max_packets_this_tick = 200;
 	int con_id;
 
-	for (con_id=0; con_id<MAX_TCP_CONNECTIONS; con_id++) {
-		unsigned char buf[66000];
-		ssize_t res, res2;
-		fd_set rfds;
+	for (con_id=0; con_id<net->n_tcp_connections; con_id++) {
+		struct tcp_connection *tc = &net->tcp_connections[con_id];
+		fd_set fds;
 		struct timeval tv;
 
-		if (received_packets_this_tick > max_packets_this_tick)
-			break;
-
-		if (!net->tcp_connections[con_id].in_use)
+		if (!tc->in_use || tc->state >= TCP_OUTSIDE_DISCONNECTED)
 			continue;
 
-		if (net->tcp_connections[con_id].socket < 0) {
+		if (tc->socket < 0) {
 			fatal("INTERNAL ERROR in net.c, tcp socket < 0"
 			    " but in use?\n");
 			continue;
 		}
 
-		if (net->tcp_connections[con_id].incoming_buf == NULL)
-			CHECK_ALLOCATION(net->tcp_connections[con_id].
-			    incoming_buf = (unsigned char *) malloc(TCP_INCOMING_BUF_LEN));
+		if (tc->state == TCP_OUTSIDE_TRYINGTOCONNECT) {
+			/*  Is the socket available for output?  */
+			FD_ZERO(&fds);
+			FD_SET(tc->socket, &fds);
+			tv.tv_sec = tv.tv_usec = 0;
+			if (select(tc->socket+1, NULL, &fds, NULL, &tv) < 1)
+				continue;
+
+			net_tcp_connected(net, nic, con_id);
+			if (tc->state != TCP_OUTSIDE_CONNECTED)
+				continue;
+		}
+
+		received_packets_this_tick += net_tcp_resend(net, nic, con_id,
+		    net_ip_rx_budget(nic, received_packets_this_tick,
+		    max_packets_this_tick));
 
-		if (net->tcp_connections[con_id].state >=
-		    TCP_OUTSIDE_DISCONNECTED)
+		if (tc->outside_eof || net_ip_rx_budget(nic,
+		    received_packets_this_tick, max_packets_this_tick) == 0)
 			continue;
 
-		/*  Is the socket available for output?  */
-		FD_ZERO(&rfds);		/*  write  */
-		FD_SET(net->tcp_connections[con_id].socket, &rfds);
+		/*  Is there incoming data available on the socket?  */
+		FD_ZERO(&fds);
+		FD_SET(tc->socket, &fds);
 		tv.tv_sec = tv.tv_usec = 0;
-		errno = 0;
-		res = select(net->tcp_connections[con_id].socket+1,
-		    NULL, &rfds, NULL, &tv);
+		if (select(tc->socket+1, &fds, NULL, NULL, &tv) > 0)
+			received_packets_this_tick += net_tcp_receive(net,
+			    nic, con_id, net_ip_rx_budget(nic,
+			    received_packets_this_tick, max_packets_this_tick));
+	}
+}
 
-		if (errno == ECONNREFUSED) {
-			fatal("[ ECONNREFUSED: TODO ]\n");
-			net->tcp_connections[con_id].state =
-			    TCP_OUTSIDE_DISCONNECTED;
-			fatal("CHANGING TO TCP_OUTSIDE_DISCONNECTED "
-			    "(refused connection)\n");
-			continue;
-		}
 
-		if (errno == ETIMEDOUT) {
-			fatal("[ ETIMEDOUT: TODO ]\n");
-			/*  TODO  */
-			net->tcp_connections[con_id].state =
-			    TCP_OUTSIDE_DISCONNECTED;
-			fatal("CHANGING TO TCP_OUTSIDE_DISCONNECTED "
-			    "(timeout)\n");
-			continue;
-		}
+#ifdef HAVE_EPOLL
+/*
+ *  net_ip_epoll_rx_avail():
+ *
+ *  Receive any available UDP and TCP packets (from the outside world).
+ *  Only the sockets which epoll reports as ready are looked at, so the
+ *  cost does not grow with the number of idle connections.
+ */
+static void net_ip_epoll_rx_avail(struct net *net, struct nic_data *nic)
+{
+	struct epoll_event events[NET_IP_MAX_EVENTS];
+	int received_packets_this_tick = 0;
+	int max_packets_this_tick = 200;
+	int i, n_events, con_id, n;
 
-		if (net->tcp_connections[con_id].state ==
-		    TCP_OUTSIDE_TRYINGTOCONNECT && res > 0) {
-			net->tcp_connections[con_id].state =
-			    TCP_OUTSIDE_CONNECTED;
-			debug("CHANGING TO TCP_OUTSIDE_CONNECTED\n");
-			net_ip_tcp_connectionreply(net, nic, con_id, 1,
-			    NULL, 0, 0);
-		}
+	n_events = epoll_wait(net->epoll_fd, events, NET_IP_MAX_EVENTS, 0);
 
-		if (net->tcp_connections[con_id].state ==
-		    TCP_OUTSIDE_CONNECTED && res < 1) {
-			continue;
-		}
+	for (i=0; i<n_events; i++) {
+		uint32_t id = events[i].data.u32;
+		uint32_t ev = events[i].events;
 
-		/*
-		 *  Does this connection have unacknowledged data?  Then, if
-		 *  enough number of rounds have passed, try to resend it using
-		 *  the old value of seqnr.
-		 */
-		if (net->tcp_connections[con_id].incoming_buf_len != 0) {
-			net->tcp_connections[con_id].incoming_buf_rounds ++;
-			if (net->tcp_connections[con_id].incoming_buf_rounds >
-			    10000) {
-				debug("  at seqnr %u but backing back to %u,"
-				    " resending %i bytes\n",
-				    net->tcp_connections[con_id].outside_seqnr,
-				    net->tcp_connections[con_id].
-				    incoming_buf_seqnr,
-				    net->tcp_connections[con_id].
-				    incoming_buf_len);
+		con_id = id & ~NET_IP_WATCH_TCP;
 
-				net->tcp_connections[con_id].
-				    incoming_buf_rounds = 0;
-				net->tcp_connections[con_id].outside_seqnr =
-				    net->tcp_connections[con_id].
-				    incoming_buf_seqnr;
-
-				net_ip_tcp_connectionreply(net, nic, con_id,
-				    0, net->tcp_connections[con_id].
-				    incoming_buf,
-				    net->tcp_connections[con_id].
-				    incoming_buf_len, 0);
-			}
-			continue;
-		}
+		if (!(id & NET_IP_WATCH_TCP)) {
+			if (con_id >= net->n_udp_connections ||
+			    !net->udp_connections[con_id].in_use)
+				continue;
 
-		/*  Don't receive unless the guest OS is ready!  */
-		if (((int32_t)net->tcp_connections[con_id].outside_seqnr -
-		    (int32_t)net->tcp_connections[con_id].inside_acknr) > 0) {
-/*			fatal("YOYO 1! outside_seqnr - inside_acknr = %i\n",
-			    net->tcp_connections[con_id].outside_seqnr -
-			    net->tcp_connections[con_id].inside_acknr);  */
+			while (net_ip_rx_budget(nic, received_packets_this_tick,
+			    max_packets_this_tick) > 0 &&
+			    (n = net_udp_receive(net, nic, con_id)) > 0)
+				received_packets_this_tick += n;
 			continue;
 		}
 
-		/*  Is there incoming data available on the socket?  */
-		FD_ZERO(&rfds);		/*  read  */
-		FD_SET(net->tcp_connections[con_id].socket, &rfds);
-		tv.tv_sec = tv.tv_usec = 0;
-		res2 = select(net->tcp_connections[con_id].socket+1, &rfds,
-		    NULL, NULL, &tv);
-
-		/*  No more incoming TCP data on this connection?  */
-		if (res2 < 1)
+		if (con_id >= net->n_tcp_connections ||
+		    !net->tcp_connections[con_id].in_use)
 			continue;
 
-		res = read(net->tcp_connections[con_id].socket, buf, 1400);
-		if (res > 0) {
-			/*  debug("\n -{- %lli -}-\n", (long long)res);  */
-			net->tcp_connections[con_id].incoming_buf_len = res;
-			net->tcp_connections[con_id].incoming_buf_rounds = 0;
-			net->tcp_connections[con_id].incoming_buf_seqnr = 
-			    net->tcp_connections[con_id].outside_seqnr;
-			debug("  putting %i bytes (seqnr %u) in the incoming "
-			    "buf\n", res, net->tcp_connections[con_id].
-			    incoming_buf_seqnr);
-			memcpy(net->tcp_connections[con_id].incoming_buf,
-			    buf, res);
-
-			net_ip_tcp_connectionreply(net, nic, con_id, 0,
-			    buf, res, 0);
-		} else if (res == 0) {
-			net->tcp_connections[con_id].state =
-			    TCP_OUTSIDE_DISCONNECTED;
-			debug("CHANGING TO TCP_OUTSIDE_DISCONNECTED, read"
-			    " res=0\n");
-			net_ip_tcp_connectionreply(net, nic, con_id, 0,
-			    NULL, 0, 0);
-		} else {
-			net->tcp_connections[con_id].state =
-			    TCP_OUTSIDE_DISCONNECTED;
-			fatal("CHANGING TO TCP_OUTSIDE_DISCONNECTED, "
-			    "read res<=0, errno = %i\n", errno);
-			net_ip_tcp_connectionreply(net, nic, con_id, 0,
-			    NULL, 0, 0);
+		switch (net->tcp_connections[con_id].state) {
+		case TCP_OUTSIDE_TRYINGTOCONNECT:
+			if (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+				net_tcp_connected(net, nic, con_id);
+			break;
+		case TCP_OUTSIDE_CONNECTED:
+			/*  Left unread if over budget; epoll is level-
+			    triggered, so this socket is reported again.  */
+			if (ev & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				received_packets_this_tick += net_tcp_receive(
+				    net, nic, con_id, net_ip_rx_budget(nic,
+				    received_packets_this_tick,
+				    max_packets_this_tick));
+			break;
+		default:
+			net_ip_unwatch(net,
+			    net->tcp_connections[con_id].socket);
 		}
-
-		net->timestamp ++;
-		net->tcp_connections[con_id].last_used_timestamp =
-		    net->timestamp;
 	}
+
+	/*  Resending does not involve the sockets, so this is cheap:  */
+	for (con_id=0; con_id<net->n_tcp_connections; con_id++)
+		if (net->tcp_connections[con_id].in_use &&
+		    net->tcp_connections[con_id].state ==
+		    TCP_OUTSIDE_CONNECTED)
+			received_packets_this_tick += net_tcp_resend(net, nic,
+			    con_id, net_ip_rx_budget(nic,
+			    received_packets_this_tick, max_packets_this_tick));
 }
+#endif
+
 
+/*
+ *  net_ip_rx_avail():
+ *
+ *  Receive any available UDP and TCP packets (from the outside world), and
+ *  turn them into ethernet packets for the emulated NIC.
+ */
+void net_ip_rx_avail(struct net *net, struct nic_data *nic)
+{
+#ifdef HAVE_EPOLL
+	if (net->epoll_fd >= 0) {
+		net_ip_epoll_rx_avail(net, nic);
+		return;
+	}
+#endif
 
+	net_udp_rx_avail(net, nic);
+	net_tcp_rx_avail(net, nic);
+}
@@ -0,0 +1,261 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Packet buffers and per-NIC packet queues.
+ *
+ *  Packets on their way to an emulated NIC are kept in buffers from a pool
+ *  owned by the net, so that under sustained traffic no memory needs to be
+ *  allocated per packet. Each NIC has its own ring queue of incoming
+ *  packets, so that receiving is O(1) regardless of how many NICs (and
+ *  how many queued packets for other NICs) there are.
+ *
+ *  A queue is a single-producer, single-consumer ring: the producer only
+ *  writes the tail index and the consumer only writes the head index, and
+ *  a slot is published (by moving the tail) only after the packet in it has
+ *  been filled in. The queues are thus safe to use with the producer (e.g.
+ *  the NAT gateway or a tap device) and the consumer (the NIC) in different
+ *  threads. The buffer pool itself is not thread-safe.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "misc.h"
+#include "net.h"
+
+
+#ifdef __GNUC__
+#define	LOAD_ACQUIRE(x)		__atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define	STORE_RELEASE(x,v)	__atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#else
+#define	LOAD_ACQUIRE(x)		(x)
+#define	STORE_RELEASE(x,v)	((x) = (v))
+#endif
+
+
+/*
+ *  net_packet_alloc():
+ *
+ *  Allocates a packet buffer of len bytes, filled with zeroes. Once the
+ *  packet has been filled in, it should be passed to net_packet_enqueue()
+ *  (or freed with net_packet_free()).
+ */
+struct net_packet *net_packet_alloc(struct net *net, size_t len)
+{
+	struct net_packet *p;
+	size_t buf_size = NET_PACKET_BUF_SIZE;
+
+	net->n_packet_allocs ++;
+
+	if (len <= NET_PACKET_BUF_SIZE && net->free_packets != NULL) {
+		p = net->free_packets;
+		net->free_packets = p->next_free;
+		p->next_free = NULL;
+		p->len = len;
+		memset(p->data, 0, len);
+		return p;
+	}
+
+	if (len > NET_PACKET_BUF_SIZE) {
+		buf_size = len;
+		net->n_packet_pool_misses ++;
+	} else
+		net->n_packet_buffers ++;
+
+	CHECK_ALLOCATION(p = (struct net_packet *) malloc(
+	    sizeof(struct net_packet) + buf_size));
+
+	p->next_free = NULL;
+	p->buf_size = buf_size;
+	p->len = len;
+	p->data = (unsigned char *) (p + 1);
+	memset(p->data, 0, len);
+
+	return p;
+}
+
+
+/*
+ *  net_packet_free():
+ *
+ *  Returns a packet buffer to the pool.
+ */
+void net_packet_free(struct net *net, struct net_packet *p)
+{
+	if (p->buf_size != NET_PACKET_BUF_SIZE) {
+		free(p);
+		return;
+	}
+
+	p->next_free = net->free_packets;
+	net->free_packets = p;
+}
+
+
+/*
+ *  net_packet_queue_init():
+ *
+ *  Allocates the incoming packet queue of a NIC.
+ */
+void net_packet_queue_init(struct nic_data *nic)
+{
+	CHECK_ALLOCATION(nic->queue = (struct net_packet_queue *)
+	    malloc(sizeof(struct net_packet_queue)));
+	memset(nic->queue, 0, sizeof(struct net_packet_queue));
+}
+
+
+/*
+ *  net_packet_enqueue():
+ *
+ *  Adds a packet to a NIC's incoming queue. If the queue is full (or the
+ *  packet is not for any NIC on the net), the packet is dropped.
+ */
+void net_packet_enqueue(struct net *net, struct nic_data *nic,
+	struct net_packet *p)
+{
+	struct net_packet_queue *q;
+	unsigned int head, tail, depth;
+
+	if (nic == NULL || nic->queue == NULL) {
+		net_packet_free(net, p);
+		return;
+	}
+
+	q = nic->queue;
+	tail = q->tail;
+	head = LOAD_ACQUIRE(q->head);
+	depth = (tail - head) & (NET_PACKET_QUEUE_LEN - 1);
+
+	if (depth == NET_PACKET_QUEUE_LEN - 1) {
+		q->n_dropped ++;
+		debugmsg(SUBSYS_NET, "queue", VERBOSITY_DEBUG,
+		    "queue full, dropping a %i-byte packet", p->len);
+		net_packet_free(net, p);
+		return;
+	}
+
+	q->slot[tail] = p;
+	STORE_RELEASE(q->tail, (tail + 1) & (NET_PACKET_QUEUE_LEN - 1));
+
+	q->n_enqueued ++;
+	if (depth + 1 > q->max_depth)
+		q->max_depth = depth + 1;
+}
+
+
+/*
+ *  net_packet_dequeue():
+ *
+ *  Removes the first packet from a NIC's incoming queue, and returns it.
+ *  Returns NULL if the queue is empty.
+ */
+struct net_packet *net_packet_dequeue(struct nic_data *nic)
+{
+	struct net_packet_queue *q = nic->queue;
+	struct net_packet *p;
+	unsigned int head;
+
+	if (q == NULL)
+		return NULL;
+
+	head = q->head;
+	if (head == LOAD_ACQUIRE(q->tail))
+		return NULL;
+
+	p = q->slot[head];
+	STORE_RELEASE(q->head, (head + 1) & (NET_PACKET_QUEUE_LEN - 1));
+
+	return p;
+}
+
+
+bool net_packet_queue_empty(struct nic_data *nic)
+{
+	struct net_packet_queue *q = nic->queue;
+
+	return q == NULL || q->head == LOAD_ACQUIRE(q->tail);
+}
+
+
+/*
+ *  net_packet_queue_space():
+ *
+ *  Returns the number of packets which can be added to a NIC's incoming
+ *  queue before it is full.
+ */
+int net_packet_queue_space(struct nic_data *nic)
+{
+	struct net_packet_queue *q;
+	unsigned int depth;
+
+	if (nic == NULL || nic->queue == NULL)
+		return 0;
+
+	q = nic->queue;
+	depth = (q->tail - LOAD_ACQUIRE(q->head)) & (NET_PACKET_QUEUE_LEN - 1);
+
+	return NET_PACKET_QUEUE_LEN - 1 - depth;
+}
+
+
+/*
+ *  net_packet_dumpinfo():
+ *
+ *  Prints packet buffer and queue statistics.
+ */
+void net_packet_dumpinfo(struct net *net)
+{
+	int n_free = 0;
+
+	if (net->n_nics == 0)
+		return;
+
+	for (struct net_packet *p = net->free_packets; p != NULL;
+	    p = p->next_free)
+		n_free ++;
+
+	debug("packet buffers: %i allocated, %i free in the pool, %llu"
+	    " allocations (%llu too large for the pool)\n",
+	    net->n_packet_buffers, n_free,
+	    (unsigned long long) net->n_packet_allocs,
+	    (unsigned long long) net->n_packet_pool_misses);
+
+	for (int i = 0; i < net->n_nics; i++) {
+		struct net_packet_queue *q = net->nic_data[i]->queue;
+
+		debug("nic %i: ", i);
+		net_debugaddr(net->nic_data[i]->mac_address,
+		    NET_ADDR_ETHERNET);
+		debug(": %llu packets queued, %llu dropped, queue depth %u"
+		    " (max %u)\n", (unsigned long long) q->n_enqueued,
+		    (unsigned long long) q->n_dropped,
+		    (q->tail - q->head) & (NET_PACKET_QUEUE_LEN - 1),
+		    q->max_depth);
+	}
+}
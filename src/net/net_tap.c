@@ -56,7 +56,7 @@
 static void net_tap_rx_for_nic(struct net *net, struct nic_data *nic,
 	unsigned char *buf, ssize_t size)
 {
-	struct ethernet_packet_link *lp;
+	struct net_packet *lp;
 
 	/*
 	 * We should deliver to the interface if:
@@ -80,8 +80,9 @@ static void net_tap_rx_for_nic(struct net *net, struct nic_data *nic,
 
 	if (nic->promiscuous_mode ||
 	    net_ether_multicast(buf) || net_ether_eq(nic->mac_address, buf)) {
-		lp = net_allocate_ethernet_packet_link(net, nic, (int)size);
+		lp = net_packet_alloc(net, size);
 		memcpy(lp->data, buf, size);
+		net_packet_enqueue(net, nic, lp);
 	}
 }
 
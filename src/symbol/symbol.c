@@ -40,6 +40,144 @@
 
 #define	SYMBOLBUF_MAX	100
 
+#define	SYMBOL_MIN_HASH_SIZE	1024
+
+
+/*
+ *  symbol_name_hash():
+ *
+ *  FNV-1a hash of a symbol name.
+ */
+static uint32_t symbol_name_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name) {
+		h ^= (unsigned char) *name++;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+
+/*
+ *  symbol_rehash():
+ *
+ *  Rebuilds the name hash table, growing it if necessary. Must be called
+ *  whenever symbols have moved within the symbol array (i.e. after sorting).
+ */
+static void symbol_rehash(struct symbol_context *sc)
+{
+	int i, n = SYMBOL_MIN_HASH_SIZE;
+
+	while (n < sc->n_symbols * 2)
+		n <<= 1;
+
+	if (n != sc->n_name_hash) {
+		free(sc->name_hash);
+		CHECK_ALLOCATION(sc->name_hash = (int *) malloc(sizeof(int) * n));
+		sc->n_name_hash = n;
+	}
+
+	memset(sc->name_hash, 0, sizeof(int) * n);
+
+	for (i=sc->n_symbols-1; i>=0; i--) {
+		struct symbol *s = &sc->symbols[i];
+		uint32_t h = symbol_name_hash(s->name) & (n - 1);
+
+		s->next_in_hash = sc->name_hash[h];
+		sc->name_hash[h] = i + 1;
+	}
+}
+
+
+/*
+ *  symbol_find_by_name():
+ *
+ *  Returns the symbol with the exact (raw) name, or NULL. If several symbols
+ *  have the same name, the one with the lowest address is returned. (The
+ *  order of the hash chains depends on when the table was last rebuilt, so
+ *  the whole chain is checked, to give the same answer every time.)
+ */
+static struct symbol *symbol_find_by_name(struct symbol_context *sc,
+	const char *name)
+{
+	struct symbol *found = NULL;
+	int i;
+
+	if (sc->n_name_hash == 0)
+		return NULL;
+
+	i = sc->name_hash[symbol_name_hash(name) & (sc->n_name_hash - 1)];
+	while (i != 0) {
+		struct symbol *s = &sc->symbols[i - 1];
+		if (strcmp(name, s->name) == 0 &&
+		    (found == NULL || s->addr < found->addr))
+			found = s;
+		i = s->next_in_hash;
+	}
+
+	return found;
+}
+
+
+/*
+ *  symbol_intern():
+ *
+ *  Returns a pointer to a copy of name in the string pool. Names which are
+ *  already used by another symbol are only stored once.
+ */
+static const char *symbol_intern(struct symbol_context *sc, const char *name)
+{
+	struct symbol *s = symbol_find_by_name(sc, name);
+	size_t len = strlen(name) + 1;
+	char *p;
+
+	if (s != NULL)
+		return s->name;
+
+	/*  Really long names get their own allocation:  */
+	if (len > SYMBOL_STRPOOL_CHUNKSIZE / 4) {
+		CHECK_ALLOCATION(p = strdup(name));
+		return p;
+	}
+
+	if (sc->strpool == NULL ||
+	    sc->strpool->used + len > SYMBOL_STRPOOL_CHUNKSIZE) {
+		struct symbol_strpool *chunk;
+		CHECK_ALLOCATION(chunk = (struct symbol_strpool *)
+		    malloc(sizeof(struct symbol_strpool)));
+		chunk->used = 0;
+		chunk->next = sc->strpool;
+		sc->strpool = chunk;
+	}
+
+	p = sc->strpool->data + sc->strpool->used;
+	memcpy(p, name, len);
+	sc->strpool->used += len;
+
+	return p;
+}
+
+
+/*
+ *  symbol_display_name():
+ *
+ *  Returns the name of a symbol as it should be shown to the user. C++
+ *  names are demangled the first time they are displayed.
+ */
+static const char *symbol_display_name(struct symbol *s)
+{
+	if (s->demangled == NULL) {
+		s->demangled = symbol_demangle_cplusplus(s->name);
+		if (s->demangled == NULL)
+			s->demangled = (char *) s->name;
+	}
+
+	return s->demangled;
+}
+
 
 /*
  *  symbol_nsymbols():
@@ -56,38 +194,92 @@ int symbol_nsymbols(struct symbol_context *sc)
  *  get_symbol_addr():
  *
  *  Find a symbol by name. If addr is non-NULL, *addr is set to the symbol's
- *  address. Return value is 1 if the symbol is found, 0 otherwise.
+ *  address. Return value is 1 if the symbol is found, 0 otherwise. If
+ *  several symbols have the same name, the lowest address is returned.
  *
- *  NOTE:  This is O(n).
+ *  Raw names are looked up via the name hash table. If that fails, the
+ *  name may be a demangled C++ name, which requires a (slow) scan of all
+ *  mangled names.
  */
 int get_symbol_addr(struct symbol_context *sc, const char *symbol, uint64_t *addr)
 {
-	struct symbol *s;
+	struct symbol *s = symbol_find_by_name(sc, symbol);
+	int i;
 
-	if (sc->sorted_array) {
-		int i;
-		for (i=0; i<sc->n_symbols; i++)
-			if (strcmp(symbol, sc->first_symbol[i].name) == 0) {
-				if (addr != NULL)
-					*addr = sc->first_symbol[i].addr;
-				return 1;
-			}
-	} else {
-		s = sc->first_symbol;
-		while (s != NULL) {
-			if (strcmp(symbol, s->name) == 0) {
-				if (addr != NULL)
-					*addr = s->addr;
-				return 1;
-			}
-			s = s->next;
+	if (s == NULL && strchr(symbol, ':') != NULL) {
+		for (i=0; i<sc->n_symbols; i++) {
+			struct symbol *tmp = &sc->symbols[i];
+			if (tmp->name[0] == '_' && tmp->name[1] == 'Z' &&
+			    (s == NULL || tmp->addr < s->addr) &&
+			    strcmp(symbol, symbol_display_name(tmp)) == 0)
+				s = tmp;
 		}
 	}
 
+	if (s == NULL)
+		return 0;
+
+	if (addr != NULL)
+		*addr = s->addr;
+
+	return 1;
+}
+
+
+/*
+ *  sym_addr_compare():
+ *
+ *  Helper function for sorting symbols according to their address.
+ */
+int sym_addr_compare(const void *a, const void *b)
+{
+	struct symbol *p1 = (struct symbol *) a;
+	struct symbol *p2 = (struct symbol *) b;
+
+	if (p1->addr < p2->addr)
+		return -1;
+	if (p1->addr > p2->addr)
+		return 1;
+
 	return 0;
 }
 
 
+/*
+ *  symbol_sort():
+ *
+ *  Sorts the symbol array according to address, and recalculates the size
+ *  of symbols that have size = 0. Sizes calculated by an earlier sort are
+ *  recalculated too, since a symbol added since then may have ended up
+ *  between a symbol and its old successor.
+ */
+static void symbol_sort(struct symbol_context *sc)
+{
+	int i;
+
+	qsort(sc->symbols, sc->n_symbols, sizeof(struct symbol),
+	    sym_addr_compare);
+
+	for (i=0; i<sc->n_symbols; i++) {
+		/*  Recalculate size, if 0:  */
+		if (sc->symbols[i].len == 0 || sc->symbols[i].len_computed) {
+			uint64_t len;
+			if (i != sc->n_symbols-1)
+				len = sc->symbols[i+1].addr
+				    - sc->symbols[i].addr;
+			else
+				len = 1;
+
+			sc->symbols[i].len = len;
+			sc->symbols[i].len_computed = 1;
+		}
+	}
+
+	sc->n_sorted = sc->n_symbols;
+	symbol_rehash(sc);
+}
+
+
 /*
  *  get_symbol_name_and_n_args():
  *
@@ -122,18 +314,25 @@ char *get_symbol_name_and_n_args(struct symbol_context *sc, uint64_t addr,
 	if (offset != NULL)
 		*offset = 0;
 
+	/*  Symbols added since the array was last sorted?  */
+	if (sc->sorted_array && sc->n_sorted != sc->n_symbols)
+		symbol_sort(sc);
+
 	if (!sc->sorted_array) {
-		/*  Slow, linear O(n) search:  */
-		s = sc->first_symbol;
-		while (s != NULL) {
+		/*  Slow, linear O(n) search, most recently added first:  */
+		int i;
+		for (i=sc->n_symbols-1; i>=0; i--) {
+			s = &sc->symbols[i];
+
 			/*  Found a match?  */
 			if (addr >= s->addr && addr < s->addr + s->len) {
 				if (addr == s->addr)
 					snprintf(symbol_buf, SYMBOLBUF_MAX,
-					    "%s", s->name);
+					    "%s", symbol_display_name(s));
 				else
 					snprintf(symbol_buf, SYMBOLBUF_MAX,
-					    "%s+0x%" PRIx64, s->name, (uint64_t)
+					    "%s+0x%" PRIx64,
+					    symbol_display_name(s), (uint64_t)
 					    (addr - s->addr));
 				if (offset != NULL)
 					*offset = addr - s->addr;
@@ -141,14 +340,13 @@ char *get_symbol_name_and_n_args(struct symbol_context *sc, uint64_t addr,
 					*n_argsp = s->n_args;
 				return symbol_buf;
 			}
-			s = s->next;
 		}
 	} else {
 		/*  Faster, O(log n) search:  */
 		int lowest = 0, highest = sc->n_symbols - 1;
 		while (lowest <= highest) {
 			int ofs = (lowest + highest) / 2;
-			s = sc->first_symbol + ofs;
+			s = sc->symbols + ofs;
 
 			/*  Found a match?  */
 			if (addr >= s->addr && addr <= s->addr + (s->len - 1)) {
@@ -156,13 +354,13 @@ char *get_symbol_name_and_n_args(struct symbol_context *sc, uint64_t addr,
 					snprintf(symbol_buf, SYMBOLBUF_MAX,
 					    "%s%s%s",
 					    color_symbol_ptr(),
-					    s->name,
+					    symbol_display_name(s),
 					    color_normal_ptr());
 				else
 					snprintf(symbol_buf, SYMBOLBUF_MAX,
 					    "%s%s%s+0x%" PRIx64,
 					    color_symbol_ptr(),
-					    s->name,
+					    symbol_display_name(s),
 					    color_normal_ptr(),
 					    (uint64_t) (addr - s->addr));
 
@@ -206,12 +404,7 @@ void add_symbol_name(struct symbol_context *sc,
 	uint64_t addr, uint64_t len, const char *name, int type, int n_args)
 {
 	struct symbol *s;
-
-	if (sc->sorted_array) {
-		fprintf(stderr, "add_symbol_name(): Internal error: the "
-		    "symbol array is already sorted\n");
-		exit(1);
-	}
+	uint32_t h;
 
 	if (name == NULL) {
 		fprintf(stderr, "add_symbol_name(): name = NULL\n");
@@ -257,24 +450,32 @@ void add_symbol_name(struct symbol_context *sc,
 	if ((addr >> 32) == 0 && (addr & 0x80000000ULL))
 		addr |= 0xffffffff00000000ULL;
 
-	CHECK_ALLOCATION(s = (struct symbol *) malloc(sizeof(struct symbol)));
-	memset(s, 0, sizeof(struct symbol));
+	if (sc->n_symbols >= sc->max_symbols) {
+		sc->max_symbols = sc->max_symbols == 0 ? 1024
+		    : sc->max_symbols * 2;
+		CHECK_ALLOCATION(sc->symbols = (struct symbol *) realloc(
+		    sc->symbols, sizeof(struct symbol) * sc->max_symbols));
+	}
 
-	s->name = symbol_demangle_cplusplus(name);
+	/*  Grow the name hash table when it becomes too crowded:  */
+	if (sc->n_symbols >= sc->n_name_hash / 2)
+		symbol_rehash(sc);
 
-	if (s->name == NULL)
-		CHECK_ALLOCATION(s->name = strdup(name));
+	s = &sc->symbols[sc->n_symbols];
+	memset(s, 0, sizeof(struct symbol));
 
+	s->name   = symbol_intern(sc, name);
 	s->addr   = addr;
 	s->len    = len;
 	s->type   = type;
 	s->n_args = n_args;
 
-	sc->n_symbols ++;
+	/*  Add to the hash chain:  */
+	h = symbol_name_hash(s->name) & (sc->n_name_hash - 1);
+	s->next_in_hash = sc->name_hash[h];
+	sc->name_hash[h] = sc->n_symbols + 1;
 
-	/*  Add first in list:  */
-	s->next = sc->first_symbol;
-	sc->first_symbol = s;
+	sc->n_symbols ++;
 }
 
 
@@ -339,77 +540,18 @@ void symbol_readfile(struct symbol_context *sc, char *fname)
 }
 
 
-/*
- *  sym_addr_compare():
- *
- *  Helper function for sorting symbols according to their address.
- */
-int sym_addr_compare(const void *a, const void *b)
-{
-	struct symbol *p1 = (struct symbol *) a;
-	struct symbol *p2 = (struct symbol *) b;
-
-	if (p1->addr < p2->addr)
-		return -1;
-	if (p1->addr > p2->addr)
-		return 1;
-
-	return 0;
-}
-
-
 /*
  *  symbol_recalc_sizes():
  *
- *  Recalculate sizes of symbols that have size = 0, by creating an array
- *  containing all symbols, qsort()-ing that array according to address, and
- *  recalculating the size fields if necessary.
+ *  Sort the symbol array according to address, and recalculate the size
+ *  fields of symbols that have size = 0. After this, address lookups use
+ *  binary search. Symbols may still be added; they are sorted in, and the
+ *  calculated sizes updated, when the next address lookup is done.
  */
 void symbol_recalc_sizes(struct symbol_context *sc)
 {
-	struct symbol *tmp_array;
-	struct symbol *last_ptr;
-	struct symbol *tmp_ptr;
-	int i;
-
-	CHECK_ALLOCATION(tmp_array = (struct symbol *) malloc(sizeof (struct symbol) *
-	    sc->n_symbols));
-
-	/*  Copy first_symbol --> tmp_array, and remove the old
-		first_symbol at the same time:  */
-	tmp_ptr = sc->first_symbol;
-	i = 0;
-	while (tmp_ptr != NULL) {
-		tmp_array[i] = *tmp_ptr;
-		last_ptr = tmp_ptr;
-		tmp_ptr = tmp_ptr->next;
-		free(last_ptr);
-		i++;
-	}
-
-	qsort(tmp_array, sc->n_symbols, sizeof(struct symbol),
-	    sym_addr_compare);
+	symbol_sort(sc);
 	sc->sorted_array = 1;
-
-	/*  Recreate the first_symbol chain:  */
-	sc->first_symbol = NULL;
-	for (i=0; i<sc->n_symbols; i++) {
-		/*  Recalculate size, if 0:  */
-		if (tmp_array[i].len == 0) {
-			uint64_t len;
-			if (i != sc->n_symbols-1)
-				len = tmp_array[i+1].addr
-				    - tmp_array[i].addr;
-			else
-				len = 1;
-
-			tmp_array[i].len = len;
-		}
-
-		tmp_array[i].next = &tmp_array[i+1];
-	}
-
-	sc->first_symbol = tmp_array;
 }
 
 
@@ -420,8 +562,5 @@ void symbol_recalc_sizes(struct symbol_context *sc)
  */
 void symbol_init(struct symbol_context *sc)
 {
-	sc->first_symbol = NULL;
-	sc->sorted_array = 0;
-	sc->n_symbols = 0;
+	memset(sc, 0, sizeof(struct symbol_context));
 }
-
@@ -0,0 +1,275 @@
+/*
+ *  GXemul floating point conversion tests.
+ *
+ *  This file is in the Public Domain.
+ *
+ *  Checks the emulator's IEEE conversion routines (src/core/float_emul.c)
+ *  against the host's own IEEE arithmetic, for special values and for
+ *  random bit patterns, and checks the rounding modes and exception flags of
+ *  strict mode. Also measures how long the conversions take.
+ *
+ *  Build and run with "make conv" (after building the emulator).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "float_emul.h"
+
+
+#define	N_RANDOM	1000000
+#define	N_TIMED		10000000
+
+
+static int n_failed = 0;
+
+
+/*  float_emul.c reports unimplemented formats with fatal():  */
+void fatal(const char *fmt, ...)
+{
+	va_list argp;
+
+	va_start(argp, fmt);
+	vfprintf(stderr, fmt, argp);
+	va_end(argp);
+}
+
+
+static void fail(const char *what, uint64_t x, uint64_t got, uint64_t expected)
+{
+	if (n_failed++ < 20)
+		printf("FAIL: %s 0x%016llx: got 0x%016llx, expected 0x%016llx\n",
+		    what, (unsigned long long) x, (unsigned long long) got,
+		    (unsigned long long) expected);
+}
+
+
+static uint64_t random64(void)
+{
+	return ((uint64_t) (random() & 0xffff) << 48) |
+	    ((uint64_t) (random() & 0xffff) << 32) |
+	    ((uint64_t) (random() & 0xffff) << 16) | (random() & 0xffff);
+}
+
+
+/*
+ *  Round trip: interpreting a value and storing it again must give the same
+ *  bits back, except for NaNs, which become the default NaN (with the same
+ *  sign as the host's NaN).
+ */
+static void check_single(uint32_t x)
+{
+	struct ieee_float_value fv;
+	uint64_t r;
+	float f;
+
+	memcpy(&f, &x, sizeof(f));
+	ieee_interpret_float_value(x, &fv, IEEE_FMT_S);
+
+	if (fv.nan != (f != f))
+		fail("single nan", x, fv.nan, f != f);
+
+	if (fv.nan)
+		return;
+
+	if (fv.f != (double) f)
+		fail("single value", x, fv.f, f);
+
+	r = ieee_store_float_value(fv.f, IEEE_FMT_S);
+	if (r != x)
+		fail("single round trip", x, r, x);
+}
+
+
+static void check_double(uint64_t x)
+{
+	struct ieee_float_value fv;
+	uint64_t r;
+	double d;
+
+	memcpy(&d, &x, sizeof(d));
+	ieee_interpret_float_value(x, &fv, IEEE_FMT_D);
+
+	if (fv.nan != (d != d))
+		fail("double nan", x, fv.nan, d != d);
+
+	if (fv.nan)
+		return;
+
+	r = ieee_store_float_value(fv.f, IEEE_FMT_D);
+	if (r != x)
+		fail("double round trip", x, r, x);
+}
+
+
+/*
+ *  Conversion from double to single must round to nearest (the host's
+ *  default rounding mode).
+ */
+static void check_double_to_single(uint64_t x)
+{
+	uint64_t r;
+	uint32_t expected;
+	double d;
+	float f;
+
+	memcpy(&d, &x, sizeof(d));
+	if (d != d)
+		return;
+
+	f = d;
+	memcpy(&expected, &f, sizeof(expected));
+
+	r = ieee_store_float_value(d, IEEE_FMT_S);
+	if (r != expected)
+		fail("double to single", x, r, expected);
+}
+
+
+static void check_strict(const char *what, int rounding_mode, double a,
+	double b, int fmt, uint64_t expected, int expected_exceptions)
+{
+	volatile double va = a, vb = b;
+	uint64_t r;
+	int exceptions;
+
+	ieee_strict = true;
+	ieee_strict_begin(rounding_mode);
+	r = ieee_store_float_value(va / vb, fmt);
+	exceptions = ieee_strict_end();
+	ieee_strict = false;
+
+	if (r != expected)
+		fail(what, rounding_mode, r, expected);
+	if (exceptions != expected_exceptions)
+		fail(what, rounding_mode, exceptions, expected_exceptions);
+}
+
+
+static double seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t singles[] = {
+		0x00000000, 0x80000000, 0x3f800000, 0xbf800000,
+		0x3e2e147b, 0x42280000, 0x7f7fffff, 0xff7fffff,
+		0x00800000, 0x007fffff, 0x00000001, 0x80000001,
+		0x7f800000, 0xff800000, 0x7fc00000, 0x7fffffff,
+		0x7f800001, 0xffc01234 };
+	static const uint64_t doubles[] = {
+		0x0000000000000000ULL, 0x8000000000000000ULL,
+		0x3ff0000000000000ULL, 0xbff0000000000000ULL,
+		0x3fc5c28f5c28f5c3ULL, 0x4045000000000000ULL,
+		0x7fefffffffffffffULL, 0xffefffffffffffffULL,
+		0x0010000000000000ULL, 0x000fffffffffffffULL,
+		0x0000000000000001ULL, 0x8000000000000001ULL,
+		0x7ff0000000000000ULL, 0xfff0000000000000ULL,
+		0x7ff8000000000000ULL, 0x7fffffffffffffffULL,
+		0x7ff0000000000001ULL, 0x47efffffefffffffULL,
+		0x47effffff0000000ULL, 0x36a0000000000000ULL };
+	struct ieee_float_value fv;
+	volatile uint64_t sink = 0;
+	volatile double zero = 0.0;
+	uint64_t default_nan;
+	double t;
+	size_t i;
+
+	/*  NaNs are stored with the sign of the host's NaN:  */
+	default_nan = signbit(zero / zero)? 0xffffffffffffffffULL :
+	    0x7fffffffffffffffULL;
+
+	srandom(1);
+
+	printf("special values: ");
+	for (i = 0; i < sizeof(singles) / sizeof(singles[0]); i++)
+		check_single(singles[i]);
+	for (i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++) {
+		check_double(doubles[i]);
+		check_double_to_single(doubles[i]);
+	}
+	printf("%s\n", n_failed? "FAILED" : "ok");
+
+	printf("random values: ");
+	for (i = 0; i < N_RANDOM; i++) {
+		uint64_t x = random64();
+		check_single(x);
+		check_double(x);
+		check_double_to_single(x);
+	}
+	printf("%s\n", n_failed? "FAILED" : "ok");
+
+	printf("integers: ");
+	ieee_interpret_float_value(0xfffffffeULL, &fv, IEEE_FMT_W);
+	if (fv.f != -2.0)
+		fail("word", 0xfffffffeULL, fv.f, -2);
+	if (ieee_store_float_value(-2.7, IEEE_FMT_W) != 0xfffffffeULL)
+		fail("word", 0, ieee_store_float_value(-2.7, IEEE_FMT_W),
+		    0xfffffffeULL);
+	if (ieee_store_float_value(1e12, IEEE_FMT_L) != 1000000000000ULL)
+		fail("long", 0, ieee_store_float_value(1e12, IEEE_FMT_L),
+		    1000000000000ULL);
+	printf("%s\n", n_failed? "FAILED" : "ok");
+
+	printf("strict mode: ");
+	check_strict("1/3 nearest", IEEE_ROUND_NEAREST, 1.0, 3.0, IEEE_FMT_S,
+	    0x3eaaaaab, IEEE_EXC_INEXACT);
+	check_strict("1/3 zero", IEEE_ROUND_ZERO, 1.0, 3.0, IEEE_FMT_S,
+	    0x3eaaaaaa, IEEE_EXC_INEXACT);
+	check_strict("1/3 up", IEEE_ROUND_UP, 1.0, 3.0, IEEE_FMT_S,
+	    0x3eaaaaab, IEEE_EXC_INEXACT);
+	check_strict("-1/3 down", IEEE_ROUND_DOWN, -1.0, 3.0, IEEE_FMT_D,
+	    0xbfd5555555555556ULL, IEEE_EXC_INEXACT);
+	check_strict("-1/3 up", IEEE_ROUND_UP, -1.0, 3.0, IEEE_FMT_D,
+	    0xbfd5555555555555ULL, IEEE_EXC_INEXACT);
+	check_strict("1/4", IEEE_ROUND_NEAREST, 1.0, 4.0, IEEE_FMT_S,
+	    0x3e800000, 0);
+	check_strict("1/0", IEEE_ROUND_NEAREST, 1.0, 0.0, IEEE_FMT_D,
+	    0x7ff0000000000000ULL, IEEE_EXC_DIVBYZERO);
+	check_strict("0/0", IEEE_ROUND_NEAREST, 0.0, 0.0, IEEE_FMT_D,
+	    default_nan, IEEE_EXC_INVALID);
+	check_strict("overflow", IEEE_ROUND_NEAREST, 1e300, 1e-10, IEEE_FMT_S,
+	    0x7f800000, IEEE_EXC_OVERFLOW | IEEE_EXC_INEXACT);
+	check_strict("overflow, zero", IEEE_ROUND_ZERO, 1e300, 1e-10,
+	    IEEE_FMT_S, 0x7f7fffff, IEEE_EXC_OVERFLOW | IEEE_EXC_INEXACT);
+	check_strict("underflow", IEEE_ROUND_NEAREST, 1e-40, 3.0, IEEE_FMT_S,
+	    0x00005ceb, IEEE_EXC_UNDERFLOW | IEEE_EXC_INEXACT);
+	check_strict("word range", IEEE_ROUND_NEAREST, 1e10, 1.0, IEEE_FMT_W,
+	    0x7fffffff, IEEE_EXC_INVALID);
+	printf("%s\n", n_failed? "FAILED" : "ok");
+
+	/*  Performance:  */
+	t = seconds();
+	for (i = 0; i < N_TIMED; i++) {
+		ieee_interpret_float_value(0x3fc5c28f5c28f5c3ULL + i, &fv,
+		    IEEE_FMT_D);
+		sink += ieee_store_float_value(fv.f, IEEE_FMT_D);
+	}
+	t = seconds() - t;
+	printf("double interpret+store: %.1f ns\n", t * 1e9 / N_TIMED);
+
+	t = seconds();
+	for (i = 0; i < N_TIMED; i++) {
+		ieee_interpret_float_value(0x3e2e147b + (i & 0xffff), &fv,
+		    IEEE_FMT_S);
+		sink += ieee_store_float_value(fv.f, IEEE_FMT_S);
+	}
+	t = seconds() - t;
+	printf("single interpret+store: %.1f ns\n", t * 1e9 / N_TIMED);
+
+	if (n_failed) {
+		printf("%i tests FAILED\n", n_failed);
+		return 1;
+	}
+
+	return 0;
+}
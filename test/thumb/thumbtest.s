@@ -0,0 +1,481 @@
+/*
+ *  GXemul Thumb instruction tests.
+ *
+ *  This file is in the Public Domain.
+ *
+ *  Each test leaves a result in r0, which is compared against the expected
+ *  value. A '.' is printed for every test which passes, and the number of
+ *  the test (in hex) for every test which fails. The condition flags are
+ *  read by getflags (ARM code, called with blx) into r5, as NZCV in the
+ *  low 4 bits.
+ *
+ *  r6 = test number, r7 = number of failed tests. CHECK changes r1.
+ */
+
+	.syntax	unified
+	.text
+
+	.macro	CHECK expected
+	ldr	r1, =\expected
+	bl	check
+	.endm
+
+	.macro	CHECKFLAGS expected
+	movs	r0, r5
+	CHECK	\expected
+	.endm
+
+	/*  Shifts r0 left one step, and sets bit 0 if cond is true for
+	    cmp r1, r2.  */
+	.macro	COND cond
+	lsls	r0, r0, #1
+	cmp	r1, r2
+	b\cond	1f
+	b	2f
+1:	adds	r0, #1
+2:
+	.endm
+
+	/*  Places a literal pool in the middle of the code.  */
+	.macro	POOL
+	b	3f
+	.ltorg
+3:
+	.endm
+
+	.macro	ALLCONDS a, b, expected
+	ldr	r1, =\a
+	ldr	r2, =\b
+	movs	r0, #0
+	COND	eq
+	COND	ne
+	COND	cs
+	COND	cc
+	COND	mi
+	COND	pl
+	COND	vs
+	COND	vc
+	COND	hi
+	COND	ls
+	COND	ge
+	COND	lt
+	COND	gt
+	COND	le
+	CHECK	\expected
+	.endm
+
+
+/*  The emulated machine starts in ARM mode.  */
+	.arm
+	.global	f
+f:	adr	r0, main
+	orr	r0, r0, #1
+	bx	r0
+
+getflags:
+	mrs	r5, cpsr
+	mov	r5, r5, lsr #28
+	bx	lr
+
+	.thumb
+	.thumb_func
+main:
+	movs	r6, #0
+	movs	r7, #0
+	adr	r0, title
+	bl	puts
+	b	1f
+	.align	2
+title:
+	.asciz	"GXemul Thumb instruction tests\n"
+	.align	1
+1:
+
+	/*  Move, add, and subtract immediate:  */
+	movs	r0, #200
+	CHECK	200
+	movs	r1, #5
+	adds	r0, r1, #7
+	CHECK	12
+	movs	r1, #5
+	subs	r0, r1, #7
+	blx	getflags
+	CHECK	0xfffffffe
+	CHECKFLAGS 0x8
+	ldr	r1, =0x7fffffff
+	adds	r0, r1, #1
+	blx	getflags
+	CHECK	0x80000000
+	CHECKFLAGS 0x9
+	ldr	r1, =0xffffffff
+	movs	r2, #1
+	adds	r0, r1, r2
+	blx	getflags
+	CHECK	0
+	CHECKFLAGS 0x6
+
+	/*  Shift by immediate:  */
+	ldr	r1, =0x87654321
+	lsls	r0, r1, #4
+	blx	getflags
+	CHECK	0x76543210
+	CHECKFLAGS 0x0
+	ldr	r1, =0x87654321
+	lsrs	r0, r1, #1
+	blx	getflags
+	CHECK	0x43b2a190
+	CHECKFLAGS 0x2
+	ldr	r1, =0x87654321
+	asrs	r0, r1, #8
+	blx	getflags
+	CHECK	0xff876543
+	CHECKFLAGS 0x8
+	ldr	r1, =0x87654321
+	lsrs	r0, r1, #32
+	blx	getflags
+	CHECK	0
+	CHECKFLAGS 0x6
+	ldr	r1, =0x87654321
+	asrs	r0, r1, #32
+	blx	getflags
+	CHECK	0xffffffff
+	CHECKFLAGS 0xa
+	POOL
+
+	/*  Data processing:  */
+	ldr	r0, =0x0ff0f0f0
+	ldr	r1, =0xf0f0ff00
+	ands	r0, r1
+	CHECK	0x00f0f000
+	ldr	r0, =0x0ff0f0f0
+	ldr	r1, =0xf0f0ff00
+	eors	r0, r1
+	CHECK	0xff000ff0
+	ldr	r0, =0x0ff0f0f0
+	ldr	r1, =0xf0f0ff00
+	orrs	r0, r1
+	CHECK	0xfff0fff0
+	ldr	r0, =0x0ff0f0f0
+	ldr	r1, =0xf0f0ff00
+	bics	r0, r1
+	CHECK	0x0f0000f0
+	ldr	r1, =0xf0f0ff00
+	mvns	r0, r1
+	CHECK	0x0f0f00ff
+	movs	r1, #5
+	rsbs	r0, r1, #0
+	blx	getflags
+	CHECK	0xfffffffb
+	CHECKFLAGS 0x8
+	ldr	r0, =0x12345
+	ldr	r1, =0x1234
+	muls	r0, r1
+	CHECK	0x14b60404
+	POOL
+
+	/*  Shift by register, including amounts of 32 and more:  */
+	ldr	r0, =0x80000001
+	movs	r1, #32
+	lsls	r0, r1
+	blx	getflags
+	CHECK	0
+	CHECKFLAGS 0x6
+	ldr	r0, =0x80000001
+	movs	r1, #32
+	lsrs	r0, r1
+	blx	getflags
+	CHECK	0
+	CHECKFLAGS 0x6
+	ldr	r0, =0x80000001
+	movs	r1, #40
+	asrs	r0, r1
+	blx	getflags
+	CHECK	0xffffffff
+	CHECKFLAGS 0xa
+	ldr	r0, =0x80000001
+	movs	r1, #36
+	rors	r0, r1
+	blx	getflags
+	CHECK	0x18000000
+	CHECKFLAGS 0x0
+	ldr	r0, =0x80000001
+	movs	r1, #32
+	rors	r0, r1
+	blx	getflags
+	CHECK	0x80000001
+	CHECKFLAGS 0xa
+	POOL
+
+	/*  Add and subtract with carry, test, and compare negative:  */
+	movs	r0, #10
+	movs	r1, #20
+	cmp	r0, r0
+	adcs	r0, r1
+	CHECK	31
+	movs	r0, #10
+	movs	r1, #3
+	movs	r2, #0
+	cmp	r2, #1
+	sbcs	r0, r1
+	blx	getflags
+	CHECK	6
+	CHECKFLAGS 0x2
+	movs	r0, #0x80
+	movs	r1, #0x7f
+	tst	r0, r1
+	blx	getflags
+	CHECKFLAGS 0x6
+	movs	r0, #1
+	ldr	r1, =0xffffffff
+	cmn	r0, r1
+	blx	getflags
+	CHECKFLAGS 0x6
+
+	/*  High registers:  */
+	movs	r0, #5
+	movs	r1, #7
+	mov	r8, r1
+	cmp	r0, r8
+	blx	getflags
+	CHECKFLAGS 0x8
+	ldr	r1, =0x1000
+	mov	r9, r1
+	ldr	r0, =0x234
+	add	r9, r9, r0
+	mov	r0, r9
+	CHECK	0x1234
+	POOL
+
+	/*  Conditional branches, after cmp r1, r2:  */
+	ALLCONDS 5, 7, 0x1655
+	ALLCONDS 7, 5, 0x196a
+	ALLCONDS 5, 5, 0x2959
+	POOL
+	ALLCONDS 0x80000000, 1, 0x19a5
+	ALLCONDS 0xffffffff, 1, 0x1a65
+	POOL
+
+	/*  Interworking with bx, to ARM code and to Thumb code:  */
+	movs	r0, #0
+	adr	r2, armcode
+	bx	r2
+
+	/*  Returns 77 in r0.  */
+	.align	2
+	.arm
+armcode:
+	mov	r0, #77
+	adr	r1, armcode_return
+	orr	r1, r1, #1
+	bx	r1
+	.thumb
+
+armcode_return:
+	CHECK	77
+	movs	r0, #0
+	adr	r2, bx_target
+	adds	r2, #1
+	bx	r2
+	movs	r0, #1
+	.align	2
+bx_target:
+	adds	r0, #2
+	CHECK	2
+
+	/*  Loads and stores of all sizes:  */
+	sub	sp, #32
+	mov	r2, sp
+	ldr	r0, =0x11223344
+	str	r0, [r2, #0]
+	ldrb	r0, [r2, #1]
+	CHECK	0x33
+	ldrh	r0, [r2, #2]
+	CHECK	0x1122
+	movs	r0, #0xaa
+	strb	r0, [r2, #3]
+	ldr	r0, [r2]
+	CHECK	0xaa223344
+	ldr	r0, =0x8899
+	movs	r1, #4
+	strh	r0, [r2, r1]
+	ldrsh	r0, [r2, r1]
+	CHECK	0xffff8899
+	movs	r1, #3
+	ldrsb	r0, [r2, r1]
+	CHECK	0xffffffaa
+	movs	r1, #0
+	ldr	r0, [r2, r1]
+	CHECK	0xaa223344
+	movs	r1, #2
+	ldrb	r0, [r2, r1]
+	CHECK	0x22
+	movs	r1, #4
+	ldrh	r0, [r2, r1]
+	CHECK	0x8899
+	movs	r0, #0x55
+	movs	r1, #9
+	strb	r0, [r2, r1]
+	ldrb	r0, [r2, #9]
+	CHECK	0x55
+	ldr	r0, =0xcafe
+	str	r0, [sp, #12]
+	ldr	r0, [r2, #12]
+	CHECK	0xcafe
+	movs	r0, #0
+	ldr	r0, [sp, #12]
+	CHECK	0xcafe
+	add	r0, sp, #16
+	mov	r1, sp
+	subs	r0, r0, r1
+	CHECK	16
+	POOL
+
+	/*  ldmia and stmia, with writeback:  */
+	mov	r2, sp
+	movs	r0, #1
+	movs	r1, #2
+	movs	r3, #3
+	stmia	r2!, {r0, r1, r3}
+	mov	r0, sp
+	subs	r0, r2, r0
+	CHECK	12
+	subs	r2, #12
+	movs	r0, #0
+	movs	r1, #0
+	movs	r3, #0
+	ldmia	r2!, {r0, r1, r3}
+	lsls	r1, r1, #4
+	lsls	r3, r3, #8
+	adds	r0, r0, r1
+	adds	r0, r0, r3
+	CHECK	0x321
+	add	sp, #32
+
+	/*  sp adjustment:  */
+	mov	r1, sp
+	sub	sp, #64
+	mov	r0, sp
+	add	sp, #64
+	subs	r0, r1, r0
+	CHECK	64
+
+	/*  Sign and zero extension, and byte reversal (ARMv6):  */
+	ldr	r1, =0x12348586
+	sxtb	r0, r1
+	CHECK	0xffffff86
+	ldr	r1, =0x12348586
+	sxth	r0, r1
+	CHECK	0xffff8586
+	ldr	r1, =0x12348586
+	uxtb	r0, r1
+	CHECK	0x86
+	ldr	r1, =0x12348586
+	uxth	r0, r1
+	CHECK	0x8586
+	ldr	r1, =0x12348586
+	rev	r0, r1
+	CHECK	0x86853412
+	ldr	r1, =0x12348586
+	rev16	r0, r1
+	CHECK	0x34128685
+	ldr	r1, =0x12348586
+	revsh	r0, r1
+	CHECK	0xffff8685
+	POOL
+
+	/*  Calls: a recursive function uses bl, push, and pop of pc.  */
+	movs	r0, #10
+	bl	fib
+	CHECK	55
+
+	/*  Done.  */
+	movs	r0, #'\n'
+	bl	putchar
+	adr	r0, ok_msg
+	cmp	r7, #0
+	beq	1f
+	adr	r0, failed_msg
+1:	bl	puts
+	ldr	r3, =0x10000010
+	strb	r0, [r3]
+2:	b	2b
+	.ltorg
+
+
+/*
+ *  check:  Compares r0 with r1, and prints the result.
+ */
+	.thumb_func
+check:
+	push	{r0-r3, lr}
+	adds	r6, #1
+	cmp	r0, r1
+	beq	1f
+	adds	r7, #1
+	movs	r0, #' '
+	bl	putchar
+	lsrs	r0, r6, #4
+	bl	puthexdigit
+	movs	r0, #15
+	ands	r0, r6
+	bl	puthexdigit
+	movs	r0, #' '
+	b	2f
+1:	movs	r0, #'.'
+2:	bl	putchar
+	pop	{r0-r3, pc}
+
+
+/*
+ *  fib:  Returns the r0th Fibonacci number.
+ */
+	.thumb_func
+fib:
+	push	{r4, r5, lr}
+	cmp	r0, #2
+	blt	1f
+	movs	r4, r0
+	subs	r0, #1
+	bl	fib
+	movs	r5, r0
+	subs	r0, r4, #2
+	bl	fib
+	adds	r0, r0, r5
+1:	pop	{r4, r5, pc}
+
+
+/*
+ *  puthexdigit, putchar, puts:  Console output.
+ */
+	.thumb_func
+puthexdigit:
+	cmp	r0, #10
+	blt	1f
+	adds	r0, #'a' - '0' - 10
+1:	adds	r0, #'0'
+	.thumb_func
+putchar:
+	ldr	r3, =0x10000000
+	strb	r0, [r3]
+	bx	lr
+
+	.thumb_func
+puts:
+	push	{r4, lr}
+	movs	r4, r0
+1:	ldrb	r0, [r4]
+	cmp	r0, #0
+	beq	2f
+	bl	putchar
+	adds	r4, #1
+	b	1b
+2:	pop	{r4, pc}
+	.ltorg
+
+
+	.align	2
+ok_msg:
+	.asciz	"OK\n"
+	.align	2
+failed_msg:
+	.asciz	"FAILED\n"